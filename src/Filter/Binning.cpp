@@ -0,0 +1,208 @@
+/*
+ * Binning.cpp
+ *
+ *  Created on: Aug 12, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#include "Binning.h"
+#include "MemoryBudget.h"
+#include <pni/utils/Types.hpp>
+#include <type_traits>
+
+std::list<Binning::Image> Binning::_images;
+size_t Binning::_images_bytes = 0;
+std::mutex Binning::_images_mutex;
+
+const size_t Binning::MAX_CACHED_BYTES = 64*1024*1024;
+
+/**
+ *	Type the sum of 4 values is computed in: wide enough for integers, the same precision for floating point.
+ */
+template<typename T>
+struct BinSum
+{
+	typedef typename std::conditional<std::is_floating_point<T>::value, T,
+			typename std::conditional<(sizeof(T) < 4), int32_t, int64_t>::type>::type type;
+};
+
+/**
+ *	\brief Gets the average of sum of \a count values.
+ *	Integers are rounded to nearest.
+ */
+template<typename T, typename S>
+static inline T average(S sum, S count)
+{
+	return std::is_floating_point<T>::value ? (T)(sum / count) : (T)( (sum + (sum >= 0 ? count/2 : -count/2)) / count );
+}
+
+/**
+ *	\brief Averages 2x2 blocks of pixels.
+ *
+ *	\param [in] src : image, rows one after another.
+ *	\param [in] width : width of image.
+ *	\param [in] height : height of image.
+ *	\param [out] dst : buffer for Binning::binnedSize(width, 2) x Binning::binnedSize(height, 2) pixels.
+ *
+ *	Odd last column and row are averaged over the pixels they have.
+ */
+template<typename T>
+void Binning::bin2x2(const T* src, size_t width, size_t height, T* dst)
+{
+	typedef typename BinSum<T>::type S;
+	size_t out_width = binnedSize(width, 2);
+	size_t full_cols = width / 2;
+
+	for(size_t y=0; y+1<height; y+=2)
+	{
+		const T* __restrict__ a = src + y*width;
+		const T* __restrict__ b = a + width;
+		T* __restrict__ out = dst + (y/2)*out_width;
+		for(size_t x=0; x<full_cols; x++)
+		{
+			S sum = (S)a[2*x] + (S)a[2*x+1] + (S)b[2*x] + (S)b[2*x+1];
+			out[x] = average<T, S>(sum, 4);
+		}
+		if(width & 1)
+			out[full_cols] = average<T, S>( (S)a[width-1] + (S)b[width-1], 2 );
+	}
+
+	if(height & 1)
+	{
+		const T* a = src + (height-1)*width;
+		T* out = dst + (height/2)*out_width;
+		for(size_t x=0; x<full_cols; x++)
+			out[x] = average<T, S>( (S)a[2*x] + (S)a[2*x+1], 2 );
+		if(width & 1)
+			out[full_cols] = a[width-1];
+	}
+}
+
+/**
+ *	\brief Looks for binned image kept.
+ *	\param [in] nxpath : path of NeXus field.
+ *	\param [in] axis : dimension the slice is taken along.
+ *	\param [in] index : number of slice.
+ *	\param [in] bin : binning factor.
+ *	\param [out] data : pixels of found image.
+ *	\return True if such image is kept.
+ */
+bool Binning::find(const std::string& nxpath, size_t axis, size_t index, size_t bin, std::shared_ptr<const void>& data)
+{
+	std::lock_guard<std::mutex> lock(_images_mutex);
+	for(auto it = _images.begin(); it != _images.end(); it++)
+	{
+		if(it->index == index && it->axis == axis && it->bin == bin && it->nxpath == nxpath)
+		{
+			_images.splice(_images.begin(), _images, it);
+			data = _images.front().data;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ *	\brief Keeps binned image, the least recently used images are dropped if there is no room.
+ *
+ *	The memory of images is taken from MemoryBudget, the image is not kept if it can't be had even without the other images.
+ *	\param [in] nxpath : path of NeXus field.
+ *	\param [in] axis : dimension the slice is taken along.
+ *	\param [in] index : number of slice.
+ *	\param [in] bin : binning factor.
+ *	\param [in] data : pixels of image.
+ *	\param [in] bytes : size of \a data in bytes.
+ */
+void Binning::store(const std::string& nxpath, size_t axis, size_t index, size_t bin, std::shared_ptr<const void> data, size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(_images_mutex);
+	while( !_images.empty() && _images_bytes + bytes > MAX_CACHED_BYTES )
+	{
+		MemoryBudget::release(_images.back().bytes);
+		_images_bytes -= _images.back().bytes;
+		_images.pop_back();
+	}
+	while( !MemoryBudget::reserve(bytes) )
+	{
+		if( _images.empty() )
+			return;
+		MemoryBudget::release(_images.back().bytes);
+		_images_bytes -= _images.back().bytes;
+		_images.pop_back();
+	}
+
+	Image image;
+	image.nxpath = nxpath;
+	image.axis = axis;
+	image.index = index;
+	image.bin = bin;
+	image.data = std::move(data);
+	image.bytes = bytes;
+	_images.push_front(image);
+	_images_bytes += bytes;
+}
+
+/**
+ *	\brief Drops all binned images, e.g. when NeXus file is reopened.
+ */
+void Binning::clear()
+{
+	std::lock_guard<std::mutex> lock(_images_mutex);
+	MemoryBudget::release(_images_bytes);
+	_images.clear();
+	_images_bytes = 0;
+}
+
+/**
+ *	\brief Drops binned images of NeXus field, e.g. when it changed in reloaded file.
+ *	\param [in] nxpath : full path of NeXus field.
+ */
+void Binning::forget(const std::string& nxpath)
+{
+	std::lock_guard<std::mutex> lock(_images_mutex);
+	for(auto it = _images.begin(); it != _images.end(); )
+	{
+		if(it->nxpath == nxpath)
+		{
+			MemoryBudget::release(it->bytes);
+			_images_bytes -= it->bytes;
+			it = _images.erase(it);
+		}
+		else
+			it++;
+	}
+}
+
+/**
+ *	@name Explicit instantiations
+ *	Binning is done for every real value type of NeXus fields.
+ */
+///@{
+#define BINNING_INSTANTIATE(T) \
+	template void Binning::bin2x2<T>(const T*, size_t, size_t, T*);
+
+BINNING_INSTANTIATE(UInt8)
+BINNING_INSTANTIATE(Int8)
+BINNING_INSTANTIATE(UInt16)
+BINNING_INSTANTIATE(Int16)
+BINNING_INSTANTIATE(UInt32)
+BINNING_INSTANTIATE(Int32)
+BINNING_INSTANTIATE(Float32)
+BINNING_INSTANTIATE(Float64)
+BINNING_INSTANTIATE(Float128)
+///@}
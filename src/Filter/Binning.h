@@ -0,0 +1,77 @@
+/*
+ * Binning.h
+ *
+ *  Created on: Aug 12, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#ifndef BINNING_H_
+#define BINNING_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+
+/**
+ *	Class reduces images by averaging blocks of pixels, used for binned previews (bin2, bin4, ...).\n
+ *	The loops are written to be vectorized by compiler. Binned images are kept, so that each level of pyramid
+ *	is computed from the level above it instead of the full image.
+ */
+class Binning {
+private:
+	/**
+	 *	Binned image kept for following requests.
+	 */
+	struct Image
+	{
+		std::string nxpath; /*!< Path of NeXus field. */
+		size_t axis; /*!< Dimension the slice is taken along. */
+		size_t index; /*!< Number of slice. */
+		size_t bin; /*!< Binning factor. */
+		std::shared_ptr<const void> data; /*!< Pixels in the type of field. */
+		size_t bytes; /*!< Size of data in bytes. */
+	};
+
+	static std::list<Image> _images; /*!< Images kept, the most recently used first. */
+	static size_t _images_bytes; /*!< Overall size of images kept. */
+	static std::mutex _images_mutex; /*!< Guards Binning#_images. */
+
+public:
+	static const size_t MAX_CACHED_BYTES; /*!< Overall size of binned images kept. */
+
+	/**
+	 *	\brief Gets the size of binned image along one dimension.
+	 *	\param [in] size : size of image.
+	 *	\param [in] bin : binning factor.
+	 *	\return Size of binned image, pixels at the edge are averaged over the part of block they have.
+	 */
+	static size_t binnedSize(size_t size, size_t bin) { return (size + bin - 1) / bin; }
+
+	template<typename T>
+	static void bin2x2(const T* src, size_t width, size_t height, T* dst);
+
+	static bool find(const std::string& nxpath, size_t axis, size_t index, size_t bin, std::shared_ptr<const void>& data);
+	static void store(const std::string& nxpath, size_t axis, size_t index, size_t bin, std::shared_ptr<const void> data, size_t bytes);
+	static void clear();
+	static void forget(const std::string& nxpath);
+};
+
+#endif /* BINNING_H_ */
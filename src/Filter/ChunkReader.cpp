@@ -0,0 +1,254 @@
+/*
+ * ChunkReader.cpp
+ *
+ *  Created on: Sep 30, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#include "ChunkReader.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/**
+ *	\brief Tells whether values in memory are little endian.
+ */
+static bool hostLittleEndian()
+{
+	uint16_t one = 1;
+	return *reinterpret_cast<const char*>(&one) == 1;
+}
+
+/**
+ *	\brief Checks whether chunks of dataset can be read and decoded here.
+ *	\param [in] storage : how the chunks are stored.
+ *	\param [in] value_size : size of one value in memory.
+ *	\return True if the values in file are the same as in memory and all filters are decoded here.
+ */
+bool ChunkReader::decodable(const ChunkStorage& storage, size_t value_size)
+{
+	if( storage.type_class != H5T_INTEGER && storage.type_class != H5T_FLOAT )
+		return false;
+	if( storage.value_bytes != value_size || storage.little_endian != hostLittleEndian() )
+		return false;
+	for(const ChunkFilter& filter : storage.filters)
+		if(filter.id != H5Z_FILTER_SHUFFLE && filter.id != H5Z_FILTER_DEFLATE)
+			return false;
+	return true;
+}
+
+/**
+ *	\brief Undoes shuffle filter: the i-th bytes of all values were stored together.
+ *	\param [in] data : shuffled chunk.
+ *	\param [in] element_size : size of value the bytes were shuffled by.
+ *	\param [out] output : values as they are in memory.
+ */
+void ChunkReader::unshuffle(const std::string& data, size_t element_size, std::string& output)
+{
+	output.assign(data.size(), '\0');
+	size_t count = data.size() / element_size;
+	for(size_t b=0; b<element_size; b++)
+	{
+		const char* src = data.data() + b*count;
+		for(size_t i=0; i<count; i++)
+			output[i*element_size + b] = src[i];
+	}
+	// HDF5 leaves the bytes of incomplete value at the end as they are
+	size_t rest = count*element_size;
+	std::copy( data.begin() + rest, data.end(), output.begin() + rest );
+}
+
+/**
+ *	\brief Decodes chunk as it is stored into its values.
+ *	\param [in] storage : how the chunks are stored, see ChunkReader::decodable.
+ *	\param [in] chunk : where the chunk is stored and which filters were skipped.
+ *	\param [in,out] data : bytes of chunk as stored, replaced by the values of whole chunk in C order.
+ *	\return False if the chunk is broken.
+ *
+ *	Filters are undone in reverse order of the pipeline, filters skipped when the chunk was written are skipped here too.
+ */
+bool ChunkReader::decode(const ChunkStorage& storage, const ChunkLocation& chunk, std::string& data)
+{
+	size_t chunk_bytes = storage.value_bytes;
+	for(size_t extent : storage.chunk)
+		chunk_bytes *= extent;
+
+	std::string decoded;
+	for(size_t i = storage.filters.size(); i-- > 0; )
+	{
+		if( i < 32 && (chunk.filter_mask & (1u << i)) )
+			continue;
+
+		const ChunkFilter& filter = storage.filters[i];
+		if(filter.id == H5Z_FILTER_DEFLATE)
+		{
+			decoded.assign(chunk_bytes, '\0');
+			uLongf length = chunk_bytes;
+			if( uncompress( reinterpret_cast<Bytef*>(&decoded[0]), &length,
+					reinterpret_cast<const Bytef*>(data.data()), data.size() ) != Z_OK )
+				return false;
+			decoded.resize(length);
+		}
+		else
+		{
+			size_t element_size = filter.values.empty() ? storage.value_bytes : filter.values[0];
+			if(element_size == 0)
+				return false;
+			unshuffle(data, element_size, decoded);
+		}
+		data.swap(decoded);
+	}
+	return data.size() == chunk_bytes;
+}
+
+/**
+ *	\brief Copies the part of chunk that lies within the hyperslab.
+ *	\param [in] storage : chunk shape and value size.
+ *	\param [in] offset : position of the first value of chunk in dataset.
+ *	\param [in] chunk : values of whole chunk in C order.
+ *	\param [in] start : first index of hyperslab along each dimension.
+ *	\param [in] count : number of indices of hyperslab along each dimension.
+ *	\param [out] output : values of hyperslab in C order.
+ *
+ *	Chunks don't overlap, so chunks are copied into the hyperslab concurrently.
+ */
+void ChunkReader::copyChunk(const ChunkStorage& storage, const std::vector<size_t>& offset, const char* chunk,
+		const size_t* start, const size_t* count, char* output)
+{
+	size_t rank = offset.size();
+	std::vector<size_t> begin(rank), end(rank), chunk_stride(rank), output_stride(rank);
+	for(size_t d = rank; d-- > 0; )
+	{
+		begin[d] = std::max( offset[d], start[d] );
+		end[d] = std::min( offset[d] + storage.chunk[d], start[d] + count[d] );
+		if(begin[d] >= end[d])
+			return;
+		chunk_stride[d] = (d + 1 < rank) ? chunk_stride[d + 1]*storage.chunk[d + 1] : 1;
+		output_stride[d] = (d + 1 < rank) ? output_stride[d + 1]*count[d + 1] : 1;
+	}
+
+	// one run of values along the last dimension at a time
+	size_t run_bytes = (end[rank - 1] - begin[rank - 1])*storage.value_bytes;
+	std::vector<size_t> position = begin;
+	for(;;)
+	{
+		size_t from = 0, to = 0;
+		for(size_t d=0; d<rank; d++)
+		{
+			from += (position[d] - offset[d])*chunk_stride[d];
+			to += (position[d] - start[d])*output_stride[d];
+		}
+		memcpy( output + to*storage.value_bytes, chunk + from*storage.value_bytes, run_bytes );
+
+		int d = (int)rank - 2;
+		for(; d >= 0; d--)
+		{
+			if(++position[d] < end[d])
+				break;
+			position[d] = begin[d];
+		}
+		if(d < 0)
+			return;
+	}
+}
+
+/**
+ *	\brief Reads hyperslab of chunked dataset without HDF5.
+ *	\param [in] nxpath : path of dataset, its file has to be open.
+ *	\param [in] start : first index along each dimension.
+ *	\param [in] count : number of indices along each dimension.
+ *	\param [in] rank : rank of dataset.
+ *	\param [in] value_size : size of one value in bytes, the values are given in native type of dataset of that size.
+ *	\param [out] output : buffer for values in C order.
+ *	\return False if the dataset is not chunked, its chunks can't be decoded here, some chunk of hyperslab
+ *	was never written or couldn't be read. The caller reads the hyperslab by HDF5 then.
+ *
+ *	Chunks are read and decoded by the shared ThreadPool, the calling thread takes part in it.
+ */
+bool ChunkReader::read(const std::string& nxpath, const size_t* start, const size_t* count, size_t rank,
+		size_t value_size, void* output)
+{
+	ChunkStorage storage;
+	if( rank == 0 || !NXGateway::chunkStorage(nxpath, storage) || storage.chunk.size() != rank
+			|| !decodable(storage, value_size) )
+		return false;
+
+	// chunks touched by hyperslab, in C order
+	std::vector<size_t> first(rank), last(rank);
+	for(size_t d=0; d<rank; d++)
+	{
+		if(count[d] == 0 || storage.chunk[d] == 0)
+			return false;
+		first[d] = start[d] / storage.chunk[d];
+		last[d] = (start[d] + count[d] - 1) / storage.chunk[d];
+	}
+	std::vector<ChunkLocation> chunks;
+	std::vector<size_t> position = first;
+	for(;;)
+	{
+		ChunkLocation chunk;
+		for(size_t d=0; d<rank; d++)
+			chunk.offset.push_back( position[d]*storage.chunk[d] );
+		chunks.push_back(chunk);
+
+		int d = (int)rank - 1;
+		for(; d >= 0; d--)
+		{
+			if(++position[d] <= last[d])
+				break;
+			position[d] = first[d];
+		}
+		if(d < 0)
+			break;
+	}
+
+	std::shared_ptr<const DirectFile> file;
+	if( !NXGateway::locateChunks(nxpath, chunks, file) )
+		return false;
+
+	std::atomic<bool> failed(false);
+	ThreadPool::shared().parallelFor(chunks.size(), [&](size_t i)
+	{
+		if(failed)
+			return;
+		const ChunkLocation& chunk = chunks[i];
+		std::string data(chunk.nbytes, '\0');
+		size_t done = 0;
+		while(done < data.size())
+		{
+			ssize_t n = pread(file->fd, &data[done], data.size() - done, chunk.address + done);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				break;
+			done += n;
+		}
+		if( done < data.size() || !decode(storage, chunk, data) )
+		{
+			failed = true;
+			return;
+		}
+		copyChunk(storage, chunk.offset, data.data(), start, count, static_cast<char*>(output));
+	});
+	return !failed;
+}
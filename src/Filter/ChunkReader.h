@@ -0,0 +1,53 @@
+/*
+ * ChunkReader.h
+ *
+ *  Created on: Sep 30, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#ifndef CHUNKREADER_H_
+#define CHUNKREADER_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "NXGateway.h"
+
+/**
+ *	Reads hyperslabs of chunked datasets without HDF5.\n
+ *	HDF5 reads and decompresses the chunks of hyperslab one after another. Here all chunks of hyperslab are located
+ *	at once (NXGateway::locateChunks), then each one is read by pread, decompressed and copied into the hyperslab
+ *	by the shared ThreadPool, so reading of some chunks overlaps with decompressing of others.\n
+ *	Only the filters decoded here are supported: shuffle and deflate. Hyperslabs of other datasets, or with chunks
+ *	never written, are left to HDF5.
+ */
+class ChunkReader {
+private:
+	static bool decodable(const ChunkStorage& storage, size_t value_size);
+	static bool decode(const ChunkStorage& storage, const ChunkLocation& chunk, std::string& data);
+	static void unshuffle(const std::string& data, size_t element_size, std::string& output);
+	static void copyChunk(const ChunkStorage& storage, const std::vector<size_t>& offset, const char* chunk,
+			const size_t* start, const size_t* count, char* output);
+
+public:
+	static bool read(const std::string& nxpath, const size_t* start, const size_t* count, size_t rank,
+			size_t value_size, void* output);
+};
+
+#endif /* CHUNKREADER_H_ */
@@ -0,0 +1,179 @@
+/*
+ * ConcatRule.cpp
+ *
+ *  Created on: Sep 16, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#include "ConcatRule.h"
+#include <algorithm>
+
+/**
+ *	\brief Constructor of ConcatRule.
+ *	\param [in] image_rule : rule of slices, each field is written with the same options.
+ *	\param [in] members : full paths of rank 3 NeXus fields, in the order their slices are numbered.
+ *	\param [in] counts : number of slices of each field.
+ */
+ConcatRule::ConcatRule(const ImageRule& image_rule, const std::vector<std::string>& members, const std::vector<size_t>& counts)
+	: ImageRule(image_rule), _members(members)
+{
+	_offsets.push_back(0);
+	for(size_t count : counts)
+		_offsets.push_back( _offsets.back() + count );
+}
+
+/**
+ *	 Destructor of ConcatRule
+ */
+ConcatRule::~ConcatRule() {
+
+}
+
+/**
+ *	\brief Gets the number of all slices.
+ */
+size_t ConcatRule::count() const
+{
+	return _offsets.back();
+}
+
+/**
+ *	\brief Gets the full path of the first field, its metadata stands for all of them.
+ */
+const std::string& ConcatRule::firstMember() const
+{
+	return _members.front();
+}
+
+/**
+ *	\brief Finds the field a slice lies in.
+ *	\param [in] index : number of slice counted through all fields.
+ *	\param [out] member : full path of the field.
+ *	\param [out] local : number of slice within the field.
+ *	\return False if there is no such slice.
+ */
+bool ConcatRule::locate(size_t index, std::string& member, size_t& local) const
+{
+	auto it = std::upper_bound(_offsets.begin(), _offsets.end(), index);
+	if( it == _offsets.begin() || it == _offsets.end() )
+		return false;
+	size_t field = (it - _offsets.begin()) - 1;
+	member = _members[field];
+	local = index - _offsets[field];
+	return true;
+}
+
+/**
+ *	\brief Gets the field a slice lies in, its file is opened if it is not open.
+ *	\param [in] index : number of slice counted through all fields.
+ *	\param [out] local : gets the number of slice within the field and the full path of field.
+ *	\return The NeXus field.
+ *	\throw NXFSException if there is no such slice, or the field can't be opened.
+ */
+pninx::NXObject ConcatRule::memberObject(size_t index, SliceRef& local) const
+{
+	if( !locate(index, local.nxpath, local.index) )
+		throw NXFSException("ConcatRule: no slice " + std::to_string(index));
+	return NXGateway::getNXObjectByPath( local.nxpath.c_str() );
+}
+
+/**
+ *	\brief Reads a slice from the field it lies in, see ImageRule::readContent.
+ *	\param [in] nxobject : not used, the field is found by the number of slice.
+ *	\param [in] slice : slice counted through all fields.
+ *	\return The content of TIFF.
+ */
+FileContent ConcatRule::readContent(pninx::NXObject &nxobject, const SliceRef& slice)
+{
+	SliceRef local = slice;
+	pninx::NXObject member = memberObject(slice.index, local);
+	return ImageRule::readContent(member, local);
+}
+
+/**
+ *	\brief Reads a part of slice from the field it lies in, see ImageRule::readRange.
+ *	\param [in] nxobject : not used, the field is found by the number of slice.
+ *	\param [in] slice : slice counted through all fields.
+ *	\param [in] size : maximum number of bytes.
+ *	\param [in] offset : offset from the file begin.
+ *	\param [out] output : the requested part of TIFF.
+ *	\return False if the whole slice is needed to write any part of TIFF.
+ */
+bool ConcatRule::readRange(pninx::NXObject &nxobject, const SliceRef& slice, size_t size, off_t offset, FileContent& output)
+{
+	SliceRef local = slice;
+	pninx::NXObject member = memberObject(slice.index, local);
+	return ImageRule::readRange(member, local, size, offset, output);
+}
+
+/**
+ *	\brief Constructor of ConcatStackRule.
+ *	\param [in] slices : rule of slices, the pages are written with the same options. It has to outlive the stack.
+ */
+ConcatStackRule::ConcatStackRule(const ConcatRule& slices) : StackRule(slices), _slices(&slices)
+{
+}
+
+/**
+ *	 Destructor of ConcatStackRule
+ */
+ConcatStackRule::~ConcatStackRule() {
+
+}
+
+/**
+ *	\brief Gets the metadata of the first field with the number of all slices as the first dimension.
+ *	\param [in] slice : not used, the fields are known to the rule of slices.
+ */
+NXMetadata ConcatStackRule::stackMetadata(const SliceRef& slice)
+{
+	NXMetadata output = NXGateway::metadata( _slices->firstMember() );
+	if( !output.shape.empty() )
+		output.shape[0] = _slices->count();
+	return output;
+}
+
+/**
+ *	\brief Gets the pixels of rows of one page from the field it lies in.
+ *	\param [in] nxfield : not used, the field is found by the number of page.
+ *	\param [in] slice : not used, the full path of field is found by the number of page.
+ *	\param [in] page : number of page counted through all fields.
+ *	\param [in] first_row : first row of page to be read.
+ *	\param [in] row_count : number of rows to be read.
+ */
+FileContent ConcatStackRule::readPage(pninx::NXField& nxfield, const SliceRef& slice, size_t page, size_t first_row, size_t row_count)
+{
+	SliceRef local(page);
+	pninx::NXField member = (pninx::NXField) _slices->memberObject(page, local);
+	return readRows(member, local, first_row, row_count);
+}
+
+/**
+ *	\brief Gets size without opening NeXus fields, see Rule::sizeFromMetadata.
+ *	\param [in] metadata : metadata of the first field.
+ *	\param [in] slice : not used, the stack represents all fields.
+ *	\param [out] size : size of multi-page TIFF.
+ *	\return Always true.
+ */
+bool ConcatStackRule::sizeFromMetadata(const NXMetadata& metadata, const SliceRef& slice, size_t& size)
+{
+	NXMetadata stack = metadata;
+	if( !stack.shape.empty() )
+		stack.shape[0] = _slices->count();
+	return StackRule::sizeFromMetadata(stack, slice, size);
+}
@@ -0,0 +1,75 @@
+/*
+ * ConcatRule.h
+ *
+ *  Created on: Sep 16, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#ifndef CONCATRULE_H_
+#define CONCATRULE_H_
+
+#include <string>
+#include <vector>
+
+#include "ImageRule.h"
+#include "StackRule.h"
+
+/**
+ *	Class represents the slices of rank 3 NeXus fields of several files (e.g. of a scan series) as one folder of images.\n
+ *	The slices are numbered through: the first slices of each field follow the last ones of the field before,
+ *	the field and its slice are found by binary search in the numbers of first slices.
+ *	Fields are opened when their slices are read, see NXGateway::getNXObjectByPath.
+ */
+class ConcatRule: public ImageRule {
+private:
+	std::vector<std::string> _members; /*!< Full paths of the fields, in the order of their files. */
+	std::vector<size_t> _offsets; /*!< Number of first slice of each field, followed by the number of all slices. */
+
+public:
+	ConcatRule(const ImageRule& image_rule, const std::vector<std::string>& members, const std::vector<size_t>& counts);
+	virtual ~ConcatRule();
+
+	size_t count() const;
+	const std::string& firstMember() const;
+	bool locate(size_t index, std::string& member, size_t& local) const;
+	pninx::NXObject memberObject(size_t index, SliceRef& local) const;
+
+	//fuse methods
+	virtual FileContent readContent(pninx::NXObject &nxobject, const SliceRef& slice);
+	virtual bool readRange(pninx::NXObject &nxobject, const SliceRef& slice, size_t size, off_t offset, FileContent& output);
+};
+
+/**
+ *	Class represents the slices of ConcatRule as one multi-page TIFF, each page is read from the field it lies in.
+ */
+class ConcatStackRule: public StackRule {
+private:
+	const ConcatRule* _slices; /*!< Rule of the slices, it maps pages to fields. */
+
+protected:
+	virtual NXMetadata stackMetadata(const SliceRef& slice);
+	virtual FileContent readPage(pninx::NXField& nxfield, const SliceRef& slice, size_t page, size_t first_row, size_t row_count);
+
+public:
+	ConcatStackRule(const ConcatRule& slices);
+	virtual ~ConcatStackRule();
+
+	virtual bool sizeFromMetadata(const NXMetadata& metadata, const SliceRef& slice, size_t& size);
+};
+
+#endif /* CONCATRULE_H_ */
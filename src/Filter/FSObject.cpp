@@ -21,13 +21,27 @@
  */
 
 #include "FSObject.h"
+#include <typeinfo>
+
+std::atomic<unsigned long> FSObject::_generation(1);
+std::atomic<ino_t> FSObject::_last_inode(0);
+std::mutex FSObject::_stat_mutex;
 
 /**
  * Default constructor of FSObject
  */
 FSObject::FSObject() {
 	rule = NULL;
+	slice_rule = NULL;
+	slice_count = 0;
+	slice_axis = 0;
+	slice_bin = 1;
+	slice_inode = 0;
+	inode = 0;
 	_type = FSType::NONE;
+	_stat_generation = 0;
+	_slice_stat_generation = 0;
+	_slice_parent = NULL;
 }
 
 /**
@@ -38,7 +52,16 @@ FSObject::FSObject() {
 FSObject::FSObject(const char* in_name) : name(in_name)
 {
 	rule = NULL;
+	slice_rule = NULL;
+	slice_count = 0;
+	slice_axis = 0;
+	slice_bin = 1;
+	slice_inode = 0;
+	inode = 0;
 	_type = FSType::NONE;
+	_stat_generation = 0;
+	_slice_stat_generation = 0;
+	_slice_parent = NULL;
 }
 
 /**
@@ -58,6 +81,15 @@ int FSObject::addChild(std::string object_name)
 	return 0;
 }
 
+/**
+ *	\brief Gets the names of files/folders stored in FSTree within this FSObject.
+ *	\return children vector, without computed slice files.
+ */
+const std::vector<std::string>& FSObject::getChildren() const
+{
+	return children;
+}
+
 /**
  *	\brief Gets the content of FUSE file.
  *	\return content of file.
@@ -67,21 +99,210 @@ std::string FSObject::read()
 	std::string output = "";
 	if(this->rule != NULL)
 	{
+		NXGateway::AccessLock access;
 		auto nx = NXGateway::getNXObjectByPath( this->_nxobjectpath.c_str() );
-		output = this->rule->read( nx );
+		output = this->rule->readContent( nx, sliceRef() ).str();
 	}
 	else
 		output = "Behavior not implemented";
 	return output;
 }
 
+/**
+ *	\brief Gets the content of FUSE file as segments.
+ *	\return content of file.
+ */
+FileContent FSObject::readContent()
+{
+	if(this->rule == NULL)
+		return FileContent("Behavior not implemented");
+
+	NXGateway::AccessLock access;
+	auto nx = NXGateway::getNXObjectByPath( this->_nxobjectpath.c_str() );
+	return this->rule->readContent( nx, sliceRef() );
+}
+
+/**
+ *	\brief Gets a part of the content of FUSE file, if the rule can read it alone.
+ *	\param [in] size : maximum number of bytes.
+ *	\param [in] offset : offset from the file begin.
+ *	\param [out] output : the requested part of file content.
+ *	\return True if \a output was read, false if the whole content has to be read.
+ */
+bool FSObject::readRange(size_t size, off_t offset, FileContent& output)
+{
+	if(this->rule == NULL)
+		return false;
+
+	NXGateway::AccessLock access;
+	auto nx = NXGateway::getNXObjectByPath( this->_nxobjectpath.c_str() );
+	return this->rule->readRange( nx, sliceRef(), size, offset, output );
+}
+
 /**
  *	\brief Gets the children of FSObject.
- *	\return children vector
+ *	\return children vector, followed by the names of computed slice files.
+ *
+ *	Of chunk files (FSObject::setChunkKeys) only those of chunks that were written are listed, see NXGateway::writtenChunks.
  */
 std::vector<std::string> FSObject::readdir()
 {
-	return children;
+	if(slice_count == 0)
+		return children;
+
+	std::vector<std::string> output = children;
+	char num[32];
+	if( slice_grid.empty() )
+	{
+		output.reserve(children.size() + slice_count);
+		for(size_t i=0; i<slice_count; i++)
+		{
+			snprintf(num, sizeof(num), "%zu", i);
+			output.push_back(num + slice_extension);
+		}
+		return output;
+	}
+
+	std::vector<std::vector<size_t>> keys;
+	{
+		// the file of directory is opened by looking the field up
+		NXGateway::AccessLock access;
+		NXGateway::getNXObjectByPath( _nxobjectpath.c_str() );
+		NXGateway::writtenChunks(_nxobjectpath, keys);
+	}
+	for(const std::vector<size_t>& key : keys)
+	{
+		// chunks written after the tree was built lie outside of the grid
+		bool inside = key.size() == slice_grid.size();
+		for(size_t d=0; inside && d<key.size(); d++)
+			inside = key[d] < slice_grid[d];
+		if(!inside)
+			continue;
+
+		std::string name;
+		for(size_t d=0; d<key.size(); d++)
+		{
+			snprintf(num, sizeof(num), (d == 0) ? "%zu" : ".%zu", key[d]);
+			name += num;
+		}
+		output.push_back(name);
+	}
+	return output;
+}
+
+/**
+ *	\brief Makes this folder contain computed slice files.
+ *	\param [in] rule : the Rule of slice files, shared by all of them.
+ *	\param [in] count : number of slices.
+ *	\param [in] extension : extension of slice files.
+ *	\param [in] axis : dimension of NeXus field the slices are taken along.
+ *	\param [in] bin : binning factor of slice images, 1 for full resolution.
+ *
+ *	Slice files are not stored in FSTree, they are named "<number><extension>" and created by FSObject::sliceAt when looked up.
+ */
+void FSObject::setSlices(Rule* rule, size_t count, std::string extension, size_t axis, size_t bin)
+{
+	slice_rule = rule;
+	slice_count = count;
+	slice_extension = extension;
+	slice_axis = axis;
+	slice_bin = bin;
+	slice_inode = nextInode(count);
+	slice_grid.clear();
+	_slice_stat_generation = 0;
+}
+
+/**
+ *	\brief Makes this folder contain computed chunk files, named by chunk keys as Zarr names them.
+ *	\param [in] rule : the Rule of chunk files, shared by all of them.
+ *	\param [in] grid : number of chunks along each dimension of NeXus field.
+ *
+ *	The chunk at key "i.j.k" is the slice number ((i*grid[1] + j)*grid[2] + k), see FSObject::sliceAt.
+ *	Unlike slices, chunk files don't share attributes: their sizes differ and chunks never written don't exist.
+ */
+void FSObject::setChunkKeys(Rule* rule, const std::vector<size_t>& grid)
+{
+	size_t count = grid.empty() ? 0 : 1;
+	for(size_t n : grid)
+		count *= n;
+	setSlices(rule, count, "");
+	slice_grid = grid;
+}
+
+/**
+ *	\brief Parses a number in the name of computed file.
+ *	\param [in] name : name of file.
+ *	\param [in] begin : position of first digit.
+ *	\param [in] end : position after the last digit.
+ *	\param [in] limit : the number has to be less than it.
+ *	\param [out] number : the number parsed.
+ *	\return False unless the name holds a decimal number without leading zeros there, as readdir lists them.
+ */
+static bool parseNumber(const std::string& name, size_t begin, size_t end, size_t limit, size_t& number)
+{
+	if( begin >= end || (name[begin] == '0' && end - begin > 1) )
+		return false;
+	number = 0;
+	for(size_t i=begin; i<end; i++)
+	{
+		char c = name[i];
+		if(c < '0' || c > '9' || number > (limit - 1) / 10)
+			return false;
+		number = number*10 + (c - '0');
+	}
+	return number < limit;
+}
+
+/**
+ *	\brief Creates computed slice file of this folder.
+ *	\param [in] child_name : name of file, i.e. number of slice followed by the extension, or chunk key.
+ *	\param [out] output : slice file, valid until this folder is changed.
+ *	\return False if there is no such slice file.
+ */
+bool FSObject::sliceAt(const std::string& child_name, FSObject& output) const
+{
+	if(slice_count == 0 || child_name.length() <= slice_extension.length())
+		return false;
+
+	size_t index = 0;
+	if( !slice_grid.empty() )
+	{
+		// chunk key: one number for each dimension, separated by dots
+		size_t pos = 0;
+		for(size_t d=0; d<slice_grid.size(); d++)
+		{
+			size_t end = child_name.find('.', pos);
+			if(end == std::string::npos)
+				end = child_name.length();
+			size_t number;
+			if( (end == child_name.length()) != (d + 1 == slice_grid.size())
+					|| !parseNumber(child_name, pos, end, slice_grid[d], number) )
+				return false;
+			index = index*slice_grid[d] + number;
+			pos = end + 1;
+		}
+	}
+	else
+	{
+		size_t num_len = child_name.length() - slice_extension.length();
+		if( child_name.compare(num_len, std::string::npos, slice_extension) != 0
+				|| !parseNumber(child_name, 0, num_len, slice_count, index) )
+			return false;
+	}
+
+	output.name = child_name;
+	output.fullpath = (fullpath == "/") ? "/" + child_name : fullpath + "/" + child_name;
+	output.setNXObjectPath(_nxobjectpath);
+	output.rule = slice_rule;
+	output.slice = SliceRef(index, slice_axis, slice_bin);
+	output.children.clear();
+	output.slice_rule = NULL;
+	output.slice_count = 0;
+	output.slice_grid.clear();
+	output.inode = slice_inode + index;
+	output._stat_generation = 0;
+	output._slice_parent = this;
+	return true;
 }
 
 /**
@@ -94,11 +315,13 @@ FSType FSObject::getattr()
 	FSType ret = FSType::NONE;
 	if(this->rule != NULL)
 	{
-		pninx::NXObject nx = NXGateway::getNXObjectByPath( this->_nxobjectpath.c_str() );
+		// folders made by Filter (e.g. of files of directory) don't open their NeXus object
+		if( typeid(*this->rule) == typeid(Rule) && this->rule->getOptionValue("fsobject_type") == "FOLDER" )
+			return FSType::FOLDER;
 		try
 		{
 			//the truth is out there
-			ret = this->rule->getattr( nx );
+			ret = this->rule->getattr( NXGateway::metadata( this->_nxobjectpath ) );
 		}
 		catch (NXFSException& e) {
 			//todo handle exception
@@ -111,18 +334,137 @@ FSType FSObject::getattr()
  *	\brief Gets the size of FSObject.
  *
  *	\return size of file in bytes.
+ *
+ *	The size is computed from the metadata kept by NXGateway if the rule can do it, so HDF5 is not asked.
  */
 size_t FSObject::size()
 {
 	size_t sz = 0;
 	if(this->rule != NULL)
 	{
+		SliceRef slice_ref = sliceRef();
+		if( this->rule->sizeFromMetadata( NXGateway::metadata( this->_nxobjectpath ), slice_ref, sz ) )
+			return sz;
+		NXGateway::AccessLock access;
 		auto nx = NXGateway::getNXObjectByPath( this->_nxobjectpath.c_str() );
-		sz = this->rule->size( nx );
+		sz = this->rule->size( nx, slice_ref );
 	}
 	return sz;
 }
 
+/**
+ *	\brief Gets the attributes of FSObject as FUSE wants them.
+ *
+ *	\param [out] output : attributes of file/folder.
+ *	\return False if there is no such file/folder.
+ *
+ *	The attributes are computed once and copied afterwards, until the NeXus file is reopened.
+ *	Computed slice files of one folder have the same attributes but the inode, so they are computed for the first one only.
+ *	Chunk files (FSObject::setChunkKeys) have their own.
+ */
+bool FSObject::stat(struct stat& output)
+{
+	unsigned long generation = _generation;
+	{
+		std::lock_guard<std::mutex> lock(_stat_mutex);
+		if(_stat_generation == generation)
+		{
+			memcpy(&output, &_stat, sizeof(struct stat));
+			return true;
+		}
+		if(sharesSliceStat() && _slice_parent->_slice_stat_generation == generation)
+		{
+			memcpy(&_stat, &_slice_parent->_slice_stat, sizeof(struct stat));
+			_stat.st_ino = inode;
+			_stat_generation = generation;
+			memcpy(&output, &_stat, sizeof(struct stat));
+			return true;
+		}
+	}
+
+	struct stat computed;
+	if( !computeStat(computed) )
+		return false;
+
+	std::lock_guard<std::mutex> lock(_stat_mutex);
+	memcpy(&_stat, &computed, sizeof(struct stat));
+	_stat_generation = generation;
+	if(sharesSliceStat())
+	{
+		memcpy(&_slice_parent->_slice_stat, &computed, sizeof(struct stat));
+		_slice_parent->_slice_stat_generation = generation;
+	}
+	memcpy(&output, &_stat, sizeof(struct stat));
+	return true;
+}
+
+/**
+ *	\brief Tells whether this is a computed slice file whose attributes are those of the other slices of its folder.
+ */
+bool FSObject::sharesSliceStat() const
+{
+	return _slice_parent != NULL && _slice_parent->slice_grid.empty();
+}
+
+/**
+ *	\brief Computes the attributes of FSObject.
+ *
+ *	\param [out] output : attributes of file/folder.
+ *	\return False if there is no such file/folder.
+ */
+bool FSObject::computeStat(struct stat& output)
+{
+	memset(&output, 0, sizeof(struct stat));
+
+	FSType type = (fullpath == "/") ? FSType::FOLDER : getattr();
+	switch(type)
+	{
+		case FSType::FILE:
+			output.st_mode = S_IFREG | 0444;
+			output.st_nlink = 1;
+			try{
+				output.st_size = size();
+			}catch (NXFSException&) {
+				return false;
+			}
+			output.st_blocks = (output.st_size + 511) / 512;
+			break;
+		case FSType::FOLDER:
+			output.st_mode = S_IFDIR | 0444;
+			output.st_nlink = 2;
+			break;
+		default:
+			return false;
+	};
+
+	// objects of file being written get their own time, so that the kernel drops only their cached contents
+	struct timespec mtime = NXGateway::changeTime(_nxobjectpath);
+	output.st_ino = inode;
+	output.st_mtim = mtime;
+	output.st_ctim = mtime;
+	output.st_atim = mtime;
+	return true;
+}
+
+/**
+ *	\brief Makes attributes of all FSObjects be computed again, e.g. when NeXus file was reopened.
+ */
+void FSObject::invalidateStats()
+{
+	_generation++;
+}
+
+/**
+ *	\brief Reserves inode numbers.
+ *
+ *	\param [in] count : number of inode numbers.
+ *	\return the first inode number reserved.
+ */
+ino_t FSObject::nextInode(size_t count)
+{
+	return _last_inode.fetch_add(count) + 1;
+}
+
 /**
  * \brief Sets NeXus object path
  *
@@ -133,6 +475,28 @@ void FSObject::setNXObjectPath(std::string path)
 	_nxobjectpath = path;
 }
 
+/**
+ * \brief Gets NeXus object path
+ *
+ * \return NeXus object path
+ */
+const std::string& FSObject::getNXObjectPath() const
+{
+	return _nxobjectpath;
+}
+
+/**
+ * \brief Gets the part of NeXus object represented by this file, as it is passed to the Rule.
+ *
+ * \return FSObject#slice with the full path of NeXus object.
+ */
+SliceRef FSObject::sliceRef() const
+{
+	SliceRef output = slice;
+	output.nxpath = _nxobjectpath;
+	return output;
+}
+
 /**
  * \brief renames child specified by \a child_name with a \a new_name
  *
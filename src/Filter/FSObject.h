@@ -28,6 +28,9 @@
 #include <iostream>
 #include <string.h>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <sys/stat.h>
 
 #include "Rule.h"
 #include "enums.h"
@@ -38,9 +41,23 @@
  */
 class FSObject {
 private:
-	std::string _nxobjectpath; /*!< Absolute path of NXObject within NXFile. */
+	std::string _nxobjectpath; /*!< Absolute path of NXObject within NXFile, in directory mode it starts with the name of file. */
 	std::vector<std::string> children; /*!< List of files/folders located in this FSObject. */
 	FSType _type; /*!< deprecated. */
+
+	struct stat _stat; /*!< Attributes of FSObject, valid if FSObject#_stat_generation is the current one. */
+	unsigned long _stat_generation; /*!< Generation FSObject#_stat was filled in, 0 if it is empty. */
+	mutable struct stat _slice_stat; /*!< Attributes shared by computed slice files of this folder. */
+	mutable unsigned long _slice_stat_generation; /*!< Generation FSObject#_slice_stat was filled in. */
+	const FSObject* _slice_parent; /*!< Folder of computed slice file, NULL for objects stored in FSTree. */
+
+	static std::atomic<unsigned long> _generation; /*!< Current generation of attributes, changed when NeXus file is reopened. */
+	static std::atomic<ino_t> _last_inode; /*!< The last inode number given. */
+	static std::mutex _stat_mutex; /*!< Guards attributes of all FSObjects. */
+
+	bool computeStat(struct stat& output);
+	bool sharesSliceStat() const;
+	SliceRef sliceRef() const;
 public:
 	FSObject();
 	FSObject(const char* name);
@@ -49,16 +66,39 @@ public:
 	std::string name;
 	std::string fullpath;
 	int addChild(std::string fullpath);
+	const std::vector<std::string>& getChildren() const;
 	void renameChild(const char* child_name, const char* new_name);
 	void setNXObjectPath(std::string path);
+	const std::string& getNXObjectPath() const;
+
+	ino_t inode; /*!< Inode number, given by FSTree. */
+	static ino_t nextInode(size_t count = 1);
 
 	Rule* rule; /*!< The Rule defines how this FSObject will be represented. */
+	SliceRef slice; /*!< The part of NeXus object represented by this file. */
+
+	Rule* slice_rule; /*!< The Rule of computed slice files in this folder, NULL if there are none. */
+	size_t slice_count; /*!< Number of computed slice files. */
+	std::string slice_extension; /*!< Extension of computed slice files. */
+	size_t slice_axis; /*!< Dimension of NeXus field the computed slice files are taken along. */
+	size_t slice_bin; /*!< Binning factor of computed slice files. */
+	ino_t slice_inode; /*!< Inode number of the first computed slice file. */
+	std::vector<size_t> slice_grid; /*!< Number of chunks along each dimension if computed files are named by chunk keys ("0.1.2"), empty for numbered slices. */
+
+	void setSlices(Rule* rule, size_t count, std::string extension, size_t axis = 0, size_t bin = 1);
+	void setChunkKeys(Rule* rule, const std::vector<size_t>& grid);
+	bool sliceAt(const std::string& child_name, FSObject& output) const;
 
 	//fuse methods
 	virtual std::string read();
+	virtual FileContent readContent();
+	virtual bool readRange(size_t size, off_t offset, FileContent& output);
 	virtual std::vector<std::string> readdir();
 	virtual FSType getattr();
 	virtual size_t size();
+
+	bool stat(struct stat& output);
+	static void invalidateStats();
 };
 
 #endif /* FSOBJECT_H_ */
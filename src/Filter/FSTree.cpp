@@ -22,19 +22,7 @@
 
 #include "FSTree.h"
 
-std::map<std::string, FSObject>* FSTree::_nodes_ptr;
-
-/**
- *	\brief to access Nodes map and prevent static initializing troubles.
- */
-std::map<std::string, FSObject>& FSTree::Nodes()
-{
-	if(_nodes_ptr == NULL)
-	{
-		_nodes_ptr = new std::map<std::string, FSObject>();
-	}
-	return *_nodes_ptr;
-}
+std::shared_ptr<FSTree> FSTree::_current = std::make_shared<FSTree>();
 
 /**
  *	\brief Constructor of FSTree.
@@ -45,8 +33,10 @@ FSTree::FSTree() {
 	FSObject obj;
 	obj.name = "/";
 	obj.fullpath = "/";
+	obj.inode = FSObject::nextInode();
+	_scan_time = 0;
 	try{
-		Nodes().insert( std::pair<std::string, FSObject> ("/", obj) );
+		_nodes.insert( std::pair<std::string, FSObject> ("/", obj) );
 	}catch (...) {
 		fprintf(stderr, "Error occurred: \n");
 		abort();
@@ -55,13 +45,206 @@ FSTree::FSTree() {
 }
 
 /**
- *	Destructor of FSTree. Frees memory.
+ *	Destructor of FSTree. Frees memory, the Rules of its FSObjects are freed with the last tree using them.
  *
  */
 FSTree::~FSTree() {
-	if(this->Nodes().size() > 0)
-		this->Nodes().clear();
-	this->_nodes_ptr = NULL;
+	_nodes.clear();
+	_rules.clear();
+	_branches.clear();
+}
+
+/**
+ *	\brief Takes the ownership of Rules of FSObjects, it is called when the tree is complete.
+ *	\param [in] base : tree this one was copied from, Rules that came from it are shared. NULL if there is none.
+ */
+void FSTree::adoptRules(const FSTree* base)
+{
+	for(auto& node : _nodes)
+	{
+		// Rules are shared by FSObjects, e.g. slice folder and its views
+		Rule* rules[2] = { node.second.rule, node.second.slice_rule };
+		for(Rule* rule : rules)
+		{
+			if(rule == NULL || _rules.find(rule) != _rules.end())
+				continue;
+			auto it = (base != NULL) ? base->_rules.find(rule) : _rules.end();
+			if(base != NULL && it != base->_rules.end())
+				_rules.insert(*it);
+			else
+				_rules.insert( std::make_pair(rule, std::shared_ptr<Rule>(rule)) );
+		}
+	}
+
+	for(auto& entry : _branches)
+	{
+		std::shared_ptr<FSTree> branch = std::atomic_load(&entry.second);
+		if(branch == NULL)
+			continue;
+		auto it = (base != NULL) ? base->_branches.find(entry.first) : _branches.end();
+		std::shared_ptr<FSTree> base_branch = (base != NULL && it != base->_branches.end()) ? std::atomic_load(&it->second) : std::shared_ptr<FSTree>();
+		branch->adoptRules( base_branch.get() );
+	}
+}
+
+/**
+ *	\brief Copies the tree, the copy shares Rules with this one.
+ *	\return The copy, to be completed and published.
+ */
+std::shared_ptr<FSTree> FSTree::copy() const
+{
+	std::shared_ptr<FSTree> output = std::make_shared<FSTree>();
+	output->_nodes = _nodes;
+	output->_nxobjects = _nxobjects;
+	output->_scan_time = _scan_time;
+	output->_rules = _rules;
+	// the copy is changed while it is built, so the branches are copied too
+	for(auto& entry : _branches)
+	{
+		std::shared_ptr<FSTree> branch = std::atomic_load(&entry.second);
+		output->_branches[entry.first] = (branch != NULL) ? branch->copy() : branch;
+	}
+	return output;
+}
+
+/**
+ *	\brief Remembers NeXus object FSObject was created for.
+ *	\param [in] nxpath : full path of NeXus object.
+ *	\param [in] fspath : full path of FSObject.
+ *	\param [in] shape : shape of NeXus field, empty for groups.
+ */
+void FSTree::addNXObject(const std::string& nxpath, const std::string& fspath, const shape_t& shape)
+{
+	NXObjectEntry& entry = _nxobjects[nxpath];
+	entry.fspath = fspath;
+	entry.shape = shape;
+	entry.mtime = 0;
+	entry.version = 0;
+}
+
+/**
+ *	\brief Gets NeXus object the tree was built for.
+ *	\param [in] nxpath : full path of NeXus object.
+ *	\return The entry of NeXus object, NULL if there is none.
+ */
+NXObjectEntry* FSTree::findNXObject(const std::string& nxpath)
+{
+	auto it = _nxobjects.find(nxpath);
+	if( it != _nxobjects.end() )
+		return &it->second;
+	FSTree* branch = branchOf( nxpath.c_str() );
+	return (branch != NULL) ? branch->findNXObject(nxpath) : NULL;
+}
+
+/**
+ *	\brief Gets all NeXus objects the tree was built for, without those of its branches.
+ *	\return NeXus objects, key is a path of NeXus object.
+ */
+const std::map<std::string, NXObjectEntry>& FSTree::nxobjects() const
+{
+	return _nxobjects;
+}
+
+/**
+ *	\brief Sets modification times of NeXus objects.
+ *	\param [in] times : modification times, key is a path of NeXus object (see NXGateway::scan).
+ *	\param [in] scan_time : the time the modification times were taken.
+ */
+void FSTree::setNXObjectTimes(const std::map<std::string, time_t>& times, time_t scan_time)
+{
+	for(auto& entry : _nxobjects)
+	{
+		auto it = times.find(entry.first);
+		entry.second.mtime = (it != times.end()) ? it->second : 0;
+	}
+	_scan_time = scan_time;
+}
+
+/**
+ *	\brief Gets the time modification times of NeXus objects were taken.
+ */
+time_t FSTree::scanTime() const
+{
+	return _scan_time;
+}
+
+/**
+ *	\brief Marks folder of NeXus file whose contents are built on first access, see FSTree::setBranch.
+ *	\param [in] fspath : full path of folder, directly in root folder.
+ */
+void FSTree::setUnexpanded(const std::string& fspath)
+{
+	_branches[fspath] = std::shared_ptr<FSTree>();
+}
+
+/**
+ *	\brief Tells whether the contents of folder of NeXus file are not built yet.
+ *	\param [in] fspath : full path of folder.
+ */
+bool FSTree::isUnexpanded(const std::string& fspath) const
+{
+	auto it = _branches.find(fspath);
+	return it != _branches.end() && std::atomic_load(&it->second) == NULL;
+}
+
+/**
+ *	\brief Starts the branch of folder marked by FSTree::setUnexpanded.
+ *	\param [in] fspath : full path of folder.
+ *	\return New tree holding a copy of the folder, its contents are built in it.
+ */
+std::shared_ptr<FSTree> FSTree::branch(const std::string& fspath) const
+{
+	std::shared_ptr<FSTree> output = std::make_shared<FSTree>();
+	auto it = _nodes.find(fspath);
+	if( it != _nodes.end() )
+		output->_nodes.insert(*it);
+	return output;
+}
+
+/**
+ *	\brief Sets the contents of folder built on first access, the tree may be served meanwhile.
+ *	\param [in] fspath : full path of folder marked by FSTree::setUnexpanded.
+ *	\param [in] branch : complete tree started by FSTree::branch, it is not changed afterwards.
+ *
+ *	A branch once set stays with the tree, so FSObjects found in it are valid while the tree is held.
+ */
+void FSTree::setBranch(const std::string& fspath, std::shared_ptr<FSTree> branch)
+{
+	auto it = _branches.find(fspath);
+	if( it != _branches.end() )
+		std::atomic_store(&it->second, branch);
+}
+
+/**
+ *	\brief Gets the branch which \a path lies in.
+ *	\param [in] path : full path of FSObject or of NeXus object.
+ *	\return The branch of folder at the start of \a path, NULL if there is none or the folder is not built yet.
+ */
+FSTree* FSTree::branchOf(const char* path) const
+{
+	if( _branches.empty() || path[0] != '/' )
+		return NULL;
+	const char* end = strchr(path + 1, '/');
+	auto it = _branches.find( (end == NULL) ? std::string(path) : std::string(path, end - path) );
+	return (it != _branches.end()) ? std::atomic_load(&it->second).get() : NULL;
+}
+
+/**
+ *	\brief Gets the tree served.
+ *	\return The tree, it stays valid while the pointer is held even if a new tree is published meanwhile.
+ */
+std::shared_ptr<FSTree> FSTree::current()
+{
+	return std::atomic_load(&_current);
+}
+
+/**
+ *	\brief Makes \a tree the one served.
+ *	\param [in] tree : new tree, it is not changed afterwards.
+ */
+void FSTree::publish(std::shared_ptr<FSTree> tree)
+{
+	std::atomic_store(&_current, tree);
 }
 
 
@@ -72,7 +255,7 @@ void FSTree::lookup()
 {
 #ifdef _DEBUG_MODE_
 	ErrorLog::log_write("\nFSTree.lookup: run; \n" );
-	for (std::map<std::string, FSObject>::iterator it = Nodes().begin(); it != Nodes().end(); ++it)
+	for (std::map<std::string, FSObject>::iterator it = _nodes.begin(); it != _nodes.end(); ++it)
 	{
 		ErrorLog::log_write("%s: b-%p (%d) \n", it->second.fullpath.c_str(), it->second.rule, it->second.rule->_type);
 	}
@@ -89,6 +272,10 @@ void FSTree::lookup()
  */
 int FSTree::insert(FSObject& new_node, const std::string path)
 {
+	FSTree* branch = branchOf( path.c_str() );
+	if(branch != NULL)
+		return branch->insert(new_node, path);
+
 	std::string path_str = path;
 	if(path == "/")
 		path_str += new_node.name;
@@ -96,14 +283,15 @@ int FSTree::insert(FSObject& new_node, const std::string path)
 		path_str += "/" + new_node.name;
 
 	new_node.fullpath = path_str;
+	new_node.inode = FSObject::nextInode();
 	//todo: handle exception if there is no parent with such path?!
-	auto it = Nodes().find( path.c_str() );
-	if(it != Nodes().end())
+	auto it = _nodes.find( path.c_str() );
+	if(it != _nodes.end())
 		it->second.addChild(new_node.name.c_str());
 	else
 		return -1;
 
-	Nodes().insert(std::pair<std::string, FSObject>(path_str, new_node));
+	_nodes.insert(std::pair<std::string, FSObject>(path_str, new_node));
 	return 0;
 }
 
@@ -128,8 +316,12 @@ int FSTree::insert(FSObject& new_node, FSObject& parent)
  */
 FSObject& FSTree::find(const char* path)
 {
-	auto fsobj_it = Nodes().find(path);
-	if( fsobj_it != Nodes().end() )
+	FSTree* branch = branchOf(path);
+	if(branch != NULL)
+		return branch->find(path);
+
+	auto fsobj_it = _nodes.find(path);
+	if( fsobj_it != _nodes.end() )
 		return fsobj_it->second;
 	else
 	{
@@ -139,6 +331,23 @@ FSObject& FSTree::find(const char* path)
 	}
 }
 
+/**
+ *	\brief It looks for FSObject specified by \a path, without throwing.
+ *	\param [in] path : full path of FSObject one want to have.
+ *	\return pointer to a match, NULL if there is no such FSObject.
+ */
+FSObject* FSTree::tryFind(const char* path)
+{
+	FSTree* branch = branchOf(path);
+	if(branch != NULL)
+		return branch->tryFind(path);
+
+	auto fsobj_it = _nodes.find(path);
+	if( fsobj_it != _nodes.end() )
+		return &fsobj_it->second;
+	return NULL;
+}
+
 /**
  *	\brief It looks for FSObject specified by \a path.
  *	\param [in] path : full path of FSObject one want to have.
@@ -161,8 +370,8 @@ FSObject& FSTree::operator [](const char* path)
  */
 int FSTree::setRule( const char* path, Rule* behavior )
 {
-	auto fsobj_it = Nodes().find( path );
-	if(fsobj_it != Nodes().end() )
+	auto fsobj_it = _nodes.find( path );
+	if(fsobj_it != _nodes.end() )
 		fsobj_it->second.rule = behavior;
 	else
 		return -1;//todo log error
@@ -177,8 +386,8 @@ int FSTree::setRule( const char* path, Rule* behavior )
  */
 int FSTree::setRule( FSObject& fsobj, Rule* behavior )
 {
-	auto fsobj_it = Nodes().find( fsobj.fullpath.c_str() );
-	if(fsobj_it != Nodes().end() )
+	auto fsobj_it = _nodes.find( fsobj.fullpath.c_str() );
+	if(fsobj_it != _nodes.end() )
 		fsobj_it->second.rule = behavior;
 	else
 		return -1;//todo log error
@@ -194,15 +403,15 @@ int FSTree::setRule( FSObject& fsobj, Rule* behavior )
  */
 void FSTree::changeFSObjectName(const char* path, const char* newname)
 {
-	auto fsobj_it = Nodes().find(path);
-	if( fsobj_it != Nodes().end() )
+	auto fsobj_it = _nodes.find(path);
+	if( fsobj_it != _nodes.end() )
 	{
 		std::string parent_fullpath;
 		std::string old_name;
 		FSObject fsobj_copy = fsobj_it->second;
 
-		Nodes().erase(fsobj_it);
 		old_name = fsobj_it->second.name;
+		_nodes.erase(fsobj_it);
 		fsobj_copy.name = newname;
 
 		std::string fullpath = fsobj_copy.fullpath;
@@ -219,19 +428,9 @@ void FSTree::changeFSObjectName(const char* path, const char* newname)
 		//todo: else return nothing?
 
 		fsobj_copy.fullpath = fullpath;
-		Nodes().insert( std::pair<std::string, FSObject>( fullpath, fsobj_copy ) );
+		_nodes.insert( std::pair<std::string, FSObject>( fullpath, fsobj_copy ) );
 
-		Nodes().find(parent_fullpath)->second.renameChild(old_name.c_str(), newname);
+		_nodes.find(parent_fullpath)->second.renameChild(old_name.c_str(), newname);
 	}
 	//todo: else return an error
 }
-
-/**
- *	\brief Takes the last added element of FSTree.
- */
-FSObject& FSTree::last()
-{
-	auto it = Nodes().end();
-	it--;
-	return it->second;
-}
@@ -26,35 +26,76 @@
 #include <stdio.h>
 #include <iostream>
 #include <map>
+#include <set>
 #include <vector>
+#include <memory>
 #include <string.h>
 
 #include "FSObject.h"
 
 /**
- * Class intended to manage the virtual filesystem tree based on FSObject
+ *	NeXus object FSTree was built for, used to find what changed in NeXus file when it is reloaded.
+ */
+struct NXObjectEntry
+{
+	std::string fspath; /*!< Full path of FSObject created for NeXus object. */
+	shape_t shape; /*!< Shape of NeXus field, empty for groups. */
+	time_t mtime; /*!< Modification time of NeXus object reported by HDF5, 0 if HDF5 doesn't track it. */
+	unsigned long version; /*!< Incremented each time NeXus object grows or its contents change, see Filter::version. */
+};
+
+/**
+ *	Class intended to manage the virtual filesystem tree based on FSObject.\n
+ *	A tree is built once and then only read. The tree served by FUSE is FSTree::current(), a reload builds a new tree
+ *	and publishes it by FSTree::publish. The old tree stays alive while somebody holds it.\n
+ *	A reload of grown NeXus file starts from FSTree::copy of the old tree and adds only what is new.\n
+ *	In directory mode the folders of NeXus files are built on first access into trees of their own (branches),
+ *	which are set into the tree served (FSTree::setBranch). Paths within a built folder are looked up in its branch.
  */
 class FSTree {
 private:
-	static std::map<std::string, FSObject>* _nodes_ptr; /*!< The list of files/folders. */
-	static std::map<std::string, FSObject>& Nodes();
+	std::map<std::string, FSObject> _nodes; /*!< The list of files/folders. */
+	std::map<std::string, NXObjectEntry> _nxobjects; /*!< NeXus objects the tree was built for, key is a path of NeXus object. */
+	time_t _scan_time; /*!< The time NeXus objects were listed, modification times from this second on are not trusted. */
+	std::map<Rule*, std::shared_ptr<Rule>> _rules; /*!< Rules of FSObjects, shared with the trees built from this one. */
+	std::map<std::string, std::shared_ptr<FSTree>> _branches; /*!< Trees of folders built on first access (Filter::expandFile), key is a full path of folder. Empty until the folder is built, accessed atomically. */
+	static std::shared_ptr<FSTree> _current; /*!< The tree served, accessed atomically. */
 
+	FSTree(const FSTree&);
+	FSTree& operator=(const FSTree&);
 public:
 	FSTree();
 	virtual ~FSTree();
-	static void lookup();
-	static FSObject& find(const char* path);
+	void lookup();
+	FSObject& find(const char* path);
+	FSObject* tryFind(const char* path);
 
-	static int insert(FSObject& new_node, const std::string path);
-	static int insert(FSObject& new_node, FSObject& parent);
+	int insert(FSObject& new_node, const std::string path);
+	int insert(FSObject& new_node, FSObject& parent);
 
-	static int setRule( FSObject& fsobj, Rule* behavior );
-	static int setRule( const char* path, Rule* behavior );
-	static FSObject& last();
+	int setRule( FSObject& fsobj, Rule* behavior );
+	int setRule( const char* path, Rule* behavior );
 
-	static void changeFSObjectName(const char* path, const char* newname);
+	void changeFSObjectName(const char* path, const char* newname);
 
 	FSObject& operator[](const char *path);
+
+	void addNXObject(const std::string& nxpath, const std::string& fspath, const shape_t& shape);
+	NXObjectEntry* findNXObject(const std::string& nxpath);
+	const std::map<std::string, NXObjectEntry>& nxobjects() const;
+	void setNXObjectTimes(const std::map<std::string, time_t>& times, time_t scan_time);
+	time_t scanTime() const;
+	void setUnexpanded(const std::string& fspath);
+	bool isUnexpanded(const std::string& fspath) const;
+	std::shared_ptr<FSTree> branch(const std::string& fspath) const;
+	void setBranch(const std::string& fspath, std::shared_ptr<FSTree> branch);
+	FSTree* branchOf(const char* path) const;
+
+	void adoptRules(const FSTree* base);
+	std::shared_ptr<FSTree> copy() const;
+
+	static std::shared_ptr<FSTree> current();
+	static void publish(std::shared_ptr<FSTree> tree);
 };
 
 #endif /* FSTREE_H_ */
@@ -0,0 +1,256 @@
+/*
+ * FileContent.cpp
+ *
+ *  Created on: Jul 8, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#include "FileContent.h"
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/**
+ *	Constructor of empty FileContent.
+ */
+FileContent::FileContent() : _size(0) {}
+
+/**
+ *	\brief Constructor of FileContent consisting of one segment.
+ *	\param [in] content : the whole file content.
+ */
+FileContent::FileContent(std::string content) : _size(0)
+{
+	append(std::move(content));
+}
+
+FileContent::~FileContent() {}
+
+/**
+ *	\brief Appends the piece of memory to the file content.
+ *	\param [in] owner : object that keeps \a data valid as long as the segment exists.
+ *	\param [in] data : begin of the piece.
+ *	\param [in] length : length of the piece in bytes.
+ */
+void FileContent::append(std::shared_ptr<const void> owner, const char* data, size_t length)
+{
+	if(length == 0)
+		return;
+	ContentSegment segment;
+	segment.owner = std::move(owner);
+	segment.data = data;
+	segment.length = length;
+	segment.fd = -1;
+	segment.position = 0;
+	_segments.push_back(segment);
+	_size += length;
+}
+
+/**
+ *	\brief Appends the segment of other file content, e.g. trimmed by FileContent::slice.
+ *	\param [in] segment : the piece, in memory or in file.
+ */
+void FileContent::append(const ContentSegment& segment)
+{
+	if(segment.length == 0)
+		return;
+	_segments.push_back(segment);
+	_size += segment.length;
+}
+
+/**
+ *	\brief Appends the piece of open file to the file content, it is not read until it is copied.
+ *	\param [in] owner : object that keeps \a fd open as long as the segment exists.
+ *	\param [in] fd : file descriptor the piece is read from by pread.
+ *	\param [in] position : offset of the piece in file.
+ *	\param [in] length : length of the piece in bytes.
+ */
+void FileContent::appendFile(std::shared_ptr<const void> owner, int fd, off_t position, size_t length)
+{
+	if(length == 0)
+		return;
+	ContentSegment segment;
+	segment.owner = std::move(owner);
+	segment.data = NULL;
+	segment.length = length;
+	segment.fd = fd;
+	segment.position = position;
+	_segments.push_back(segment);
+	_size += length;
+}
+
+/**
+ *	\brief Copies the piece into buffer, the piece lying in file is read.
+ *	\param [in] piece : the piece of file content.
+ *	\param [out] buf : buffer of \a piece.length bytes.
+ *
+ *	Bytes that can't be read (e.g. the file was truncated meanwhile) are zeros.
+ */
+static void copyPiece(const ContentSegment& piece, char* buf)
+{
+	if(piece.data != NULL)
+	{
+		memcpy(buf, piece.data, piece.length);
+		return;
+	}
+
+	size_t done = 0;
+	while(done < piece.length)
+	{
+		ssize_t n = pread(piece.fd, buf + done, piece.length - done, piece.position + done);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			break;
+		done += n;
+	}
+	memset(buf + done, 0, piece.length - done);
+}
+
+/**
+ *	\brief Appends the string to the file content.
+ *	\param [in] content : the piece of file.
+ */
+void FileContent::append(std::string content)
+{
+	auto owner = std::make_shared<std::string>(std::move(content));
+	append(owner, owner->data(), owner->length());
+}
+
+/**
+ *	\brief Gets the size of file content.
+ *	\return Overall length of segments in bytes.
+ */
+size_t FileContent::size() const
+{
+	return _size;
+}
+
+/**
+ *	\brief Gets the memory held by file content.
+ *	\return Overall length of segments that lie in memory, pieces of files are not counted.
+ */
+size_t FileContent::memoryBytes() const
+{
+	size_t output = 0;
+	for(const ContentSegment& segment : _segments)
+		if(segment.fd < 0)
+			output += segment.length;
+	return output;
+}
+
+/**
+ *	\brief Gets the segments of file content.
+ */
+const std::vector<ContentSegment>& FileContent::segments() const
+{
+	return _segments;
+}
+
+/**
+ *	\brief Joins the segments.
+ *	\return The whole file content as a string.
+ */
+std::string FileContent::str() const
+{
+	std::string output;
+	output.reserve(_size);
+	for(const ContentSegment& segment : _segments)
+	{
+		if(segment.data != NULL)
+			output.append(segment.data, segment.length);
+		else
+		{
+			size_t begin = output.length();
+			output.resize(begin + segment.length);
+			copyPiece(segment, &output[begin]);
+		}
+	}
+	return output;
+}
+
+/**
+ *	\brief Copies the part of file content into buffer.
+ *	\param [out] buf : buffer to copy into.
+ *	\param [in] size : maximum number of bytes to be copied.
+ *	\param [in] offset : offset from the file begin.
+ *	\return Number of bytes copied.
+ */
+size_t FileContent::copy(char* buf, size_t size, off_t offset) const
+{
+	std::vector<ContentSegment> pieces;
+	size_t copied = slice(size, offset, pieces);
+	for(const ContentSegment& piece : pieces)
+	{
+		copyPiece(piece, buf);
+		buf += piece.length;
+	}
+	return copied;
+}
+
+/**
+ *	\brief Gets the segments that cover the part of file content.
+ *	\param [in] size : maximum number of bytes.
+ *	\param [in] offset : offset from the file begin.
+ *	\param [out] output : segments trimmed to the requested part. They share the owners with this FileContent.
+ *	\return Number of bytes covered by \a output.
+ */
+size_t FileContent::slice(size_t size, off_t offset, std::vector<ContentSegment>& output) const
+{
+	size_t covered = 0;
+	size_t begin = 0;
+	for(const ContentSegment& segment : _segments)
+	{
+		size_t end = begin + segment.length;
+		if( covered < size && (size_t)offset < end )
+		{
+			size_t from = ( (size_t)offset > begin ) ? (size_t)offset - begin : 0;
+			size_t len = segment.length - from;
+			if(len > size - covered)
+				len = size - covered;
+
+			ContentSegment piece = segment;
+			if(piece.data != NULL)
+				piece.data += from;
+			else
+				piece.position += from;
+			piece.length = len;
+			output.push_back(piece);
+			covered += len;
+		}
+		begin = end;
+	}
+	return covered;
+}
+
+/**
+ *	\brief Gets the part of file content.
+ *	\param [in] size : maximum number of bytes.
+ *	\param [in] offset : offset from the file begin.
+ *	\return File content that begins at \a offset, the segments share the owners with this FileContent.
+ */
+FileContent FileContent::range(size_t size, off_t offset) const
+{
+	std::vector<ContentSegment> pieces;
+	slice(size, offset, pieces);
+
+	FileContent output;
+	for(const ContentSegment& piece : pieces)
+		output.append(piece);
+	return output;
+}
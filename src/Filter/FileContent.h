@@ -0,0 +1,73 @@
+/*
+ * FileContent.h
+ *
+ *  Created on: Jul 8, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#ifndef FILECONTENT_H_
+#define FILECONTENT_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include <memory>
+
+/**
+ *	One contiguous piece of file content. The memory it points to is kept alive by \a owner.\n
+ *	A piece may also lie in an open file instead of memory (e.g. values of contiguous dataset in NeXus file),
+ *	then it is read when it is copied, or FUSE reads it from the file itself (see FuseProvider::fs_read_buf).
+ */
+struct ContentSegment
+{
+	std::shared_ptr<const void> owner; /*!< Keeps \a data valid, e.g. the string or the DArray the data belongs to, or keeps \a fd open. */
+	const char* data; /*!< Begin of the piece, NULL if the piece lies in file. */
+	size_t length; /*!< Length of the piece in bytes. */
+	int fd; /*!< File the piece lies in, -1 if it lies in memory. */
+	off_t position; /*!< Offset of the piece in file \a fd. */
+};
+
+/**
+ *	The content of a file as a list of segments.\n
+ *	It allows to serve e.g. a TIFF header and the pixel data read from NeXus file without joining them into one string.
+ */
+class FileContent {
+private:
+	std::vector<ContentSegment> _segments; /*!< Pieces of file in order. */
+	size_t _size; /*!< Overall length of pieces. */
+public:
+	FileContent();
+	FileContent(std::string content);
+	virtual ~FileContent();
+
+	void append(std::shared_ptr<const void> owner, const char* data, size_t length);
+	void append(std::string content);
+	void append(const ContentSegment& segment);
+	void appendFile(std::shared_ptr<const void> owner, int fd, off_t position, size_t length);
+
+	size_t size() const;
+	size_t memoryBytes() const;
+	const std::vector<ContentSegment>& segments() const;
+	std::string str() const;
+	size_t copy(char* buf, size_t size, off_t offset) const;
+	size_t slice(size_t size, off_t offset, std::vector<ContentSegment>& output) const;
+	FileContent range(size_t size, off_t offset) const;
+};
+
+#endif /* FILECONTENT_H_ */
@@ -23,17 +23,31 @@
 #include "Filter.h"
 
 #include <stdlib.h>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <signal.h>
+#include <fnmatch.h>
 #include "../ErrorLog.h"
+#include "Readahead.h"
 
 XMLFile Filter::_xmlfile;
 NXGateway Filter::_nxgate;
-FSTree Filter::_nxtree;
 NXFSCache* Filter::_cache;
+std::set<std::string> Filter::_missing;
+std::mutex Filter::_missing_mutex;
+sem_t Filter::_reload_requests;
+const size_t Filter::MAX_MISSING = 4096;
+const int Filter::NEGATIVE_TIMEOUT = 5;
+const int Filter::DEFAULT_FOLLOW_INTERVAL = 1000;
+int Filter::_follow_interval = 0;
+void (*Filter::_change_listener)() = NULL;
+std::mutex Filter::_build_mutex;
 
 /**
  * Constructor Filter
  */
-Filter::Filter() {_cache = new NXFSCache(_nxtree);}
+Filter::Filter() {_nxtree = NULL; _cache = new NXFSCache();}
 
 /**
  * \brief Constructor Filter.
@@ -47,7 +61,8 @@ Filter::Filter(const char* nxfile_path, const char* xmlfile_path)
 {
 	_nx_path = nxfile_path;
 	_xml_path = xmlfile_path;
-	_cache = new NXFSCache(_nxtree);
+	_nxtree = NULL;
+	_cache = new NXFSCache();
 
 	if(_xml_path.empty())
 	{
@@ -80,7 +95,7 @@ Filter::Filter(const char* nxfile_path, const char* xmlfile_path)
 
 	try
 	{
-		_nxgate.load_file( _nx_path.c_str() );
+		loadNXFile();
 	}catch (NXFSException& e) {
 		fprintf(stderr, "Having troubles while opening passed NeXus file (%s): %s\n", _nx_path.c_str(), e.what() );
 		usage();
@@ -96,6 +111,13 @@ Filter::Filter(const char* nxfile_path, const char* xmlfile_path)
 void Filter::usage()
 {
 	fprintf(stderr, "usage:  NXFS 1.[FUSE and mount options] 2.[xmlFile] 3. <rootNexusFile>  4. <mountPoint>\nDo not change the order of these arguments.\n");
+	fprintf(stderr, "If <rootNexusFile> is a directory, each NeXus file in it is a folder, built when it is first opened.\n");
+	fprintf(stderr, "Set NXFS_MAX_OPEN_FILES=<n> to keep at most n files of directory open (%zu by default).\n", NXGateway::DEFAULT_MAX_OPEN_FILES);
+	fprintf(stderr, "Set NXFS_READ_WORKERS=<n> to read images by n helper processes in parallel.\n");
+	fprintf(stderr, "Send SIGUSR1, or stat fuse_reload in any folder of mount point, to reload the NeXus file in background after it was updated.\n");
+	fprintf(stderr, "Missing paths are cached by the kernel for %d seconds (-o negative_timeout=<s> to change),\n"
+			"so a repeated stat of the same fuse_reload within that time is ignored; SIGUSR1 is never ignored.\n", NEGATIVE_TIMEOUT);
+	fprintf(stderr, "Use --follow[=<ms>] to mount a NeXus file while it is written (HDF5 SWMR), its datasets are checked for growth every <ms> milliseconds (%d by default).\n", DEFAULT_FOLLOW_INTERVAL);
 	abort();
 }
 
@@ -104,7 +126,7 @@ void Filter::usage()
  */
 Filter::~Filter() {
 	_nxgate.~NXGateway();
-	_nxtree.~FSTree();
+	FSTree::publish( std::make_shared<FSTree>() );
 	_xmlfile.~XMLFile();
 	_cache->~NXFSCache();
 }
@@ -120,30 +142,48 @@ void Filter::addGroup(pninx::NXGroup nxgroup, FSObject& fsparent)
 {
 	for(pninx::NXObject &nxobject : nxgroup)
 	{
-		FSObject fsobj;
+		if( !addObject(nxobject, fsparent) )
+			return;
+	}
+}
 
-		fsobj.name = nxobject.name();
+/**
+ * \brief Creates and inserts FSObject for NXObject, and for all NXObjects within it if it is a group.
+ *
+ * \param [in] nxobject : NeXus object
+ * \param [in] fsparent : parent FSObject folder
+ * \return False if FSObject can't be inserted.
+ */
+bool Filter::addObject(pninx::NXObject& nxobject, FSObject& fsparent)
+{
+	FSObject fsobj;
 
-		fsobj.fullpath = fsparent.fullpath;
-		fsobj.fullpath += "/";
-		fsobj.fullpath += fsobj.name;
+	fsobj.name = nxobject.name();
 
-		//todo: if exception
-		if(_nxtree.insert(fsobj, fsparent) != 0)
-		{
-			//todo log error
-			return;
-		}
+	fsobj.fullpath = fsparent.fullpath;
+	fsobj.fullpath += "/";
+	fsobj.fullpath += fsobj.name;
 
-		createBehavior(fsobj, nxobject);
-		fsobj = _nxtree.last();
+	// in directory mode the folder of file has the name of file as its NeXus path
+	const std::string& parent_nxpath = fsparent.getNXObjectPath();
+	fsobj.setNXObjectPath( (parent_nxpath.empty() || parent_nxpath == "/") ? "/" + fsobj.name : parent_nxpath + "/" + fsobj.name );
 
-		//todo think how to check further browsing
-		if( nxobject.object_type() == pni::nx::NXObjectType::NXGROUP )
-		{
-			addGroup(nxobject, fsobj);
-		}
+	//todo: if exception
+	if(_nxtree->insert(fsobj, fsparent) != 0)
+	{
+		//todo log error
+		return false;
+	}
+
+	// the tree may hold other nodes sorted after the new one, e.g. folders of other files in directory mode
+	std::string fspath = createBehavior(fsobj, nxobject);
+
+	//todo think how to check further browsing
+	if( nxobject.object_type() == pni::nx::NXObjectType::NXGROUP )
+	{
+		addGroup(nxobject, _nxtree->find( fspath.c_str() ));
 	}
+	return true;
 }
 
 /**
@@ -160,20 +200,21 @@ void Filter::addRootGroup(pninx::NXGroup& nxgroup)
 		fsobj.fullpath = "/";
 		// todo: think how to substitude it
 		fsobj.fullpath += fsobj.name;
+		fsobj.setNXObjectPath(fsobj.fullpath);
 
 		std::string root_str = "/";
-		if(_nxtree.insert(fsobj, root_str) != 0)
+		if(_nxtree->insert(fsobj, root_str) != 0)
 		{
 			ErrorLog::log_write("An internal error occurred. Cannot create filtesystem.");
 			return;
 		}
-		createBehavior(fsobj, nxobject);
+		std::string fspath = createBehavior(fsobj, nxobject);
 
 		//if( fsobj.Behaviour->getattr(nxobject) == FSType::FOLDER )
 		//todo: think how to do it better. if there is some group that should be displayed as a file
 		if( nxobject.object_type() == pni::nx::NXObjectType::NXGROUP )
 		{
-			addGroup(nxobject, fsobj);
+			addGroup(nxobject, _nxtree->find( fspath.c_str() ));
 		}
 	}
 }
@@ -190,11 +231,10 @@ void Filter::createSubFiles(Rule* behaviour, pninx::NXObject& nxobj,  FSObject&
 	 * algorythm:
 	 * 1. get the shape of nxobject data
 	 * 2. check that shape is 3d, if not then do not apply, and log error
-	 * 3. for each slice of nxobject ( slice(i,width,height) ) make fsobject
-	 * 	3.1. fsobject rule is passed rule (behaviour)
-	 * 	3.2. fsobject options should have the following option: <"part", i>
-	 * 	3.3. add just created fsobject to fstree
-	 * 4. return
+	 * 3. make parent a folder of computed slice files: their names are generated by readdir,
+	 * 	and the number of slice is parsed from the name on lookup (FSObject::sliceAt)
+	 * 4. add subfolders of slices along other axes (views), binned slices (pyramid) and stack file if there are such options
+	 * 5. return
 	 */
 	//todo: check if there is several rule types
 
@@ -202,24 +242,136 @@ void Filter::createSubFiles(Rule* behaviour, pninx::NXObject& nxobj,  FSObject&
 	subFiles data = myRule->createSubFiles( nxobj );
 	if( data.isValid() )
 	{
-		size_t entityNum = data.num;
+		std::string nxpath = parent.getNXObjectPath();
+		myRule->changeFSType( FSType::FILE );
+		(*_nxtree)[parent.fullpath.c_str()].setSlices( myRule, data.num, data.extension );
+		NXGateway::planChunkCache( nxpath, RuleType::IMAGE );
 
-		for( size_t i=0; i<entityNum ;i++ )
+		// slices along the other axes, e.g. sinograms, in subfolders
+		shape_t shape = ( (pninx::NXField) nxobj ).shape<shape_t>();
+		std::istringstream views( myRule->getOptionValue("views") );
+		std::string view;
+		while( std::getline(views, view, ',') )
 		{
-			FSObject curFSobj;
-			std::string num = static_cast<std::ostringstream*>( &(std::ostringstream() << i) )->str();
-			curFSobj.name = num + data.extension;
-			curFSobj.fullpath = parent.fullpath + "/" + curFSobj.name;
-			curFSobj.setNXObjectPath(nxobj.path());
-			curFSobj.rule = myRule;
-			curFSobj.rule->changeFSType( FSType::FILE );
-			curFSobj.rule->addOption( "part_number", num );
-
-			//todo: log error
-			if(_nxtree.insert( curFSobj, parent ) != 0)
+			view.erase( std::remove_if(view.begin(), view.end(), ::isspace), view.end() );
+			size_t axis;
+			if(view == "xz")
+				axis = 1;
+			else if(view == "yz")
+				axis = 2;
+			else
+			{
+				if( !view.empty() && view != "xy" )
+					ErrorLog::log_xml_error_msg("Unknown view, xz and yz are supported", "views", nxobj.path().c_str());
 				continue;
+			}
+
+			FSObject viewFSobj;
+			viewFSobj.name = view;
+			viewFSobj.setNXObjectPath(nxpath);
+			viewFSobj.rule = new Rule();
+			viewFSobj.rule->addOption("fsobject_type", "FOLDER");
+			viewFSobj.setSlices( myRule, shape[axis], data.extension, axis );
+
+			if(_nxtree->insert( viewFSobj, parent ) != 0)
+				ErrorLog::log_write("Cannot create %s view for %s\n", view.c_str(), nxobj.path().c_str());
 		}
+
+		// binned previews of slices, "bin2", "bin4", ... subfolders
+		std::istringstream pyramid( myRule->getOptionValue("pyramid") );
+		std::string level;
+		TypeID type = ( (pninx::NXField) nxobj ).type_id();
+		while( std::getline(pyramid, level, ',') )
+		{
+			level.erase( std::remove_if(level.begin(), level.end(), ::isspace), level.end() );
+			if( level.empty() )
+				continue;
+			size_t bin = atoi( level.c_str() );
+			if( bin < 2 || (bin & (bin - 1)) != 0 )
+			{
+				ErrorLog::log_xml_error_msg("Pyramid levels have to be powers of 2", "pyramid", nxobj.path().c_str());
+				continue;
+			}
+			if( type == TypeID::COMPLEX32 || type == TypeID::COMPLEX64 || type == TypeID::COMPLEX128 )
+			{
+				ErrorLog::log_xml_error_msg("Complex values cannot be binned", "pyramid", nxobj.path().c_str());
+				break;
+			}
+
+			FSObject binFSobj;
+			binFSobj.name = "bin" + std::to_string(bin);
+			binFSobj.setNXObjectPath(nxpath);
+			binFSobj.rule = new Rule();
+			binFSobj.rule->addOption("fsobject_type", "FOLDER");
+			binFSobj.setSlices( myRule, shape[0], data.extension, 0, bin );
+
+			if(_nxtree->insert( binFSobj, parent ) != 0)
+				ErrorLog::log_write("Cannot create %s for %s\n", binFSobj.name.c_str(), nxobj.path().c_str());
+		}
+
+		// all slices as one multi-page TIFF
+		std::string stack_name = myRule->getOptionValue("stack");
+		if( !stack_name.empty() )
+		{
+			FSObject stackFSobj;
+			stackFSobj.name = stack_name;
+			stackFSobj.fullpath = parent.fullpath + "/" + stackFSobj.name;
+			stackFSobj.setNXObjectPath(nxpath);
+			stackFSobj.rule = new StackRule(*myRule);
+
+			if(_nxtree->insert( stackFSobj, parent ) != 0)
+				ErrorLog::log_write("Cannot create %s for %s\n", stackFSobj.fullpath.c_str(), nxobj.path().c_str());
+		}
+	}
+}
+
+/**
+ * \brief Gets how NeXus field is stored, if it can be a Zarr array.
+ * \param [in] nxobj : NeXus field.
+ * \param [in] nxpath : full path of \a nxobj.
+ * \param [out] storage : see NXGateway::chunkStorage.
+ * \return False if the field is not chunked, or its values are neither integers nor floats.
+ */
+bool Filter::zarrStorage(pninx::NXObject& nxobj, const std::string& nxpath, ChunkStorage& storage)
+{
+	if( nxobj.object_type() != pni::nx::NXObjectType::NXFIELD || !NXGateway::chunkStorage(nxpath, storage)
+			|| ZarrRule::dtype(storage).empty() )
+	{
+		ErrorLog::log_xml_error_msg("Zarr array needs a chunked field of integers or floats", "zarr", nxobj.path().c_str());
+		return false;
+	}
+	return true;
+}
+
+/**
+ * \brief Makes folder a Zarr v2 array of chunked NeXus field: .zarray, .zattrs and one file for each chunk (see ZarrRule).
+ * \param [in] nxobj : chunked NeXus field.
+ * \param [in] parent : folder of array.
+ * \return False if the field can't be a Zarr array, see Filter::zarrStorage.
+ */
+bool Filter::createZarrFiles(pninx::NXObject& nxobj, FSObject& parent)
+{
+	std::string nxpath = parent.getNXObjectPath();
+	ChunkStorage storage;
+	if( !zarrStorage(nxobj, nxpath, storage) )
+		return false;
+
+	(*_nxtree)[parent.fullpath.c_str()].setChunkKeys( new ZarrRule(ZarrRule::Part::CHUNK, storage), ZarrRule::chunkGrid(storage) );
+
+	const std::pair<const char*, ZarrRule::Part> parts[] = {
+			{".zarray", ZarrRule::Part::ARRAY},
+			{".zattrs", ZarrRule::Part::ATTRIBUTES} };
+	for(auto& part : parts)
+	{
+		FSObject partFSobj;
+		partFSobj.name = part.first;
+		partFSobj.setNXObjectPath(nxpath);
+		partFSobj.rule = new ZarrRule(part.second, storage);
+
+		if(_nxtree->insert( partFSobj, parent ) != 0)
+			ErrorLog::log_write("Cannot create %s for %s\n", part.first, nxobj.path().c_str());
 	}
+	return true;
 }
 
 /**
@@ -307,6 +459,45 @@ void Filter::tryCreateSpecificBehavior(Rule* &behavior, pninx::NXObject& nxobjec
 				return;
 			}
 		}
+		else if(specificRuleName == "zarr")
+		{
+			// the folder keeps the name of field, .zarray and .zattrs are stored in it already
+			if( createZarrFiles(nxobject, fsobj) )
+			{
+				delete behavior;
+				behavior = new Rule();
+				behavior->addOption("fsobject_type", "FOLDER");
+			}
+		}
+		else if(specificRuleName == "refs")
+		{
+			// references to chunks in NeXus file, in kerchunk format
+			ChunkStorage storage;
+			std::string file_path;
+			if( zarrStorage(nxobject, fsobj.getNXObjectPath(), storage) )
+			{
+				ZarrRule* refs = new ZarrRule(ZarrRule::Part::REFERENCES, storage);
+				refs->setOptions( _xmlfile.fetchSpecificRule( nxobject.path().c_str() ) );
+				refs->addOption("fsobject_type", "FILE");
+				if( !NXGateway::storedFile(fsobj.getNXObjectPath(), file_path) )
+				{
+					ErrorLog::log_xml_error_msg("The file is not stored by the sec2 driver or its path can't be resolved, chunks can't be referred to by offsets",
+							"refs", nxobject.path().c_str());
+					delete refs;
+				}
+				else if( refs->passThrough() )
+				{
+					delete behavior;
+					behavior = refs;
+				}
+				else
+				{
+					ErrorLog::log_xml_error_msg("Chunks are stored by filters other than shuffle and deflate, they can't be referred to",
+							"refs", nxobject.path().c_str());
+					delete refs;
+				}
+			}
+		}
 		else
 		{
 			Rule* rule;
@@ -341,59 +532,532 @@ void Filter::tryCreateSpecificBehavior(Rule* &behavior, pninx::NXObject& nxobjec
  *
  *	\param [out] fsobj : changes name and fullpath if there are such options in fsobj.rule.
  *	\param [in] nxobject : NXObject the Rule created for.
+ *	\return Full path of FSObject in the tree, it changes if the Rule adds an extension.
  */
-void Filter::createBehavior(FSObject &fsobj, pninx::NXObject &nxobject)
+std::string Filter::createBehavior(FSObject &fsobj, pninx::NXObject &nxobject)
 {
 	Rule* behavior = createHardcodedBehavior(nxobject);
 	tryCreateDefaultBehavior(behavior, nxobject);
 	tryCreateSpecificBehavior(behavior, nxobject, fsobj);
 
-	_nxtree[fsobj.fullpath.c_str()].rule = behavior;
-	_nxtree[fsobj.fullpath.c_str()].setNXObjectPath(nxobject.path());
+	// the NeXus path was set before insert, in directory mode it starts with the name of file and rules above match the path within the file
+	std::string nxpath = fsobj.getNXObjectPath();
+	(*_nxtree)[fsobj.fullpath.c_str()].rule = behavior;
 
-	std::string ext_str = _nxtree[fsobj.fullpath.c_str()].rule->getOptionValue("extension");
+	std::string fspath = fsobj.fullpath;
+	std::string ext_str = (*_nxtree)[fsobj.fullpath.c_str()].rule->getOptionValue("extension");
 	if( !ext_str.empty() )
 	{
 		std::string new_filename = fsobj.name;
 		new_filename += ext_str;
-		_nxtree.changeFSObjectName(fsobj.fullpath.c_str(), new_filename.c_str());
+		_nxtree->changeFSObjectName(fsobj.fullpath.c_str(), new_filename.c_str());
+		fspath = fspath.substr(0, fspath.find_last_of("/") + 1) + new_filename;
 	}
+
+	shape_t shape;
+	if( nxobject.object_type() == pni::nx::NXObjectType::NXFIELD )
+		shape = ( (pninx::NXField) nxobject ).shape<shape_t>();
+	_nxtree->addNXObject(nxpath, fspath, shape);
+	return fspath;
 }
 
 //todo add description
 /**
  *	\brief Browses through NeXus file and creates filesystem object (FSObject) for each NeXus object.
  *
+ *	The FSObjects are put in a new FSTree, which is published when it is complete.
+ *	For directory of NeXus files only the folders of files and of concatenated fields are created, see Filter::expandFile.
  */
 void Filter::createTree()
 {
-	pninx::NXGroup root_group = _nxgate.getNXObjectByPath("/");
+	std::shared_ptr<FSTree> tree = std::make_shared<FSTree>();
+	_nxtree = tree.get();
+
+	try{
+		time_t scan_time = time(NULL);
+		std::map<std::string, time_t> times = NXGateway::scan();
+
+		Rule* behaviuor = new Rule();
+		behaviuor->addOption("fsobject_type", "FOLDER");
+		(*_nxtree)["/"].rule = behaviuor;
+
+		if( NXGateway::isDirectory() )
+		{
+			// files of directory are opened and their folders built on first access, see Filter::treeFor
+			std::string root_str = "/";
+			for(const std::string& name : NXGateway::files())
+			{
+				FSObject fsobj;
+				fsobj.name = name;
+				fsobj.fullpath = "/" + name;
+				if(_nxtree->insert(fsobj, root_str) != 0)
+					continue;
+				Rule* folder = new Rule();
+				folder->addOption("fsobject_type", "FOLDER");
+				(*_nxtree)[fsobj.fullpath.c_str()].rule = folder;
+				(*_nxtree)[fsobj.fullpath.c_str()].setNXObjectPath(fsobj.fullpath);
+				_nxtree->addNXObject(fsobj.fullpath, fsobj.fullpath, shape_t());
+				_nxtree->setUnexpanded(fsobj.fullpath);
+			}
+
+			// fields concatenated through files, the files are looked at on first access too
+			_concats.clear();
+			for(auto& options : _xmlfile.fetchConcatRules())
+			{
+				FSObject fsobj;
+				fsobj.name = options["name"];
+				fsobj.fullpath = "/" + fsobj.name;
+				if( fsobj.name.empty() || fsobj.name.find('/') != std::string::npos || _nxtree->tryFind(fsobj.fullpath.c_str()) != NULL )
+				{
+					ErrorLog::log_xml_error_msg("Concatenation needs a name that is not a name of file", "name", options["path"].c_str());
+					continue;
+				}
+				if(_nxtree->insert(fsobj, root_str) != 0)
+					continue;
+				Rule* folder = new Rule();
+				folder->addOption("fsobject_type", "FOLDER");
+				(*_nxtree)[fsobj.fullpath.c_str()].rule = folder;
+				(*_nxtree)[fsobj.fullpath.c_str()].setNXObjectPath(fsobj.fullpath);
+				_nxtree->addNXObject(fsobj.fullpath, fsobj.fullpath, shape_t());
+				_nxtree->setUnexpanded(fsobj.fullpath);
+				_concats[fsobj.fullpath] = options;
+			}
+		}
+		else
+		{
+			pninx::NXGroup root_group = _nxgate.getNXObjectByPath("/");
+			addRootGroup( root_group );
+		}
+		_nxtree->setNXObjectTimes(times, scan_time);
+	}catch (...) {
+		_nxtree = NULL;
+		throw;
+	}
+	_nxtree = NULL;
+	tree->adoptRules(NULL);
+	FSTree::publish( tree );
+
+	// NeXus objects are closed now, so HDF5 takes the chunk cache parameters
+	NXGateway::applyChunkCaches();
+}
+
+/**
+ *	\brief Builds the contents of folder of NeXus file in directory mode, and sets them into the tree served.
+ *
+ *	\param [in] folder : full path of folder, e.g. "/scan_0001.nx", or of concatenated field (see Filter::addConcat).
+ *
+ *	Only the folder is built, in a branch of its own (FSTree::branch), so the other folders are not copied.
+ *	The NeXus access (NXGateway::lockAccess) is held meanwhile.
+ *	Errors are logged, the folder stays as far as it was built then.
+ */
+void Filter::expandFile( const std::string& folder )
+{
+	// the access is taken before the build as by FUSE reads
+	NXGateway::AccessLock access;
+	std::lock_guard<std::mutex> lock(_build_mutex);
+	std::shared_ptr<FSTree> tree = FSTree::current();
+	if( !tree->isUnexpanded(folder) )
+		return;
 
-	Rule* behaviuor = new Rule();
-	behaviuor->addOption("fsobject_type", "FOLDER");
-	_nxtree["/"].rule = behaviuor;
+	std::shared_ptr<FSTree> branch = tree->branch(folder);
+	_nxtree = branch.get();
+	try{
+		FSObject* fsfolder = _nxtree->tryFind( folder.c_str() );
+		auto concat = _concats.find(folder);
+		if(fsfolder != NULL && concat != _concats.end())
+			addConcat( concat->second, *fsfolder );
+		else if(fsfolder != NULL)
+		{
+			pninx::NXGroup root_group = NXGateway::getNXObjectByPath( folder.c_str() );
+			addGroup( root_group, *fsfolder );
+		}
+	}catch (NXFSException& e) {
+		ErrorLog::log_write("The error occurred while reading NeXus file (%s): %s\n", folder.c_str(), e.what() );
+	}catch (...) {
+		ErrorLog::log_write("The error occurred while reading NeXus file (%s)\n", folder.c_str() );
+	}
+	_nxtree = NULL;
+	branch->adoptRules(NULL);
+	tree->setBranch( folder, branch );
 
-	addRootGroup( root_group );
+	NXGateway::applyChunkCaches();
+	if( following() )
+		followFields( *branch );
 }
 
 /**
- *	\brief Gets FSObject specified by path.
+ *	\brief Builds the folder of slices of a field concatenated through NeXus files of directory, e.g. of a scan series.
+ *
+ *	\param [in] options : options of concatenation, see XMLFile::fetchConcatRules.
+ *	\param [out] fsfolder : folder of concatenation, it gets the computed slice files (FSObject::sliceAt) and the stack file if there is such option.
+ *
+ *	Files are taken in the order of their names, those not matching the \c files pattern (fnmatch, all files if not set) are left out.
+ *	The field has to be of rank 3 in each file, with the value type and the size of slices of the first one, other files are logged and left out.
+ *	Only the shapes of fields are read here, the fields are opened when their slices are read (see ConcatRule).
+ */
+void Filter::addConcat( std::map<std::string, std::string> options, FSObject& fsfolder )
+{
+	std::string pattern = options["files"].empty() ? "*" : options["files"];
+	std::vector<std::string> members;
+	std::vector<size_t> counts;
+	NXMetadata first;
+	for(const std::string& name : NXGateway::files())
+	{
+		if( fnmatch(pattern.c_str(), name.c_str(), 0) != 0 )
+			continue;
+
+		std::string member = "/" + name + options["path"];
+		NXMetadata metadata;
+		try{
+			metadata = NXGateway::metadata(member);
+		}catch (NXFSException& e) {
+			ErrorLog::log_write("Cannot concatenate %s: %s\n", member.c_str(), e.what() );
+			continue;
+		}catch (...) {
+			ErrorLog::log_write("Cannot concatenate %s\n", member.c_str() );
+			continue;
+		}
+
+		if( metadata.object_type != pni::nx::NXObjectType::NXFIELD || metadata.shape.size() != 3
+				|| ( !members.empty() && ( metadata.type_id != first.type_id
+						|| metadata.shape[1] != first.shape[1] || metadata.shape[2] != first.shape[2] ) ) )
+		{
+			ErrorLog::log_write("Cannot concatenate %s: it is not a rank 3 field like %s\n", member.c_str(),
+					members.empty() ? "the others" : members.front().c_str() );
+			continue;
+		}
+		if( metadata.shape[0] == 0 )
+			continue;
+
+		if( members.empty() )
+			first = metadata;
+		members.push_back(member);
+		counts.push_back(metadata.shape[0]);
+	}
+	if( members.empty() )
+	{
+		ErrorLog::log_write("No field to concatenate in %s\n", fsfolder.fullpath.c_str());
+		return;
+	}
+
+	ImageRule image_rule;
+	image_rule.setOptions(options);
+	if( !image_rule.isValidOptions() )
+	{
+		ErrorLog::log_xml_error_msg("There are some mandatory options missing", "unknown", options["path"].c_str());
+		return;
+	}
+
+	ConcatRule* slices = new ConcatRule(image_rule, members, counts);
+	slices->changeFSType( FSType::FILE );
+	fsfolder.setNXObjectPath( members.front() );
+	fsfolder.setSlices( slices, slices->count(), options["extension"] );
+	for(const std::string& member : members)
+		NXGateway::planChunkCache( member, RuleType::IMAGE );
+
+	// all slices of all files as one multi-page TIFF
+	std::string stack_name = options["stack"];
+	if( !stack_name.empty() )
+	{
+		FSObject stackFSobj;
+		stackFSobj.name = stack_name;
+		stackFSobj.fullpath = fsfolder.fullpath + "/" + stackFSobj.name;
+		stackFSobj.setNXObjectPath( members.front() );
+		stackFSobj.rule = new ConcatStackRule(*slices);
+
+		if(_nxtree->insert( stackFSobj, fsfolder ) != 0)
+			ErrorLog::log_write("Cannot create %s\n", stackFSobj.fullpath.c_str());
+	}
+}
+
+/**
+ *	\brief Gets the tree to serve path from. In directory mode the folder of NeXus file the path lies in is built first.
  *
  *	\param [in] path : fullpath of FSObject.
- *	\return FSObject specified by path or empty FSObject.
+ *	\param [in] contents : true if the contents of folder at \a path are asked for, not only its attributes.
+ *	\return The tree served, it has to be held while FSObjects from it are used.
+ */
+std::shared_ptr<FSTree> Filter::treeFor( const char* path, bool contents )
+{
+	std::shared_ptr<FSTree> tree = FSTree::current();
+	if( !NXGateway::isDirectory() || path[0] != '/' || path[1] == '\0' )
+		return tree;
+
+	// listing the directory doesn't open the files
+	const char* end = strchr(path + 1, '/');
+	std::string folder = (end == NULL) ? std::string(path) : std::string(path, end - path);
+	if( (end == NULL && !contents) || !tree->isUnexpanded(folder) )
+		return tree;
+	expandFile(folder);
+	return FSTree::current();
+}
+
+/**
+ *	\brief Builds FSTree for reloaded NeXus file from the tree served, if the file has only grown.
+ *
+ *	\param [out] changed : paths of NeXus objects that changed or got new contents, what was read from them has to be forgotten.
+ *	\return False if some NeXus object is gone or changed its rank, or a new one wasn't placed into its folder (Filter::checkPlacement),
+ *	then the whole tree has to be built again.
+ *
+ *	NeXus objects are listed with their modification times in one pass over the file (NXGateway::scan). New objects are added,
+ *	and the slice counts of image folders follow the new shape of their fields. Objects with the same modification time are
+ *	not looked at, unless HDF5 doesn't track it.
  */
-FSObject& Filter::fsobjectAt( const char* path )
+bool Filter::updateTree( std::vector<std::string>& changed )
 {
+	std::shared_ptr<FSTree> base = FSTree::current();
+	time_t scan_time = time(NULL);
+	std::map<std::string, time_t> times = NXGateway::scan();
+	if( times.empty() )
+		return false;
+	for(auto& entry : base->nxobjects())
+		if( times.find(entry.first) == times.end() )
+			return false;
+
+	std::shared_ptr<FSTree> tree = base->copy();
+	_nxtree = tree.get();
 	try{
-		return _nxtree.find(path);
-	}catch (NXFSException& e) {
-		//todo: substitute exception to null return
-		std::string err_msg = "Error appears: Filter can't find object due to: ";
-		err_msg +=  e.what();
+		// parents come before their contents in the order of paths
+		for(auto& object : times)
+		{
+			const std::string& nxpath = object.first;
+			if(nxpath == "/")
+				continue;
+
+			size_t pos = nxpath.find_last_of("/");
+			std::string parent_nxpath = (pos == 0) ? "/" : nxpath.substr(0, pos);
+			NXObjectEntry* entry = _nxtree->findNXObject(nxpath);
+			if(entry == NULL)
+			{
+				NXObjectEntry* parent_entry = _nxtree->findNXObject(parent_nxpath);
+				FSObject* fsparent = (pos == 0) ? _nxtree->tryFind("/") :
+						(parent_entry != NULL) ? _nxtree->tryFind( parent_entry->fspath.c_str() ) : NULL;
+				pninx::NXObject nxobject = NXGateway::getNXObjectByPath( nxpath.c_str() );
+				if( fsparent == NULL || !addObject(nxobject, *fsparent) || !checkPlacement(nxobject, nxpath, fsparent->fullpath) )
+				{
+					_nxtree = NULL;
+					return false;
+				}
+				changed.push_back(parent_nxpath);
+				continue;
+			}
+
+			// the time could change again within the second objects were listed in
+			if( object.second != 0 && object.second == entry->mtime && entry->mtime < base->scanTime() )
+				continue;
+
+			NXGateway::forget(nxpath);
+			shape_t shape = NXGateway::metadata(nxpath).shape;
+			if( object.second == 0 && shape == entry->shape )
+				continue;
+			if( shape.size() != entry->shape.size() || !updateSlices(*entry, nxpath, shape) )
+			{
+				_nxtree = NULL;
+				return false;
+			}
+			entry->shape = shape;
+			changed.push_back(nxpath);
+		}
+		_nxtree->setNXObjectTimes(times, scan_time);
+	}catch (...) {
+		_nxtree = NULL;
+		throw;
+	}
+	_nxtree = NULL;
+	touchObjects( *tree, changed );
+	tree->adoptRules( base.get() );
+	FSTree::publish( tree );
+
+	NXGateway::applyChunkCaches();
+	return true;
+}
+
+/**
+ *	\brief Checks that FSObjects of new NeXus object and of its contents were inserted into the right folders.
+ *
+ *	\param [in] nxobject : NeXus object added to FSTree being built.
+ *	\param [in] nxpath : full path of \a nxobject.
+ *	\param [in] folder : full path of folder the FSObject of \a nxobject has to be in.
+ *	\return False if some FSObject is missing or lies in another folder, then the whole tree has to be built again.
+ */
+bool Filter::checkPlacement( pninx::NXObject& nxobject, const std::string& nxpath, const std::string& folder )
+{
+	NXObjectEntry* entry = _nxtree->findNXObject(nxpath);
+	if( entry == NULL || _nxtree->tryFind( entry->fspath.c_str() ) == NULL )
+		return false;
+	size_t pos = entry->fspath.find_last_of("/");
+	if( entry->fspath.substr(0, (pos == 0) ? 1 : pos) != folder )
+		return false;
+
+	if( nxobject.object_type() != pni::nx::NXObjectType::NXGROUP )
+		return true;
+	std::string fspath = entry->fspath;
+	pninx::NXGroup nxgroup = nxobject;
+	for(pninx::NXObject& child : nxgroup)
+		if( !checkPlacement(child, nxpath + "/" + child.name(), fspath) )
+			return false;
+	return true;
+}
+
+/**
+ *	\brief Makes the number of slice files follow the new shape of NeXus field.
+ *
+ *	\param [in] entry : NeXus field in FSTree being built.
+ *	\param [in] nxpath : full path of NeXus field.
+ *	\param [in] shape : new shape of NeXus field.
+ *	\return False if slice files are taken along a dimension the field doesn't have now, or the Zarr array can't be described again.
+ *
+ *	The slice folder of image field and its subfolders (views, pyramid levels) are updated.
+ *	The chunk files and the .zarray of Zarr array folder get new Rules for the new shape (see Filter::createZarrFiles).
+ */
+bool Filter::updateSlices( const NXObjectEntry& entry, const std::string& nxpath, const shape_t& shape )
+{
+	FSObject* fsobj = _nxtree->tryFind( entry.fspath.c_str() );
+	if(fsobj == NULL)
+		return false;
+
+	std::vector<FSObject*> folders(1, fsobj);
+	for(const std::string& child : fsobj->getChildren())
+	{
+		FSObject* subfolder = _nxtree->tryFind( (fsobj->fullpath + "/" + child).c_str() );
+		if(subfolder != NULL && subfolder->getNXObjectPath() == nxpath)
+			folders.push_back(subfolder);
+	}
+
+	for(FSObject* folder : folders)
+	{
+		if(folder->slice_rule == NULL)
+			continue;
+		if( !folder->slice_grid.empty() )
+		{
+			if( !updateZarrFiles(*folder, nxpath, shape) )
+				return false;
+			continue;
+		}
+		if(folder->slice_axis >= shape.size())
+			return false;
+		folder->setSlices( folder->slice_rule, shape[folder->slice_axis], folder->slice_extension, folder->slice_axis, folder->slice_bin );
+	}
+	return true;
+}
+
+/**
+ *	\brief Describes Zarr array folder again for the new shape of its field, the Rules of the old tree are left as they are.
+ *
+ *	\param [in,out] folder : folder of Zarr array in FSTree being built, see Filter::createZarrFiles.
+ *	\param [in] nxpath : full path of NeXus field.
+ *	\param [in] shape : new shape of NeXus field.
+ *	\return False if the field is not stored in chunks of that shape now.
+ */
+bool Filter::updateZarrFiles( FSObject& folder, const std::string& nxpath, const shape_t& shape )
+{
+	ChunkStorage storage;
+	if( !NXGateway::chunkStorage(nxpath, storage) || storage.dims.size() != shape.size()
+			|| !std::equal(shape.begin(), shape.end(), storage.dims.begin()) )
+	{
+		ErrorLog::log_write("Cannot describe Zarr array %s for the new shape of field\n", folder.fullpath.c_str());
+		return false;
+	}
+
+	folder.setChunkKeys( new ZarrRule(ZarrRule::Part::CHUNK, storage), ZarrRule::chunkGrid(storage) );
+	FSObject* zarray = _nxtree->tryFind( (folder.fullpath + "/.zarray").c_str() );
+	if(zarray != NULL)
+		zarray->rule = new ZarrRule(ZarrRule::Part::ARRAY, storage);
+	return true;
+}
+
+/**
+ *	\brief Forgets what was read from NeXus object that changed in reloaded file.
+ *
+ *	\param [in] tree : FSTree built for reloaded file.
+ *	\param [in] nxpath : full path of NeXus object.
+ *
+ *	Contents of image folder all come from its field. The table of group is made of its fields, so the group is forgotten too.
+ */
+void Filter::forgetObject( FSTree& tree, const std::string& nxpath )
+{
+	ReadPlanner::forget(nxpath);
+	Binning::forget(nxpath);
+	if(nxpath == "/")
+		return;
+
+	NXObjectEntry* entry = tree.findNXObject(nxpath);
+	if(entry == NULL)
+		return;
+	FSObject* fsobj = tree.tryFind( entry->fspath.c_str() );
+	NXFSCache::forget( entry->fspath, fsobj != NULL && fsobj->slice_rule != NULL );
+
+	size_t pos = nxpath.find_last_of("/");
+	NXObjectEntry* parent_entry = (pos == 0) ? NULL : tree.findNXObject( nxpath.substr(0, pos) );
+	if(parent_entry != NULL)
+		NXFSCache::forget( parent_entry->fspath, false );
+}
+
+/**
+ *	\brief Marks NeXus objects as changed in FSTree being built, see Filter::version.
+ *
+ *	\param [in] tree : FSTree being built, it is not published yet.
+ *	\param [in] changed : paths of NeXus objects that changed. Their groups change too, as tables are made of their fields.
+ */
+void Filter::touchObjects( FSTree& tree, const std::vector<std::string>& changed )
+{
+	std::set<NXObjectEntry*> touched;
+	for(const std::string& nxpath : changed)
+	{
+		touched.insert( tree.findNXObject(nxpath) );
+		size_t pos = nxpath.find_last_of("/");
+		if(pos != std::string::npos && nxpath != "/")
+			touched.insert( tree.findNXObject( (pos == 0) ? "/" : nxpath.substr(0, pos) ) );
+	}
+	touched.erase(NULL);
+	for(NXObjectEntry* entry : touched)
+		entry->version++;
+}
+
+/**
+ *	\brief Gets FSObject specified by path.
+ *
+ *	\param [in] tree : FSTree to look in, it has to be held while the FSObject is used.
+ *	\param [in] path : fullpath of FSObject.
+ *	\param [out] scratch : receives the FSObject if it is a computed slice file, which is not stored in FSTree.
+ *	\return FSObject specified by path: either the one stored in FSTree, or \a scratch.
+ *	\throw NXFSException if there is no such FSObject.
+ */
+FSObject* Filter::fsobjectAt( FSTree& tree, const char* path, FSObject& scratch )
+{
+	FSObject* fsobj = tryFsobjectAt( tree, path, scratch );
+	if( fsobj == NULL )
+	{
+		std::string err_msg = "Error appears: Filter can't find object ";
+		err_msg += path;
 		throw NXFSException( err_msg );
 	}
-	FSObject output;
-	return output;
+	return fsobj;
+}
+
+/**
+ *	\brief Gets FSObject specified by path, without throwing.
+ *
+ *	\param [in] tree : FSTree to look in, it has to be held while the FSObject is used.
+ *	\param [in] path : fullpath of FSObject.
+ *	\param [out] scratch : receives the FSObject if it is a computed slice file, which is not stored in FSTree.
+ *	\return FSObject specified by path: either the one stored in FSTree, or \a scratch. NULL if there is no such FSObject.
+ */
+FSObject* Filter::tryFsobjectAt( FSTree& tree, const char* path, FSObject& scratch )
+{
+	FSObject* fsobj = tree.tryFind(path);
+	if( fsobj != NULL )
+		return fsobj;
+
+	const char* name = strrchr(path, '/');
+	if( name == NULL || name[1] == '\0' )
+		return NULL;
+
+	std::string parent_path = (name == path) ? "/" : std::string(path, name - path);
+	FSObject* parent = tree.tryFind( parent_path.c_str() );
+	if( parent != NULL && parent->sliceAt( name + 1, scratch ) )
+		return &scratch;
+	return NULL;
 }
 
 /**
@@ -405,8 +1069,9 @@ FSObject& Filter::fsobjectAt( const char* path )
 FSType Filter::getattr( const char* path )
 {
 	FSType type = FSType::NONE;
+	FSObject scratch;
 	try{
-		type = fsobjectAt( path ).getattr();
+		type = fsobjectAt( *treeFor(path, false), path, scratch )->getattr();
 	}catch (NXFSException& e) {
 		//todo: substitute exception to null return
 		std::string err_msg = "Error appears: Filter can't get attributes due to: ";
@@ -418,14 +1083,18 @@ FSType Filter::getattr( const char* path )
 }
 
 /**
- * \brief Gets content of file specified by path.
+ * \brief Gets part of content of file specified by path.
  *
  * \param [in] path : fullpath of FSObject.
- * \return content of file as string.
+ * \param [in] size : maximum number of bytes.
+ * \param [in] offset : offset from the file begin.
+ * \return content of file that begins at \a offset.
  */
-std::string Filter::read( const char* path )
+FileContent Filter::read( const char* path, size_t size, off_t offset )
 {
-	std::string output = _cache->read(path);
+	std::shared_ptr<FSTree> tree = treeFor(path, false);
+	FSObject scratch;
+	FileContent output = _cache->read( *fsobjectAt( *tree, path, scratch ), size, offset );
 	//return fsobjectAt( path ).read();
 	return output;
 }
@@ -438,7 +1107,9 @@ std::string Filter::read( const char* path )
  */
 std::vector<std::string> Filter::readdir( const char* path )
 {
-	return fsobjectAt( path ).readdir();
+	std::shared_ptr<FSTree> tree = treeFor(path, true);
+	FSObject scratch;
+	return fsobjectAt( *tree, path, scratch )->readdir();
 }
 
 /**
@@ -446,26 +1117,332 @@ std::vector<std::string> Filter::readdir( const char* path )
  *
  * \param [in] path : fullpath of FSObject.
  * \return size of file in bytes
+ *
+ *	The size of file that was read is taken from NXFSCache, it is exact for compressed files too.
  */
 size_t Filter::size( const char* path )
 {
-	return fsobjectAt( path ).size();
+	size_t output;
+	if( NXFSCache::size(path, output) )
+		return output;
+
+	std::shared_ptr<FSTree> tree = treeFor(path, false);
+	FSObject scratch;
+	return fsobjectAt( *tree, path, scratch )->size();
+}
+
+/**
+ * \brief Gets the attributes of file/folder specified by path.
+ *
+ * \param [in] path : fullpath of FSObject.
+ * \param [out] output : attributes of file/folder.
+ * \return 0 if success, -ENOENT if there is no such file/folder.
+ *
+ *	The attributes are kept by FSObject, only the exact size of file that was read is taken from NXFSCache.\n
+ *	Missing paths are remembered, so that probes of names like ".hidden" or "__init__.py" are answered at once.
+ */
+int Filter::stat( const char* path, struct stat& output )
+{
+	{
+		std::lock_guard<std::mutex> lock(_missing_mutex);
+		if( _missing.count(path) > 0 )
+			return -ENOENT;
+	}
+
+	std::shared_ptr<FSTree> tree = treeFor(path, false);
+	FSObject scratch;
+	FSObject* fsobj = tryFsobjectAt( *tree, path, scratch );
+	if( fsobj == NULL )
+	{
+		std::lock_guard<std::mutex> lock(_missing_mutex);
+		if( _missing.size() >= MAX_MISSING )
+			_missing.clear();
+		_missing.insert(path);
+		return -ENOENT;
+	}
+	if( !fsobj->stat(output) )
+		return -ENOENT;
+
+	size_t exact;
+	if( S_ISREG(output.st_mode) && NXFSCache::size(path, exact) )
+	{
+		output.st_size = exact;
+		output.st_blocks = (exact + 511) / 512;
+	}
+	return 0;
 }
 
 /**
  * \brief reopens the NeXus file.
  *
- *	It reopens the NeXus file in order to achieve new data from it if it was updated.\n
- *	If any error occurred it will abort.
+ *	It reopens the NeXus file in order to achieve new data from it if it was updated, and builds a new FSTree for it.
+ *	If the file has only grown, the tree is updated (Filter::updateTree), otherwise it is built again with new Rules.
+ *	The NeXus access (NXGateway::lockAccess) is held meanwhile, so reads wait for the new file and tree.\n
+ *	If the new file can't be opened, the old file and tree are kept and served (see NXGateway::load_file), the error is logged.
+ * \return True if the new tree is published.
  */
-void Filter::reopenNXFile()
+bool Filter::reopenNXFile()
 {
+	// reads wait until the new file and tree are in place, the access is taken before the build as by FUSE reads
+	NXGateway::AccessLock access;
+	std::lock_guard<std::mutex> lock(_build_mutex);
+	std::vector<std::string> changed;
+	bool updated = false;
 	try
 	{
-		this->_nxgate.load_file(this->_nx_path.c_str());
-		fprintf(stderr, "NXFS: NeXus file reopened\n");
+		loadNXFile();
+		ReadWorkers::reopen();
+		// the directory may have other files now, their folders are built again when they are opened
+		updated = !NXGateway::isDirectory() && updateTree(changed);
+		if( !updated )
+		{
+			NXGateway::clearObjects();
+			createTree();
+		}
 	}catch (NXFSException& e) {
-		fprintf(stdout, "The error occurred while reopening NeXus file (%s): %s", e.what(), this->_nx_path.c_str() );
-		abort();
+		ErrorLog::log_write("The error occurred while reopening NeXus file (%s): %s\n", this->_nx_path.c_str(), e.what() );
+		return false;
+	}catch (...) {
+		ErrorLog::log_write("The error occurred while reopening NeXus file (%s)\n", this->_nx_path.c_str() );
+		return false;
+	}
+
+	// the contents read from the old file are dropped, only of objects that changed if the tree was updated
+	if(updated)
+	{
+		std::shared_ptr<FSTree> tree = FSTree::current();
+		for(const std::string& nxpath : changed)
+			forgetObject(*tree, nxpath);
+	}
+	else
+	{
+		ReadPlanner::clear();
+		Binning::clear();
+		_cache->clear();
+	}
+	Readahead::clear();
+	FSObject::invalidateStats();
+	{
+		std::lock_guard<std::mutex> lock(_missing_mutex);
+		_missing.clear();
+	}
+	if( following() )
+		followFields( *FSTree::current() );
+	if(_change_listener != NULL)
+		_change_listener();
+	if(updated)
+		ErrorLog::log_write("NXFS: NeXus file reopened, %zu objects changed\n", changed.size());
+	else
+		ErrorLog::log_write("NXFS: NeXus file reopened\n");
+	return true;
+}
+
+/**
+ * \brief Opens the NeXus file, or the directory of NeXus files (NXGateway::load_directory).
+ * \throw NXFSException if it can't be opened.
+ */
+void Filter::loadNXFile()
+{
+	struct stat path_stat;
+	if( ::stat(_nx_path.c_str(), &path_stat) == 0 && S_ISDIR(path_stat.st_mode) )
+		_nxgate.load_directory( _nx_path.c_str(), following() );
+	else
+		_nxgate.load_file( _nx_path.c_str(), following() );
+}
+
+/**
+ * \brief Follows the extents of fields of tree, see NXGateway::follow.
+ * \param [in] tree : the tree served, or a branch of it built on first access (Filter::expandFile).
+ */
+void Filter::followFields( const FSTree& tree )
+{
+	NXGateway::AccessLock access;
+	for(auto& entry : tree.nxobjects())
+		if( !entry.second.shape.empty() )
+			NXGateway::follow(entry.first);
+}
+
+/**
+ * \brief Grows FSTree with the NeXus file being written.
+ *
+ *	The extents of followed datasets are refreshed (NXGateway::refreshFollowed). If some grew, a copy of the tree served
+ *	gets new slice files and is published, and the contents read from grown fields and their tables are forgotten.
+ *	The writer can't add or remove NeXus objects while SWMR is used, so the rest of the tree stays.
+ *	The NeXus access (NXGateway::lockAccess) is held meanwhile.
+ * \return True if some dataset grew.
+ */
+bool Filter::followNXFile()
+{
+	// the access is taken before the build as by FUSE reads, and held while the grown fields are read
+	NXGateway::AccessLock access;
+	std::map<std::string, shape_t> grown;
+	try
+	{
+		grown = NXGateway::refreshFollowed();
+	}catch (...) {
+		ErrorLog::log_write("The error occurred while refreshing NeXus file (%s)\n", this->_nx_path.c_str() );
+		return false;
+	}
+	if( grown.empty() )
+		return false;
+
+	std::lock_guard<std::mutex> lock(_build_mutex);
+	std::shared_ptr<FSTree> base = FSTree::current();
+	std::shared_ptr<FSTree> tree = base->copy();
+	std::vector<std::string> changed;
+	_nxtree = tree.get();
+	for(auto& object : grown)
+	{
+		NXObjectEntry* entry = _nxtree->findNXObject(object.first);
+		if( entry == NULL )
+			continue;
+		if( object.second.size() != entry->shape.size() || !updateSlices(*entry, object.first, object.second) )
+		{
+			ErrorLog::log_write("NXFS: %s grew, but its files can't follow it until the file is reloaded\n", object.first.c_str());
+			continue;
+		}
+		entry->shape = object.second;
+		changed.push_back(object.first);
+	}
+	_nxtree = NULL;
+	touchObjects( *tree, changed );
+	tree->adoptRules( base.get() );
+	FSTree::publish( tree );
+
+	ReadWorkers::refresh();
+	for(const std::string& nxpath : changed)
+		forgetObject(*tree, nxpath);
+	Readahead::clear();
+	FSObject::invalidateStats();
+	{
+		std::lock_guard<std::mutex> lock(_missing_mutex);
+		_missing.clear();
+	}
+	if(_change_listener != NULL)
+		_change_listener();
+	return true;
+}
+
+/**
+ * \brief Sets the NeXus file to be followed while it is written, it has to be called before Filter is created.
+ * \param [in] interval : milliseconds between refreshes, 0 not to follow the file.
+ */
+void Filter::setFollow( int interval )
+{
+	_follow_interval = (interval > 0) ? interval : 0;
+}
+
+/**
+ * \brief Tells whether the NeXus file is followed while it is written.
+ */
+bool Filter::following()
+{
+	return _follow_interval > 0;
+}
+
+/**
+ * \brief Sets the function called after NeXus objects grew or the file was reloaded, e.g. to wake pollers.
+ * \param [in] listener : function called by the reloading thread, NULL for none.
+ */
+void Filter::setChangeListener( void (*listener)() )
+{
+	_change_listener = listener;
+}
+
+/**
+ * \brief Gets the version of file/folder specified by path, it changes when its NeXus object grows.
+ *
+ * \param [in] path : fullpath of FSObject.
+ * \return Version of NeXus object the FSObject is made of, 0 if there is no such FSObject.
+ */
+unsigned long Filter::version( const char* path )
+{
+	std::shared_ptr<FSTree> tree = treeFor(path, false);
+	FSObject scratch;
+	FSObject* fsobj = tryFsobjectAt( *tree, path, scratch );
+	if( fsobj == NULL )
+		return 0;
+	NXObjectEntry* entry = tree->findNXObject( fsobj->getNXObjectPath() );
+	return (entry != NULL) ? entry->version : 0;
+}
+
+/**
+ * \brief Starts the thread reloading the NeXus file on request.
+ *
+ *	It has to be called when FUSE runs, i.e. after it has daemonized. Besides Filter::requestReload,
+ *	a reload is requested by SIGUSR1.
+ */
+void Filter::startReloader()
+{
+	sem_init(&_reload_requests, 0, 0);
+	std::thread( [this]() { reloadLoop(); } ).detach();
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = reloadSignal;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &action, NULL);
+}
+
+/**
+ * \brief Requests to reload the NeXus file, it is done in background by Filter::reloadLoop.
+ *
+ *	It doesn't block, and is safe to call from a signal handler.
+ */
+void Filter::requestReload()
+{
+	sem_post(&_reload_requests);
+}
+
+/**
+ * \brief Signal handler requesting a reload.
+ * \param [in] signum : signal number.
+ */
+void Filter::reloadSignal(int signum)
+{
+	requestReload();
+}
+
+/**
+ * \brief Reloads the NeXus file whenever it is requested, runs in its own thread.
+ *
+ *	Requests made while a reload is running are served by one more reload. If the file is followed, it is refreshed
+ *	(Filter::followNXFile) when no reload was requested for Filter#_follow_interval, so the trees are built by one thread.
+ */
+void Filter::reloadLoop()
+{
+	if( following() )
+		followFields( *FSTree::current() );
+
+	for(;;)
+	{
+		if( !following() )
+		{
+			if( sem_wait(&_reload_requests) != 0 )
+				continue;
+		}
+		else
+		{
+			// the file being written is refreshed between the requests
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += _follow_interval / 1000;
+			deadline.tv_nsec += (_follow_interval % 1000) * 1000000L;
+			if(deadline.tv_nsec >= 1000000000L)
+			{
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+			if( sem_timedwait(&_reload_requests, &deadline) != 0 )
+			{
+				if(errno == ETIMEDOUT)
+					followNXFile();
+				continue;
+			}
+		}
+		while( sem_trywait(&_reload_requests) == 0 )
+			;
+		reopenNXFile();
 	}
 }
@@ -27,11 +27,18 @@
 #include <pni/utils/Types.hpp>
 #include <pni/nx/NX.hpp>
 #include <errno.h>
+#include <set>
+#include <mutex>
+#include <memory>
+#include <semaphore.h>
 #include "FSTree.h"
 #include "XMLFile.h"
 #include "enums.h"
 #include "ImageRule.h"
 #include "TableRule.h"
+#include "StackRule.h"
+#include "ConcatRule.h"
+#include "ZarrRule.h"
 #include "NXGateway.h"
 #include "NXFSCache.h"
 #include "../config.h"
@@ -39,42 +46,79 @@
 namespace pninx=pni::nx::h5;
 
 /**
- *	It manages the other components, such as FSTree (Filter#_nxtree), XMLFile (Filter#_xmlfile), NXGateway (Filter#_nxgate), NXFSCache (Filter#_cache).
+ *	It manages the other components, such as FSTree (FSTree::current()), XMLFile (Filter#_xmlfile), NXGateway (Filter#_nxgate), NXFSCache (Filter#_cache).
  */
 class Filter {
 private:
-	static FSTree _nxtree;
+	FSTree* _nxtree; /*!< The tree being built by Filter::createTree. */
 	static XMLFile _xmlfile;
 	static NXGateway _nxgate;
 	static NXFSCache* _cache;
+	static std::set<std::string> _missing; /*!< Paths looked up and not found, FSTree doesn't change until NeXus file is reopened. */
+	static std::mutex _missing_mutex; /*!< Guards Filter#_missing. */
+	static sem_t _reload_requests; /*!< Posted to reload the NeXus file, see Filter::requestReload. */
+	static int _follow_interval; /*!< Milliseconds between refreshes of NeXus file being written, 0 if it is not followed. */
+	static void (*_change_listener)(); /*!< Called when NeXus objects grew, see Filter::setChangeListener. */
+	static std::mutex _build_mutex; /*!< Held while a new FSTree is built from the one served, so that one tree is built at a time. */
 
 	void addRootGroup( pninx::NXGroup& nxgroup );
 	void addGroup( pninx::NXGroup nxgroup, FSObject& fsparent );
+	bool addObject( pninx::NXObject& nxobject, FSObject& fsparent );
+	bool updateTree( std::vector<std::string>& changed );
+	bool checkPlacement( pninx::NXObject& nxobject, const std::string& nxpath, const std::string& folder );
+	bool updateSlices( const NXObjectEntry& entry, const std::string& nxpath, const shape_t& shape );
+	bool updateZarrFiles( FSObject& folder, const std::string& nxpath, const shape_t& shape );
+	static void forgetObject( FSTree& tree, const std::string& nxpath );
+	static void touchObjects( FSTree& tree, const std::vector<std::string>& changed );
+	void followFields( const FSTree& tree );
+	bool followNXFile();
+	void loadNXFile();
+	void expandFile( const std::string& folder );
+	void addConcat( std::map<std::string, std::string> options, FSObject& fsfolder );
+	std::shared_ptr<FSTree> treeFor( const char* path, bool contents );
 
 	Rule* createHardcodedBehavior( pninx::NXObject &nxobject );
 	void tryCreateDefaultBehavior( Rule* &behaviour, pninx::NXObject &nxobject );
 	void tryCreateSpecificBehavior(Rule* &behaviour, pninx::NXObject& nxobject, FSObject& fsobj);
-	void createBehavior( FSObject &fsobj, pninx::NXObject &nxobject );
+	std::string createBehavior( FSObject &fsobj, pninx::NXObject &nxobject );
 	void createSubFiles(Rule* behaviour, pninx::NXObject& nxobj,  FSObject& parent);
+	bool createZarrFiles(pninx::NXObject& nxobj, FSObject& parent);
+	static bool zarrStorage(pninx::NXObject& nxobj, const std::string& nxpath, ChunkStorage& storage);
 
-	static FSObject& fsobjectAt( const char* path );
+	static FSObject* fsobjectAt( FSTree& tree, const char* path, FSObject& scratch );
+	static FSObject* tryFsobjectAt( FSTree& tree, const char* path, FSObject& scratch );
+	static void reloadSignal(int signum);
+	void reloadLoop();
 
-	std::string _xml_path; /*!< Stores the NeXus file path. */
-	std::string _nx_path; /*!< Stores the XML file path. */
+	std::string _xml_path; /*!< Stores the XML file path. */
+	std::string _nx_path; /*!< Stores the NeXus file path, or the path of directory of NeXus files. */
+	std::map<std::string, std::map<std::string, std::string>> _concats; /*!< Options of fields concatenated through files of directory, by full path of their folders. Guarded by Filter#_build_mutex once FUSE runs. */
 public:
 	void createTree();
 	Filter( );
 	Filter( const char* nxfile_path, const char* xmlfile_path );
 	virtual ~Filter( );
 
-	void reopenNXFile();
+	bool reopenNXFile();
+	void startReloader();
+	static void requestReload();
 	static void usage();
 
+	static void setFollow( int interval );
+	static bool following();
+	static void setChangeListener( void (*listener)() );
+	unsigned long version( const char* path );
+
+	static const size_t MAX_MISSING; /*!< Number of missing paths remembered. */
+	static const int NEGATIVE_TIMEOUT; /*!< Seconds the kernel remembers missing paths, passed to FUSE as negative_timeout. */
+	static const int DEFAULT_FOLLOW_INTERVAL; /*!< Milliseconds between refreshes of NeXus file being written, unless given with --follow. */
+
 	//FUSE functions
-	static FSType getattr( const char* path );
-	static std::string read( const char* path );
-	static std::vector<std::string> readdir( const char* path );
-	static size_t size( const char* path );
+	FSType getattr( const char* path );
+	FileContent read( const char* path, size_t size, off_t offset );
+	std::vector<std::string> readdir( const char* path );
+	size_t size( const char* path );
+	int stat( const char* path, struct stat& output );
 };
 
 /**
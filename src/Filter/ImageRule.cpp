@@ -22,6 +22,8 @@
 
 #include "ImageRule.h"
 #include "enums.h"
+#include "../ErrorLog.h"
+#include <algorithm>
 
 //std::map<std::string, char> ImageRule::photometric_values;
 
@@ -80,64 +82,64 @@ ImageRule::~ImageRule() {
  *	To get data from \a nxfield we need to know the type of data stored. But we have only TypeID of data type. \n
  *	So this function calls readNXFieldImageRule<T>(pninx::NXField&) with right template parameter.
  */
-std::string ImageRule::readNXFieldUInt8 (pninx::NXField& nxfield)
+FileContent ImageRule::readNXFieldUInt8 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count)
 {
-	return readNXFieldImageRule<UInt8>(nxfield);
+	return readNXFieldImageRule<UInt8>(nxfield, slice, first_row, row_count);
 }
 
-std::string ImageRule::readNXFieldUInt16 (pninx::NXField& nxfield)
+FileContent ImageRule::readNXFieldUInt16 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count)
 {
-	return readNXFieldImageRule<UInt16>(nxfield);
+	return readNXFieldImageRule<UInt16>(nxfield, slice, first_row, row_count);
 }
 
-std::string ImageRule::readNXFieldUInt32 (pninx::NXField& nxfield)
+FileContent ImageRule::readNXFieldUInt32 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count)
 {
-	return readNXFieldImageRule<UInt32>(nxfield);
+	return readNXFieldImageRule<UInt32>(nxfield, slice, first_row, row_count);
 }
 
-std::string ImageRule::readNXFieldInt8 (pninx::NXField& nxfield)
+FileContent ImageRule::readNXFieldInt8 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count)
 {
-	return readNXFieldImageRule<Int8>(nxfield);
+	return readNXFieldImageRule<Int8>(nxfield, slice, first_row, row_count);
 }
 
-std::string ImageRule::readNXFieldInt16 (pninx::NXField& nxfield)
+FileContent ImageRule::readNXFieldInt16 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count)
 {
-	return readNXFieldImageRule<Int16>(nxfield);
+	return readNXFieldImageRule<Int16>(nxfield, slice, first_row, row_count);
 }
 
-std::string ImageRule::readNXFieldInt32 (pninx::NXField& nxfield)
+FileContent ImageRule::readNXFieldInt32 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count)
 {
-	return readNXFieldImageRule<Int32>(nxfield);
+	return readNXFieldImageRule<Int32>(nxfield, slice, first_row, row_count);
 }
 
-std::string ImageRule::readNXFieldFloat32 (pninx::NXField& nxfield)
+FileContent ImageRule::readNXFieldFloat32 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count)
 {
-	return readNXFieldImageRule<Float32>(nxfield);
+	return readNXFieldImageRule<Float32>(nxfield, slice, first_row, row_count);
 }
 
-std::string ImageRule::readNXFieldFloat64 (pninx::NXField& nxfield)
+FileContent ImageRule::readNXFieldFloat64 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count)
 {
-	return readNXFieldImageRule<Float64>(nxfield);
+	return readNXFieldImageRule<Float64>(nxfield, slice, first_row, row_count);
 }
 
-std::string ImageRule::readNXFieldFloat128 (pninx::NXField& nxfield)
+FileContent ImageRule::readNXFieldFloat128 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count)
 {
-	return readNXFieldImageRule<Float128>(nxfield);
+	return readNXFieldImageRule<Float128>(nxfield, slice, first_row, row_count);
 }
 
-std::string ImageRule::readNXFieldComplex32 (pninx::NXField& nxfield)
+FileContent ImageRule::readNXFieldComplex32 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count)
 {
-	return readNXFieldImageRule<Complex32>(nxfield);
+	return readNXFieldImageRule<Complex32>(nxfield, slice, first_row, row_count);
 }
 
-std::string ImageRule::readNXFieldComplex64 (pninx::NXField& nxfield)
+FileContent ImageRule::readNXFieldComplex64 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count)
 {
-	return readNXFieldImageRule<Complex64>(nxfield);
+	return readNXFieldImageRule<Complex64>(nxfield, slice, first_row, row_count);
 }
 
-std::string ImageRule::readNXFieldComplex128 (pninx::NXField& nxfield)
+FileContent ImageRule::readNXFieldComplex128 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count)
 {
-	return readNXFieldImageRule<Complex128>(nxfield);
+	return readNXFieldImageRule<Complex128>(nxfield, slice, first_row, row_count);
 }
 ///@}
 
@@ -151,60 +153,415 @@ std::string ImageRule::readNXFieldComplex128 (pninx::NXField& nxfield)
  */
 std::string ImageRule::read(pninx::NXObject &nxobject)
 {
-	std::string output;
+	// the path within the file is the full path of object of single NeXus file
+	return readContent(nxobject, SliceRef(nxobject.path())).str();
+}
 
-	if(nxobject.object_type() == pni::nx::NXObjectType::NXFIELD)
+/**
+ *	\brief Reads the data from NeXus objects and returns the representation of this data.
+ *	\param [in] nxobject : the NeXus object to be represented.
+ *	\param [in] slice : slice of \a nxobject represented by file.
+ *	\return A representation that is ready to stored as a file.
+ *
+ *	Uncompressed TIFF is returned as a shared header template followed by the pixel data as it was read,
+ *	compressed and palette TIFFs are written into memory by TIFFProvider::EncodeTIFF.
+ */
+FileContent ImageRule::readContent(pninx::NXObject &nxobject, const SliceRef& slice)
+{
+	FileContent output;
+
+	if(nxobject.object_type() != pni::nx::NXObjectType::NXFIELD)
+		throw new NXFSException("ImageRule: nxobject is not a NXFIELD");
+
+	pninx::NXField nxfield = (pninx::NXField) nxobject;
+	if( imageRuleReadField.find( nxfield.type_id() ) == imageRuleReadField.end() )
 	{
-		auto readField_iterator = imageRuleReadField.find( ( (pninx::NXField) nxobject ).type_id() );
-		if(readField_iterator != imageRuleReadField.end() )
-		{
-			getImageRuleContent_t read_func = readField_iterator->second;
-			pninx::NXField nxfield = (pninx::NXField) nxobject;
-			output = (this->*read_func)( nxfield );
-		}else
-			output = "An error occurred, see log file \n";//todo log error
+		output.append( "An error occurred, see log file \n" );//todo log error
+		return output;
 	}
-	else
+
+	PixelFormat format;
+	TIFFLayout layout = tiffLayout(NXGateway::metadata(slice.nxpath), slice, format);
+	FileContent pixels = readRows(nxfield, slice, 0, layout.height);
+
+	if( !TIFFProvider::isNativeLayout(layout.photometric) || layout.compression != COMPRESSION_NONE )
 	{
-		throw new NXFSException("ImageRule: nxobject is not a NXFIELD");
+		std::string joined;
+		const char* data = NULL;
+		if(pixels.segments().size() == 1)
+			data = pixels.segments()[0].data;
+		else
+		{
+			joined = pixels.str();
+			data = joined.data();
+		}
+		output.append( TIFFProvider::EncodeTIFF( data, pixels.size(), layout ) );
+		return output;
 	}
 
+	auto header = TIFFProvider::HeaderTemplate(layout);
+	output.append( header, header->data(), header->length() );
+	for(const ContentSegment& segment : pixels.range(layout.data_size, 0).segments())
+		output.append( segment.owner, segment.data, segment.length );
+	if(pixels.size() < layout.data_size)
+		output.append( std::string( layout.data_size - pixels.size(), '\0' ) );
 	return output;
 }
 
+/**
+ *	\brief Reads a part of TIFF representation, only image rows that fall into the part are read from NeXus file.
+ *	\param [in] nxobject : the NeXus object to be represented.
+ *	\param [in] slice : slice of \a nxobject represented by file.
+ *	\param [in] size : maximum number of bytes.
+ *	\param [in] offset : offset from the file begin.
+ *	\param [out] output : the requested part of TIFF.
+ *	\return False if the whole slice is needed to write any part of TIFF: it is compressed, has a color map,
+ *	or its window is computed from all pixels.
+ *
+ *	Uncompressed strips follow the header one after another, so the offset of each row is known in advance.
+ */
+bool ImageRule::readRange(pninx::NXObject &nxobject, const SliceRef& slice, size_t size, off_t offset, FileContent& output)
+{
+	if(nxobject.object_type() != pni::nx::NXObjectType::NXFIELD)
+		return false;
+
+	pninx::NXField nxfield = (pninx::NXField) nxobject;
+	TypeID type = nxfield.type_id();
+	if( imageRuleReadField.find(type) == imageRuleReadField.end()
+			|| type == TypeID::COMPLEX32 || type == TypeID::COMPLEX64 || type == TypeID::COMPLEX128 )
+		return false;
+
+	PixelFormat format;
+	TIFFLayout layout = tiffLayout(NXGateway::metadata(slice.nxpath), slice, format);
+	if( !TIFFProvider::isNativeLayout(layout.photometric) || layout.compression != COMPRESSION_NONE
+			|| layout.samples != 1 || format.window_auto )
+		return false;
+
+	size_t begin = offset;
+	size_t end = begin + size;
+	if(end > layout.size())
+		end = layout.size();
+	if(begin >= end)
+		return true;
+
+	if(begin < layout.header_size)
+	{
+		auto header = TIFFProvider::HeaderTemplate(layout);
+		size_t header_end = (end < layout.header_size) ? end : layout.header_size;
+		output.append( header, header->data() + begin, header_end - begin );
+	}
+
+	if(end > layout.header_size)
+	{
+		size_t data_begin = ( (begin > layout.header_size) ? begin : layout.header_size ) - layout.header_size;
+		size_t data_end = end - layout.header_size;
+		size_t row_bytes = layout.rowBytes();
+		size_t first_row = data_begin / row_bytes;
+		size_t last_row = (data_end + row_bytes - 1) / row_bytes;
+
+		FileContent rows = readRows(nxfield, slice, first_row, last_row - first_row);
+		FileContent part = rows.range(data_end - data_begin, data_begin - first_row*row_bytes);
+		for(const ContentSegment& segment : part.segments())
+			output.append( segment.owner, segment.data, segment.length );
+	}
+
+	return true;
+}
+
+/**
+ *	\brief Gets the pixels of image rows in output format.
+ *	\param [in] nxfield : the NeXus Field that is represented.
+ *	\param [in] slice : slice of NXField, along any axis.
+ *	\param [in] first_row : first row of image to be read.
+ *	\param [in] row_count : number of rows to be read.
+ *	\return The pixels, empty if value type of \a nxfield is not supported.
+ */
+FileContent ImageRule::readRows(pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count)
+{
+	auto readField_iterator = imageRuleReadField.find( nxfield.type_id() );
+	if( readField_iterator == imageRuleReadField.end() )
+		return FileContent();
+
+	getImageRuleContent_t read_func = readField_iterator->second;
+	return (this->*read_func)( nxfield, slice, first_row, row_count );
+}
+
+/**
+ *	\brief Gets image rows of contiguous field as pieces of NeXus file, without HDF5.
+ *	\param [in] nxfield : the NeXus Field that is represented.
+ *	\param [in] slice : full resolution slice of NXField.
+ *	\param [in] first_row : first row of image.
+ *	\param [in] row_count : number of rows.
+ *	\param [in] value_size : size of pixel in bytes.
+ *	\param [out] output : the rows are appended as pieces of file, FUSE reads them from the file itself.
+ *	\return False if the rows have to be read by HDF5, see NXGateway::contiguousStorage.
+ *
+ *	Rows of slice along the first axis are one piece, rows of slice along the second axis are one piece each.
+ *	Pixels of slice along the last axis don't lie next to each other, such slice is read by HDF5.
+ */
+bool ImageRule::readDirect(pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count, size_t value_size, FileContent& output)
+{
+	size_t row_axis, col_axis;
+	ReadPlanner::imageAxes(slice.axis, row_axis, col_axis);
+	if(col_axis != 2)
+		return false;
+
+	ContiguousStorage storage;
+	if( !NXGateway::contiguousStorage( slice.nxpath, storage )
+			|| storage.dims.size() != 3 || storage.value_bytes != value_size )
+		return false;
+	const std::vector<size_t>& dims = storage.dims;
+	if( slice.index >= dims[slice.axis] || first_row + row_count > dims[row_axis] )
+		return false;
+
+	Hyperslab rows = ReadPlanner::imageRows(dims, slice.axis, slice.index, first_row, row_count);
+	size_t row_bytes = dims[2]*value_size;
+	size_t row_stride = (row_axis == 0) ? dims[1]*row_bytes : row_bytes;
+	off_t first = storage.offset + (rows.start[0]*dims[1] + rows.start[1])*row_bytes;
+	if(row_stride == row_bytes)
+		output.appendFile( storage.file, storage.file->fd, first, row_count*row_bytes );
+	else
+		for(size_t row=0; row<row_count; row++)
+			output.appendFile( storage.file, storage.file->fd, first + row*row_stride, row_bytes );
+	return true;
+}
+
 /*std::vector<std::string> ImageRule::readdir(pninx::NXObject &nxobject)
 {
 	std::vector<std::string> output;
 	return output;
 }*/
 
+/**
+ *	\brief Gets the options how the TIFF file should be displayed.
+ *	\param [out] bit : bits per sample, 32 if not set or less than 8.
+ *	\param [out] colormetric : TIFF photometric value, PHOTOMETRIC_MINISBLACK if not set or unknown.
+ */
+void ImageRule::readImageOptions(uint& bit, char& colormetric)
+{
+	bit = 32;
+	colormetric = PHOTOMETRIC_MINISBLACK;
+
+	auto bit_it = this->options.find("bit");
+	if( bit_it != this->options.end() )
+	{
+		std::istringstream(bit_it->second.c_str()) >> bit;
+		if(bit < 8)
+		{
+			bit = 32;
+			/*ErrorLog::log_xml_error_msg("Amount of bits cannot be less than 8. The default value 32 bits will be set up.",
+					"unknown", nxfield.path().c_str());*/
+		}
+	}
+
+	auto photo_option_it = this->options.find("colormetric");
+	if( photo_option_it != this->options.end() )
+	{
+		auto photo_it = photometric_values.find(photo_option_it->second);
+		if( photo_it != photometric_values.end() )
+			colormetric = photo_it->second;
+	}//todo: log else case
+}
+
+/**
+ *	\brief Gets the options how the TIFF strips should be written.
+ *	\param [out] compression : TIFF compression from "compression" option (deflate, zip, lzw, zstd or none),
+ *	COMPRESSION_NONE if not set, unknown or not supported by libtiff.
+ *	\param [out] rows_per_strip : rows in each strip from "rows_per_strip" option, 0 if not set to let TIFFProvider::Layout decide.
+ */
+void ImageRule::readStripOptions(uint16_t& compression, uint32_t& rows_per_strip)
+{
+	static const std::map<std::string, uint16_t> compression_values({
+		 {"none", COMPRESSION_NONE},
+		 {"deflate", COMPRESSION_ADOBE_DEFLATE},
+		 {"zip", COMPRESSION_ADOBE_DEFLATE},
+		 {"lzw", COMPRESSION_LZW},
+#ifdef COMPRESSION_ZSTD
+		 {"zstd", COMPRESSION_ZSTD},
+#endif
+		});
+
+	compression = COMPRESSION_NONE;
+	rows_per_strip = 0;
+
+	auto compression_it = this->options.find("compression");
+	if( compression_it != this->options.end() )
+	{
+		std::string name = compression_it->second;
+		std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+		auto value_it = compression_values.find(name);
+		if( value_it != compression_values.end() && TIFFProvider::isCompressionSupported(value_it->second) )
+			compression = value_it->second;
+		else
+			ErrorLog::log_write("ImageRule: compression \"%s\" is not supported, TIFFs are not compressed.\n",
+					compression_it->second.c_str());
+	}
+
+	auto rows_it = this->options.find("rows_per_strip");
+	if( rows_it != this->options.end() )
+		rows_per_strip = atoi( rows_it->second.c_str() );
+}
+
+/**
+ *	\brief Decides how the pixels of NeXus field are written into TIFF.
+ *	\param [in] type : value type of NeXus field.
+ *	\param [in] bit : bits per sample requested in ImageRule#options.
+ *	\param [in] colormetric : TIFF photometric value.
+ *	\return Output format.
+ *
+ *	8 and 16 bits are written as unsigned integers, 32 and 64 bits keep the kind of value (floating point, signed or unsigned).\n
+ *	The window is taken from "window_min" and "window_max" options. If there is "window_clip" option (percent of
+ *	values clipped at each end), or floating point values are written as integers, the window is computed from each slice.\n
+ *	Without window integer values are saturated. Values are written as they are read if nothing has to be changed.
+ */
+PixelFormat ImageRule::pixelFormat(TypeID type, uint bit, char colormetric)
+{
+	size_t type_bits = 0;
+	bool is_float = false;
+	bool is_signed = false;
+	switch(type)
+	{
+	case TypeID::UINT8: type_bits = 8; break;
+	case TypeID::INT8: type_bits = 8; is_signed = true; break;
+	case TypeID::UINT16: type_bits = 16; break;
+	case TypeID::INT16: type_bits = 16; is_signed = true; break;
+	case TypeID::UINT32: type_bits = 32; break;
+	case TypeID::INT32: type_bits = 32; is_signed = true; break;
+	case TypeID::FLOAT32: type_bits = 32; is_float = true; break;
+	case TypeID::FLOAT64: type_bits = 64; is_float = true; break;
+	case TypeID::FLOAT128: type_bits = 8*sizeof(Float128); is_float = true; break;
+	default: break;
+	}
+
+	PixelFormat format;
+	format.bit = bit;
+	format.sampleformat = SAMPLEFORMAT_UINT;
+	format.passthrough = true;
+	format.window = false;
+	format.window_auto = false;
+	format.window_min = 0;
+	format.window_max = 0;
+	format.clip = 0;
+
+	// complex values and RGB triples are written as they are
+	if(type_bits == 0 || colormetric == PHOTOMETRIC_RGB)
+		return format;
+
+	if(bit != 8 && bit != 16 && bit != 32 && !(bit == 64 && is_float))
+		format.bit = 32;
+	if(format.bit >= 32)
+	{
+		if(is_float)
+			format.sampleformat = SAMPLEFORMAT_IEEEFP;
+		else if(is_signed)
+			format.sampleformat = SAMPLEFORMAT_INT;
+	}
+
+	auto min_it = this->options.find("window_min");
+	auto max_it = this->options.find("window_max");
+	auto clip_it = this->options.find("window_clip");
+	if( min_it != this->options.end() && max_it != this->options.end() )
+	{
+		format.window = true;
+		std::istringstream(min_it->second) >> format.window_min;
+		std::istringstream(max_it->second) >> format.window_max;
+	}
+	else if( clip_it != this->options.end() )
+	{
+		format.window_auto = true;
+		std::istringstream(clip_it->second) >> format.clip;
+	}
+	else if( is_float && format.sampleformat != SAMPLEFORMAT_IEEEFP )
+		format.window_auto = true;
+
+	bool same_kind = (format.sampleformat == SAMPLEFORMAT_IEEEFP) ? is_float
+			: ( !is_float && ( is_signed == (format.sampleformat == SAMPLEFORMAT_INT) ) );
+	format.passthrough = !format.window && !format.window_auto && type_bits == format.bit && same_kind;
+
+	return format;
+}
+
 /**
  *	\brief Gets size.
  *	\param [in] nxobject : NeXus object to get size from.
  *	\return Size of representaion of \a nxobject.
  *
+ *	The size is exact for uncompressed TIFFs written natively by TIFFProvider::EncodeTIFF.
+ *	For compressed TIFFs it is an upper bound (TIFFLayout::maxDataSize), the exact one is known after the file was read (see NXFSCache::size).
  */
 size_t ImageRule::size(pninx::NXObject &nxobject)
 {
-	shape_t volume = ( (pninx::NXField) nxobject ).shape<shape_t>();
-	uint8_t bit = 32;
-	auto bit_it = this->options.find("bit");
-	if( bit_it != this->options.end() )
-	{
-		std::istringstream( bit_it->second.c_str() ) >> bit;
-	}
-	size_t multiplier = bit/8;
-	size_t sz = volume[1]*volume[2]*multiplier + 186;//magic number, about 186 bytes is "system" TIFF information
+	// the path within the file is the full path of object of single NeXus file
+	return size(nxobject, SliceRef(nxobject.path()));
+}
+
+/**
+ *	\brief Gets size.
+ *	\param [in] nxobject : NeXus object to get size from.
+ *	\param [in] slice : slice of \a nxobject represented by file, the axis of slice decides the size of image.
+ *	\return Size of representaion of \a slice.
+ */
+size_t ImageRule::size(pninx::NXObject &nxobject, const SliceRef& slice)
+{
+	size_t output = 0;
+	sizeFromMetadata(NXGateway::metadata(slice.nxpath), slice, output);
+	return output;
+}
+
+/**
+ *	\brief Gets size without opening NeXus field, see Rule::sizeFromMetadata.
+ *	\param [in] metadata : metadata of NeXus field.
+ *	\param [in] slice : slice of field represented by file.
+ *	\param [out] size : size of representation of \a slice.
+ *	\return Always true, TIFF layout depends on the shape and type of field only.
+ */
+bool ImageRule::sizeFromMetadata(const NXMetadata& metadata, const SliceRef& slice, size_t& size)
+{
+	PixelFormat format;
+	TIFFLayout layout = tiffLayout(metadata, slice, format);
+	if( TIFFProvider::isNativeLayout(layout.photometric) && layout.compression == COMPRESSION_NONE )
+		size = layout.size();
+	else if( TIFFProvider::isNativeLayout(layout.photometric) )
+		// compressed strips are written by libtiff, the tags it adds fit in the 186 bytes as below
+		size = layout.header_size + layout.maxDataSize() + 186;
+	else
+		//libtiff adds the color map, about 186 bytes is "system" TIFF information
+		size = layout.maxDataSize() + 3*2*(1 << layout.bit) + 186;
+	return true;
+}
+
+/**
+ *	\brief Gets the layout of TIFF that represents a slice of NeXus field.
+ *	\param [in] metadata : metadata of the NeXus Field that is represented.
+ *	\param [in] slice : slice of NXField, its axis decides which dimensions are the rows and columns of image.
+ *	\param [out] format : output format of pixels.
+ *	\return Layout in accordance with ImageRule#options. Of the two dimensions left by the slice the first one
+ *	is the height of image, the other one is the width. Both are divided by the binning factor of \a slice.
+ */
+TIFFLayout ImageRule::tiffLayout(const NXMetadata& metadata, const SliceRef& slice, PixelFormat& format)
+{
+	const shape_t& volume = metadata.shape;
+	uint bit;
+	char colormetric;
+	readImageOptions(bit, colormetric);
+	format = pixelFormat( metadata.type_id, bit, colormetric );
+
+	uint16_t compression;
+	uint32_t rows_per_strip;
+	readStripOptions(compression, rows_per_strip);
 
-	return sz;
+	size_t row_axis, col_axis;
+	ReadPlanner::imageAxes(slice.axis, row_axis, col_axis);
+	return TIFFProvider::Layout(Binning::binnedSize(volume[col_axis], slice.bin), Binning::binnedSize(volume[row_axis], slice.bin),
+			format.bit, colormetric, format.sampleformat, compression, rows_per_strip);
 }
 
 /**
  *	\brief Gets filesystem type of representation.
- *	\param [in] nxobject : NeXus object to get type from.
- *	\return FSType of representaion of \a nxobject.
+ *	\param [in] metadata : metadata of NeXus object to get type from.
+ *	\return FSType of representaion of NeXus object.
  */
-FSType ImageRule::getattr(pninx::NXObject &nxobject)
+FSType ImageRule::getattr(const NXMetadata& metadata)
 {
 	return FSType::FILE;
 }
@@ -29,10 +29,18 @@
 #include "Rule.h"
 #include "enums.h"
 #include "TIFFProvider.h"
+#include "FileContent.h"
+#include "PixelConverter.h"
 #include "NXFSException.h"
 #include "NXGateway.h"
+#include "ReadPlanner.h"
+#include "Binning.h"
+#include "ReadWorkers.h"
+#include "ChunkReader.h"
 #include <pni/nx/NX.hpp>
 #include <pni/utils/Types.hpp>
+#include <type_traits>
+#include <algorithm>
 
 /**
  *	Class handles the representation of the NeXus data and creates TIFFs from it.
@@ -42,7 +50,7 @@ private:
 	/**
 	 *	Typedef pointer to function to store functions in a map.
 	 */
-	typedef std::string (ImageRule::*getImageRuleContent_t) (pninx::NXField& nxfield);
+	typedef FileContent (ImageRule::*getImageRuleContent_t) (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count);
 
 	const std::map<std::string, char> photometric_values; /*!< list of supported photometric values from XML file. Key is an expected value from XML file, and value is correct value that will be written in TIFF tags. */
 	/**
@@ -52,83 +60,268 @@ private:
 
 
 	/**
-	 * 	\brief Gets the TIFF representation of NXField.
+	 * 	\brief Gets the pixels of image rows stored in NXField.
 	 *	\param [in] nxfield : the NeXus Field that has to be represented as a TIFF file.
-	 *	\return The content of file that can be stored as a TIFF.
+	 *	\param [in] slice : slice of NXField, along any axis, possibly binned.
+	 *	\param [in] first_row : first row of image to be read.
+	 *	\param [in] row_count : number of rows to be read.
+	 *	\return The pixels of rows as they are written in TIFF strips.
 	 *
 	 *	The template function which cause such a non readable solution with map of functions.\n
-	 *	It gets the NeXus Field data in accordance with type that passed as a template parameter.
-	 *	Then it gets options how the TIFF file should be displayed (bit, photometric...).
-	 *	And writes the TIFF file into memory.
+	 *	It gets the rows of slice from NeXus Field in accordance with type that passed as a template parameter,
+	 *	rows of binned slice are taken from the binned image (see ImageRule::binnedImage).\n
+	 *	Then it converts them into the output format (see ImageRule::pixelFormat), pixels that need no conversion are returned as they were read.
+	 *	Such pixels of contiguous field are not read at all, they are given as pieces of NeXus file (see ImageRule::readDirect).
 	 */
 	template<typename T>
-	std::string readNXFieldImageRule (pninx::NXField& nxfield)
+	FileContent readNXFieldImageRule (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count)
 	{
-		int bit = 32;
-		int colormetric = PHOTOMETRIC_MINISBLACK;
-		uint part_num = 0;
+		uint bit;
+		char colormetric;
+		readImageOptions(bit, colormetric);
+		PixelFormat format = pixelFormat(nxfield.type_id(), bit, colormetric);
 
-		auto bit_it = this->options.find("bit");
-		if( bit_it != this->options.end() )
+		FileContent output;
+		if( format.passthrough && slice.bin <= 1 && readDirect(nxfield, slice, first_row, row_count, sizeof(T), output) )
+			return output;
+
+		const T* values = NULL;
+		std::shared_ptr<const void> pixels_owner;
+		size_t n = 0;
+		if(slice.bin > 1)
+		{
+			std::shared_ptr<const std::vector<T>> image = binnedImage<T>( nxfield, slice,
+					std::integral_constant<bool, std::is_arithmetic<T>::value>() );
+			if(!image)
+				return FileContent();
+
+			size_t row_axis, col_axis;
+			ReadPlanner::imageAxes(slice.axis, row_axis, col_axis);
+			size_t width = Binning::binnedSize( nxfield.shape<shape_t>()[col_axis], slice.bin );
+			values = image->data() + first_row*width;
+			n = row_count*width;
+			pixels_owner = image;
+		}
+		else
+			readPixels<T>(nxfield, slice, first_row, row_count, values, pixels_owner, n);
+
+		if( format.passthrough )
 		{
-			std::istringstream(bit_it->second.c_str()) >> bit;
-			if(bit < 8)
+			output.append( pixels_owner, reinterpret_cast<const char*>( values ), n*sizeof(T) );
+			return output;
+		}
+
+		auto converted = std::make_shared<std::string>( n*(format.bit/8), '\0' );
+		convertPixels<T>( values, n, &(*converted)[0], format,
+				std::integral_constant<bool, std::is_arithmetic<T>::value>() );
+		output.append( converted, converted->data(), converted->length() );
+		return output;
+	}
+
+	/**
+	 *	\brief Reads image rows of full resolution slice.
+	 *	\param [in] nxfield : the NeXus Field that is represented.
+	 *	\param [in] slice : slice of NXField, along any axis.
+	 *	\param [in] first_row : first row of image to be read.
+	 *	\param [in] row_count : number of rows to be read.
+	 *	\param [out] values : pixels of rows, one row after another.
+	 *	\param [out] owner : keeps \a values alive.
+	 *	\param [out] n : number of pixels.
+	 *
+	 *	Rows are read in bands of HDF5 chunk rows (see ReadPlanner::bands), rows of several bands are copied together.
+	 */
+	template<typename T>
+	void readPixels(pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count,
+			const T*& values, std::shared_ptr<const void>& owner, size_t& n)
+	{
+		shape_t shape = nxfield.shape<shape_t>();
+		std::vector<size_t> chunk = NXGateway::chunkShape( slice.nxpath );
+		Hyperslab rows = ReadPlanner::imageRows(shape, slice.axis, slice.index, first_row, row_count);
+		std::vector<Hyperslab> bands = ReadPlanner::bands(chunk, sizeof(T), slice.axis, rows);
+		n = rows.elements();
+
+		if(bands.size() == 1)
+		{
+			readBand<T>(nxfield, slice.nxpath, shape, chunk, slice.axis, rows, values, owner, NULL);
+			return;
+		}
+
+		auto pixels = std::make_shared<std::vector<T>>( n );
+		T* output = pixels->data();
+		for(const Hyperslab& band : bands)
+		{
+			const T* band_values;
+			std::shared_ptr<const void> band_owner;
+			readBand<T>(nxfield, slice.nxpath, shape, chunk, slice.axis, band, band_values, band_owner, output);
+			output += band.elements();
+		}
+		values = pixels->data();
+		owner = pixels;
+	}
+
+	/**
+	 *	\brief Reads image rows of one band of whole chunk rows.
+	 *	\param [in] nxfield : the NeXus Field that is represented.
+	 *	\param [in] nxpath : full path of \a nxfield, see SliceRef.
+	 *	\param [in] shape : shape of \a nxfield.
+	 *	\param [in] chunk : HDF5 chunk shape of \a nxfield.
+	 *	\param [in] axis : axis along which the image is sliced.
+	 *	\param [in] rows : band of image rows, see ReadPlanner::bands.
+	 *	\param [out] values : pixels of rows, one row after another, if \a output is NULL.
+	 *	\param [out] owner : keeps \a values alive.
+	 *	\param [out] output : buffer the pixels are copied into, NULL to get them in \a values.
+	 *
+	 *	ReadPlanner extends the read to a block of whole HDF5 chunks with the neighbouring slices.
+	 *	Such blocks are kept, so that following rows and slices don't decompress the same chunks again.
+	 */
+	template<typename T>
+	void readBand(pninx::NXField& nxfield, const std::string& nxpath, const shape_t& shape, const std::vector<size_t>& chunk, size_t axis,
+			const Hyperslab& rows, const T*& values, std::shared_ptr<const void>& owner, T* output)
+	{
+		Hyperslab slab;
+		std::shared_ptr<const void> block;
+		if( !ReadPlanner::findBlock(nxpath, rows, slab, block) )
+		{
+			slab = ReadPlanner::plan(shape, chunk, sizeof(T), axis, rows);
+			auto data = std::make_shared<DArray<T>>( shape_t{ slab.count[0], slab.count[1], slab.count[2] } );
+			// chunks of the block are read and decompressed concurrently if they can be decoded without HDF5,
+			// otherwise a worker process reads the block if there are any, so that concurrent reads are not serialized by HDF5
+			T* buffer = const_cast<T*>( data->storage().ptr() );
+			unsigned long generation = NXGateway::generation();
+			if( !ChunkReader::read(nxpath, slab.start, slab.count, 3, sizeof(T), buffer)
+					&& !ReadWorkers::read(nxpath, slab.start, slab.count, 3, sizeof(T), buffer) )
+				nxfield( Slice( slab.start[0], slab.start[0] + slab.count[0] ),
+						Slice( slab.start[1], slab.start[1] + slab.count[1] ),
+						Slice( slab.start[2], slab.start[2] + slab.count[2] ) ).read( *data );
+			block = data;
+			// a block of the old file read while the file was reloaded is not kept (see ReadWorkers::read)
+			if( NXGateway::generation() == generation )
 			{
-				bit = 32;
-				/*ErrorLog::log_xml_error_msg("Amount of bits cannot be less than 8. The default value 32 bits will be set up.",
-						"unknown", nxfield.path().c_str());*/
+				NXGateway::recordRead(nxpath, slab.start, slab.count, 3);
+				if( !(slab == rows) )
+					ReadPlanner::storeBlock(nxpath, slab, block, slab.elements()*sizeof(T));
 			}
 		}
 
-		auto photo_option_it = this->options.find("colormetric");
-		if( photo_option_it != this->options.end() )
+		values = static_cast<const DArray<T>*>( block.get() )->storage().ptr();
+		owner = block;
+		if(output != NULL)
+		{
+			if(slab == rows)
+				std::copy( values, values + rows.elements(), output );
+			else
+				ReadPlanner::extract<T>( values, slab, rows, axis, output );
+		}
+		else if( !(slab == rows) )
+		{
+			// rows of image are not contiguous within the block
+			auto pixels = std::make_shared<std::vector<T>>( rows.elements() );
+			ReadPlanner::extract<T>( values, slab, rows, axis, pixels->data() );
+			values = pixels->data();
+			owner = pixels;
+		}
+	}
+
+	/**
+	 *	\brief Gets the whole binned slice.
+	 *	\param [in] nxfield : the NeXus Field that is represented.
+	 *	\param [in] slice : binned slice, its binning factor is a power of 2.
+	 *	\return Pixels of binned image.
+	 *
+	 *	Each level of pyramid is binned 2x2 from the level above it: bin2 from the full slice, bin4 from bin2 and so on.
+	 *	Binned images are kept by Binning, so a preview of the whole stack reads every slice once.
+	 */
+	template<typename T>
+	std::shared_ptr<const std::vector<T>> binnedImage(pninx::NXField& nxfield, const SliceRef& slice, std::true_type)
+	{
+		const std::string& nxpath = slice.nxpath;
+		std::shared_ptr<const void> kept;
+		if( Binning::find(nxpath, slice.axis, slice.index, slice.bin, kept) )
+			return std::static_pointer_cast<const std::vector<T>>(kept);
+
+		shape_t shape = nxfield.shape<shape_t>();
+		size_t row_axis, col_axis;
+		ReadPlanner::imageAxes(slice.axis, row_axis, col_axis);
+
+		SliceRef upper = slice;
+		upper.bin = slice.bin / 2;
+		size_t width = Binning::binnedSize(shape[col_axis], upper.bin);
+		size_t height = Binning::binnedSize(shape[row_axis], upper.bin);
+
+		const T* values = NULL;
+		std::shared_ptr<const void> owner;
+		if(upper.bin > 1)
 		{
-			auto photo_it = photometric_values.find(photo_option_it->second);
-			if( photo_it != photometric_values.end() )
-				colormetric = photo_it->second;
-		}//todo: log else case
-
-		auto part_num_it = this->options.find("part_number");
-		if( part_num_it != this->options.end() )
-			part_num = atoi( part_num_it->second.c_str() );
-		//todo substitute with ostringstream
-		//convert str to int
-		/*else
-			int a =6;//todo: write error in log file*/
-
-		// getting the file content from nexus field
-		size_t width = nxfield.shape<shape_t>()[1];
-		size_t height = nxfield.shape<shape_t>()[2];
-
-		DArray<T> data( shape_t{ width, height } );
-		nxfield( part_num ,Slice( 0, width ), Slice( 0, height ) ).read( data );
-
-		// rotate array %)
-		/*T content[width][height];
-			for(size_t i=0;i<width;i++)
-				for(size_t j=0;j<height;j++)
-					content[i][j] = data[j*1024+i];*/
-
-		std::ostringstream outputTIFF;
-
-		TIFF *input = TIFFProvider::StreamOpen("mem_TIFF", &outputTIFF);
-		TIFFProvider::WriteTIFF(input, (void*)( data.storage().ptr() ) , width, height, bit, colormetric);
-
-		return outputTIFF.str();
+			std::shared_ptr<const std::vector<T>> image = binnedImage<T>(nxfield, upper, std::true_type());
+			values = image->data();
+			owner = image;
+		}
+		else
+		{
+			size_t n;
+			readPixels<T>(nxfield, upper, 0, height, values, owner, n);
+		}
+
+		auto binned = std::make_shared<std::vector<T>>( Binning::binnedSize(width, 2)*Binning::binnedSize(height, 2) );
+		Binning::bin2x2<T>( values, width, height, binned->data() );
+		Binning::store(nxpath, slice.axis, slice.index, slice.bin, binned, binned->size()*sizeof(T));
+		return binned;
 	}
 
-	virtual std::string readNXFieldInt8 (pninx::NXField& nxfield);
-	virtual std::string readNXFieldInt16 (pninx::NXField& nxfield);
-	virtual std::string readNXFieldInt32 (pninx::NXField& nxfield);
-	virtual std::string readNXFieldUInt8 (pninx::NXField& nxfield);
-	virtual std::string readNXFieldUInt16 (pninx::NXField& nxfield);
-	virtual std::string readNXFieldUInt32 (pninx::NXField& nxfield);
-	virtual std::string readNXFieldFloat32 (pninx::NXField& nxfield);
-	virtual std::string readNXFieldFloat64 (pninx::NXField& nxfield);
-	virtual std::string readNXFieldFloat128 (pninx::NXField& nxfield);
-	virtual std::string readNXFieldComplex32 (pninx::NXField& nxfield);
-	virtual std::string readNXFieldComplex64 (pninx::NXField& nxfield);
-	virtual std::string readNXFieldComplex128 (pninx::NXField& nxfield);
+	/**
+	 *	Complex values are not binned, Filter doesn't create pyramid for them.
+	 */
+	template<typename T>
+	std::shared_ptr<const std::vector<T>> binnedImage(pninx::NXField& , const SliceRef& , std::false_type)
+	{
+		return std::shared_ptr<const std::vector<T>>();
+	}
+
+	/**
+	 *	\brief Converts pixels into output format, computes the window first if needed.
+	 *	\param [in] src : pixels read from NeXus file.
+	 *	\param [in] n : number of pixels.
+	 *	\param [out] dst : buffer for converted pixels.
+	 *	\param [in,out] format : output format, the window is resolved if it has to be computed from the pixels.
+	 */
+	template<typename T>
+	void convertPixels(const T* src, size_t n, char* dst, PixelFormat& format, std::true_type)
+	{
+		if(format.window_auto)
+		{
+			PixelConverter::valueRange<T>( src, n, format.clip, format.window_min, format.window_max );
+			format.window = true;
+		}
+		PixelConverter::convertTo<T>( src, n, dst, format );
+	}
+
+	/**
+	 *	Complex values can't be converted, ImageRule::pixelFormat never asks for it.
+	 */
+	template<typename T>
+	void convertPixels(const T* , size_t , char* , PixelFormat& , std::false_type) {}
+
+	bool readDirect(pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count, size_t value_size, FileContent& output);
+
+	virtual FileContent readNXFieldInt8 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count);
+	virtual FileContent readNXFieldInt16 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count);
+	virtual FileContent readNXFieldInt32 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count);
+	virtual FileContent readNXFieldUInt8 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count);
+	virtual FileContent readNXFieldUInt16 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count);
+	virtual FileContent readNXFieldUInt32 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count);
+	virtual FileContent readNXFieldFloat32 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count);
+	virtual FileContent readNXFieldFloat64 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count);
+	virtual FileContent readNXFieldFloat128 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count);
+	virtual FileContent readNXFieldComplex32 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count);
+	virtual FileContent readNXFieldComplex64 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count);
+	virtual FileContent readNXFieldComplex128 (pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count);
+
+protected:
+	PixelFormat pixelFormat(TypeID type, uint bit, char colormetric);
+	TIFFLayout tiffLayout(const NXMetadata& metadata, const SliceRef& slice, PixelFormat& format);
+	FileContent readRows(pninx::NXField& nxfield, const SliceRef& slice, size_t first_row, size_t row_count);
+	void readImageOptions(uint& bit, char& colormetric);
+	void readStripOptions(uint16_t& compression, uint32_t& rows_per_strip);
 
 public:
 	ImageRule();
@@ -138,10 +331,14 @@ public:
 
 
 	//fuse methods
-	virtual FSType getattr(pninx::NXObject &nxobject);
+	virtual FSType getattr(const NXMetadata& metadata);
 	//virtual std::vector<std::string> readdir(pninx::NXObject &nxobject);
 	virtual std::string read(pninx::NXObject &nxobject);
+	virtual FileContent readContent(pninx::NXObject &nxobject, const SliceRef& slice);
+	virtual bool readRange(pninx::NXObject &nxobject, const SliceRef& slice, size_t size, off_t offset, FileContent& output);
 	virtual size_t size(pninx::NXObject &nxobject);
+	virtual size_t size(pninx::NXObject &nxobject, const SliceRef& slice);
+	virtual bool sizeFromMetadata(const NXMetadata& metadata, const SliceRef& slice, size_t& size);
 };
 
 #endif /* IMAGERULE_H_ */
@@ -0,0 +1,72 @@
+/*
+ * MemoryBudget.cpp
+ *
+ *  Created on: Aug 26, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#include "MemoryBudget.h"
+#include <unistd.h>
+
+size_t MemoryBudget::_used = 0;
+std::mutex MemoryBudget::_mutex;
+
+/**
+ *	\brief Gets the memory all caches together can use.
+ *	\return Half of physical memory.
+ */
+size_t MemoryBudget::limit()
+{
+	static const size_t memory = (size_t)sysconf(_SC_PHYS_PAGES) * (size_t)sysconf(_SC_PAGE_SIZE) / 2;
+	return memory;
+}
+
+/**
+ *	\brief Gets the memory reserved by caches.
+ */
+size_t MemoryBudget::used()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _used;
+}
+
+/**
+ *	\brief Reserves memory for a cache.
+ *	\param [in] bytes : amount of memory.
+ *	\return False if it doesn't fit into MemoryBudget::limit or into free system memory, nothing is reserved then.
+ */
+bool MemoryBudget::reserve(size_t bytes)
+{
+	size_t free_memory = (size_t)sysconf(_SC_AVPHYS_PAGES) * (size_t)sysconf(_SC_PAGE_SIZE);
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	if(_used + bytes > limit() || bytes > free_memory)
+		return false;
+	_used += bytes;
+	return true;
+}
+
+/**
+ *	\brief Releases memory reserved by MemoryBudget::reserve.
+ *	\param [in] bytes : amount of memory.
+ */
+void MemoryBudget::release(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_used = (bytes < _used) ? _used - bytes : 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * MemoryBudget.h
+ *
+ *  Created on: Aug 26, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#ifndef MEMORYBUDGET_H_
+#define MEMORYBUDGET_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <mutex>
+
+/**
+ *	Memory shared by the caches that can grow large: file contents of NXFSCache, HDF5 chunk caches of NXGateway,
+ *	blocks of ReadPlanner, binned images of Binning and slices read ahead by Readahead.\n
+ *	A cache reserves memory before it grows and releases it when it shrinks, so together they stay within the limit.
+ */
+class MemoryBudget {
+private:
+	static size_t _used; /*!< Memory reserved. */
+	static std::mutex _mutex; /*!< Guards MemoryBudget#_used. */
+
+public:
+	static size_t limit();
+	static size_t used();
+	static bool reserve(size_t bytes);
+	static void release(size_t bytes);
+};
+
+#endif /* MEMORYBUDGET_H_ */
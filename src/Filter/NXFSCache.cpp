@@ -21,33 +21,145 @@
  */
 
 #include "NXFSCache.h"
+#include "Readahead.h"
+#include "MemoryBudget.h"
+#include "NXGateway.h"
 
 /**
  *	The list of file contents. Key is a full file path.
  */
-std::map<std::string, std::string> NXFSCache::_memcache;
+std::map<std::string, NXFSCache::CachedContent> NXFSCache::_memcache;
+std::list<std::string> NXFSCache::_lru;
+std::mutex NXFSCache::_memcache_mutex;
+
+/**
+ *	Exact sizes of file contents that were read. Key is a full file path.\n
+ *	Sizes of compressed files are known only after they were written, they stay here after the content is freed.
+ */
+std::map<std::string, size_t> NXFSCache::_sizes;
+std::mutex NXFSCache::_sizes_mutex;
 
 NXFSCache::~NXFSCache() {
-	if(_memcache.size() > 0)
-		_memcache.clear();
+	clear();
+}
+
+/**
+ *	\brief Forgets all file contents and sizes, e.g. when the NeXus file was reloaded.
+ */
+void NXFSCache::clear()
+{
+	{
+		std::lock_guard<std::mutex> lock(_memcache_mutex);
+		for(auto it = _memcache.begin(); it != _memcache.end(); )
+			it = drop(it);
+	}
+	std::lock_guard<std::mutex> lock(_sizes_mutex);
+	_sizes.clear();
+}
+
+/**
+ *	\brief Tells if \a path is the file \a fspath, or a file within folder \a fspath if \a with_contents is set.
+ */
+static bool isFileOf(const std::string& path, const std::string& fspath, bool with_contents)
+{
+	if(path == fspath)
+		return true;
+	return with_contents && path.length() > fspath.length() && path.compare(0, fspath.length(), fspath) == 0
+			&& (fspath == "/" || path[fspath.length()] == '/');
+}
+
+/**
+ *	\brief Forgets the content and size of file, e.g. when its NeXus object changed in reloaded file.
+ *	\param [in] fspath : full path of file or folder.
+ *	\param [in] with_contents : forget the files within folder too, e.g. slice files of image folder.
+ */
+void NXFSCache::forget(const std::string& fspath, bool with_contents)
+{
+	{
+		std::lock_guard<std::mutex> lock(_memcache_mutex);
+		// the files within folder follow the folder in map
+		for(auto it = _memcache.lower_bound(fspath); it != _memcache.end() && it->first.compare(0, fspath.length(), fspath) == 0; )
+		{
+			if( !isFileOf(it->first, fspath, with_contents) )
+			{
+				it++;
+				continue;
+			}
+			it = drop(it);
+		}
+	}
+	std::lock_guard<std::mutex> lock(_sizes_mutex);
+	for(auto it = _sizes.lower_bound(fspath); it != _sizes.end() && it->first.compare(0, fspath.length(), fspath) == 0; )
+	{
+		if( isFileOf(it->first, fspath, with_contents) )
+			it = _sizes.erase(it);
+		else
+			it++;
+	}
 }
 
 /**
- *	\brief Gets the file content specified by \a path.
- *	\param [in] fspath : full path of FSObject that has to be readed.
- *	\return The content of file.
+ *	\brief Gets the part of file content of \a fsobj.
+ *	\param [in] fsobj : FSObject that has to be readed, its full path is the key in cache.
+ *	\param [in] size : maximum number of bytes.
+ *	\param [in] offset : offset from the file begin.
+ *	\return The requested part of file content.
  *
- *	It gets the file content in memory if there was no such file content, and returns it.
+ *	Cached file content and slice files read ahead (see Readahead) are served from memory.
+ *	Otherwise the part is read alone if the rule of file can do it,
+ *	e.g. only the rows of image that fall into the part are read from NeXus file.\n
+ *	Other files are read entirely and cached.\n
+ *	HDF5 chunk caches resized meanwhile are applied after the read (see NXGateway::applyChunkCaches),
+ *	when the NeXus object read is closed again.
  */
-std::string NXFSCache::read(const char* fspath)
+FileContent NXFSCache::read(FSObject& fsobj, size_t size, off_t offset)
 {
-	std::string output;
-	if( !getOutput(fspath, output) )
+	const char* fspath = fsobj.fullpath.c_str();
+	FileContent output;
+	unsigned long generation = NXGateway::generation();
+	Readahead::access(fsobj);
+	if( getOutput(fspath, output) )
+		return output.range(size, offset);
+
+	if( Readahead::find(fsobj.fullpath, output) )
 	{
-		output = getCacheOutput(fspath);
+		std::lock_guard<std::mutex> lock(_sizes_mutex);
+		_sizes[fspath] = output.size();
+		return output.range(size, offset);
 	}
 
-	return output;
+	if( fsobj.readRange(size, offset, output) )
+	{
+		NXGateway::applyChunkCaches();
+		return output;
+	}
+
+	output = getCacheOutput(fsobj);
+	if( NXGateway::generation() == generation )
+	{
+		std::lock_guard<std::mutex> lock(_sizes_mutex);
+		_sizes[fspath] = output.size();
+	}
+	NXGateway::applyChunkCaches();
+
+	return output.range(size, offset);
+}
+
+/**
+ *	\brief Gets the exact size of file content that was read before.
+ *	\param [in] fspath : full path of FSObject.
+ *	\param [out] size : size of file content.
+ *	\return True if the file was read before, otherwise false.
+ */
+bool NXFSCache::size(const char* fspath, size_t& size)
+{
+	std::lock_guard<std::mutex> lock(_sizes_mutex);
+	auto it = _sizes.find( fspath );
+	if( it == _sizes.end() )
+		return false;
+
+	size = it->second;
+	return true;
 }
 
 /**
@@ -56,13 +168,15 @@ std::string NXFSCache::read(const char* fspath)
  *	\param [out] output : FSObject content.
  *	\return True if there is such file content in memory, otherwise false.
  */
-bool NXFSCache::getOutput(const char* fspath, std::string& output)
+bool NXFSCache::getOutput(const char* fspath, FileContent& output)
 {
+	std::lock_guard<std::mutex> lock(_memcache_mutex);
 	auto it = _memcache.find( fspath );
 
 	if( it != _memcache.end() )
 	{
-		output = it->second;
+		_lru.splice(_lru.begin(), _lru, it->second.lru);
+		output = it->second.content;
 		return true;
 	}
 	else
@@ -74,60 +188,67 @@ bool NXFSCache::getOutput(const char* fspath, std::string& output)
 
 /**
  *	\brief Caches the file content in memory, and returns it.
- *	\param [in] fspath : full path to FSObject that has to be read.
+ *	\param [in] fsobj : FSObject that has to be read.
  *	\return The file content.
+ *
+ *	The memory is taken from MemoryBudget shared with HDF5 chunk caches, the least recently used file contents are freed
+ *	to make room. The content is not cached if there is no room even then, or if it is larger than the whole budget.
  */
-std::string NXFSCache::getCacheOutput(const char* fspath)
+FileContent NXFSCache::getCacheOutput(FSObject& fsobj)
 {
-	std::string output;
-	//checks available memory
-	size_t avail_mem = getFreeSystemMemory();
-
-	//checks size of file supposed to read
-	size_t sz = _nxfstree.find(fspath).size();
-
-	//todo: to limit number of members in cache?!
-	if(sz < avail_mem)
-	{
-		//todo: handle exception?
-		output = _nxfstree.find(fspath).read();
-		_memcache.insert(std::pair<std::string, std::string> (fspath, output) );
-	}
-	else
-	{
-		cacheFree(sz);
-		output = _nxfstree.find(fspath).read();
-		_memcache.insert(std::pair<std::string, std::string> (fspath, output) );
-	}
+	const char* fspath = fsobj.fullpath.c_str();
+	//todo: handle exception?
+	unsigned long generation = NXGateway::generation();
+	FileContent output = fsobj.readContent();
+	// content of the old file read while the file was reloaded is not kept (see ReadWorkers::read)
+	if( NXGateway::generation() != generation )
+		return output;
+
+	// pieces lying in files take no memory
+	size_t sz = output.memoryBytes();
+	// the cache is not emptied for a content that can't fit anyway
+	if( sz > MemoryBudget::limit() )
+		return output;
+
+	std::lock_guard<std::mutex> lock(_memcache_mutex);
+	if( _memcache.find(fspath) != _memcache.end() || !( MemoryBudget::reserve(sz) || cacheFree(sz) ) )
+		return output;
+	_lru.push_front(fspath);
+	CachedContent& entry = _memcache[fspath];
+	entry.content = output;
+	entry.bytes = sz;
+	entry.lru = _lru.begin();
 
 	return output;
 }
 
 
 /**
- *	Deletes cached file contents while don't have enough memory.
- *	\param [in] size : An amount of memory to be freed.
+ *	Deletes the least recently used file contents until the memory for a new one can be reserved.
+ *	\param [in] size : An amount of memory to be reserved.
+ *	\return True if the memory was reserved.
+ *	NXFSCache#_memcache_mutex is locked.
  */
-void NXFSCache::cacheFree(size_t size)
+bool NXFSCache::cacheFree(size_t size)
 {
-	long int mem_left = size;
-//todo add counter if there are no memory on machine just don't give a fuck and abort.
-	while(mem_left > 50)//magic number
+	while( !_lru.empty() )
 	{
-		mem_left -= _memcache.begin()->second.length();
-		_memcache.erase( _memcache.begin() );
+		drop( _memcache.find( _lru.back() ) );
+		if( MemoryBudget::reserve(size) )
+			return true;
 	}
+	return false;
 }
 
 /**
- *	\brief Checks how much memory there is in system.
- *	\return Amount of available memory in system.
+ *	Deletes cached file content and gives its memory back to MemoryBudget.
+ *	\param [in] it : the content in NXFSCache#_memcache.
+ *	\return The content following it.
+ *	NXFSCache#_memcache_mutex is locked.
  */
-size_t NXFSCache::getFreeSystemMemory()
+std::map<std::string, NXFSCache::CachedContent>::iterator NXFSCache::drop(std::map<std::string, CachedContent>::iterator it)
 {
-	long pages_avail = sysconf(_SC_AVPHYS_PAGES);
-    //long pages_total = sysconf(_SC_PHYS_PAGES);
-    long page_size = sysconf(_SC_PAGE_SIZE);
-
-    return pages_avail * page_size;
+	MemoryBudget::release(it->second.bytes);
+	_lru.erase(it->second.lru);
+	return _memcache.erase(it);
 }
@@ -26,30 +26,47 @@
 #include <stdio.h>
 #include "FSTree.h"
 #include <unistd.h>
+#include <mutex>
+#include <list>
 
 /**
  *	Class is designed to store in memory some file contents to increase performance of system.
  */
 class NXFSCache {
 private:
-	static std::map<std::string, std::string> _memcache;
-	FSTree& _nxfstree; /*!< Reference to FSTree created on application start. */
+	/**
+	 *	File content kept in memory.
+	 */
+	struct CachedContent {
+		FileContent content; /*!< The content. */
+		size_t bytes; /*!< Memory reserved for it from MemoryBudget. */
+		std::list<std::string>::iterator lru; /*!< Position in NXFSCache#_lru. */
+	};
 
-	std::string getCacheOutput(const char* fspath);
-	bool getOutput(const char* fspath, std::string& output);
-	void cacheFree(size_t size);
+	static std::map<std::string, CachedContent> _memcache;
+	static std::list<std::string> _lru; /*!< Paths of cached contents, the most recently used first. */
+	static std::mutex _memcache_mutex; /*!< Guards NXFSCache#_memcache and NXFSCache#_lru. */
+	static std::map<std::string, size_t> _sizes;
+	static std::mutex _sizes_mutex;
 
-	size_t getFreeSystemMemory();
+	FileContent getCacheOutput(FSObject& fsobj);
+	bool getOutput(const char* fspath, FileContent& output);
+	bool cacheFree(size_t size);
+	static std::map<std::string, CachedContent>::iterator drop(std::map<std::string, CachedContent>::iterator it);
 
 public:
 	/**
 	 *	\brief Constructor of NXFSCache.
 	 */
-	NXFSCache(FSTree& nxfstree) : _nxfstree(nxfstree) {};
+	NXFSCache() {};
 	virtual ~NXFSCache();
 
 	//FUSE function
-	std::string read(const char* fspath);
+	FileContent read(FSObject& fsobj, size_t size, off_t offset);
+
+	static bool size(const char* fspath, size_t& size);
+	static void clear();
+	static void forget(const std::string& fspath, bool with_contents);
 };
 
 #endif /* NXFSCACHE_H_ */
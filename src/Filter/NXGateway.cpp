@@ -21,15 +21,1189 @@
  */
 
 #include "NXGateway.h"
+#include "MemoryBudget.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
 
 pninx::NXFile NXGateway::_nxfile;
+hid_t NXGateway::_h5file = -1;
+struct timespec NXGateway::_file_time;
+dev_t NXGateway::_file_dev = 0;
+ino_t NXGateway::_file_ino = 0;
+std::atomic<unsigned long> NXGateway::_generation(0);
+std::map<std::string, std::vector<size_t>> NXGateway::_chunks;
+std::mutex NXGateway::_chunks_mutex;
+bool NXGateway::_swmr = false;
+std::map<std::string, ContiguousStorage> NXGateway::_contiguous;
+std::map<std::string, std::shared_ptr<const DirectFile>> NXGateway::_direct_files;
+std::map<std::string, NXGateway::FollowedDataset> NXGateway::_followed;
+std::map<std::string, struct timespec> NXGateway::_change_times;
+std::string NXGateway::_directory;
+std::map<std::string, struct timespec> NXGateway::_file_times;
+std::map<std::string, NXGateway::DirectoryFile> NXGateway::_open_files;
+std::list<std::string> NXGateway::_open_files_lru;
+size_t NXGateway::_max_open_files = 0;
+std::mutex NXGateway::_access_mutex;
+thread_local size_t NXGateway::_access_depth = 0;
+std::map<std::string, NXGateway::ChunkCache> NXGateway::_chunk_caches;
+std::atomic<bool> NXGateway::_chunk_caches_pending(false);
+std::mutex NXGateway::_chunk_caches_mutex;
+
+NXGateway::object_list_t NXGateway::_objects;
+std::map<std::string, NXGateway::object_list_t::iterator> NXGateway::_objects_index;
+std::mutex NXGateway::_objects_mutex;
+std::map<std::string, NXMetadata> NXGateway::_metadata;
+std::mutex NXGateway::_metadata_mutex;
+
+const size_t NXGateway::MAX_OPEN_OBJECTS = 256;
+const size_t NXGateway::DEFAULT_MAX_OPEN_FILES = 64;
+const size_t NXGateway::MAX_CHUNK_CACHE_BYTES = 256*1024*1024;
+const size_t NXGateway::CHUNK_CACHE_CHECK_READS = 16;
+
+/**
+ *	Size of HDF5 chunk cache used unless it is set, see H5Pset_chunk_cache.
+ */
+static const size_t DEFAULT_CHUNK_CACHE_BYTES = 1024*1024;
+/**
+ *	Attempts to resize chunk cache of dataset that is always open elsewhere, before giving up.
+ */
+static const size_t MAX_CHUNK_CACHE_ATTEMPTS = 8;
 
 NXGateway::NXGateway() {
 }
 
 NXGateway::~NXGateway() {
+	AccessLock access;
+	clearObjects();
+	closeFiles();
 	if(_nxfile.is_valid())
 		_nxfile.close();
+	close_h5file();
+}
+
+/**
+ *	\brief Takes the access to NeXus files, until NXGateway::unlockAccess.
+ *
+ *	Neither pninx handles nor HDF5 (which is not required to be built threadsafe) are used by two threads at once.
+ *	NXGateway takes the access itself whenever it calls HDF5 or pninx, so that lookups of metadata by stat are safe too.
+ *	Who keeps pninx objects got from NXGateway holds the access while using them and until they are destroyed:
+ *	FUSE reads, read-ahead tasks (see Readahead), and the building of FSTree.\n
+ *	The access is taken before any mutex of NXGateway. A thread may take it again while it holds it, the takes are counted.
+ */
+void NXGateway::lockAccess()
+{
+	if(_access_depth++ == 0)
+		_access_mutex.lock();
+}
+
+/**
+ *	\brief Gives back the access to NeXus files taken by NXGateway::lockAccess.
+ */
+void NXGateway::unlockAccess()
+{
+	if(--_access_depth == 0)
+		_access_mutex.unlock();
+}
+
+/**
+ *	\brief Takes the access to NeXus files, see NXGateway::lockAccess.
+ */
+NXGateway::AccessLock::AccessLock()
+{
+	lockAccess();
+}
+
+/**
+ *	\brief Gives back the access taken by constructor.
+ */
+NXGateway::AccessLock::~AccessLock()
+{
+	unlockAccess();
+}
+
+/**
+ *	\brief Gives back the access to NeXus files if this thread holds it, however many times it was taken.
+ */
+NXGateway::AccessRelease::AccessRelease() : _depth(_access_depth)
+{
+	if(_depth > 0)
+	{
+		_access_depth = 0;
+		_access_mutex.unlock();
+	}
+}
+
+/**
+ *	\brief Takes the access given back by constructor again.
+ */
+NXGateway::AccessRelease::~AccessRelease()
+{
+	if(_depth > 0)
+	{
+		_access_mutex.lock();
+		_access_depth = _depth;
+	}
+}
+
+/**
+ *	\brief Closes HDF5 handle of NeXus file and forgets what was learned from it.
+ */
+void NXGateway::close_h5file()
+{
+	// the caches are set again when the file is reopened
+	std::lock_guard<std::mutex> lock(_chunk_caches_mutex);
+	for(auto& entry : _chunk_caches)
+		closeChunkCache(entry.second);
+
+	std::lock_guard<std::mutex> chunks_lock(_chunks_mutex);
+	// HDF5 keeps the file open while some dataset of it is open
+	for(auto& entry : _followed)
+		H5Dclose(entry.second.dataset);
+	_followed.clear();
+	if(_h5file >= 0)
+		H5Fclose(_h5file);
+	_h5file = -1;
+	_chunks.clear();
+	_contiguous.clear();
+	_direct_files.clear();
+}
+
+/**
+ *	\brief Closes the NeXus file or the files of directory loaded, and forgets their objects.
+ */
+void NXGateway::closeLoaded()
+{
+	close_h5file();
+	closeFiles();
+	std::lock_guard<std::mutex> lock(_objects_mutex);
+	_objects_index.clear();
+	_objects.clear();
+	if(_nxfile.is_valid())
+		_nxfile.close();
+	_file_ino = 0;
+}
+
+/**
+ *	\brief Closes the dataset keeping chunk cache, the cache is set again when the file is opened.
+ *	\param [in,out] cache : chunk cache of dataset.
+ *
+ *	NXGateway#_chunk_caches_mutex is locked.
+ */
+void NXGateway::closeChunkCache(ChunkCache& cache)
+{
+	if(cache.dataset >= 0)
+	{
+		H5Dclose(cache.dataset);
+		MemoryBudget::release(cache.nbytes);
+	}
+	cache.dataset = -1;
+	cache.nbytes = DEFAULT_CHUNK_CACHE_BYTES;
+	cache.attempts = 0;
+	if(cache.wanted != cache.nbytes)
+		_chunk_caches_pending = true;
+}
+
+/**
+ *	\brief Splits path of NeXus object into the file and the path within it.
+ *	\param [in] nxpath : full path of NeXus object, it starts with the name of file in directory mode.
+ *	\param [out] file : name of file in directory, empty if a single file is opened.
+ *	\param [out] inner : path of NeXus object within the file.
+ *	\return False if the path doesn't name a NeXus object, i.e. it is the directory itself.
+ */
+bool NXGateway::splitPath(const std::string& nxpath, std::string& file, std::string& inner)
+{
+	if( _directory.empty() )
+	{
+		file.clear();
+		inner = nxpath;
+		return true;
+	}
+	if(nxpath.size() < 2 || nxpath[0] != '/')
+		return false;
+	size_t pos = nxpath.find('/', 1);
+	file = nxpath.substr(1, (pos == std::string::npos) ? std::string::npos : pos - 1);
+	inner = (pos == std::string::npos) ? "/" : nxpath.substr(pos);
+	return true;
+}
+
+/**
+ *	\brief Gets HDF5 handle of file.
+ *	\param [in] file : name of file in directory, see NXGateway::splitPath.
+ *	\return Handle, -1 if the file is not open.
+ *
+ *	NXGateway#_chunks_mutex or NXGateway#_chunk_caches_mutex is locked, the files are closed while both are.
+ */
+hid_t NXGateway::h5fileOf(const std::string& file)
+{
+	if( _directory.empty() )
+		return _h5file;
+	auto it = _open_files.find(file);
+	return (it != _open_files.end()) ? it->second.h5file : -1;
+}
+
+/**
+ *	\brief Tells whether \a key starts with \a prefix.
+ */
+static bool startsWith(const std::string& key, const std::string& prefix)
+{
+	return key.compare(0, prefix.size(), prefix) == 0;
+}
+
+/**
+ *	\brief Opens file of directory unless it is open, the least recently used files are closed if too many are open.
+ *	\param [in] file : name of file in directory.
+ *	\throw NXFSException if there is no such file or it can't be opened.
+ *
+ *	Files whose datasets are followed (NXGateway::follow) stay open.
+ */
+void NXGateway::openFile(const std::string& file)
+{
+	AccessLock access;
+	std::lock_guard<std::mutex> lock(_chunk_caches_mutex);
+	std::lock_guard<std::mutex> chunks_lock(_chunks_mutex);
+	std::lock_guard<std::mutex> objects_lock(_objects_mutex);
+	if( _open_files.find(file) != _open_files.end() )
+		return;
+	if( _file_times.find(file) == _file_times.end() )
+		throw NXFSException("NXGateway: no such NeXus file in directory: " + file);
+
+	std::vector<std::string> closed;
+	size_t excess = (_open_files.size() + 1 > _max_open_files) ? _open_files.size() + 1 - _max_open_files : 0;
+	for(auto it = _open_files_lru.rbegin(); it != _open_files_lru.rend() && closed.size() < excess; ++it)
+	{
+		std::string prefix = "/" + *it + "/";
+		auto followed = _followed.lower_bound(prefix);
+		if( followed == _followed.end() || !startsWith(followed->first, prefix) )
+			closed.push_back(*it);
+	}
+	for(const std::string& name : closed)
+		closeFile(name);
+
+	// HDF5 takes the access flags from the first handle of file, the handle opened by pninx shares it
+	std::string path = _directory + "/" + file;
+	DirectoryFile opened;
+	opened.h5file = -1;
+	if(_swmr)
+		opened.h5file = H5Fopen(path.c_str(), H5F_ACC_RDONLY | H5F_ACC_SWMR_READ, H5P_DEFAULT);
+	try
+	{
+		opened.nxfile = pninx::NXFile::open_file(path, true);
+	}catch (...) {
+		if(opened.h5file >= 0)
+			H5Fclose(opened.h5file);
+		throw NXFSException("cannot open NeXus file " + file);
+	}
+	if(opened.h5file < 0)
+		opened.h5file = H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	_open_files_lru.push_front(file);
+	opened.lru = _open_files_lru.begin();
+	_open_files.insert( std::make_pair(file, opened) );
+
+	// the chunk caches of file closed before are set again
+	_chunk_caches_pending = true;
+}
+
+/**
+ *	\brief Closes file of directory with its datasets and objects kept open. Metadata of its objects is kept.
+ *	\param [in] file : name of file in directory.
+ *
+ *	NXGateway#_chunk_caches_mutex, NXGateway#_chunks_mutex and NXGateway#_objects_mutex are locked.
+ */
+void NXGateway::closeFile(const std::string& file)
+{
+	auto opened = _open_files.find(file);
+	if( opened == _open_files.end() )
+		return;
+
+	// HDF5 keeps the file open while some dataset of it is open
+	std::string prefix = "/" + file + "/";
+	for(auto it = _chunk_caches.lower_bound(prefix); it != _chunk_caches.end() && startsWith(it->first, prefix); ++it)
+		closeChunkCache(it->second);
+	for(auto it = _followed.lower_bound(prefix); it != _followed.end() && startsWith(it->first, prefix); )
+	{
+		H5Dclose(it->second.dataset);
+		it = _followed.erase(it);
+	}
+	// the file is not kept open for pread either
+	for(auto it = _contiguous.lower_bound(prefix); it != _contiguous.end() && startsWith(it->first, prefix); )
+		it = _contiguous.erase(it);
+	_direct_files.erase(file);
+	auto root = _objects_index.find("/" + file);
+	if( root != _objects_index.end() )
+	{
+		_objects.erase(root->second);
+		_objects_index.erase(root);
+	}
+	for(auto it = _objects_index.lower_bound(prefix); it != _objects_index.end() && startsWith(it->first, prefix); )
+	{
+		_objects.erase(it->second);
+		it = _objects_index.erase(it);
+	}
+
+	if(opened->second.h5file >= 0)
+		H5Fclose(opened->second.h5file);
+	if(opened->second.nxfile.is_valid())
+		opened->second.nxfile.close();
+	_open_files_lru.erase(opened->second.lru);
+	_open_files.erase(opened);
+}
+
+/**
+ *	\brief Closes all files of directory.
+ */
+void NXGateway::closeFiles()
+{
+	AccessLock access;
+	std::lock_guard<std::mutex> lock(_chunk_caches_mutex);
+	std::lock_guard<std::mutex> chunks_lock(_chunks_mutex);
+	std::lock_guard<std::mutex> objects_lock(_objects_mutex);
+	while( !_open_files.empty() )
+		closeFile(_open_files.begin()->first);
+}
+
+/**
+ *	\brief Gets the smallest prime number not less than \a n, HDF5 advises a prime number of chunk cache slots.
+ */
+static size_t primeAtLeast(size_t n)
+{
+	if(n <= 2)
+		return 2;
+	for(n |= 1; ; n += 2)
+	{
+		bool prime = true;
+		for(size_t d = 3; d*d <= n && prime; d += 2)
+			prime = (n % d != 0);
+		if(prime)
+			return n;
+	}
+}
+
+/**
+ *	\brief Decides the chunk cache of dataset, it is applied by NXGateway::applyChunkCaches.
+ *	\param [in] nxpath : full path of NeXus field.
+ *	\param [in] type : type of rule the field is represented by.
+ *
+ *	Images are read in bands of chunk rows (see ReadPlanner::bands), so the cache of image field holds a band of chunks
+ *	across the image. Other fields are read whole, one chunk at a time.
+ */
+void NXGateway::planChunkCache(const std::string& nxpath, RuleType type)
+{
+	AccessLock access;
+	std::vector<size_t> chunk = chunkShape(nxpath);
+	if(chunk.empty())
+		return;
+
+	std::lock_guard<std::mutex> lock(_chunk_caches_mutex);
+	std::string file, inner;
+	hid_t h5file = splitPath(nxpath, file, inner) ? h5fileOf(file) : -1;
+	if(h5file < 0 || _chunk_caches.find(nxpath) != _chunk_caches.end())
+		return;
+
+	hid_t dataset = H5Dopen2(h5file, inner.c_str(), H5P_DEFAULT);
+	if(dataset < 0)
+		return;
+	ChunkCache cache;
+	cache.chunk = chunk;
+	hid_t space = H5Dget_space(dataset);
+	hid_t datatype = H5Dget_type(dataset);
+	hsize_t dims[H5S_MAX_RANK];
+	int rank = (space >= 0) ? H5Sget_simple_extent_dims(space, dims, NULL) : -1;
+	for(int i=0; i<rank; i++)
+		cache.dims.push_back(dims[i]);
+	cache.chunk_bytes = (datatype >= 0) ? H5Tget_size(datatype) : 1;
+	if(datatype >= 0)
+		H5Tclose(datatype);
+	if(space >= 0)
+		H5Sclose(space);
+	H5Dclose(dataset);
+	if(cache.dims.size() != chunk.size())
+		return;
+
+	size_t chunks = 1;
+	for(size_t d : chunk)
+		cache.chunk_bytes *= d;
+	if(type == RuleType::IMAGE && chunk.size() == 3)
+		chunks = (cache.dims[2] + chunk[2] - 1) / chunk[2];
+
+	cache.dataset = -1;
+	cache.nbytes = DEFAULT_CHUNK_CACHE_BYTES;
+	cache.wanted = chunks*cache.chunk_bytes;
+	if(cache.wanted > MAX_CHUNK_CACHE_BYTES)
+		cache.wanted = MAX_CHUNK_CACHE_BYTES;
+	if(cache.wanted < DEFAULT_CHUNK_CACHE_BYTES)
+		cache.wanted = DEFAULT_CHUNK_CACHE_BYTES;
+	cache.attempts = 0;
+	cache.reads = 0;
+	cache.partial_reads = 0;
+	cache.touched_bytes = 0;
+	_chunk_caches.insert( std::make_pair(nxpath, cache) );
+	if(cache.wanted != cache.nbytes)
+		_chunk_caches_pending = true;
+}
+
+/**
+ *	\brief Counts a read from dataset, the chunk cache grows if reads often don't cover whole chunks.
+ *	\param [in] nxpath : full path of NeXus field.
+ *	\param [in] start : first index of read along each dimension.
+ *	\param [in] count : number of indices read along each dimension.
+ *	\param [in] rank : rank of dataset.
+ *
+ *	Chunks read partly are decompressed again by the next read unless they stay in the chunk cache.
+ *	If it happens in most of NXGateway::CHUNK_CACHE_CHECK_READS reads, the cache grows to hold all chunks touched by one read.
+ */
+void NXGateway::recordRead(const std::string& nxpath, const size_t* start, const size_t* count, size_t rank)
+{
+	std::lock_guard<std::mutex> lock(_chunk_caches_mutex);
+	auto it = _chunk_caches.find(nxpath);
+	if( it == _chunk_caches.end() || it->second.chunk.size() != rank )
+		return;
+
+	ChunkCache& cache = it->second;
+	bool whole = true;
+	size_t touched = cache.chunk_bytes;
+	for(size_t d=0; d<rank; d++)
+	{
+		size_t c = cache.chunk[d];
+		if(count[d] == 0)
+			return;
+		touched *= (start[d] + count[d] - 1) / c - start[d] / c + 1;
+		if(start[d] % c != 0 || ( (start[d] + count[d]) % c != 0 && start[d] + count[d] != cache.dims[d] ))
+			whole = false;
+	}
+
+	cache.reads++;
+	if(!whole)
+	{
+		cache.partial_reads++;
+		if(touched > cache.touched_bytes)
+			cache.touched_bytes = touched;
+	}
+	if(cache.reads < CHUNK_CACHE_CHECK_READS)
+		return;
+
+	if(2*cache.partial_reads > cache.reads && cache.touched_bytes > cache.wanted && cache.wanted < MAX_CHUNK_CACHE_BYTES)
+	{
+		cache.wanted = (cache.touched_bytes < MAX_CHUNK_CACHE_BYTES) ? cache.touched_bytes : MAX_CHUNK_CACHE_BYTES;
+		cache.attempts = 0;
+		_chunk_caches_pending = true;
+	}
+	cache.reads = 0;
+	cache.partial_reads = 0;
+	cache.touched_bytes = 0;
+}
+
+/**
+ *	\brief Applies chunk caches decided by NXGateway::planChunkCache and NXGateway::recordRead.
+ *
+ *	It has effect only while the dataset is not open elsewhere, so it is called when no NeXus object is likely open,
+ *	and the caches that were not applied are tried again next time.
+ */
+void NXGateway::applyChunkCaches()
+{
+	if(!_chunk_caches_pending)
+		return;
+
+	AccessLock access;
+	std::lock_guard<std::mutex> lock(_chunk_caches_mutex);
+	_chunk_caches_pending = false;
+	for(auto& entry : _chunk_caches)
+	{
+		ChunkCache& cache = entry.second;
+		std::string file, inner;
+		// caches of files of directory that are closed are set when the file is opened again
+		if(cache.wanted == cache.nbytes || !splitPath(entry.first, file, inner) || h5fileOf(file) < 0)
+			continue;
+		if( !openChunkCache(cache, entry.first) )
+			_chunk_caches_pending = true;
+	}
+}
+
+/**
+ *	\brief Opens dataset with NXGateway::ChunkCache#wanted chunk cache, the memory is taken from MemoryBudget.
+ *	\param [in,out] cache : chunk cache of dataset.
+ *	\param [in] nxpath : full path of NeXus field.
+ *	\return False if the dataset was open elsewhere and the cache has to be tried again.
+ *	NXGateway#_chunk_caches_mutex is locked.
+ */
+bool NXGateway::openChunkCache(ChunkCache& cache, const std::string& nxpath)
+{
+	size_t reserved = (cache.dataset >= 0) ? cache.nbytes : 0;
+	if(cache.wanted > reserved && !MemoryBudget::reserve(cache.wanted - reserved))
+	{
+		// no memory left, keep the cache as it is
+		cache.wanted = cache.nbytes;
+		return true;
+	}
+	if(cache.wanted < reserved)
+		MemoryBudget::release(reserved - cache.wanted);
+	reserved = cache.wanted;
+
+	// the handle kept by NXGateway::getNXObjectByPath would keep the old cache
+	dropObject(nxpath);
+	if(cache.dataset >= 0)
+		H5Dclose(cache.dataset);
+	std::string file, inner;
+	splitPath(nxpath, file, inner);
+	hid_t dapl = H5Pcreate(H5P_DATASET_ACCESS);
+	H5Pset_chunk_cache(dapl, primeAtLeast( 100 * (cache.wanted / cache.chunk_bytes + 1) ), cache.wanted,
+			H5D_CHUNK_CACHE_W0_DEFAULT);
+	cache.dataset = H5Dopen2(h5fileOf(file), inner.c_str(), dapl);
+	H5Pclose(dapl);
+
+	size_t effective = DEFAULT_CHUNK_CACHE_BYTES;
+	if(cache.dataset >= 0)
+	{
+		// HDF5 reports the cache of shared dataset, which is the old one if the dataset was open elsewhere
+		hid_t access = H5Dget_access_plist(cache.dataset);
+		size_t nslots, nbytes;
+		double w0;
+		if(access >= 0 && H5Pget_chunk_cache(access, &nslots, &nbytes, &w0) >= 0)
+			effective = nbytes;
+		if(access >= 0)
+			H5Pclose(access);
+	}
+	else
+		effective = 0;
+
+	if(effective < reserved)
+		MemoryBudget::release(reserved - effective);
+	else if(effective > reserved)
+		MemoryBudget::reserve(effective - reserved);
+
+	if(cache.dataset < 0)
+	{
+		cache.nbytes = DEFAULT_CHUNK_CACHE_BYTES;
+		cache.wanted = cache.nbytes;
+		return true;
+	}
+
+	cache.nbytes = effective;
+	if(effective == cache.wanted)
+	{
+		cache.attempts = 0;
+		return true;
+	}
+	if(++cache.attempts >= MAX_CHUNK_CACHE_ATTEMPTS)
+	{
+		cache.wanted = cache.nbytes;
+		return true;
+	}
+	return false;
+}
+
+/**
+ *	\brief Gets HDF5 chunk shape of dataset.
+ *	\param [in] nxpath : full path of NeXus field.
+ *	\return Chunk shape, empty if the dataset is not chunked or can't be opened.
+ *
+ *	The chunk shape is asked from HDF5 once per dataset.
+ */
+std::vector<size_t> NXGateway::chunkShape(const std::string& nxpath)
+{
+	{
+		std::lock_guard<std::mutex> lock(_chunks_mutex);
+		auto it = _chunks.find(nxpath);
+		if( it != _chunks.end() )
+			return it->second;
+	}
+
+	AccessLock access;
+	std::lock_guard<std::mutex> lock(_chunks_mutex);
+
+	std::vector<size_t> output;
+	std::string file, inner;
+	hid_t h5file = splitPath(nxpath, file, inner) ? h5fileOf(file) : -1;
+	// not remembered while the file of directory is closed
+	if(h5file < 0)
+		return output;
+
+	hid_t dataset = H5Dopen2(h5file, inner.c_str(), H5P_DEFAULT);
+	if(dataset >= 0)
+	{
+		hid_t plist = H5Dget_create_plist(dataset);
+		if(plist >= 0 && H5Pget_layout(plist) == H5D_CHUNKED)
+		{
+			hsize_t dims[H5S_MAX_RANK];
+			int rank = H5Pget_chunk(plist, H5S_MAX_RANK, dims);
+			for(int i=0; i<rank; i++)
+				output.push_back(dims[i]);
+		}
+		if(plist >= 0)
+			H5Pclose(plist);
+		H5Dclose(dataset);
+	}
+
+	_chunks.insert( std::make_pair(nxpath, output) );
+	return output;
+}
+
+/**
+ *	\brief Opens dataset with HDF5 library.
+ *	\param [in] nxpath : full path of dataset.
+ *	\return Handle to be closed by caller, -1 if the dataset or its file isn't open.
+ *
+ *	NXGateway#_chunks_mutex is locked, so the file is not closed meanwhile.
+ */
+hid_t NXGateway::openDataset(const std::string& nxpath)
+{
+	std::string file, inner;
+	hid_t h5file = splitPath(nxpath, file, inner) ? h5fileOf(file) : -1;
+	if(h5file < 0)
+		return -1;
+	return H5Dopen2(h5file, inner.c_str(), H5P_DEFAULT);
+}
+
+/**
+ *	\brief Gets how the chunks of dataset are stored.
+ *	\param [in] nxpath : full path of dataset, its file has to be open (see NXGateway::getNXObjectByPath).
+ *	\param [out] output : shapes, filter pipeline and value type of dataset.
+ *	\return False if the dataset is not chunked or can't be opened.
+ */
+bool NXGateway::chunkStorage(const std::string& nxpath, ChunkStorage& output)
+{
+	AccessLock access;
+	std::lock_guard<std::mutex> lock(_chunks_mutex);
+	hid_t dataset = openDataset(nxpath);
+	if(dataset < 0)
+		return false;
+
+	bool chunked = false;
+	hid_t plist = H5Dget_create_plist(dataset);
+	hid_t space = H5Dget_space(dataset);
+	hid_t datatype = H5Dget_type(dataset);
+	if(plist >= 0 && space >= 0 && datatype >= 0 && H5Pget_layout(plist) == H5D_CHUNKED)
+	{
+		hsize_t dims[H5S_MAX_RANK];
+		int rank = H5Pget_chunk(plist, H5S_MAX_RANK, dims);
+		output.chunk.assign(dims, dims + ((rank > 0) ? rank : 0));
+		rank = H5Sget_simple_extent_dims(space, dims, NULL);
+		output.dims.assign(dims, dims + ((rank > 0) ? rank : 0));
+
+		output.filters.clear();
+		int filter_count = H5Pget_nfilters(plist);
+		for(int i=0; i<filter_count; i++)
+		{
+			ChunkFilter filter;
+			unsigned int flags;
+			unsigned int values[16];
+			size_t value_count = 16;
+			filter.id = H5Pget_filter2(plist, i, &flags, &value_count, values, 0, NULL, NULL);
+			filter.values.assign(values, values + ((value_count < 16) ? value_count : 16));
+			output.filters.push_back(filter);
+		}
+
+		output.type_class = H5Tget_class(datatype);
+		output.is_signed = (output.type_class == H5T_INTEGER) && H5Tget_sign(datatype) == H5T_SGN_2;
+		output.little_endian = H5Tget_order(datatype) != H5T_ORDER_BE;
+		output.value_bytes = H5Tget_size(datatype);
+
+		output.fill_value = 0;
+		H5D_fill_value_t defined;
+		if( H5Pfill_value_defined(plist, &defined) >= 0 && defined == H5D_FILL_VALUE_USER_DEFINED
+				&& (output.type_class == H5T_INTEGER || output.type_class == H5T_FLOAT) )
+			H5Pget_fill_value(plist, H5T_NATIVE_DOUBLE, &output.fill_value);
+
+		chunked = output.chunk.size() == output.dims.size() && !output.chunk.empty();
+	}
+	if(datatype >= 0)
+		H5Tclose(datatype);
+	if(space >= 0)
+		H5Sclose(space);
+	if(plist >= 0)
+		H5Pclose(plist);
+	H5Dclose(dataset);
+	return chunked;
+}
+
+/**
+ *	\brief Gets where a chunk is stored.
+ *	\param [in] nxpath : full path of chunked dataset, its file has to be open.
+ *	\param [in] offset : position of the first value of chunk in dataset.
+ *	\param [out] filter_mask : filters skipped when the chunk was written, bit i stands for the filter i of pipeline.
+ *	\param [out] nbytes : size of chunk as stored.
+ *	\return False if the chunk was never written.
+ */
+bool NXGateway::chunkInfo(const std::string& nxpath, const std::vector<size_t>& offset, unsigned& filter_mask, size_t& nbytes)
+{
+	AccessLock access;
+	std::lock_guard<std::mutex> lock(_chunks_mutex);
+	hid_t dataset = openDataset(nxpath);
+	if(dataset < 0)
+		return false;
+
+	std::vector<hsize_t> start(offset.begin(), offset.end());
+	haddr_t address = HADDR_UNDEF;
+	hsize_t size = 0;
+	herr_t status = H5Dget_chunk_info_by_coord(dataset, start.data(), &filter_mask, &address, &size);
+	H5Dclose(dataset);
+	nbytes = size;
+	return status >= 0 && address != HADDR_UNDEF && size > 0;
+}
+
+/**
+ *	\brief Reads a chunk as it is stored, the filters are not applied.
+ *	\param [in] nxpath : full path of chunked dataset, its file has to be open.
+ *	\param [in] offset : position of the first value of chunk in dataset.
+ *	\param [out] output : bytes of chunk.
+ *	\param [out] filter_mask : filters skipped when the chunk was written.
+ *	\return False if the chunk was never written or can't be read.
+ */
+bool NXGateway::readChunk(const std::string& nxpath, const std::vector<size_t>& offset, std::string& output, unsigned& filter_mask)
+{
+	AccessLock access;
+	std::lock_guard<std::mutex> lock(_chunks_mutex);
+	hid_t dataset = openDataset(nxpath);
+	if(dataset < 0)
+		return false;
+
+	std::vector<hsize_t> start(offset.begin(), offset.end());
+	hsize_t size = 0;
+	bool done = H5Dget_chunk_storage_size(dataset, start.data(), &size) >= 0 && size > 0;
+	if(done)
+	{
+		uint32_t filters = 0;
+		output.assign(size, '\0');
+		done = H5Dread_chunk(dataset, H5P_DEFAULT, start.data(), &filters, &output[0]) >= 0;
+		filter_mask = filters;
+	}
+	H5Dclose(dataset);
+	return done;
+}
+
+/**
+ *	\brief Reads the values of one chunk through the filters, in the byte order of file.
+ *	\param [in] nxpath : full path of chunked dataset, its file has to be open.
+ *	\param [in] offset : position of the first value of chunk in dataset.
+ *	\param [out] output : values of the whole chunk, in C order. Parts of edge chunks beyond the dataset are zeros.
+ *	\return False if the dataset can't be read.
+ */
+bool NXGateway::readChunkValues(const std::string& nxpath, const std::vector<size_t>& offset, std::string& output)
+{
+	AccessLock access;
+	std::lock_guard<std::mutex> lock(_chunks_mutex);
+	hid_t dataset = openDataset(nxpath);
+	if(dataset < 0)
+		return false;
+
+	bool done = false;
+	hid_t plist = H5Dget_create_plist(dataset);
+	hid_t space = H5Dget_space(dataset);
+	hid_t datatype = H5Dget_type(dataset);
+	if(plist >= 0 && space >= 0 && datatype >= 0)
+	{
+		hsize_t chunk[H5S_MAX_RANK], dims[H5S_MAX_RANK], count[H5S_MAX_RANK], zero[H5S_MAX_RANK];
+		int rank = H5Pget_chunk(plist, H5S_MAX_RANK, chunk);
+		if(rank > 0 && rank == H5Sget_simple_extent_dims(space, dims, NULL) && (size_t)rank == offset.size())
+		{
+			std::vector<hsize_t> start(offset.begin(), offset.end());
+			size_t values = 1;
+			for(int i=0; i<rank; i++)
+			{
+				count[i] = (start[i] < dims[i]) ? std::min(chunk[i], dims[i] - start[i]) : 0;
+				zero[i] = 0;
+				values *= chunk[i];
+			}
+			output.assign(values * H5Tget_size(datatype), '\0');
+
+			hid_t memspace = H5Screate_simple(rank, chunk, NULL);
+			if( memspace >= 0
+					&& H5Sselect_hyperslab(space, H5S_SELECT_SET, start.data(), NULL, count, NULL) >= 0
+					&& H5Sselect_hyperslab(memspace, H5S_SELECT_SET, zero, NULL, count, NULL) >= 0 )
+				done = H5Dread(dataset, datatype, memspace, space, H5P_DEFAULT, &output[0]) >= 0;
+			if(memspace >= 0)
+				H5Sclose(memspace);
+		}
+	}
+	if(datatype >= 0)
+		H5Tclose(datatype);
+	if(space >= 0)
+		H5Sclose(space);
+	if(plist >= 0)
+		H5Pclose(plist);
+	H5Dclose(dataset);
+	return done;
+}
+
+/**
+ *	\brief Lists where the chunks of dataset are stored, so that they can be read from the file directly.
+ *	\param [in] nxpath : full path of chunked dataset, its file has to be open.
+ *	\param [out] file_path : absolute path of file the chunks are stored in, see NXGateway::addressedFile.
+ *	\param [out] output : chunks written so far, in C order of their positions.
+ *	\return False if the dataset is not chunked, can't be opened, or its addresses are not offsets in one file.
+ *
+ *	Each chunk is looked up by its position, chunks never written are left out.
+ */
+bool NXGateway::chunkLocations(const std::string& nxpath, std::string& file_path, std::vector<ChunkLocation>& output)
+{
+	AccessLock access;
+	std::lock_guard<std::mutex> lock(_chunks_mutex);
+	hid_t dataset = openDataset(nxpath);
+	if(dataset < 0)
+		return false;
+
+	bool chunked = false;
+	hid_t plist = H5Dget_create_plist(dataset);
+	hid_t space = H5Dget_space(dataset);
+	if(plist >= 0 && space >= 0 && H5Pget_layout(plist) == H5D_CHUNKED)
+	{
+		hsize_t chunk[H5S_MAX_RANK], dims[H5S_MAX_RANK], position[H5S_MAX_RANK];
+		int rank = H5Pget_chunk(plist, H5S_MAX_RANK, chunk);
+		chunked = rank > 0 && rank == H5Sget_simple_extent_dims(space, dims, NULL);
+		bool empty = false;
+		for(int d=0; chunked && d<rank; d++)
+		{
+			empty = empty || dims[d] == 0;
+			position[d] = 0;
+		}
+
+		// the chunks are referred to by offsets in one file that can be found from anywhere
+		chunked = chunked && addressedFile(dataset, file_path);
+
+		output.clear();
+		while(chunked && !empty)
+		{
+			ChunkLocation location;
+			haddr_t address = HADDR_UNDEF;
+			hsize_t size = 0;
+			if( H5Dget_chunk_info_by_coord(dataset, position, &location.filter_mask, &address, &size) >= 0
+					&& address != HADDR_UNDEF && size > 0 )
+			{
+				location.offset.assign(position, position + rank);
+				location.address = address;
+				location.nbytes = size;
+				output.push_back(location);
+			}
+
+			// next position in C order
+			int d = rank - 1;
+			for(; d >= 0; d--)
+			{
+				position[d] += chunk[d];
+				if(position[d] < dims[d])
+					break;
+				position[d] = 0;
+			}
+			if(d < 0)
+				break;
+		}
+	}
+	if(space >= 0)
+		H5Sclose(space);
+	if(plist >= 0)
+		H5Pclose(plist);
+	H5Dclose(dataset);
+	return chunked;
+}
+
+/**
+ *	\brief Lists the chunks of dataset that were written, only they are stored in file.
+ *	\param [in] nxpath : full path of chunked dataset, its file has to be open.
+ *	\param [out] output : position of each chunk in the grid of chunks (offset divided by the chunk shape), in C order.
+ *	\return False if the dataset is not chunked or can't be opened.
+ */
+bool NXGateway::writtenChunks(const std::string& nxpath, std::vector<std::vector<size_t>>& output)
+{
+	AccessLock access;
+	std::lock_guard<std::mutex> lock(_chunks_mutex);
+	hid_t dataset = openDataset(nxpath);
+	if(dataset < 0)
+		return false;
+
+	bool chunked = false;
+	hid_t plist = H5Dget_create_plist(dataset);
+	hsize_t count = 0;
+	output.clear();
+	if(plist >= 0 && H5Pget_layout(plist) == H5D_CHUNKED && H5Dget_num_chunks(dataset, H5S_ALL, &count) >= 0)
+	{
+		hsize_t chunk[H5S_MAX_RANK], offset[H5S_MAX_RANK];
+		int rank = H5Pget_chunk(plist, H5S_MAX_RANK, chunk);
+		chunked = rank > 0;
+		// the chunks are listed in the order of the index of dataset
+		for(hsize_t i=0; chunked && i<count; i++)
+		{
+			unsigned filter_mask;
+			haddr_t address;
+			hsize_t size;
+			if( H5Dget_chunk_info(dataset, H5S_ALL, i, offset, &filter_mask, &address, &size) < 0 )
+				continue;
+			std::vector<size_t> position(rank);
+			for(int d=0; d<rank; d++)
+				position[d] = offset[d] / chunk[d];
+			output.push_back(position);
+		}
+		std::sort(output.begin(), output.end());
+	}
+	if(plist >= 0)
+		H5Pclose(plist);
+	H5Dclose(dataset);
+	return chunked;
+}
+
+/**
+ *	\brief Collects a string attribute, callback of H5Aiterate2.
+ */
+static herr_t collectStringAttribute(hid_t location, const char* name, const H5A_info_t* info, void* data)
+{
+	std::map<std::string, std::string>& output = *static_cast<std::map<std::string, std::string>*>(data);
+	hid_t attribute = H5Aopen(location, name, H5P_DEFAULT);
+	if(attribute < 0)
+		return 0;
+	hid_t datatype = H5Aget_type(attribute);
+	hid_t space = H5Aget_space(attribute);
+	if( datatype >= 0 && space >= 0 && H5Tget_class(datatype) == H5T_STRING && H5Sget_simple_extent_npoints(space) == 1 )
+	{
+		if( H5Tis_variable_str(datatype) > 0 )
+		{
+			char* value = NULL;
+			if( H5Aread(attribute, datatype, &value) >= 0 && value != NULL )
+			{
+				output[name] = value;
+				H5Dvlen_reclaim(datatype, space, H5P_DEFAULT, &value);
+			}
+		}
+		else
+		{
+			std::string value(H5Tget_size(datatype), '\0');
+			if( H5Aread(attribute, datatype, &value[0]) >= 0 )
+				output[name] = value.substr(0, value.find('\0'));
+		}
+	}
+	if(space >= 0)
+		H5Sclose(space);
+	if(datatype >= 0)
+		H5Tclose(datatype);
+	H5Aclose(attribute);
+	return 0;
+}
+
+/**
+ *	\brief Gets the string attributes of dataset, e.g. units.
+ *	\param [in] nxpath : full path of dataset, its file has to be open.
+ *	\return Values of scalar string attributes by their names, other attributes are left out.
+ */
+std::map<std::string, std::string> NXGateway::stringAttributes(const std::string& nxpath)
+{
+	AccessLock access;
+	std::map<std::string, std::string> output;
+	std::lock_guard<std::mutex> lock(_chunks_mutex);
+	hid_t dataset = openDataset(nxpath);
+	if(dataset < 0)
+		return output;
+	H5Aiterate2(dataset, H5_INDEX_NAME, H5_ITER_NATIVE, NULL, collectStringAttribute, &output);
+	H5Dclose(dataset);
+	return output;
+}
+
+/**
+ *	\brief Opens the file for reading.
+ *	\param [in] path : path of file.
+ */
+DirectFile::DirectFile(const std::string& path)
+{
+	fd = open(path.c_str(), O_RDONLY);
+}
+
+DirectFile::~DirectFile()
+{
+	if(fd >= 0)
+		close(fd);
+}
+
+/**
+ *	\brief Gets the file HDF5 addresses of object are offsets in.
+ *	\param [in] object : HDF5 object of the file.
+ *	\param [out] file_path : absolute path of file, with symbolic links resolved.
+ *	\return False if the path is not known, or the addresses are not offsets in one file (drivers other than sec2, e.g. family, split).
+ *
+ *	HDF5 gives the path the file was opened by, it may be relative to the working directory of NXFS.
+ */
+bool NXGateway::addressedFile(hid_t object, std::string& file_path)
+{
+	hid_t h5file = H5Iget_file_id(object);
+	hid_t access = (h5file >= 0) ? H5Fget_access_plist(h5file) : -1;
+	bool sec2 = access >= 0 && H5Pget_driver(access) == H5FD_SEC2;
+	if(access >= 0)
+		H5Pclose(access);
+	if(h5file >= 0)
+		H5Fclose(h5file);
+	ssize_t length = H5Fget_name(object, NULL, 0);
+	if(!sec2 || length <= 0)
+		return false;
+	std::string name(length + 1, '\0');
+	H5Fget_name(object, &name[0], length + 1);
+	name.resize(length);
+
+	char resolved[PATH_MAX];
+	if( realpath(name.c_str(), resolved) == NULL )
+		return false;
+	file_path = resolved;
+	return true;
+}
+
+/**
+ *	\brief Gets the file a dataset is stored in, if it can be referred to by offsets, see NXGateway::chunkLocations.
+ *	\param [in] nxpath : full path of dataset, its file has to be open.
+ *	\param [out] file_path : absolute path of file, see NXGateway::addressedFile.
+ *	\return False if the dataset can't be opened, or its addresses are not offsets in one file.
+ */
+bool NXGateway::storedFile(const std::string& nxpath, std::string& file_path)
+{
+	AccessLock access;
+	std::lock_guard<std::mutex> lock(_chunks_mutex);
+	hid_t dataset = openDataset(nxpath);
+	if(dataset < 0)
+		return false;
+	bool found = addressedFile(dataset, file_path);
+	H5Dclose(dataset);
+	return found;
+}
+
+/**
+ *	\brief Gets the file of HDF5 object opened for pread, it is opened once and kept until the file is closed.
+ *	\param [in] file : name of file in directory, see NXGateway::splitPath.
+ *	\param [in] object : HDF5 object of the file, the path of file is asked from it.
+ *	\return The file, NULL if it can't be opened or HDF5 addresses in it are not offsets in one file.
+ *
+ *	NXGateway#_chunks_mutex is locked.
+ */
+std::shared_ptr<const DirectFile> NXGateway::directFile(const std::string& file, hid_t object)
+{
+	auto it = _direct_files.find(file);
+	if( it != _direct_files.end() )
+		return it->second;
+
+	std::shared_ptr<const DirectFile> output;
+	std::string file_path;
+	if( !addressedFile(object, file_path) )
+		return output;
+
+	output = std::make_shared<const DirectFile>(file_path);
+	if(output->fd < 0)
+		return std::shared_ptr<const DirectFile>();
+	_direct_files[file] = output;
+	return output;
+}
+
+/**
+ *	\brief Gets where the values of dataset lie in NeXus file, if they can be read without HDF5.
+ *	\param [in] nxpath : full path of dataset, its file has to be open.
+ *	\param [out] output : the file opened for pread, the offset of values and their layout.
+ *	\return False if the values can't be read directly.
+ *
+ *	The values are read directly if the dataset is contiguous, its storage is allocated in the file itself
+ *	(not in external files) and the values in file are the same as in memory, i.e. of native type and byte order.
+ *	The answer is asked from HDF5 once per dataset, the files opened for pread are shared by their datasets.
+ */
+bool NXGateway::contiguousStorage(const std::string& nxpath, ContiguousStorage& output)
+{
+	{
+		std::lock_guard<std::mutex> lock(_chunks_mutex);
+		auto it = _contiguous.find(nxpath);
+		if( it != _contiguous.end() )
+		{
+			output = it->second;
+			return output.file != NULL;
+		}
+	}
+
+	AccessLock access;
+	std::lock_guard<std::mutex> lock(_chunks_mutex);
+
+	hid_t dataset = openDataset(nxpath);
+	// not remembered while the file of directory is closed
+	if(dataset < 0)
+		return false;
+
+	ContiguousStorage storage;
+	storage.offset = 0;
+	storage.value_bytes = 0;
+	hid_t plist = H5Dget_create_plist(dataset);
+	hid_t space = H5Dget_space(dataset);
+	hid_t datatype = H5Dget_type(dataset);
+	hid_t native = (datatype >= 0) ? H5Tget_native_type(datatype, H5T_DIR_DEFAULT) : -1;
+	if(plist >= 0 && space >= 0 && native >= 0 && H5Pget_layout(plist) == H5D_CONTIGUOUS
+			&& H5Pget_external_count(plist) == 0 && H5Tequal(datatype, native) > 0)
+	{
+		hsize_t dims[H5S_MAX_RANK];
+		int rank = H5Sget_simple_extent_dims(space, dims, NULL);
+		storage.dims.assign(dims, dims + ((rank > 0) ? rank : 0));
+		storage.value_bytes = H5Tget_size(datatype);
+		hsize_t nbytes = storage.value_bytes;
+		for(size_t dim : storage.dims)
+			nbytes *= dim;
+
+		// the address is undefined until the values are written
+		haddr_t address = H5Dget_offset(dataset);
+		if(address != HADDR_UNDEF && nbytes > 0 && H5Dget_storage_size(dataset) >= nbytes)
+		{
+			std::string file, inner;
+			splitPath(nxpath, file, inner);
+			storage.file = directFile(file, dataset);
+			storage.offset = address;
+		}
+	}
+	if(native >= 0)
+		H5Tclose(native);
+	if(datatype >= 0)
+		H5Tclose(datatype);
+	if(space >= 0)
+		H5Sclose(space);
+	if(plist >= 0)
+		H5Pclose(plist);
+	H5Dclose(dataset);
+
+	_contiguous.insert( std::make_pair(nxpath, storage) );
+	output = storage;
+	return output.file != NULL;
+}
+
+/**
+ *	\brief Gets where chunks are stored, for reading them without HDF5.
+ *	\param [in] nxpath : full path of chunked dataset, its file has to be open.
+ *	\param [in,out] chunks : chunks to be located, given by their ChunkLocation#offset.
+ *	\param [out] file : the file opened for pread the chunks lie in.
+ *	\return False if some chunk was never written, or the chunks can't be read directly.
+ *
+ *	All chunks are located while the dataset is opened once, so the chunk index is searched without other calls between.
+ */
+bool NXGateway::locateChunks(const std::string& nxpath, std::vector<ChunkLocation>& chunks, std::shared_ptr<const DirectFile>& file)
+{
+	AccessLock access;
+	std::lock_guard<std::mutex> lock(_chunks_mutex);
+	hid_t dataset = openDataset(nxpath);
+	if(dataset < 0)
+		return false;
+
+	bool located = true;
+	std::vector<hsize_t> position;
+	for(ChunkLocation& chunk : chunks)
+	{
+		position.assign(chunk.offset.begin(), chunk.offset.end());
+		haddr_t address = HADDR_UNDEF;
+		hsize_t size = 0;
+		if( H5Dget_chunk_info_by_coord(dataset, position.data(), &chunk.filter_mask, &address, &size) < 0
+				|| address == HADDR_UNDEF || size == 0 )
+		{
+			located = false;
+			break;
+		}
+		chunk.address = address;
+		chunk.nbytes = size;
+	}
+
+	if(located)
+	{
+		std::string name, inner;
+		splitPath(nxpath, name, inner);
+		file = directFile(name, dataset);
+		located = file != NULL;
+	}
+	H5Dclose(dataset);
+	return located;
 }
 
 /**
@@ -37,37 +1211,445 @@ NXGateway::~NXGateway() {
  * 	\param [in] nxpath : full path of NXObject to be returned.
  * 	\return NXObject
  * 	\throw NXFSException if nxobject is not found
+ *
+ *	The objects are kept open, so the path is resolved by HDF5 once. The least recently used ones are closed
+ *	when there are more than NXGateway::MAX_OPEN_OBJECTS.
  */
 pninx::NXObject NXGateway::getNXObjectByPath(const char* nxpath)
 {
-	if( !_nxfile.is_valid() )
-		throw NXFSException("NXGateway: Nexus file is not valid");
-	return _nxfile[nxpath];
+	AccessLock access;
+	std::string file, inner;
+	if( !splitPath(nxpath, file, inner) )
+		throw NXFSException("NXGateway: directory of NeXus files is not a NeXus object");
+
+	for(int attempt = 0; ; attempt++)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_objects_mutex);
+			pninx::NXFile* nxfile = &_nxfile;
+			if( !_directory.empty() )
+			{
+				auto opened = _open_files.find(file);
+				nxfile = (opened != _open_files.end()) ? &opened->second.nxfile : NULL;
+				if(nxfile != NULL)
+					_open_files_lru.splice(_open_files_lru.begin(), _open_files_lru, opened->second.lru);
+			}
+
+			if(nxfile != NULL)
+			{
+				if( !nxfile->is_valid() )
+					throw NXFSException("NXGateway: Nexus file is not valid");
+
+				auto it = _objects_index.find(nxpath);
+				if( it != _objects_index.end() )
+				{
+					_objects.splice(_objects.begin(), _objects, it->second);
+					return it->second->second;
+				}
+
+				pninx::NXObject nxobject = (*nxfile)[inner];
+				_objects.push_front( std::make_pair(std::string(nxpath), nxobject) );
+				_objects_index[nxpath] = _objects.begin();
+				if(_objects.size() > MAX_OPEN_OBJECTS)
+				{
+					_objects_index.erase(_objects.back().first);
+					_objects.pop_back();
+				}
+				return nxobject;
+			}
+		}
+		// the file of directory may be closed again by other threads meanwhile
+		if(attempt >= 2)
+			throw NXFSException("NXGateway: cannot keep NeXus file open");
+		openFile(file);
+	}
 }
 
 /**
- *	\brief Opens NeXus file.
- *	\param [in] nxfile_path : full path to locally stored NeXus file.
- *	\throw NXFSException if there is some troubles while opening NeXus file.
+ *	\brief Gets the generation of NeXus file, it changes each time the file or directory is loaded (reloaded).
+ *
+ *	Who gives back the access (NXGateway::AccessRelease) checks it when the access is taken again:
+ *	if it changed, what was read meanwhile may come from the new file, while the objects held are of the old one.
  */
-void NXGateway::load_file(const char* nxfile_path)
+unsigned long NXGateway::generation()
 {
-	if(_nxfile.is_valid())
-		_nxfile.close();
+	return _generation;
+}
+
+/**
+ *	\brief Tells whether a directory of NeXus files is opened, see NXGateway::load_directory.
+ */
+bool NXGateway::isDirectory()
+{
+	return !_directory.empty();
+}
+
+/**
+ *	\brief Gets the names of NeXus files in directory.
+ *	\return Names of files, empty if a single file is opened.
+ */
+std::vector<std::string> NXGateway::files()
+{
+	std::lock_guard<std::mutex> lock(_objects_mutex);
+	std::vector<std::string> output;
+	for(auto& entry : _file_times)
+		output.push_back(entry.first);
+	return output;
+}
+
+/**
+ *	\brief Gets the modification time of NeXus file.
+ *	\return The time the NeXus file was modified before it was (re)opened.
+ */
+struct timespec NXGateway::fileTime()
+{
+	return _file_time;
+}
+
+/**
+ *	\brief Gets the time NeXus object was modified.
+ *	\param [in] nxpath : full path of NeXus object.
+ *	\return The time the object was seen to grow (NXGateway::refreshFollowed), or the time of its NeXus file.
+ */
+struct timespec NXGateway::changeTime(const std::string& nxpath)
+{
+	{
+		std::lock_guard<std::mutex> lock(_metadata_mutex);
+		auto it = _change_times.find(nxpath);
+		if( it != _change_times.end() )
+			return it->second;
+	}
 
+	std::string file, inner;
+	if( _directory.empty() || !splitPath(nxpath, file, inner) )
+		return _file_time;
+	std::lock_guard<std::mutex> lock(_objects_mutex);
+	auto it = _file_times.find(file);
+	return (it != _file_times.end()) ? it->second : _file_time;
+}
+
+/**
+ *	\brief Gets the static information about NeXus object.
+ *	\param [in] nxpath : full path of NXObject.
+ *	\return Metadata of object, it is read from HDF5 once per NeXus file.
+ *	\throw NXFSException if nxobject is not found
+ */
+NXMetadata NXGateway::metadata(const std::string& nxpath)
+{
+	{
+		std::lock_guard<std::mutex> lock(_metadata_mutex);
+		auto it = _metadata.find(nxpath);
+		if( it != _metadata.end() )
+			return it->second;
+	}
 
-	if( strlen(nxfile_path) > 0 )
+	// the object is closed before the access is given back
+	AccessLock access;
+	pninx::NXObject nxobject = getNXObjectByPath( nxpath.c_str() );
+	NXMetadata output;
+	output.object_type = nxobject.object_type();
+	output.type_id = TypeID::NONE;
+	output.size = 0;
+	if(output.object_type == pni::nx::NXObjectType::NXFIELD)
 	{
-		try
+		pninx::NXField nxfield = (pninx::NXField) nxobject;
+		output.type_id = nxfield.type_id();
+		output.shape = nxfield.shape<shape_t>();
+		output.size = nxfield.size();
+		output.chunk = chunkShape(nxpath);
+	}
+
+	std::lock_guard<std::mutex> lock(_metadata_mutex);
+	_metadata.insert( std::make_pair(nxpath, output) );
+	return output;
+}
+
+/**
+ *	\brief Closes NeXus object kept open, so that it can be opened with other parameters.
+ *	\param [in] nxpath : full path of NXObject.
+ */
+void NXGateway::dropObject(const std::string& nxpath)
+{
+	std::lock_guard<std::mutex> lock(_objects_mutex);
+	auto it = _objects_index.find(nxpath);
+	if( it == _objects_index.end() )
+		return;
+	_objects.erase(it->second);
+	_objects_index.erase(it);
+}
+
+/**
+ *	\brief Closes NeXus object if it is kept open and forgets its metadata, e.g. when it changed in reloaded file.
+ *	\param [in] nxpath : full path of NeXus object.
+ */
+void NXGateway::forget(const std::string& nxpath)
+{
+	AccessLock access;
+	dropObject(nxpath);
+	{
+		std::lock_guard<std::mutex> lock(_metadata_mutex);
+		_metadata.erase(nxpath);
+	}
+	std::lock_guard<std::mutex> lock(_chunks_mutex);
+	_chunks.erase(nxpath);
+	_contiguous.erase(nxpath);
+}
+
+/**
+ *	\brief Adds NeXus object visited by NXGateway::scan to the list.
+ */
+static herr_t scanObject(hid_t object, const char* name, const H5O_info_t* info, void* data)
+{
+	std::map<std::string, time_t>& output = *static_cast<std::map<std::string, time_t>*>(data);
+	// HDF5 tracks the change time of datasets (e.g. extending one changes it), the modification time is usually 0
+	time_t mtime = (info->mtime > info->ctime) ? info->mtime : info->ctime;
+	if( strcmp(name, ".") == 0 )
+		output["/"] = mtime;
+	else
+		output["/" + std::string(name)] = mtime;
+	return 0;
+}
+
+/**
+ *	\brief Lists all NeXus objects of file with their modification times, in one pass over the file by HDF5.
+ *	\return Modification times, 0 if HDF5 doesn't track them. Key is a full path of NeXus object.
+ *	Empty if the file can't be listed.
+ */
+std::map<std::string, time_t> NXGateway::scan()
+{
+	AccessLock access;
+	std::map<std::string, time_t> output;
+	std::lock_guard<std::mutex> lock(_chunks_mutex);
+	if(_h5file < 0 || H5Ovisit(_h5file, H5_INDEX_NAME, H5_ITER_NATIVE, scanObject, &output) < 0)
+		output.clear();
+	return output;
+}
+
+/**
+ *	\brief Follows the extent of dataset while the file is being written, see NXGateway::refreshFollowed.
+ *	\param [in] nxpath : full path of NeXus field.
+ *
+ *	Only datasets of file opened for SWMR reading that can be extended are followed. The followed datasets are
+ *	forgotten when the file is reopened.
+ */
+void NXGateway::follow(const std::string& nxpath)
+{
+	AccessLock access;
+	std::lock_guard<std::mutex> lock(_chunks_mutex);
+	std::string file, inner;
+	hid_t h5file = splitPath(nxpath, file, inner) ? h5fileOf(file) : -1;
+	if(!_swmr || h5file < 0 || _followed.find(nxpath) != _followed.end())
+		return;
+
+	hid_t dataset = H5Dopen2(h5file, inner.c_str(), H5P_DEFAULT);
+	if(dataset < 0)
+		return;
+	hid_t space = H5Dget_space(dataset);
+	int rank = (space >= 0) ? H5Sget_simple_extent_ndims(space) : -1;
+	std::vector<hsize_t> dims( (rank > 0) ? rank : 0 ), maxdims( dims.size() );
+	bool extendible = false;
+	if(rank > 0 && H5Sget_simple_extent_dims(space, dims.data(), maxdims.data()) >= 0)
+		for(int d=0; d<rank; d++)
+			extendible = extendible || maxdims[d] != dims[d];
+	if(space >= 0)
+		H5Sclose(space);
+
+	if(!extendible)
+	{
+		H5Dclose(dataset);
+		return;
+	}
+	FollowedDataset followed;
+	followed.dataset = dataset;
+	followed.dims = dims;
+	_followed.insert( std::make_pair(nxpath, followed) );
+}
+
+/**
+ *	\brief Refreshes the extents of followed datasets, the writer may have extended them.
+ *	\return New shapes of datasets that grew, key is a path of dataset.
+ *
+ *	What was learned about the datasets that grew is forgotten (NXGateway::forget), and their change time and the one
+ *	of their groups is set to now.
+ */
+std::map<std::string, shape_t> NXGateway::refreshFollowed()
+{
+	AccessLock access;
+	std::map<std::string, shape_t> output;
+	{
+		std::lock_guard<std::mutex> lock(_chunks_mutex);
+		for(auto& entry : _followed)
 		{
-			_nxfile = pninx::NXFile::open_file(nxfile_path, true);
-		}catch (...) {
-			throw NXFSException("cannot open NeXus file");
+			FollowedDataset& followed = entry.second;
+			if( H5Drefresh(followed.dataset) < 0 )
+				continue;
+			hid_t space = H5Dget_space(followed.dataset);
+			if(space < 0)
+				continue;
+			std::vector<hsize_t> dims( followed.dims.size() );
+			if( H5Sget_simple_extent_ndims(space) == (int)dims.size()
+					&& H5Sget_simple_extent_dims(space, dims.data(), NULL) >= 0 && dims != followed.dims )
+			{
+				followed.dims = dims;
+				output[entry.first] = shape_t( dims.begin(), dims.end() );
+			}
+			H5Sclose(space);
 		}
 	}
-	else
+	if( output.empty() )
+		return output;
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	for(auto& entry : output)
 	{
+		forget(entry.first);
+		size_t pos = entry.first.find_last_of("/");
+		std::lock_guard<std::mutex> lock(_metadata_mutex);
+		_change_times[entry.first] = now;
+		_change_times[ (pos == 0) ? "/" : entry.first.substr(0, pos) ] = now;
+	}
+
+	// the chunk caches are planned for the old shape
+	std::lock_guard<std::mutex> lock(_chunk_caches_mutex);
+	for(auto& entry : output)
+	{
+		auto it = _chunk_caches.find(entry.first);
+		if( it != _chunk_caches.end() )
+			it->second.dims.assign( entry.second.begin(), entry.second.end() );
+	}
+	return output;
+}
+
+/**
+ *	\brief Closes all NeXus objects kept open and forgets their metadata.
+ */
+void NXGateway::clearObjects()
+{
+	AccessLock access;
+	{
+		std::lock_guard<std::mutex> lock(_objects_mutex);
+		_objects_index.clear();
+		_objects.clear();
+	}
+	std::lock_guard<std::mutex> lock(_metadata_mutex);
+	_metadata.clear();
+}
+
+/**
+ *	\brief Opens NeXus file.
+ *	\param [in] nxfile_path : full path to locally stored NeXus file.
+ *	\param [in] swmr : open the file for SWMR reading, while it is being written by other process.
+ *	\throw NXFSException if there is some troubles while opening NeXus file.
+ *
+ *	Metadata of NeXus objects is kept, the one reloading a file forgets what changed (NXGateway::forget, NXGateway::clearObjects).
+ *	The file opened before stays in service until the new one is open, so it is kept if the new one can't be opened;
+ *	except a file changed in place (the same inode), which is closed first, as HDF5 wouldn't read it again.
+ */
+void NXGateway::load_file(const char* nxfile_path, bool swmr)
+{
+	if( strlen(nxfile_path) == 0 )
 		throw NXFSException("NeXus file path is empty");
+
+	AccessLock access;
+	struct stat file_stat;
+	if( stat(nxfile_path, &file_stat) != 0 )
+		throw NXFSException("cannot open NeXus file");
+	// HDF5 gives the file already open instead of reading it again, so a file changed in place is closed first
+	if( file_stat.st_ino == _file_ino && file_stat.st_dev == _file_dev )
+		closeLoaded();
+
+	// HDF5 takes the access flags from the first handle of file, the handle opened by pninx shares it
+	hid_t h5file = -1;
+	if(swmr)
+		h5file = H5Fopen(nxfile_path, H5F_ACC_RDONLY | H5F_ACC_SWMR_READ, H5P_DEFAULT);
+	// files written without SWMR (e.g. in the old format) are read as they are
+	bool swmr_opened = (h5file >= 0);
+	pninx::NXFile nxfile;
+	try
+	{
+		nxfile = pninx::NXFile::open_file(nxfile_path, true);
+	}catch (...) {
+		if(h5file >= 0)
+			H5Fclose(h5file);
+		throw NXFSException("cannot open NeXus file");
+	}
+	if(h5file < 0)
+		h5file = H5Fopen(nxfile_path, H5F_ACC_RDONLY, H5P_DEFAULT);
+
+	// the old file is served until the new one is open
+	closeLoaded();
+	{
+		std::lock_guard<std::mutex> lock(_chunk_caches_mutex);
+		std::lock_guard<std::mutex> chunks_lock(_chunks_mutex);
+		std::lock_guard<std::mutex> objects_lock(_objects_mutex);
+		_nxfile = nxfile;
+		_h5file = h5file;
+		_swmr = swmr_opened;
+		_directory.clear();
+		_file_times.clear();
 	}
+	{
+		std::lock_guard<std::mutex> lock(_metadata_mutex);
+		_change_times.clear();
+	}
+
+	_file_time = file_stat.st_mtim;
+	_file_dev = file_stat.st_dev;
+	_file_ino = file_stat.st_ino;
+	_generation++;
 }
 
+/**
+ *	\brief Opens directory of NeXus files, each file is opened when its objects are asked for.
+ *	\param [in] directory_path : full path to locally stored directory.
+ *	\param [in] swmr : open the files for SWMR reading, while they are being written by other processes.
+ *	\throw NXFSException if the directory can't be read.
+ *
+ *	Files with .nx, .nxs, .h5, .hdf5 and .hdf extensions are taken. Paths of NeXus objects start with the name of their file,
+ *	e.g. /scan_0001.nx/entry/data. At most NXFS_MAX_OPEN_FILES (environment variable) files are kept open,
+ *	NXGateway::DEFAULT_MAX_OPEN_FILES by default.
+ */
+void NXGateway::load_directory(const char* directory_path, bool swmr)
+{
+	AccessLock access;
+	DIR* dir = opendir(directory_path);
+	if(dir == NULL)
+		throw NXFSException("cannot open directory of NeXus files");
+	std::map<std::string, struct timespec> file_times;
+	for(struct dirent* entry = readdir(dir); entry != NULL; entry = readdir(dir))
+	{
+		std::string name = entry->d_name;
+		size_t dot = name.find_last_of(".");
+		std::string extension = (dot == std::string::npos) ? "" : name.substr(dot);
+		if(extension != ".nx" && extension != ".nxs" && extension != ".h5" && extension != ".hdf5" && extension != ".hdf")
+			continue;
+		struct stat file_stat;
+		if( stat( (std::string(directory_path) + "/" + name).c_str(), &file_stat ) == 0 && S_ISREG(file_stat.st_mode) )
+			file_times[name] = file_stat.st_mtim;
+	}
+	closedir(dir);
+
+	const char* value = getenv("NXFS_MAX_OPEN_FILES");
+	int max_open_files = (value != NULL) ? atoi(value) : 0;
+
+	closeLoaded();
+	{
+		std::lock_guard<std::mutex> lock(_chunk_caches_mutex);
+		std::lock_guard<std::mutex> chunks_lock(_chunks_mutex);
+		std::lock_guard<std::mutex> objects_lock(_objects_mutex);
+		_directory = directory_path;
+		_file_times.swap(file_times);
+		_max_open_files = (max_open_files > 0) ? max_open_files : DEFAULT_MAX_OPEN_FILES;
+		_swmr = swmr;
+	}
+	{
+		std::lock_guard<std::mutex> lock(_metadata_mutex);
+		_change_times.clear();
+	}
+
+	struct stat directory_stat;
+	if( stat(directory_path, &directory_stat) == 0 )
+		_file_time = directory_stat.st_mtim;
+	_generation++;
+}
@@ -24,19 +24,248 @@
 #define NXGATEWAY_H_
 
 #include <pni/nx/NX.hpp>
+#include <pni/utils/Types.hpp>
+#include <hdf5.h>
+#include <sys/stat.h>
+#include <map>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
 #include "NXFSException.h"
+#include "enums.h"
 
 namespace pninx=pni::nx::h5;
 
+/**
+ *	Static information about NeXus object, it doesn't change while NeXus file is open.\n
+ *	Kept by NXGateway, so that file attributes are answered without HDF5.
+ */
+struct NXMetadata
+{
+	pni::nx::NXObjectType object_type; /*!< Field or group. */
+	TypeID type_id; /*!< Value type of field, TypeID::NONE for groups. */
+	shape_t shape; /*!< Shape of field, empty for groups. */
+	size_t size; /*!< Number of values of field, 0 for groups. */
+	std::vector<size_t> chunk; /*!< HDF5 chunk shape of field, empty if it is not chunked. */
+};
+
+/**
+ *	Filter of HDF5 filter pipeline the chunks of dataset are stored through.
+ */
+struct ChunkFilter
+{
+	H5Z_filter_t id; /*!< HDF5 filter, e.g. H5Z_FILTER_DEFLATE. */
+	std::vector<unsigned int> values; /*!< Parameters of filter, e.g. the compression level of deflate. */
+};
+
+/**
+ *	How the values of chunked dataset are stored, see NXGateway::chunkStorage.
+ */
+struct ChunkStorage
+{
+	std::vector<size_t> dims; /*!< Shape of dataset. */
+	std::vector<size_t> chunk; /*!< Chunk shape of dataset. */
+	std::vector<ChunkFilter> filters; /*!< Filter pipeline, in the order the filters are applied when the chunks are written. */
+	H5T_class_t type_class; /*!< H5T_INTEGER or H5T_FLOAT, values of other classes are not described further. */
+	bool is_signed; /*!< True if integers are signed. */
+	bool little_endian; /*!< Byte order of values in file. */
+	size_t value_bytes; /*!< Size of one value in bytes. */
+	double fill_value; /*!< Value of chunks not written, 0 if it is not defined. */
+};
+
+/**
+ *	Where a chunk is stored in NeXus file, see NXGateway::chunkLocations.
+ */
+struct ChunkLocation
+{
+	std::vector<size_t> offset; /*!< Position of the first value of chunk in dataset. */
+	haddr_t address; /*!< Byte offset of chunk in file. */
+	size_t nbytes; /*!< Size of chunk as stored. */
+	unsigned filter_mask; /*!< Filters skipped when the chunk was written, bit i stands for the filter i of pipeline. */
+};
+
+/**
+ *	File opened for reading with pread, closed when the last holder releases it.
+ */
+struct DirectFile
+{
+	int fd; /*!< File descriptor, -1 if the file can't be opened. */
+
+	DirectFile(const std::string& path);
+	~DirectFile();
+};
+
+/**
+ *	Where the values of contiguous dataset lie in NeXus file, see NXGateway::contiguousStorage.
+ */
+struct ContiguousStorage
+{
+	std::shared_ptr<const DirectFile> file; /*!< NeXus file opened for pread, NULL if the values can't be read directly. */
+	off_t offset; /*!< Byte offset of the first value in file. */
+	std::vector<size_t> dims; /*!< Shape of dataset, the values lie in C order. */
+	size_t value_bytes; /*!< Size of one value in bytes. */
+};
+
 class NXGateway {
 private:
 	static pninx::NXFile _nxfile;
+	static hid_t _h5file; /*!< The same file opened with HDF5 library, for the information pninx doesn't give. */
+	static struct timespec _file_time; /*!< Modification time of NeXus file when it was opened. */
+	static dev_t _file_dev; /*!< Device of NeXus file opened, see NXGateway::load_file. */
+	static ino_t _file_ino; /*!< Inode of NeXus file opened, 0 if none is. */
+	static std::atomic<unsigned long> _generation; /*!< Incremented each time a NeXus file or directory is loaded, see NXGateway::generation. */
+	static std::map<std::string, std::vector<size_t>> _chunks; /*!< Chunk shapes of datasets asked so far. */
+	static std::mutex _chunks_mutex; /*!< Guards NXGateway#_chunks, NXGateway#_h5file and NXGateway#_followed. */
+	static bool _swmr; /*!< True if the file is opened for SWMR reading, while it is being written. */
+	static std::map<std::string, ContiguousStorage> _contiguous; /*!< Storage of datasets asked so far, guarded by NXGateway#_chunks_mutex. */
+	static std::map<std::string, std::shared_ptr<const DirectFile>> _direct_files; /*!< NeXus files opened for pread, key is a name of file (see NXGateway::splitPath). Guarded by NXGateway#_chunks_mutex. */
+
+	/**
+	 *	Extendible dataset whose extent is followed while the file is being written.
+	 */
+	struct FollowedDataset
+	{
+		hid_t dataset; /*!< Handle kept open, H5Drefresh updates the extent seen by all handles of dataset. */
+		std::vector<hsize_t> dims; /*!< Extent seen at the last refresh. */
+	};
+	static std::map<std::string, FollowedDataset> _followed; /*!< Datasets followed, key is a path of dataset. */
+	static std::map<std::string, struct timespec> _change_times; /*!< Times NeXus objects were seen to grow. */
+
+	/**
+	 *	NeXus file of directory opened on demand, see NXGateway::load_directory.
+	 */
+	struct DirectoryFile
+	{
+		pninx::NXFile nxfile; /*!< The file opened by pninx. */
+		hid_t h5file; /*!< The same file opened with HDF5 library. */
+		std::list<std::string>::iterator lru; /*!< Position in NXGateway#_open_files_lru. */
+	};
+	static std::string _directory; /*!< Directory of NeXus files, empty if a single file is opened. */
+	static std::map<std::string, struct timespec> _file_times; /*!< Modification times of files of directory, key is a file name. */
+	static std::map<std::string, DirectoryFile> _open_files; /*!< Files of directory opened, key is a file name. */
+	static std::list<std::string> _open_files_lru; /*!< Names of files opened, the most recently used first. Guarded by NXGateway#_objects_mutex. */
+	static size_t _max_open_files; /*!< Number of files of directory kept open. */
+
+	static bool splitPath(const std::string& nxpath, std::string& file, std::string& inner);
+	static hid_t h5fileOf(const std::string& file);
+	static void openFile(const std::string& file);
+	static void closeFile(const std::string& file);
+	static void closeFiles();
+
+	typedef std::list<std::pair<std::string, pninx::NXObject>> object_list_t;
+	static object_list_t _objects; /*!< Opened NeXus objects, the most recently used first. */
+	static std::map<std::string, object_list_t::iterator> _objects_index; /*!< Opened NeXus objects by path. */
+	static std::mutex _objects_mutex; /*!< Guards NXGateway#_objects. */
+	static std::map<std::string, NXMetadata> _metadata; /*!< Metadata of NeXus objects asked so far. */
+	static std::mutex _metadata_mutex; /*!< Guards NXGateway#_metadata and NXGateway#_change_times. */
+
+	static void dropObject(const std::string& nxpath);
+	static hid_t openDataset(const std::string& nxpath);
+	static bool addressedFile(hid_t object, std::string& file_path);
+	static std::shared_ptr<const DirectFile> directFile(const std::string& file, hid_t object);
+
+	/**
+	 *	HDF5 chunk cache of one dataset.\n
+	 *	HDF5 takes the chunk cache parameters from the first handle that opens a dataset, and handles opened later
+	 *	(e.g. by pninx) share its cache. So the dataset is kept open here with the wanted parameters.
+	 */
+	struct ChunkCache
+	{
+		hid_t dataset; /*!< Handle keeping the cache, -1 if not opened yet. */
+		std::vector<size_t> dims; /*!< Shape of dataset. */
+		std::vector<size_t> chunk; /*!< Chunk shape of dataset. */
+		size_t chunk_bytes; /*!< Size of one chunk in bytes. */
+		size_t nbytes; /*!< Size of cache in effect. */
+		size_t wanted; /*!< Size of cache to be applied. */
+		size_t attempts; /*!< Attempts to apply NXGateway::ChunkCache#wanted while the dataset was open elsewhere. */
+		size_t reads; /*!< Reads since the last check. */
+		size_t partial_reads; /*!< Reads since the last check that didn't cover whole chunks. */
+		size_t touched_bytes; /*!< The largest size of chunks touched by one read since the last check. */
+	};
+	static std::map<std::string, ChunkCache> _chunk_caches; /*!< Chunk caches configured, key is a path of dataset. */
+	static std::atomic<bool> _chunk_caches_pending; /*!< True if some cache has to be applied. */
+	static std::mutex _chunk_caches_mutex; /*!< Guards NXGateway#_chunk_caches. */
+
+	static bool openChunkCache(ChunkCache& cache, const std::string& nxpath);
+	static void closeChunkCache(ChunkCache& cache);
+
+	static void close_h5file();
+	static void closeLoaded();
+
+	static std::mutex _access_mutex; /*!< Serializes the use of pninx and HDF5 by FUSE threads and read-ahead tasks, see NXGateway::lockAccess. */
+	static thread_local size_t _access_depth; /*!< How many times this thread took NXGateway#_access_mutex. */
 public:
+	/**
+	 *	Holds the access to NeXus files (NXGateway::lockAccess) while it lives.
+	 */
+	class AccessLock {
+	private:
+		AccessLock(const AccessLock&);
+		AccessLock& operator=(const AccessLock&);
+	public:
+		AccessLock();
+		~AccessLock();
+	};
+
+	/**
+	 *	Gives back the access to NeXus files while it lives, if this thread holds it, and takes it again then.\n
+	 *	Used while waiting for work that doesn't touch pninx or HDF5 in this process, e.g. a read by worker process,
+	 *	so that other requests go on meanwhile.
+	 */
+	class AccessRelease {
+	private:
+		size_t _depth; /*!< Depth of the access given back, 0 if this thread didn't hold it. */
+		AccessRelease(const AccessRelease&);
+		AccessRelease& operator=(const AccessRelease&);
+	public:
+		AccessRelease();
+		~AccessRelease();
+	};
+
 	NXGateway();
 	virtual ~NXGateway();
-	static void load_file(const char* nxfile_path);
+	static void lockAccess();
+	static void unlockAccess();
+	static void load_file(const char* nxfile_path, bool swmr = false);
+	static void load_directory(const char* directory_path, bool swmr = false);
+	static bool isDirectory();
+	static unsigned long generation();
+	static std::vector<std::string> files();
 
 	static pninx::NXObject getNXObjectByPath(const char* nxpath);
+	static NXMetadata metadata(const std::string& nxpath);
+	static struct timespec fileTime();
+	static struct timespec changeTime(const std::string& nxpath);
+	static void forget(const std::string& nxpath);
+	static void clearObjects();
+	static std::map<std::string, time_t> scan();
+
+	static void follow(const std::string& nxpath);
+	static std::map<std::string, shape_t> refreshFollowed();
+
+	static const size_t MAX_OPEN_OBJECTS; /*!< Number of NeXus objects kept open. */
+	static const size_t DEFAULT_MAX_OPEN_FILES; /*!< Number of files of directory kept open, unless NXFS_MAX_OPEN_FILES is set. */
+	static std::vector<size_t> chunkShape(const std::string& nxpath);
+	static bool chunkStorage(const std::string& nxpath, ChunkStorage& output);
+	static bool chunkInfo(const std::string& nxpath, const std::vector<size_t>& offset, unsigned& filter_mask, size_t& nbytes);
+	static bool readChunk(const std::string& nxpath, const std::vector<size_t>& offset, std::string& output, unsigned& filter_mask);
+	static bool readChunkValues(const std::string& nxpath, const std::vector<size_t>& offset, std::string& output);
+	static bool chunkLocations(const std::string& nxpath, std::string& file_path, std::vector<ChunkLocation>& output);
+	static bool writtenChunks(const std::string& nxpath, std::vector<std::vector<size_t>>& output);
+	static bool storedFile(const std::string& nxpath, std::string& file_path);
+	static std::map<std::string, std::string> stringAttributes(const std::string& nxpath);
+	static bool contiguousStorage(const std::string& nxpath, ContiguousStorage& output);
+	static bool locateChunks(const std::string& nxpath, std::vector<ChunkLocation>& chunks, std::shared_ptr<const DirectFile>& file);
+
+	static const size_t MAX_CHUNK_CACHE_BYTES; /*!< Chunk cache of one dataset doesn't grow beyond this size. */
+	static const size_t CHUNK_CACHE_CHECK_READS; /*!< Number of reads after which the size of chunk cache is checked. */
+
+	static void planChunkCache(const std::string& nxpath, RuleType type);
+	static void recordRead(const std::string& nxpath, const size_t* start, const size_t* count, size_t rank);
+	static void applyChunkCaches();
 };
 
 #endif /* NXGATEWAY_H_ */
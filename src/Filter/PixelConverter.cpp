@@ -0,0 +1,244 @@
+/*
+ * PixelConverter.cpp
+ *
+ *  Created on: Jul 15, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#include "PixelConverter.h"
+#include <pni/utils/Types.hpp>
+#include <tiffio.h>
+#include <limits>
+#include <vector>
+#include <type_traits>
+
+/**
+ *	Number of histogram bins used to find percentiles in PixelConverter::valueRange.
+ */
+static const size_t HISTOGRAM_BINS = 4096;
+
+/**
+ *	\brief Converts the values with linear mapping and clamping.
+ *
+ *	\param [in] src : values to be converted.
+ *	\param [in] n : number of values.
+ *	\param [out] dst : buffer for at least \a n converted values.
+ *	\param [in] offset : value subtracted before scaling.
+ *	\param [in] scale : factor applied after subtracting \a offset.
+ *	\param [in] out_min : minimal output value.
+ *	\param [in] out_max : maximal output value.
+ *
+ *	dst = clamp( (src - offset)*scale, out_min, out_max ), rounded to nearest (halves away from zero) for integer outputs. NaN becomes \a out_min.\n
+ *	The body has no branches the compiler can't turn into min/max instructions, so the loop is vectorized.
+ */
+template<typename T, typename D>
+void PixelConverter::convert(const T* __restrict__ src, size_t n, D* __restrict__ dst,
+		double offset, double scale, double out_min, double out_max)
+{
+	// float is precise enough for 8 and 16 bit and float outputs and twice as wide in SIMD registers
+	typedef typename std::conditional< ( sizeof(T) <= 4 && ( sizeof(D) <= 2 || std::is_same<D, float>::value ) ),
+			float, double >::type calc_t;
+	const calc_t c_offset = offset;
+	const calc_t c_scale = scale;
+	const calc_t c_min = out_min;
+	const calc_t c_max = out_max;
+	const calc_t rounding = std::is_integral<D>::value ? 0.5 : 0;
+
+	for(size_t i=0; i<n; i++)
+	{
+		calc_t v = ( (calc_t)src[i] - c_offset ) * c_scale;
+		v = v > c_min ? v : c_min;
+		v = v < c_max ? v : c_max;
+		// conversion truncates toward zero, so negative values are rounded down
+		dst[i] = (D)( v + (v < 0 ? -rounding : rounding) );
+	}
+}
+
+/**
+ *	\brief Finds the range of values.
+ *
+ *	\param [in] src : values.
+ *	\param [in] n : number of values.
+ *	\param [in] clip : percent of values to be ignored at each end of range, 0 means minimum and maximum.
+ *	\param [out] lo : lower bound of range.
+ *	\param [out] hi : upper bound of range.
+ *
+ *	NaN values are ignored. Percentiles are found from histogram, so they are precise to 1/4096 of value range.
+ */
+template<typename T>
+void PixelConverter::valueRange(const T* src, size_t n, double clip, double& lo, double& hi)
+{
+	T t_min = std::numeric_limits<T>::max();
+	T t_max = std::numeric_limits<T>::lowest();
+	for(size_t i=0; i<n; i++)
+	{
+		if( src[i] != src[i] )
+			continue;
+		t_min = src[i] < t_min ? src[i] : t_min;
+		t_max = src[i] > t_max ? src[i] : t_max;
+	}
+	lo = t_min;
+	hi = t_max;
+	if( n == 0 || lo > hi )
+	{
+		lo = 0;
+		hi = 0;
+		return;
+	}
+	if( clip <= 0 || lo == hi )
+		return;
+
+	std::vector<size_t> histogram(HISTOGRAM_BINS, 0);
+	const double bin_scale = (HISTOGRAM_BINS - 1) / (hi - lo);
+	size_t counted = 0;
+	for(size_t i=0; i<n; i++)
+	{
+		if( src[i] != src[i] )
+			continue;
+		histogram[ (size_t)( ( (double)src[i] - lo ) * bin_scale ) ]++;
+		counted++;
+	}
+
+	size_t threshold = (size_t)( counted * clip / 100.0 );
+	size_t low_bin = 0, high_bin = HISTOGRAM_BINS - 1;
+	for(size_t sum = 0; low_bin < HISTOGRAM_BINS - 1; low_bin++)
+	{
+		sum += histogram[low_bin];
+		if(sum > threshold)
+			break;
+	}
+	for(size_t sum = 0; high_bin > low_bin; high_bin--)
+	{
+		sum += histogram[high_bin];
+		if(sum > threshold)
+			break;
+	}
+
+	double full_lo = lo;
+	lo = full_lo + low_bin / bin_scale;
+	hi = full_lo + (high_bin + 1) / bin_scale;
+}
+
+/**
+ *	\brief Converts the values into the output format.
+ *
+ *	\param [in] src : values to be converted.
+ *	\param [in] n : number of values.
+ *	\param [out] dst : buffer for \a n values of PixelFormat#bit bits.
+ *	\param [in] format : output format, window has to be resolved already (PixelFormat#window_auto is ignored).
+ *
+ *	Integer outputs: the window is mapped onto the whole output range, without window values are saturated.\n
+ *	Floating point outputs: values are clamped to the window if there is one.
+ */
+template<typename T>
+void PixelConverter::convertTo(const T* src, size_t n, char* dst, const PixelFormat& format)
+{
+	double offset = 0, scale = 1;
+	bool is_float = (format.sampleformat == SAMPLEFORMAT_IEEEFP);
+
+	double out_min, out_max;
+	switch(format.bit)
+	{
+	case 8:
+		out_min = 0;
+		out_max = std::numeric_limits<uint8_t>::max();
+		break;
+	case 16:
+		out_min = 0;
+		out_max = std::numeric_limits<uint16_t>::max();
+		break;
+	case 64:
+		out_min = std::numeric_limits<double>::lowest();
+		out_max = std::numeric_limits<double>::max();
+		break;
+	default:
+		if(is_float)
+		{
+			out_min = std::numeric_limits<float>::lowest();
+			out_max = std::numeric_limits<float>::max();
+		}
+		else if(format.sampleformat == SAMPLEFORMAT_INT)
+		{
+			out_min = std::numeric_limits<int32_t>::min();
+			out_max = std::numeric_limits<int32_t>::max();
+		}
+		else
+		{
+			out_min = 0;
+			out_max = std::numeric_limits<uint32_t>::max();
+		}
+		break;
+	}
+
+	if(format.window)
+	{
+		if(is_float)
+		{
+			out_min = format.window_min;
+			out_max = format.window_max;
+		}
+		else
+		{
+			// window_min is mapped onto out_min, window_max onto out_max
+			double width = format.window_max - format.window_min;
+			scale = (width > 0) ? (out_max - out_min) / width : 0;
+			offset = (scale > 0) ? format.window_min - out_min / scale : format.window_min;
+		}
+	}
+
+	switch(format.bit)
+	{
+	case 8:
+		convert<T, uint8_t>(src, n, reinterpret_cast<uint8_t*>(dst), offset, scale, out_min, out_max);
+		break;
+	case 16:
+		convert<T, uint16_t>(src, n, reinterpret_cast<uint16_t*>(dst), offset, scale, out_min, out_max);
+		break;
+	case 64:
+		convert<T, double>(src, n, reinterpret_cast<double*>(dst), offset, scale, out_min, out_max);
+		break;
+	default:
+		if(is_float)
+			convert<T, float>(src, n, reinterpret_cast<float*>(dst), offset, scale, out_min, out_max);
+		else if(format.sampleformat == SAMPLEFORMAT_INT)
+			convert<T, int32_t>(src, n, reinterpret_cast<int32_t*>(dst), offset, scale, out_min, out_max);
+		else
+			convert<T, uint32_t>(src, n, reinterpret_cast<uint32_t*>(dst), offset, scale, out_min, out_max);
+		break;
+	}
+}
+
+/**
+ *	@name Explicit instantiations
+ *	The value types of NeXus fields which can be converted.
+ */
+///@{
+#define PIXELCONVERTER_INSTANTIATE(T) \
+	template void PixelConverter::valueRange<T>(const T*, size_t, double, double&, double&); \
+	template void PixelConverter::convertTo<T>(const T*, size_t, char*, const PixelFormat&);
+
+PIXELCONVERTER_INSTANTIATE(UInt8)
+PIXELCONVERTER_INSTANTIATE(Int8)
+PIXELCONVERTER_INSTANTIATE(UInt16)
+PIXELCONVERTER_INSTANTIATE(Int16)
+PIXELCONVERTER_INSTANTIATE(UInt32)
+PIXELCONVERTER_INSTANTIATE(Int32)
+PIXELCONVERTER_INSTANTIATE(Float32)
+PIXELCONVERTER_INSTANTIATE(Float64)
+PIXELCONVERTER_INSTANTIATE(Float128)
+///@}
@@ -0,0 +1,63 @@
+/*
+ * PixelConverter.h
+ *
+ *  Created on: Jul 15, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#ifndef PIXELCONVERTER_H_
+#define PIXELCONVERTER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ *	Describes how pixel values are written into TIFF.
+ */
+struct PixelFormat
+{
+	uint16_t bit; /*!< Bits per sample of output. */
+	uint16_t sampleformat; /*!< TIFF sample format of output: SAMPLEFORMAT_UINT, SAMPLEFORMAT_INT or SAMPLEFORMAT_IEEEFP. */
+	bool passthrough; /*!< True if the values read from NeXus file can be written as they are. */
+	bool window; /*!< True if values are mapped linearly from [window_min, window_max] onto the output range. */
+	bool window_auto; /*!< True if window has to be computed from the values, see PixelFormat#clip. */
+	double window_min; /*!< Value mapped onto the output minimum. */
+	double window_max; /*!< Value mapped onto the output maximum. */
+	double clip; /*!< Percent of values clipped at each end when window is computed from the values. */
+};
+
+/**
+ *	Class converts pixel values between types, e.g. from float reconstructions to 16 bit TIFF.\n
+ *	The loops are written to be vectorized by compiler, so conversion runs at memory bandwidth.
+ */
+class PixelConverter {
+private:
+	template<typename T, typename D>
+	static void convert(const T* __restrict__ src, size_t n, D* __restrict__ dst,
+			double offset, double scale, double out_min, double out_max);
+
+public:
+	template<typename T>
+	static void valueRange(const T* src, size_t n, double clip, double& lo, double& hi);
+
+	template<typename T>
+	static void convertTo(const T* src, size_t n, char* dst, const PixelFormat& format);
+};
+
+#endif /* PIXELCONVERTER_H_ */
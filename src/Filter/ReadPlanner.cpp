@@ -0,0 +1,268 @@
+/*
+ * ReadPlanner.cpp
+ *
+ *  Created on: Aug 5, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#include "ReadPlanner.h"
+#include "MemoryBudget.h"
+
+std::list<ReadPlanner::Block> ReadPlanner::_blocks;
+size_t ReadPlanner::_blocks_bytes = 0;
+std::map<std::string, size_t> ReadPlanner::_dataset_bytes;
+std::mutex ReadPlanner::_blocks_mutex;
+
+const size_t ReadPlanner::MAX_BLOCK_BYTES = 64*1024*1024;
+const size_t ReadPlanner::MAX_DATASET_BYTES = 4*ReadPlanner::MAX_BLOCK_BYTES;
+const size_t ReadPlanner::MAX_CACHED_BYTES = 384*1024*1024;
+const size_t ReadPlanner::MIN_BAND_BYTES = 1024*1024;
+
+/**
+ *	\brief Gets the axes of field that are rows and columns of image.
+ *	\param [in] axis : axis along which the image is sliced.
+ *	\param [out] row_axis : axis of image rows, i.e. of TIFF height.
+ *	\param [out] col_axis : axis of image columns, i.e. of TIFF width.
+ */
+void ReadPlanner::imageAxes(size_t axis, size_t& row_axis, size_t& col_axis)
+{
+	row_axis = (axis == 0) ? 1 : 0;
+	col_axis = (axis == 2) ? 1 : 2;
+}
+
+/**
+ *	\brief Gets the part of field that holds image rows.
+ *	\param [in] shape : shape of rank 3 field.
+ *	\param [in] axis : axis along which the image is sliced.
+ *	\param [in] index : number of slice along \a axis.
+ *	\param [in] first_row : first row of image.
+ *	\param [in] row_count : number of rows.
+ *	\return Hyperslab of rows, whole rows.
+ */
+Hyperslab ReadPlanner::imageRows(const std::vector<size_t>& shape, size_t axis, size_t index, size_t first_row, size_t row_count)
+{
+	size_t row_axis, col_axis;
+	imageAxes(axis, row_axis, col_axis);
+
+	Hyperslab rows;
+	rows.start[axis] = index;
+	rows.count[axis] = 1;
+	rows.start[row_axis] = first_row;
+	rows.count[row_axis] = row_count;
+	rows.start[col_axis] = 0;
+	rows.count[col_axis] = shape[col_axis];
+	return rows;
+}
+
+/**
+ *	\brief Splits image rows at chunk boundaries.
+ *	\param [in] chunk : HDF5 chunk shape of field, empty if the field is not chunked.
+ *	\param [in] value_size : size of one value in bytes.
+ *	\param [in] axis : axis along which the image is sliced.
+ *	\param [in] rows : image rows needed, see ReadPlanner::imageRows.
+ *	\return Bands of rows, each one spans whole chunk rows along the row axis except at the ends of rows.
+ *
+ *	Each band is planned and read alone, so a block holds the neighbouring slices of a few rows
+ *	instead of a few neighbouring rows of one slice. Chunk rows are merged into a band until it holds
+ *	ReadPlanner::MIN_BAND_BYTES, so small chunks don't turn into many small reads, as long as the band
+ *	extended along the slice axis still fits in ReadPlanner::MAX_BLOCK_BYTES.
+ */
+std::vector<Hyperslab> ReadPlanner::bands(const std::vector<size_t>& chunk, size_t value_size, size_t axis, const Hyperslab& rows)
+{
+	std::vector<Hyperslab> output;
+	size_t row_axis, col_axis;
+	imageAxes(axis, row_axis, col_axis);
+	if(chunk.size() != 3 || chunk[row_axis] == 0 || rows.count[row_axis] == 0)
+	{
+		output.push_back(rows);
+		return output;
+	}
+
+	// bytes of one image row, and of one row of the block extended along the slice axis
+	size_t row_bytes = rows.count[col_axis] * value_size;
+	size_t block_row_bytes = row_bytes * (chunk[axis] ? chunk[axis] : 1);
+	size_t row = rows.start[row_axis];
+	size_t end = rows.start[row_axis] + rows.count[row_axis];
+	while(row < end)
+	{
+		size_t band_end = (row / chunk[row_axis] + 1) * chunk[row_axis];
+		while(band_end < end && (band_end - row) * row_bytes < MIN_BAND_BYTES
+			&& (band_end + chunk[row_axis] - row) * block_row_bytes <= MAX_BLOCK_BYTES)
+			band_end += chunk[row_axis];
+		if(band_end > end)
+			band_end = end;
+		Hyperslab band = rows;
+		band.start[row_axis] = row;
+		band.count[row_axis] = band_end - row;
+		output.push_back(band);
+		row = band_end;
+	}
+	return output;
+}
+
+/**
+ *	\brief Plans the block to be read for image rows.
+ *	\param [in] shape : shape of rank 3 field.
+ *	\param [in] chunk : HDF5 chunk shape of field, empty if the field is not chunked.
+ *	\param [in] value_size : size of one value of field in bytes.
+ *	\param [in] axis : axis along which the image is sliced.
+ *	\param [in] rows : image rows needed, one band of ReadPlanner::bands.
+ *	\return Block to be read. It contains \a rows, extended to chunk boundaries along each axis,
+ *	as long as it isn't larger than ReadPlanner::MAX_BLOCK_BYTES.
+ *
+ *	The neighbouring slices are extended first: the chunk holds them anyway, and without them
+ *	the chunk is decompressed again for each slice. Then the rows of image are extended.
+ */
+Hyperslab ReadPlanner::plan(const std::vector<size_t>& shape, const std::vector<size_t>& chunk, size_t value_size,
+		size_t axis, const Hyperslab& rows)
+{
+	Hyperslab block = rows;
+	if(chunk.size() != 3 || shape.size() != 3)
+		return block;
+
+	size_t row_axis, col_axis;
+	imageAxes(axis, row_axis, col_axis);
+
+	const size_t order[3] = { axis, row_axis, col_axis };
+	for(size_t d : order)
+	{
+		if(chunk[d] == 0)
+			continue;
+		Hyperslab extended = block;
+		size_t begin = (block.start[d] / chunk[d]) * chunk[d];
+		size_t end = ( (block.start[d] + block.count[d] + chunk[d] - 1) / chunk[d] ) * chunk[d];
+		if(end > shape[d])
+			end = shape[d];
+		extended.start[d] = begin;
+		extended.count[d] = end - begin;
+		if(extended.elements() * value_size <= MAX_BLOCK_BYTES)
+			block = extended;
+	}
+	return block;
+}
+
+/**
+ *	\brief Looks for a block held that contains image rows.
+ *	\param [in] nxpath : path of NeXus field.
+ *	\param [in] rows : image rows needed.
+ *	\param [out] slab : part of field held by found block.
+ *	\param [out] data : values of found block.
+ *	\return True if such block is held.
+ */
+bool ReadPlanner::findBlock(const std::string& nxpath, const Hyperslab& rows, Hyperslab& slab, std::shared_ptr<const void>& data)
+{
+	std::lock_guard<std::mutex> lock(_blocks_mutex);
+	for(auto it = _blocks.begin(); it != _blocks.end(); it++)
+	{
+		if(it->nxpath == nxpath && it->slab.contains(rows))
+		{
+			_blocks.splice(_blocks.begin(), _blocks, it);
+			slab = _blocks.front().slab;
+			data = _blocks.front().data;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ *	\brief Keeps block for following requests, the least recently used blocks are dropped if there is no room.
+ *
+ *	The memory of blocks is taken from MemoryBudget, the block is not kept if it can't be had even without the other blocks.
+ *	\param [in] nxpath : path of NeXus field.
+ *	\param [in] slab : part of field held by block.
+ *	\param [in] data : values of block.
+ *	\param [in] bytes : size of \a data in bytes.
+ */
+void ReadPlanner::storeBlock(const std::string& nxpath, const Hyperslab& slab, std::shared_ptr<const void> data, size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(_blocks_mutex);
+
+	// the least recently used blocks of the same field first, so one field doesn't push out the others
+	auto dataset_it = _dataset_bytes.find(nxpath);
+	for(auto it = _blocks.end(); it != _blocks.begin() && dataset_it != _dataset_bytes.end()
+			&& dataset_it->second + bytes > MAX_DATASET_BYTES; )
+	{
+		--it;
+		if(it->nxpath == nxpath)
+		{
+			dropBlock(it++);
+			dataset_it = _dataset_bytes.find(nxpath);
+		}
+	}
+	while( !_blocks.empty() && _blocks_bytes + bytes > MAX_CACHED_BYTES )
+		dropBlock( --_blocks.end() );
+	while( !MemoryBudget::reserve(bytes) )
+	{
+		if( _blocks.empty() )
+			return;
+		dropBlock( --_blocks.end() );
+	}
+
+	Block block;
+	block.nxpath = nxpath;
+	block.slab = slab;
+	block.data = std::move(data);
+	block.bytes = bytes;
+	_blocks.push_front(block);
+	_blocks_bytes += bytes;
+	_dataset_bytes[nxpath] += bytes;
+}
+
+/**
+ *	\brief Drops a block held. ReadPlanner#_blocks_mutex is locked.
+ *	\param [in] it : block to be dropped.
+ */
+void ReadPlanner::dropBlock(std::list<Block>::iterator it)
+{
+	MemoryBudget::release(it->bytes);
+	_blocks_bytes -= it->bytes;
+	auto dataset_it = _dataset_bytes.find(it->nxpath);
+	dataset_it->second -= it->bytes;
+	if(dataset_it->second == 0)
+		_dataset_bytes.erase(dataset_it);
+	_blocks.erase(it);
+}
+
+/**
+ *	\brief Drops all blocks, e.g. when NeXus file is reopened.
+ */
+void ReadPlanner::clear()
+{
+	std::lock_guard<std::mutex> lock(_blocks_mutex);
+	MemoryBudget::release(_blocks_bytes);
+	_blocks.clear();
+	_blocks_bytes = 0;
+	_dataset_bytes.clear();
+}
+
+/**
+ *	\brief Drops blocks of NeXus field, e.g. when it changed in reloaded file.
+ *	\param [in] nxpath : full path of NeXus field.
+ */
+void ReadPlanner::forget(const std::string& nxpath)
+{
+	std::lock_guard<std::mutex> lock(_blocks_mutex);
+	for(auto it = _blocks.begin(); it != _blocks.end(); )
+	{
+		auto next = std::next(it);
+		if(it->nxpath == nxpath)
+			dropBlock(it);
+		it = next;
+	}
+}
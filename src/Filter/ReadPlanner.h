@@ -0,0 +1,144 @@
+/*
+ * ReadPlanner.h
+ *
+ *  Created on: Aug 5, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#ifndef READPLANNER_H_
+#define READPLANNER_H_
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+
+/**
+ *	Rectangular part of rank 3 NeXus field: start and count along each dimension.
+ */
+struct Hyperslab
+{
+	size_t start[3]; /*!< First index along each dimension. */
+	size_t count[3]; /*!< Number of indices along each dimension. */
+
+	/**
+	 *	\brief Gets the number of elements.
+	 */
+	size_t elements() const { return count[0]*count[1]*count[2]; }
+	/**
+	 *	\brief Checks whether \a other lies within this hyperslab.
+	 */
+	bool contains(const Hyperslab& other) const
+	{
+		for(int d=0; d<3; d++)
+			if(other.start[d] < start[d] || other.start[d] + other.count[d] > start[d] + count[d])
+				return false;
+		return true;
+	}
+	bool operator==(const Hyperslab& other) const
+	{
+		for(int d=0; d<3; d++)
+			if(start[d] != other.start[d] || count[d] != other.count[d])
+				return false;
+		return true;
+	}
+};
+
+/**
+ *	Plans reads of image rows from rank 3 NeXus field, so that HDF5 chunks are not decompressed again and again.\n
+ *	An image is a slice along one axis of the field: rows and columns are the other two axes in their order.
+ *	Rows requested for an image are split into bands of whole chunk rows. Each band is extended to whole chunks, first
+ *	along the slice axis (as long as the block stays small), the block is read with one hyperslab and kept,
+ *	so neighbouring slices and rows are taken from memory and each chunk is decompressed once.
+ */
+class ReadPlanner {
+private:
+	/**
+	 *	Block read from NeXus field and kept for following requests.
+	 */
+	struct Block
+	{
+		std::string nxpath; /*!< Path of NeXus field. */
+		Hyperslab slab; /*!< Part of field held. */
+		std::shared_ptr<const void> data; /*!< Values of block in C order, the type is the type of field. */
+		size_t bytes; /*!< Size of data in bytes. */
+	};
+
+	static std::list<Block> _blocks; /*!< Blocks held, the most recently used first. */
+	static size_t _blocks_bytes; /*!< Overall size of blocks held. */
+	static std::map<std::string, size_t> _dataset_bytes; /*!< Size of blocks held for each NeXus field. */
+	static std::mutex _blocks_mutex; /*!< Guards ReadPlanner#_blocks and ReadPlanner#_dataset_bytes. */
+
+	static void dropBlock(std::list<Block>::iterator it);
+
+public:
+	static const size_t MAX_BLOCK_BYTES; /*!< Blocks are not extended beyond this size. */
+	static const size_t MAX_DATASET_BYTES; /*!< Size of blocks held for one NeXus field. */
+	static const size_t MAX_CACHED_BYTES; /*!< Overall size of blocks held. */
+	static const size_t MIN_BAND_BYTES; /*!< Chunk rows are merged into bands of at least this size. */
+
+	static void imageAxes(size_t axis, size_t& row_axis, size_t& col_axis);
+	static Hyperslab imageRows(const std::vector<size_t>& shape, size_t axis, size_t index, size_t first_row, size_t row_count);
+	static std::vector<Hyperslab> bands(const std::vector<size_t>& chunk, size_t value_size, size_t axis, const Hyperslab& rows);
+	static Hyperslab plan(const std::vector<size_t>& shape, const std::vector<size_t>& chunk, size_t value_size,
+			size_t axis, const Hyperslab& rows);
+
+	static bool findBlock(const std::string& nxpath, const Hyperslab& rows, Hyperslab& slab, std::shared_ptr<const void>& data);
+	static void storeBlock(const std::string& nxpath, const Hyperslab& slab, std::shared_ptr<const void> data, size_t bytes);
+	static void clear();
+	static void forget(const std::string& nxpath);
+
+	/**
+	 *	\brief Copies image rows out of block.
+	 *	\param [in] block : values of block in C order.
+	 *	\param [in] slab : part of field held by \a block.
+	 *	\param [in] rows : part of field to be copied, image rows planned by ReadPlanner::imageRows.
+	 *	\param [in] axis : axis along which the image is sliced.
+	 *	\param [out] output : buffer for rows, one after another.
+	 */
+	template<typename T>
+	static void extract(const T* block, const Hyperslab& slab, const Hyperslab& rows, size_t axis, T* output)
+	{
+		size_t row_axis, col_axis;
+		imageAxes(axis, row_axis, col_axis);
+
+		size_t stride[3];
+		stride[2] = 1;
+		stride[1] = slab.count[2];
+		stride[0] = slab.count[1]*slab.count[2];
+
+		size_t base = 0;
+		for(int d=0; d<3; d++)
+			base += (rows.start[d] - slab.start[d]) * stride[d];
+
+		for(size_t r=0; r<rows.count[row_axis]; r++)
+		{
+			const T* src = block + base + r*stride[row_axis];
+			size_t col_stride = stride[col_axis];
+			for(size_t c=0; c<rows.count[col_axis]; c++)
+				output[c] = src[c*col_stride];
+			output += rows.count[col_axis];
+		}
+	}
+};
+
+#endif /* READPLANNER_H_ */
@@ -0,0 +1,384 @@
+/*
+ * ReadWorkers.cpp
+ *
+ *  Created on: Sep 2, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#include "ReadWorkers.h"
+#include "ReadPlanner.h"
+#include "NXGateway.h"
+#include "../ErrorLog.h"
+#include <hdf5.h>
+#include <map>
+#include <memory>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+
+ReadWorkers::Header* ReadWorkers::_header = NULL;
+std::vector<ReadWorkers::Worker> ReadWorkers::_workers;
+std::mutex ReadWorkers::_mutex;
+std::condition_variable ReadWorkers::_free;
+
+const size_t ReadWorkers::SLOT_DATA_BYTES = ReadPlanner::MAX_BLOCK_BYTES;
+
+/**
+ *	Chunk cache of datasets opened by worker, blocks planned by ReadPlanner are mostly whole chunks.
+ */
+static const size_t WORKER_CHUNK_CACHE_BYTES = 16*1024*1024;
+
+/**
+ *	Files of directory kept open by worker, all are closed when there are more.
+ */
+static const size_t WORKER_MAX_OPEN_FILES = 16;
+
+/**
+ *	\brief Gets the time \a seconds from now, for sem_timedwait.
+ */
+static struct timespec deadline(time_t seconds)
+{
+	struct timespec output;
+	clock_gettime(CLOCK_REALTIME, &output);
+	output.tv_sec += seconds;
+	return output;
+}
+
+/**
+ *	\brief Gets the number of workers asked for by NXFS_READ_WORKERS environment variable.
+ *	\return Number of workers, 0 if it is not set.
+ */
+size_t ReadWorkers::countFromEnvironment()
+{
+	const char* value = getenv("NXFS_READ_WORKERS");
+	if(value == NULL)
+		return 0;
+	int count = atoi(value);
+	return (count > 0) ? count : 0;
+}
+
+/**
+ *	\brief Forks worker processes.
+ *	\param [in] count : number of workers, nothing is done if it is 0.
+ *	\param [in] nxfile_path : path of NeXus file, or of directory of NeXus files.
+ *	\param [in] swmr : open NeXus file for SWMR reading, while it is being written.
+ *
+ *	It has to be called while FUSE process has a single thread and no HDF5 file open.
+ *	Workers exit when FUSE process is gone: they hold the read end of a pipe, whose write end FUSE process holds.
+ */
+void ReadWorkers::start(size_t count, const std::string& nxfile_path, bool swmr)
+{
+	if(count == 0 || _header != NULL)
+		return;
+
+	size_t slot_bytes = ( (sizeof(Slot) + 63) / 64 ) * 64 + SLOT_DATA_BYTES;
+	size_t bytes = sizeof(Header) + count*slot_bytes;
+	void* memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(memory == MAP_FAILED)
+	{
+		ErrorLog::log_write("ReadWorkers: cannot map shared memory: %s\n", strerror(errno));
+		return;
+	}
+
+	int alive[2];
+	if(pipe(alive) != 0)
+	{
+		munmap(memory, bytes);
+		return;
+	}
+
+	_header = static_cast<Header*>(memory);
+	_header->generation = 0;
+	_header->refreshes = 0;
+	_header->swmr = swmr ? 1 : 0;
+	struct stat path_stat;
+	_header->directory = ( stat(nxfile_path.c_str(), &path_stat) == 0 && S_ISDIR(path_stat.st_mode) ) ? 1 : 0;
+	strncpy(_header->nxfile_path, nxfile_path.c_str(), sizeof(_header->nxfile_path) - 1);
+
+	char* next = static_cast<char*>(memory) + sizeof(Header);
+	for(size_t i=0; i<count; i++)
+	{
+		Worker worker;
+		worker.slot = reinterpret_cast<Slot*>(next);
+		worker.data = next + ( (sizeof(Slot) + 63) / 64 ) * 64;
+		worker.busy = false;
+		worker.alive = true;
+		next += slot_bytes;
+		sem_init(&worker.slot->request, 1, 0);
+		sem_init(&worker.slot->done, 1, 0);
+
+		worker.pid = fork();
+		if(worker.pid == 0)
+		{
+			close(alive[1]);
+			work(worker.slot, worker.data, alive[0]);
+			_exit(0);
+		}
+		if(worker.pid < 0)
+		{
+			ErrorLog::log_write("ReadWorkers: cannot fork worker: %s\n", strerror(errno));
+			break;
+		}
+		_workers.push_back(worker);
+	}
+	close(alive[0]);
+}
+
+/**
+ *	\brief Loop of worker process: reads the hyperslabs it is asked for.
+ *	\param [in] slot : request and reply.
+ *	\param [in] data : buffer for values read.
+ *	\param [in] alive_fd : read end of pipe, it is closed by FUSE process when it exits.
+ */
+void ReadWorkers::work(Slot* slot, char* data, int alive_fd)
+{
+	std::map<std::string, hid_t> files;
+	unsigned generation = _header->generation - 1;
+	unsigned refreshes = _header->refreshes;
+	std::map<std::string, hid_t> datasets;
+	hid_t dapl = H5Pcreate(H5P_DATASET_ACCESS);
+	H5Pset_chunk_cache(dapl, 1009, WORKER_CHUNK_CACHE_BYTES, H5D_CHUNK_CACHE_W0_DEFAULT);
+	H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
+
+	for(;;)
+	{
+		struct timespec timeout = deadline(1);
+		if(sem_timedwait(&slot->request, &timeout) != 0)
+		{
+			struct pollfd fd = { alive_fd, POLLIN, 0 };
+			if(errno == ETIMEDOUT && poll(&fd, 1, 0) > 0)
+				_exit(0);
+			continue;
+		}
+
+		// in directory mode the path of dataset starts with the name of its file
+		std::string name, inner = slot->nxpath;
+		if(_header->directory)
+		{
+			const char* end = strchr(slot->nxpath + 1, '/');
+			name = (end == NULL) ? std::string(slot->nxpath + 1) : std::string(slot->nxpath + 1, end - slot->nxpath - 1);
+			inner = (end == NULL) ? "/" : std::string(end);
+		}
+
+		if(generation != _header->generation || (files.find(name) == files.end() && files.size() >= WORKER_MAX_OPEN_FILES))
+		{
+			for(auto& entry : datasets)
+				H5Dclose(entry.second);
+			datasets.clear();
+			for(auto& entry : files)
+				H5Fclose(entry.second);
+			files.clear();
+			generation = _header->generation;
+			refreshes = _header->refreshes;
+		}
+		else if(refreshes != _header->refreshes)
+		{
+			for(auto& entry : datasets)
+				H5Drefresh(entry.second);
+			refreshes = _header->refreshes;
+		}
+
+		hid_t file = -1;
+		auto opened = files.find(name);
+		if(opened != files.end())
+			file = opened->second;
+		else
+		{
+			std::string path = _header->directory ? std::string(_header->nxfile_path) + "/" + name : std::string(_header->nxfile_path);
+			if(_header->swmr)
+				file = H5Fopen(path.c_str(), H5F_ACC_RDONLY | H5F_ACC_SWMR_READ, H5P_DEFAULT);
+			if(file < 0)
+				file = H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+			if(file >= 0)
+				files.insert( std::make_pair(name, file) );
+		}
+
+		slot->status = -1;
+		hid_t dataset = -1;
+		auto it = datasets.find(slot->nxpath);
+		if(it != datasets.end())
+			dataset = it->second;
+		else if(file >= 0 && (dataset = H5Dopen2(file, inner.c_str(), dapl)) >= 0)
+			datasets.insert( std::make_pair(std::string(slot->nxpath), dataset) );
+
+		if(dataset >= 0)
+		{
+			hsize_t start[8], count[8];
+			size_t bytes = slot->value_size;
+			for(size_t d=0; d<slot->rank; d++)
+			{
+				start[d] = slot->start[d];
+				count[d] = slot->count[d];
+				bytes *= count[d];
+			}
+
+			hid_t type = H5Dget_type(dataset);
+			hid_t native = H5Tget_native_type(type, H5T_DIR_ASCEND);
+			hid_t filespace = H5Dget_space(dataset);
+			hid_t memspace = H5Screate_simple(slot->rank, count, NULL);
+			if(native >= 0 && H5Tget_size(native) == slot->value_size && bytes <= SLOT_DATA_BYTES
+					&& H5Sget_simple_extent_ndims(filespace) == (int)slot->rank
+					&& H5Sselect_hyperslab(filespace, H5S_SELECT_SET, start, NULL, count, NULL) >= 0
+					&& H5Dread(dataset, native, memspace, filespace, H5P_DEFAULT, data) >= 0)
+				slot->status = 0;
+			H5Sclose(memspace);
+			H5Sclose(filespace);
+			if(native >= 0)
+				H5Tclose(native);
+			H5Tclose(type);
+		}
+
+		sem_post(&slot->done);
+	}
+}
+
+/**
+ *	\brief Reads hyperslab of dataset by one of workers.
+ *	\param [in] nxpath : path of dataset.
+ *	\param [in] start : first index along each dimension.
+ *	\param [in] count : number of indices along each dimension.
+ *	\param [in] rank : rank of dataset.
+ *	\param [in] value_size : size of one value in bytes.
+ *	\param [out] output : buffer for values in C order.
+ *	\return False if there are no workers, the hyperslab doesn't fit into ReadWorkers::SLOT_DATA_BYTES
+ *	or the worker couldn't read it. The caller reads it itself then.
+ *
+ *	The caller waits for a free worker, the access to NeXus files (NXGateway::lockAccess) is given back meanwhile.
+ *	If the file was reloaded meanwhile (NXGateway::generation), false is returned too, as the worker may have read the new file,
+ *	and the caller reads the hyperslab through the objects of old file it holds.
+ */
+bool ReadWorkers::read(const std::string& nxpath, const size_t* start, const size_t* count, size_t rank,
+		size_t value_size, void* output)
+{
+	if(_workers.empty() || rank > 8 || nxpath.length() >= sizeof(Slot::nxpath))
+		return false;
+	size_t bytes = value_size;
+	for(size_t d=0; d<rank; d++)
+		bytes *= count[d];
+	if(bytes > SLOT_DATA_BYTES)
+		return false;
+
+	// the worker has its own handle on NeXus file, other requests use pninx and HDF5 meanwhile
+	unsigned long generation = NXGateway::generation();
+	std::unique_ptr<NXGateway::AccessRelease> release(new NXGateway::AccessRelease());
+	Worker* worker = NULL;
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		for(;;)
+		{
+			bool any_alive = false;
+			for(Worker& candidate : _workers)
+			{
+				any_alive = any_alive || candidate.alive;
+				if(candidate.alive && !candidate.busy)
+				{
+					worker = &candidate;
+					break;
+				}
+			}
+			if(worker != NULL || !any_alive)
+				break;
+			_free.wait(lock);
+		}
+		if(worker == NULL)
+			return false;
+		worker->busy = true;
+	}
+
+	Slot* slot = worker->slot;
+	strcpy(slot->nxpath, nxpath.c_str());
+	slot->rank = rank;
+	for(size_t d=0; d<rank; d++)
+	{
+		slot->start[d] = start[d];
+		slot->count[d] = count[d];
+	}
+	slot->value_size = value_size;
+	sem_post(&slot->request);
+
+	bool answered = false;
+	for(;;)
+	{
+		struct timespec timeout = deadline(1);
+		if(sem_timedwait(&slot->done, &timeout) == 0)
+		{
+			answered = true;
+			break;
+		}
+		if(errno != EINTR && errno != ETIMEDOUT)
+			break;
+		if(!isAlive(*worker))
+			break;
+	}
+
+	// the access is taken again before the generation is checked
+	release.reset();
+	bool read = answered && slot->status == 0 && NXGateway::generation() == generation;
+	if(read)
+		memcpy(output, worker->data, bytes);
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		worker->busy = false;
+		if(!answered)
+		{
+			worker->alive = false;
+			ErrorLog::log_write("ReadWorkers: worker %d stopped, %s is read by FUSE process\n", (int)worker->pid, nxpath.c_str());
+		}
+	}
+	_free.notify_all();
+	return read;
+}
+
+/**
+ *	\brief Checks whether worker process still runs.
+ *	\param [in] worker : worker to be checked.
+ */
+bool ReadWorkers::isAlive(Worker& worker)
+{
+	// workers are children of FUSE process unless it was daemonized
+	int status;
+	if(waitpid(worker.pid, &status, WNOHANG) == worker.pid)
+		return false;
+	return kill(worker.pid, 0) == 0;
+}
+
+/**
+ *	\brief Makes workers reopen NeXus file before their next read, e.g. when it was updated.
+ */
+void ReadWorkers::reopen()
+{
+	if(_header != NULL)
+		__sync_fetch_and_add(&_header->generation, 1);
+}
+
+/**
+ *	\brief Makes workers refresh the extents of datasets they opened before their next read, e.g. when the file being written grew.
+ */
+void ReadWorkers::refresh()
+{
+	if(_header != NULL)
+		__sync_fetch_and_add(&_header->refreshes, 1);
+}
@@ -0,0 +1,103 @@
+/*
+ * ReadWorkers.h
+ *
+ *  Created on: Sep 2, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#ifndef READWORKERS_H_
+#define READWORKERS_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <semaphore.h>
+#include <sys/types.h>
+
+/**
+ *	Helper processes reading hyperslabs from NeXus file.\n
+ *	HDF5 serializes all calls of one process, so reads of concurrent requests wait for each other. Each worker
+ *	process has its own handle on NeXus file, reads and decompresses the hyperslab it is asked for, and returns
+ *	the values through memory shared with FUSE process. The request gives back the access to NeXus files while it waits
+ *	(NXGateway::AccessRelease), so blocks of concurrent requests are read at once, as many as there are workers.\n
+ *	Workers are forked before NeXus file is opened and before any thread is started.
+ */
+class ReadWorkers {
+private:
+	/**
+	 *	Memory shared by all workers.
+	 */
+	struct Header
+	{
+		unsigned generation; /*!< Changed when NeXus file is reopened, workers reopen it before the next read. */
+		unsigned refreshes; /*!< Changed when datasets of NeXus file being written grew, workers refresh them before the next read. */
+		int swmr; /*!< Non-zero if NeXus file is opened for SWMR reading. */
+		int directory; /*!< Non-zero if ReadWorkers::Header#nxfile_path is a directory, paths of datasets start with the name of file then. */
+		char nxfile_path[4096]; /*!< Path of NeXus file, or of directory of NeXus files. */
+	};
+
+	/**
+	 *	Memory shared with one worker: request, reply and values read.
+	 */
+	struct Slot
+	{
+		sem_t request; /*!< Posted by FUSE process when request is written. */
+		sem_t done; /*!< Posted by worker when reply is written. */
+		char nxpath[1024]; /*!< Path of dataset. */
+		size_t rank; /*!< Rank of dataset. */
+		size_t start[8]; /*!< First index of hyperslab along each dimension. */
+		size_t count[8]; /*!< Number of indices of hyperslab along each dimension. */
+		size_t value_size; /*!< Size of one value in bytes, the values are read in native type of dataset of that size. */
+		int status; /*!< Reply: 0 if the values were read. */
+	};
+
+	/**
+	 *	Worker process as seen by FUSE process.
+	 */
+	struct Worker
+	{
+		pid_t pid; /*!< Process of worker. */
+		Slot* slot; /*!< Request and reply. */
+		char* data; /*!< Buffer for values, ReadWorkers::SLOT_DATA_BYTES long. */
+		bool busy; /*!< True while a request is served. */
+		bool alive; /*!< False if the worker stopped answering. */
+	};
+
+	static Header* _header; /*!< Memory shared by all workers, NULL if there are no workers. */
+	static std::vector<Worker> _workers; /*!< Worker processes. */
+	static std::mutex _mutex; /*!< Guards ReadWorkers#_workers. */
+	static std::condition_variable _free; /*!< Signaled when a worker gets free. */
+
+	static void work(Slot* slot, char* data, int alive_fd);
+	static bool isAlive(Worker& worker);
+
+public:
+	static const size_t SLOT_DATA_BYTES; /*!< The largest hyperslab in bytes a worker can return. */
+
+	static void start(size_t count, const std::string& nxfile_path, bool swmr = false);
+	static size_t countFromEnvironment();
+	static bool read(const std::string& nxpath, const size_t* start, const size_t* count, size_t rank,
+			size_t value_size, void* output);
+	static void reopen();
+	static void refresh();
+};
+
+#endif /* READWORKERS_H_ */
@@ -0,0 +1,332 @@
+/*
+ * Readahead.cpp
+ *
+ *  Created on: Aug 19, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#include "Readahead.h"
+#include "FSTree.h"
+#include "NXGateway.h"
+#include "ThreadPool.h"
+#include "NXFSException.h"
+#include "MemoryBudget.h"
+#include <unistd.h>
+#include <vector>
+
+std::map<std::string, Readahead::Stream> Readahead::_streams;
+std::map<std::string, Readahead::Prefetched> Readahead::_files;
+size_t Readahead::_files_bytes = 0;
+size_t Readahead::_generation = 0;
+std::mutex Readahead::_mutex;
+
+const size_t Readahead::SEQUENTIAL_RUN = 2;
+const size_t Readahead::MAX_DEPTH = 32;
+const size_t Readahead::MAX_BYTES = 256*1024*1024;
+const double Readahead::IDLE_TIME = 10;
+
+/**
+ *	\brief Records that a file is being read, and starts reading ahead if slices of its folder are read in order.
+ *	\param [in] fsobj : file being read, only computed slice files are followed.
+ *
+ *	A file is read by several requests, the stream advances when the next slice is requested.
+ */
+void Readahead::access(const FSObject& fsobj)
+{
+	if( !fsobj.slice.is_slice )
+		return;
+
+	size_t pos = fsobj.fullpath.find_last_of("/");
+	if(pos == std::string::npos)
+		return;
+	std::string folder = (pos == 0) ? "/" : fsobj.fullpath.substr(0, pos);
+	size_t index = fsobj.slice.index;
+	auto now = std::chrono::steady_clock::now();
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	expireIdle(now);
+	auto it = _streams.find(folder);
+	if( it == _streams.end() )
+	{
+		Stream stream;
+		stream.index = index;
+		stream.run = 0;
+		stream.last_time = now;
+		stream.access_time = now;
+		stream.consume_time = 0;
+		stream.produce_time = 0;
+		stream.ahead = index;
+		stream.target = index;
+		stream.working = false;
+		_streams.insert( std::make_pair(folder, stream) );
+		return;
+	}
+
+	Stream& stream = it->second;
+	stream.access_time = now;
+	if(index == stream.index)
+		return;
+
+	if(index == stream.index + 1)
+	{
+		double elapsed = std::chrono::duration<double>(now - stream.last_time).count();
+		stream.consume_time = (stream.run == 0) ? elapsed : 0.75*stream.consume_time + 0.25*elapsed;
+		stream.run++;
+	}
+	else
+	{
+		stream.run = 0;
+		stream.ahead = index;
+		stream.target = index;
+	}
+	stream.index = index;
+	stream.last_time = now;
+	dropConsumed(folder, index, stream.run == 0);
+
+	if(stream.run < SEQUENTIAL_RUN)
+		return;
+
+	std::shared_ptr<FSTree> tree = FSTree::current();
+	FSObject* folder_fsobj = tree->tryFind( folder.c_str() );
+	if( folder_fsobj != NULL )
+		schedule(folder, stream, *folder_fsobj);
+}
+
+/**
+ *	\brief Decides how far to read ahead and starts the task reading ahead if there is none.
+ *	\param [in] folder : full path of slice folder.
+ *	\param [in,out] stream : state of folder, Readahead#_mutex is locked.
+ *	\param [in] folder_fsobj : slice folder.
+ *
+ *	Depth is the number of slices consumed while one slice is read ahead, plus one. It is at least the rest of
+ *	the HDF5 chunk along the slice axis: the chunk is decompressed anyway and kept by ReadPlanner.
+ */
+void Readahead::schedule(const std::string& folder, Stream& stream, const FSObject& folder_fsobj)
+{
+	// chunk files (FSObject::setChunkKeys) are read in parallel by their consumers, not in order
+	if(folder_fsobj.slice_count == 0 || !folder_fsobj.slice_grid.empty())
+		return;
+
+	size_t depth = 1;
+	if(stream.consume_time > 0)
+		depth = (size_t)(stream.produce_time / stream.consume_time) + 1;
+
+	std::vector<size_t> chunk = NXGateway::chunkShape( folder_fsobj.getNXObjectPath() );
+	if( folder_fsobj.slice_axis < chunk.size() && chunk[folder_fsobj.slice_axis] > 1 )
+	{
+		size_t chunk_rest = chunk[folder_fsobj.slice_axis] - 1 - stream.index % chunk[folder_fsobj.slice_axis];
+		if(depth < chunk_rest)
+			depth = chunk_rest;
+	}
+	if(depth > MAX_DEPTH)
+		depth = MAX_DEPTH;
+
+	if(stream.ahead < stream.index)
+		stream.ahead = stream.index;
+	size_t target = stream.index + depth;
+
+	// don't read ahead more than memory allows, slices already read ahead are counted by Readahead::budget
+	FSObject current;
+	if( folder_fsobj.sliceAt( std::to_string(stream.index) + folder_fsobj.slice_extension, current ) )
+	{
+		size_t slice_size = current.size();
+		if(slice_size > 0 && target > stream.ahead + budget() / slice_size)
+			target = stream.ahead + budget() / slice_size;
+	}
+
+	if(target > folder_fsobj.slice_count - 1)
+		target = folder_fsobj.slice_count - 1;
+	if(target > stream.target)
+		stream.target = target;
+
+	if( !stream.working && stream.ahead < stream.target )
+	{
+		stream.working = true;
+		size_t generation = _generation;
+		ThreadPool::shared().run( [folder, generation]() { Readahead::readAhead(folder, generation); } );
+	}
+}
+
+/**
+ *	\brief Task reading slices ahead of consumer one by one until the target of stream is reached.
+ *	\param [in] folder : full path of slice folder.
+ *	\param [in] generation : Readahead#_generation the task was started in, it stops if files were cleared since.
+ */
+void Readahead::readAhead(std::string folder, size_t generation)
+{
+	for(;;)
+	{
+		size_t index;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			auto it = _streams.find(folder);
+			if( it == _streams.end() || generation != _generation )
+				return;
+			Stream& stream = it->second;
+			if( stream.ahead >= stream.target )
+			{
+				stream.working = false;
+				return;
+			}
+			index = ++stream.ahead;
+		}
+
+		// the tree holds the Rule of slice while it is read
+		std::shared_ptr<FSTree> tree = FSTree::current();
+		FSObject slice;
+		FileContent content;
+		// the slice is read through the same pninx handles and HDF5 library as FUSE reads
+		NXGateway::lockAccess();
+		auto start = std::chrono::steady_clock::now();
+		try{
+			const FSObject& folder_fsobj = tree->find( folder.c_str() );
+			if( folder_fsobj.sliceAt( std::to_string(index) + folder_fsobj.slice_extension, slice ) )
+				content = slice.readContent();
+		}catch (...) {
+			slice.fullpath.clear();
+		}
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		NXGateway::unlockAccess();
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		auto it = _streams.find(folder);
+		if( it == _streams.end() || generation != _generation )
+			return;
+		Stream& stream = it->second;
+		if( slice.fullpath.empty() )
+		{
+			stream.working = false;
+			return;
+		}
+		stream.produce_time = (stream.produce_time == 0) ? elapsed : 0.75*stream.produce_time + 0.25*elapsed;
+
+		// the consumer could have passed this slice or jumped elsewhere meanwhile
+		if( index > stream.index && _files.find(slice.fullpath) == _files.end() )
+		{
+			Prefetched file;
+			file.folder = folder;
+			file.index = index;
+			file.content = content;
+			file.bytes = content.memoryBytes();
+			// the caches sharing the memory are full, the consumer reads the slice itself
+			if( !MemoryBudget::reserve(file.bytes) )
+			{
+				stream.working = false;
+				return;
+			}
+			_files.insert( std::make_pair(slice.fullpath, file) );
+			_files_bytes += file.bytes;
+		}
+	}
+}
+
+/**
+ *	\brief Gets the content of file read ahead.
+ *	\param [in] fspath : full path of file.
+ *	\param [out] output : content of file.
+ *	\return True if the file was read ahead.
+ */
+bool Readahead::find(const std::string& fspath, FileContent& output)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto it = _files.find(fspath);
+	if( it == _files.end() )
+		return false;
+
+	output = it->second.content;
+	return true;
+}
+
+/**
+ *	\brief Drops the files of folder the consumer has passed.
+ *	\param [in] folder : full path of slice folder.
+ *	\param [in] index : number of slice being read, files before it are dropped.
+ *	\param [in] jumped : true if the consumer left the sequence, the files after \a index are dropped too.
+ *
+ *	Readahead#_mutex is locked.
+ */
+void Readahead::dropConsumed(const std::string& folder, size_t index, bool jumped)
+{
+	for(auto it = _files.begin(); it != _files.end(); )
+	{
+		if( it->second.folder == folder && ( it->second.index < index || (jumped && it->second.index != index) ) )
+		{
+			MemoryBudget::release(it->second.bytes);
+			_files_bytes -= it->second.bytes;
+			it = _files.erase(it);
+		}
+		else
+			it++;
+	}
+}
+
+/**
+ *	\brief Forgets the folders not read for Readahead::IDLE_TIME, e.g. when the consumer stopped, and drops their files.
+ *	\param [in] now : time of the current access.
+ *
+ *	Readahead#_mutex is locked. Tasks still reading ahead for them stop after the slice they are reading.
+ */
+void Readahead::expireIdle(std::chrono::steady_clock::time_point now)
+{
+	for(auto it = _streams.begin(); it != _streams.end(); )
+	{
+		if( std::chrono::duration<double>(now - it->second.access_time).count() < IDLE_TIME )
+		{
+			it++;
+			continue;
+		}
+		for(auto file = _files.begin(); file != _files.end(); )
+		{
+			if(file->second.folder != it->first)
+			{
+				file++;
+				continue;
+			}
+			MemoryBudget::release(file->second.bytes);
+			_files_bytes -= file->second.bytes;
+			file = _files.erase(file);
+		}
+		it = _streams.erase(it);
+	}
+}
+
+/**
+ *	\brief Gets the memory left for files read ahead.
+ *	\return Bytes left of Readahead::MAX_BYTES, not more than a quarter of free system memory.
+ *	Readahead#_mutex is locked.
+ */
+size_t Readahead::budget()
+{
+	size_t free_memory = (size_t)sysconf(_SC_AVPHYS_PAGES) * (size_t)sysconf(_SC_PAGE_SIZE) / 4;
+	size_t limit = (MAX_BYTES < free_memory) ? MAX_BYTES : free_memory;
+	return (_files_bytes < limit) ? limit - _files_bytes : 0;
+}
+
+/**
+ *	\brief Drops all files read ahead and forgets the streams, e.g. when NeXus file is reopened.
+ *	Tasks reading ahead stop after the slice they are reading.
+ */
+void Readahead::clear()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	MemoryBudget::release(_files_bytes);
+	_files.clear();
+	_files_bytes = 0;
+	_streams.clear();
+	_generation++;
+}
@@ -0,0 +1,93 @@
+/*
+ * Readahead.h
+ *
+ *  Created on: Aug 19, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#ifndef READAHEAD_H_
+#define READAHEAD_H_
+
+#include <stdio.h>
+#include <string>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include "FSObject.h"
+#include "FileContent.h"
+
+/**
+ *	Detects slice files of a folder being read one after another (0.tif, 1.tif, ...) and reads the next slices
+ *	in background, so that they are served from memory when the consumer gets to them.\n
+ *	The number of slices read ahead follows the speed of consumer: it is the number of slices the consumer reads
+ *	while one slice is prepared, at least the rest of the HDF5 chunk along the slice axis, and it is limited by memory.\n
+ *	Slices are read while holding the access to NeXus files (NXGateway::lockAccess), like FUSE reads do.
+ */
+class Readahead {
+private:
+	/**
+	 *	Slice folder being read.
+	 */
+	struct Stream
+	{
+		size_t index; /*!< Number of the last slice read. */
+		size_t run; /*!< Number of slices read one after another. */
+		std::chrono::steady_clock::time_point last_time; /*!< Time the last slice was started to be read. */
+		std::chrono::steady_clock::time_point access_time; /*!< Time of the last request for a slice of folder, see Readahead::expireIdle. */
+		double consume_time; /*!< Average time the consumer takes per slice, in seconds. */
+		double produce_time; /*!< Average time of reading one slice ahead, in seconds. */
+		size_t ahead; /*!< Slices up to this one are read ahead or being read. */
+		size_t target; /*!< Slices up to this one have to be read ahead. */
+		bool working; /*!< True while a task is reading ahead. */
+	};
+
+	/**
+	 *	Slice file read ahead.
+	 */
+	struct Prefetched
+	{
+		std::string folder; /*!< Full path of slice folder. */
+		size_t index; /*!< Number of slice. */
+		FileContent content; /*!< Content of file. */
+		size_t bytes; /*!< Memory reserved for it from MemoryBudget. */
+	};
+
+	static std::map<std::string, Stream> _streams; /*!< Slice folders being read, key is a full path of folder. */
+	static std::map<std::string, Prefetched> _files; /*!< Slice files read ahead, key is a full path of file. */
+	static size_t _files_bytes; /*!< Overall size of files read ahead, reserved from MemoryBudget. */
+	static size_t _generation; /*!< Changed by Readahead::clear, reads started before are dropped. */
+	static std::mutex _mutex; /*!< Guards all members. */
+
+	static void schedule(const std::string& folder, Stream& stream, const FSObject& folder_fsobj);
+	static void readAhead(std::string folder, size_t generation);
+	static void dropConsumed(const std::string& folder, size_t index, bool jumped);
+	static void expireIdle(std::chrono::steady_clock::time_point now);
+	static size_t budget();
+
+public:
+	static const size_t SEQUENTIAL_RUN; /*!< Number of slices read in order before reading ahead starts. */
+	static const size_t MAX_DEPTH; /*!< Maximum number of slices read ahead of consumer. */
+	static const size_t MAX_BYTES; /*!< Maximum overall size of files read ahead. */
+	static const double IDLE_TIME; /*!< Seconds after which a folder not read any more is forgotten with its files read ahead. */
+
+	static void access(const FSObject& fsobj);
+	static bool find(const std::string& fspath, FileContent& output);
+	static void clear();
+};
+
+#endif /* READAHEAD_H_ */
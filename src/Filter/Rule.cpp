@@ -188,12 +188,39 @@ std::string Rule::read(pninx::NXObject& nxobject)
 	return str;
 }
 
+/**
+ *	\brief Reads the representation of \a nxobject passed.
+ *	\param [in] nxobject : NeXus object that has to be represented.
+ *	\param [in] slice : part of \a nxobject represented by file.
+ *	\return File content, one segment containing the result of Rule::read by default.
+ *
+ *	Rules that can serve their data without joining it into one string override this method.
+ */
+FileContent Rule::readContent(pninx::NXObject& nxobject, const SliceRef& slice)
+{
+	return FileContent( read(nxobject) );
+}
+
+/**
+ *	\brief Reads a part of the representation of \a nxobject without reading the whole content.
+ *	\param [in] nxobject : NeXus object that has to be represented.
+ *	\param [in] slice : part of \a nxobject represented by file.
+ *	\param [in] size : maximum number of bytes.
+ *	\param [in] offset : offset from the file begin.
+ *	\param [out] output : the requested part of file content.
+ *	\return False if the rule needs the whole content to serve any part of it (default), then \a output is untouched.
+ */
+bool Rule::readRange(pninx::NXObject& nxobject, const SliceRef& slice, size_t size, off_t offset, FileContent& output)
+{
+	return false;
+}
+
 /**
  *	\brief Gets the type of file system object.
- *	\param [in] nxobject : NeXus object that has to be represented as an object of filesytem.
+ *	\param [in] metadata : metadata of NeXus object that has to be represented as an object of filesytem.
  *	\return The type of filesystem object.
  */
-FSType Rule::getattr(pninx::NXObject& nxobject)
+FSType Rule::getattr(const NXMetadata& metadata)
 {
 	std::map<std::string,std::string>::iterator option_fstype = options.find("fsobject_type");
 
@@ -204,7 +231,7 @@ FSType Rule::getattr(pninx::NXObject& nxobject)
 	}
 	else
 	{
-		if( nxobject.object_type() == pni::nx::NXObjectType::NXGROUP )
+		if( metadata.object_type == pni::nx::NXObjectType::NXGROUP )
 			return FSType::FOLDER;
 		else
 			return FSType::FILE;
@@ -252,6 +279,42 @@ size_t Rule::size(pninx::NXObject& nxobject)
 	return sz;
 }
 
+/**
+ *	\brief Gets size of file content.
+ *	\param [in] nxobject : The NeXus object that has to be represented.
+ *	\param [in] slice : part of \a nxobject represented by file.
+ *	\return The size of representation, Rule::size of whole \a nxobject by default.
+ */
+size_t Rule::size(pninx::NXObject& nxobject, const SliceRef& slice)
+{
+	return size(nxobject);
+}
+
+/**
+ *	\brief Gets size of file content without opening NeXus object.
+ *	\param [in] metadata : metadata of NeXus object that has to be represented, see NXGateway::metadata.
+ *	\param [in] slice : part of NeXus object represented by file.
+ *	\param [out] size : the size of representation, the same as Rule::size gives.
+ *	\return False if the size can't be computed from metadata, Rule::size has to be called then.
+ *
+ *	Only plain data is sized here, with the same guess Rule::size makes. Rules that represent objects
+ *	in another way get false unless they override it with their own size.
+ */
+bool Rule::sizeFromMetadata(const NXMetadata& metadata, const SliceRef& slice, size_t& size)
+{
+	size = 0;
+	if(type != RuleType::PLAINDATA)
+		return false;
+	if(metadata.object_type == pni::nx::NXObjectType::NXFIELD)
+	{
+		size = metadata.size;
+		auto entity_size_it = types_size.find(metadata.type_id);
+		if(entity_size_it != types_size.end())
+			size += size*entity_size_it->second;
+	}
+	return true;
+}
+
 /**
  *	\brief Adds or removes the extension as a mandatory option, in accordance with the fsobject_type
  */
@@ -23,6 +23,8 @@
 #ifndef RULE_H_
 #define RULE_H_
 #include "enums.h"
+#include "FileContent.h"
+#include "NXGateway.h"
 #include <pni/nx/NX.hpp>
 #include <stdio.h>
 #include <map>
@@ -53,6 +55,24 @@ struct subFiles
 };
 
 
+/**
+ *	Identifies the part of NeXus object represented by a file, e.g. one slice of rank 3 field shown as a folder of images.\n
+ *	It is passed with each request, so one Rule serves all slices. The full path of NeXus object is passed with it,
+ *	pninx knows the path within the file only.
+ */
+struct SliceRef
+{
+	bool is_slice; /*!< False if the file represents the whole NeXus object. */
+	size_t index; /*!< Number of slice along \a axis. */
+	size_t axis; /*!< Dimension the slice is taken along, 0 for slices of the first dimension. */
+	size_t bin; /*!< Binning factor of the image, 1 for full resolution. */
+	std::string nxpath; /*!< Full path of NeXus object, in directory mode it starts with the name of file (see NXGateway::splitPath). */
+
+	SliceRef() : is_slice(false), index(0), axis(0), bin(1) {}
+	explicit SliceRef(const std::string& object_path) : is_slice(false), index(0), axis(0), bin(1), nxpath(object_path) {}
+	explicit SliceRef(size_t slice_index, size_t slice_axis = 0, size_t slice_bin = 1) : is_slice(true), index(slice_index), axis(slice_axis), bin(slice_bin) {}
+};
+
 class Rule {
 private:
 	/**
@@ -154,10 +174,14 @@ public:
 	bool isValidOptions();
 
 	//methods for FUSE
-	virtual FSType getattr(pninx::NXObject &nxobject);
+	virtual FSType getattr(const NXMetadata& metadata);
 	//virtual std::vector<std::string> readdir(pninx::NXObject &nxobject);
 	virtual std::string read(pninx::NXObject &nxobject);
+	virtual FileContent readContent(pninx::NXObject &nxobject, const SliceRef& slice);
+	virtual bool readRange(pninx::NXObject &nxobject, const SliceRef& slice, size_t size, off_t offset, FileContent& output);
 	virtual size_t size(pninx::NXObject &nxobject);
+	virtual size_t size(pninx::NXObject &nxobject, const SliceRef& slice);
+	virtual bool sizeFromMetadata(const NXMetadata& metadata, const SliceRef& slice, size_t& size);
 };
 
 #endif /* RULE_H_ */
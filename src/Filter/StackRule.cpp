@@ -0,0 +1,267 @@
+/*
+ * StackRule.cpp
+ *
+ *  Created on: Jul 29, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#include "StackRule.h"
+
+/**
+ *	\brief Constructor of StackRule.
+ *	\param [in] image_rule : rule of slices, the pages are written with the same options.
+ */
+StackRule::StackRule(const ImageRule& image_rule) : ImageRule(image_rule), _has_page(false), _page(0)
+{
+}
+
+/**
+ *	 Destructor of StackRule
+ */
+StackRule::~StackRule() {
+
+}
+
+/**
+ *	\brief Gets the layout of multi-page TIFF.
+ *	\param [in] metadata : metadata of rank 3 NeXus field, each slice is a page.
+ *	\param [out] format : output format of pixels.
+ *	\return Layout of TIFF. Pages are never compressed, otherwise the offsets of pages are not known in advance.
+ *	Palette pages are written as grayscale, the color map is written by libtiff only.
+ */
+TIFFStackLayout StackRule::stackLayout(const NXMetadata& metadata, PixelFormat& format)
+{
+	TIFFLayout page = tiffLayout(metadata, SliceRef(), format);
+	if( page.compression != COMPRESSION_NONE || !TIFFProvider::isNativeLayout(page.photometric) )
+	{
+		char photometric = TIFFProvider::isNativeLayout(page.photometric) ? page.photometric : PHOTOMETRIC_MINISBLACK;
+		page = TIFFProvider::Layout(page.width, page.height, page.bit, photometric, page.sampleformat,
+				COMPRESSION_NONE, page.rows_per_strip);
+	}
+
+	return TIFFProvider::StackLayout( page, metadata.shape[0] );
+}
+
+/**
+ *	\brief Gets the metadata the layout of stack is computed from.
+ *	\param [in] slice : the stack, it gives the full path of rank 3 NeXus field to be represented.
+ *	\return Metadata of the field, the first dimension is the number of pages.
+ */
+NXMetadata StackRule::stackMetadata(const SliceRef& slice)
+{
+	return NXGateway::metadata(slice.nxpath);
+}
+
+/**
+ *	\brief Gets the pixels of rows of one page.
+ *	\param [in] nxfield : rank 3 NeXus field.
+ *	\param [in] slice : the stack, it gives the full path of \a nxfield.
+ *	\param [in] page : number of page, i.e. of slice.
+ *	\param [in] first_row : first row of page to be read.
+ *	\param [in] row_count : number of rows to be read.
+ *	\return The pixels in output format.
+ */
+FileContent StackRule::readPage(pninx::NXField& nxfield, const SliceRef& slice, size_t page, size_t first_row, size_t row_count)
+{
+	SliceRef page_slice(page);
+	page_slice.nxpath = slice.nxpath;
+	return readRows(nxfield, page_slice, first_row, row_count);
+}
+
+/**
+ *	\brief Gets a part of pixel data of one page.
+ *	\param [in] nxfield : rank 3 NeXus field.
+ *	\param [in] slice : the stack, see StackRule::readPage.
+ *	\param [in] stack : layout of TIFF.
+ *	\param [in] format : output format of pixels.
+ *	\param [in] page : number of page, i.e. of slice.
+ *	\param [in] from : offset of first byte from the begin of pixel data of page.
+ *	\param [in] to : offset after the last byte.
+ *	\return Bytes of pixel data.
+ *
+ *	Usually only the rows that contain requested bytes are read. If the window is computed from the whole slice,
+ *	or a row of NeXus field is not a row of TIFF, the page is read entirely and kept for the next request.
+ */
+FileContent StackRule::readPagePixels(pninx::NXField& nxfield, const SliceRef& slice, const TIFFStackLayout& stack, const PixelFormat& format,
+		size_t page, size_t from, size_t to)
+{
+	TypeID type = nxfield.type_id();
+	bool by_rows = stack.page.samples == 1 && !format.window_auto
+			&& type != TypeID::COMPLEX32 && type != TypeID::COMPLEX64 && type != TypeID::COMPLEX128;
+
+	if(by_rows)
+	{
+		size_t row_bytes = stack.page.rowBytes();
+		size_t first_row = from / row_bytes;
+		size_t last_row = (to + row_bytes - 1) / row_bytes;
+		FileContent rows = readPage(nxfield, slice, page, first_row, last_row - first_row);
+		return rows.range(to - from, from - first_row*row_bytes);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_page_mutex);
+		if( _has_page && _page == page )
+			return _page_pixels.range(to - from, from);
+	}
+
+	// not read under StackRule#_page_mutex, the read may give back the access to NeXus files meanwhile (see ReadWorkers::read)
+	FileContent pixels = readPage(nxfield, slice, page, 0, stack.page.height);
+	FileContent page_pixels = pixels.range(stack.page.data_size, 0);
+	if(pixels.size() < stack.page.data_size)
+		page_pixels.append( std::string( stack.page.data_size - pixels.size(), '\0' ) );
+
+	std::lock_guard<std::mutex> lock(_page_mutex);
+	_page_pixels = page_pixels;
+	_page = page;
+	_has_page = true;
+	return page_pixels.range(to - from, from);
+}
+
+/**
+ *	\brief Reads a part of multi-page TIFF.
+ *	\param [in] nxobject : rank 3 NeXus field to be represented.
+ *	\param [in] slice : the stack, it represents the whole field and gives its full path.
+ *	\param [in] size : maximum number of bytes.
+ *	\param [in] offset : offset from the file begin.
+ *	\param [out] output : the requested part of TIFF.
+ *	\return True, the stack is always read by parts. False if \a nxobject is not NXFIELD.
+ *
+ *	The file header and IFDs are written for the requested part only, pixel data is read from the pages it falls into.
+ */
+bool StackRule::readRange(pninx::NXObject &nxobject, const SliceRef& slice, size_t size, off_t offset, FileContent& output)
+{
+	if(nxobject.object_type() != pni::nx::NXObjectType::NXFIELD)
+		return false;
+
+	pninx::NXField nxfield = (pninx::NXField) nxobject;
+	PixelFormat format;
+	TIFFStackLayout stack = stackLayout(stackMetadata(slice), format);
+
+	size_t pos = offset;
+	size_t end = pos + size;
+	if(end > stack.size())
+		end = stack.size();
+	if(pos >= end)
+		return true;
+
+	if(pos < stack.header_size)
+	{
+		std::string header(stack.header_size, '\0');
+		TIFFProvider::WriteStackHeader(stack, &header[0]);
+		size_t part_end = (end < stack.header_size) ? end : stack.header_size;
+		output.append( header.substr(pos, part_end - pos) );
+		pos = part_end;
+	}
+
+	while(pos < end)
+	{
+		size_t page = (pos - stack.header_size) / stack.page_size;
+		size_t ifd_begin = stack.ifdOffset(page);
+		size_t data_begin = stack.dataOffset(page);
+		size_t data_end = data_begin + stack.page.data_size;
+		size_t page_end = ifd_begin + stack.page_size;
+
+		if(pos < data_begin)
+		{
+			std::string ifd(stack.ifd_size, '\0');
+			TIFFProvider::WriteStackIFD(stack, page, &ifd[0]);
+			size_t part_end = (end < data_begin) ? end : data_begin;
+			output.append( ifd.substr(pos - ifd_begin, part_end - pos) );
+			pos = part_end;
+		}
+
+		if(pos < end && pos < data_end)
+		{
+			size_t part_end = (end < data_end) ? end : data_end;
+			FileContent pixels = readPagePixels(nxfield, slice, stack, format, page, pos - data_begin, part_end - data_begin);
+			for(const ContentSegment& segment : pixels.segments())
+				output.append( segment );
+			pos = part_end;
+		}
+
+		// pad byte after odd sized pixel data
+		if(pos < end && pos < page_end)
+		{
+			output.append( std::string(1, '\0') );
+			pos = page_end;
+		}
+	}
+
+	return true;
+}
+
+/**
+ *	\brief Reads the whole multi-page TIFF.
+ *	\param [in] nxobject : rank 3 NeXus field to be represented.
+ *	\param [in] slice : the stack, it represents the whole field and gives its full path.
+ *	\return The content of TIFF.
+ */
+FileContent StackRule::readContent(pninx::NXObject &nxobject, const SliceRef& slice)
+{
+	FileContent output;
+	readRange(nxobject, slice, size(nxobject, slice), 0, output);
+	return output;
+}
+
+/**
+ *	\brief Reads the whole multi-page TIFF.
+ *	\param [in] nxobject : rank 3 NeXus field to be represented.
+ *	\return The content of TIFF.
+ */
+std::string StackRule::read(pninx::NXObject &nxobject)
+{
+	// the path within the file is the full path of object of single NeXus file
+	return readContent(nxobject, SliceRef(nxobject.path())).str();
+}
+
+/**
+ *	\brief Gets size.
+ *	\param [in] nxobject : rank 3 NeXus field to be represented.
+ *	\return Size of multi-page TIFF, it is exact.
+ */
+size_t StackRule::size(pninx::NXObject &nxobject)
+{
+	// the path within the file is the full path of object of single NeXus file
+	return size(nxobject, SliceRef(nxobject.path()));
+}
+
+/**
+ *	\brief Gets size.
+ *	\param [in] nxobject : rank 3 NeXus field to be represented.
+ *	\param [in] slice : the stack, it represents the whole field and gives its full path.
+ *	\return Size of multi-page TIFF, it is exact.
+ */
+size_t StackRule::size(pninx::NXObject &nxobject, const SliceRef& slice)
+{
+	PixelFormat format;
+	return stackLayout(stackMetadata(slice), format).size();
+}
+
+/**
+ *	\brief Gets size without opening NeXus field, see Rule::sizeFromMetadata.
+ *	\param [in] metadata : metadata of rank 3 NeXus field.
+ *	\param [in] slice : not used, the stack represents the whole field.
+ *	\param [out] size : size of multi-page TIFF.
+ *	\return Always true.
+ */
+bool StackRule::sizeFromMetadata(const NXMetadata& metadata, const SliceRef& slice, size_t& size)
+{
+	PixelFormat format;
+	size = stackLayout(metadata, format).size();
+	return true;
+}
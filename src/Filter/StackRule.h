@@ -0,0 +1,65 @@
+/*
+ * StackRule.h
+ *
+ *  Created on: Jul 29, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#ifndef STACKRULE_H_
+#define STACKRULE_H_
+
+#include <mutex>
+
+#include "ImageRule.h"
+#include "TIFFProvider.h"
+#include "FileContent.h"
+
+/**
+ *	Class represents all slices of rank 3 NeXus field as one multi-page TIFF.\n
+ *	The layout of file is computed from the shape of field, so any part of it is read without reading the others:
+ *	pages are read from NeXus file only when their bytes are requested.
+ */
+class StackRule: public ImageRule {
+private:
+	std::mutex _page_mutex; /*!< Guards the last page read entirely. */
+	bool _has_page; /*!< True if StackRule#_page_pixels holds a page. */
+	size_t _page; /*!< Number of page held in StackRule#_page_pixels. */
+	FileContent _page_pixels; /*!< Pixels of the last page that had to be read entirely. */
+
+	TIFFStackLayout stackLayout(const NXMetadata& metadata, PixelFormat& format);
+	FileContent readPagePixels(pninx::NXField& nxfield, const SliceRef& slice, const TIFFStackLayout& stack, const PixelFormat& format,
+			size_t page, size_t from, size_t to);
+
+protected:
+	virtual NXMetadata stackMetadata(const SliceRef& slice);
+	virtual FileContent readPage(pninx::NXField& nxfield, const SliceRef& slice, size_t page, size_t first_row, size_t row_count);
+
+public:
+	StackRule(const ImageRule& image_rule);
+	virtual ~StackRule();
+
+	//fuse methods
+	virtual std::string read(pninx::NXObject &nxobject);
+	virtual FileContent readContent(pninx::NXObject &nxobject, const SliceRef& slice);
+	virtual bool readRange(pninx::NXObject &nxobject, const SliceRef& slice, size_t size, off_t offset, FileContent& output);
+	virtual size_t size(pninx::NXObject &nxobject);
+	virtual size_t size(pninx::NXObject &nxobject, const SliceRef& slice);
+	virtual bool sizeFromMetadata(const NXMetadata& metadata, const SliceRef& slice, size_t& size);
+};
+
+#endif /* STACKRULE_H_ */
@@ -21,10 +21,14 @@
  */
 
 #include "TIFFProvider.h"
+#include "ThreadPool.h"
 #include <iostream>
 #include <sstream>
 #include <cstring>
 
+std::map<TIFFProvider::header_key_t, std::shared_ptr<const std::string>> TIFFProvider::_headers;
+std::mutex TIFFProvider::_headers_mutex;
+
 /**
  * TIFFProvider constructor
  */
@@ -44,8 +48,10 @@ TIFFProvider::~TIFFProvider() {}
  * \param [in] p_height : height of image.
  * \param [in] bit : number of bits per sample. Should be multiple of 8.
  * \param [in] photometric : photometric according to TIFF 6.0 specification (http://partners.adobe.com/public/developer/en/tiff/TIFF6.pdf).
+ * \param [in] sampleformat : how samples are interpreted: unsigned, signed integer or IEEE floating point.
  */
-void TIFFProvider::WriteTIFF(TIFF* into, void *data, int p_width, int p_height, uint bit, char photometric)
+void TIFFProvider::WriteTIFF(TIFF* into, void *data, int p_width, int p_height, uint bit, char photometric,
+		uint16_t sampleformat)
 {
 	uint multiplier = bit/8;
 	char SamplesPerPixel = 1;
@@ -59,7 +65,8 @@ void TIFFProvider::WriteTIFF(TIFF* into, void *data, int p_width, int p_height,
 	TIFFSetField(into, TIFFTAG_IMAGELENGTH, p_height);
 	TIFFSetField(into, TIFFTAG_BITSPERSAMPLE, bit);
 	TIFFSetField(into, TIFFTAG_SAMPLESPERPIXEL, SamplesPerPixel);
-	TIFFSetField(into, TIFFTAG_ROWSPERSTRIP, p_width);
+	TIFFSetField(into, TIFFTAG_SAMPLEFORMAT, sampleformat);
+	TIFFSetField(into, TIFFTAG_ROWSPERSTRIP, p_height);
 	TIFFSetField(into, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT );
 
 	//TIFFSetField(into, TIFFTAG_COMPRESSION, COMPRESSION_DEFLATE); // compression gzip
@@ -95,139 +102,69 @@ void TIFFProvider::WriteTIFF(TIFF* into, void *data, int p_width, int p_height,
  *	\brief Creates TIFF in memory.
  *
  *	\param [in] name : the name of TIFF.
- *	\param [out] os : it should be ostream. As the result it will contain the TIFF image.
+ *	\param [out] buffer : as the result it will contain the TIFF image.
  *	\return pointer to current TIFF
  */
-TIFF* TIFFProvider::StreamOpen(const char* name, void* os)
+TIFF* TIFFProvider::MemOpen(const char* name, std::string* buffer)
 {
-	os = (std::ostream*)os;
-	// If os is either a ostrstream or ostringstream, and has no data
-	// written to it yet, then tellp() will return -1 which will break us.
-	// We workaround this by writing out a dummy character and
-	// then seek back to the beginning.
-	if( !((std::ostream*)os)->fail()
-			&& (int)((std::ostream*)os)->tellp() < 0 ) {
-			*((std::ostream*)os) << '\0';
-			((std::ostream*)os)->seekp(0);
-	}
-
-	// NB: We don't support mapped files with streams so add 'm'
-	return _tiffStreamOpen(name, "wm", os);
+	// NB: We don't support mapped files with memory buffers so add 'm'
+	return _tiffMemOpen(name, "wm", buffer);
 }
 
 
 tsize_t
-TIFFProvider::_osReadProc(thandle_t, tdata_t, tsize_t)
+TIFFProvider::_memReadProc(thandle_t, tdata_t, tsize_t)
 {
         return 0;
 }
 
 tsize_t
-TIFFProvider::_osWriteProc(thandle_t fd, tdata_t buf, tsize_t size)
+TIFFProvider::_memWriteProc(thandle_t fd, tdata_t buf, tsize_t size)
 {
-        tiffos_data     *data = (tiffos_data *)fd;
-        std::ostream         *os = data->myOS;
-        int             pos = os->tellp();
+        tiffmem_data    *data = (tiffmem_data *)fd;
+        std::string     *mem = data->myBuffer;
 
-        os->write((const char *)buf, size);
+        if( data->myPos + size > mem->size() )
+                mem->resize( data->myPos + size );
+        mem->replace( data->myPos, size, (const char *)buf, size );
+        data->myPos += size;
 
-        return ((int)os->tellp()) - pos;
+        return size;
 }
 
 toff_t
-TIFFProvider::_osSeekProc(thandle_t fd, toff_t off, int whence)
+TIFFProvider::_memSeekProc(thandle_t fd, toff_t off, int whence)
 {
-        tiffos_data     *data = (tiffos_data *)fd;
-        std::ostream *os = data->myOS;
-
-        // if the stream has already failed, don't do anything
-        if( os->fail() )
-                return os->tellp();
+        tiffmem_data    *data = (tiffmem_data *)fd;
 
+        // Seeking past the end is fine: the gap is zero filled by the next write.
         switch(whence) {
         case SEEK_SET:
-            os->seekp(data->myStreamStartPos + off, std::ios::beg);
+                data->myPos = off;
                 break;
         case SEEK_CUR:
-                os->seekp(off, std::ios::cur);
+                data->myPos += off;
                 break;
         case SEEK_END:
-                os->seekp(off, std::ios::end);
+                data->myPos = data->myBuffer->size() + off;
                 break;
         }
 
-        // Attempt to workaround problems with seeking past the end of the
-        // stream.  ofstream doesn't have a problem with this but
-        // ostrstream/ostringstream does. In that situation, add intermediate
-        // '\0' characters.
-        if( os->fail() ) {
-#ifdef __VMS
-                int             old_state;
-#else
-                std::ios::iostate    old_state;
-#endif
-                toff_t          origin=0;
-
-                old_state = os->rdstate();
-                // reset the fail bit or else tellp() won't work below
-                os->clear(os->rdstate() & ~std::ios::failbit);
-                switch( whence ) {
-                        case SEEK_SET:
-                                origin = data->myStreamStartPos;
-                                break;
-                        case SEEK_CUR:
-                                origin = os->tellp();
-                                break;
-                        case SEEK_END:
-                                os->seekp(0, std::ios::end);
-                                origin = os->tellp();
-                                break;
-                }
-                // restore original stream state
-                os->clear(old_state);
-
-                // only do something if desired seek position is valid
-                if( origin + off > data->myStreamStartPos ) {
-                        toff_t  num_fill;
-
-                        // clear the fail bit
-                        os->clear(os->rdstate() & ~std::ios::failbit);
-
-                        // extend the stream to the expected size
-                        os->seekp(0, std::ios::end);
-                        num_fill = origin + off - (toff_t)os->tellp();
-                        for( toff_t i = 0; i < num_fill; i++ )
-                                os->put('\0');
-
-                        // retry the seek
-                        os->seekp(origin + off, std::ios::beg);
-                }
-        }
-
-        return os->tellp();
+        return data->myPos;
 }
 
 
 toff_t
-TIFFProvider::_osSizeProc(thandle_t fd)
+TIFFProvider::_memSizeProc(thandle_t fd)
 {
-        tiffos_data     *data = (tiffos_data *)fd;
-        std::ostream         *os = data->myOS;
-        toff_t          pos = os->tellp();
-        toff_t          len;
-
-        os->seekp(0, std::ios::end);
-        len = os->tellp();
-        os->seekp(pos);
-
-        return len;
+        return ((tiffmem_data *)fd)->myBuffer->size();
 }
 
 int
-TIFFProvider::_osCloseProc(thandle_t fd)
+TIFFProvider::_memCloseProc(thandle_t fd)
 {
-        // Our stream was not allocated by us, so it shouldn't be closed by us.
-        delete (tiffos_data *)fd;
+        // Our buffer was not allocated by us, so it shouldn't be freed by us.
+        delete (tiffmem_data *)fd;
         return 0;
 }
 
@@ -244,24 +181,555 @@ TIFFProvider::_DummyUnmapProc(thandle_t , tdata_t , toff_t )
 
 
 TIFF*
-TIFFProvider::_tiffStreamOpen(const char* name, const char* mode, void *fd)
+TIFFProvider::_tiffMemOpen(const char* name, const char* mode, std::string* buffer)
 {
-        TIFF*   tif;
-        //open stream for writing only
+        TIFF*   tif = NULL;
+        //open buffer for writing only
         if( strchr(mode, 'w') ) {
-        		tiffos_data     *private_data = new tiffos_data;
-                private_data->myOS = (std::ostream *)fd;
-                private_data->myStreamStartPos = private_data->myOS->tellp();
+                tiffmem_data    *private_data = new tiffmem_data;
+                private_data->myBuffer = buffer;
+                private_data->myPos = 0;
 
                 // Open for writing.
                 tif = TIFFClientOpen(name, mode,
                                 (thandle_t) private_data,
-                                _osReadProc, _osWriteProc,
-                                _osSeekProc, _osCloseProc,
-                                _osSizeProc,
+                                _memReadProc, _memWriteProc,
+                                _memSeekProc, _memCloseProc,
+                                _memSizeProc,
                                 _DummyMapProc, _DummyUnmapProc);
         }
 
         return (tif);
 }
 
+/**
+ *	Size of strip aimed at when TIFF is split into strips: large enough to compress well,
+ *	small enough to give work to all threads and to read only a few rows for a small part of file.
+ */
+static const size_t STRIP_BYTES = 64*1024;
+
+/**
+ *	@name TIFF field types
+ *	Types used in IFD entries written by TIFFProvider.
+ */
+///@{
+static const uint16_t TIFF_TYPE_SHORT = 3;
+static const uint16_t TIFF_TYPE_LONG = 4;
+static const uint16_t TIFF_TYPE_RATIONAL = 5;
+static const uint16_t TIFF_TYPE_LONG8 = 16;
+///@}
+
+/**
+ *	\brief Gets the size of one value of TIFF field type.
+ */
+static inline size_t typeSize(uint16_t type)
+{
+	switch(type)
+	{
+	case TIFF_TYPE_SHORT: return 2;
+	case TIFF_TYPE_LONG: return 4;
+	default: return 8;
+	}
+}
+
+/**
+ *	\brief Gets the number of values of IFD entry as written in TIFF.
+ */
+static inline uint64_t entryCount(const TIFFEntry& entry)
+{
+	return (entry.type == TIFF_TYPE_RATIONAL) ? entry.values.size()/2 : entry.values.size();
+}
+
+/**
+ *	\brief Writes little endian integer of \a size bytes.
+ *	\return Pointer after written value.
+ */
+static inline char* putLE(char* p, uint64_t v, size_t size)
+{
+	for(size_t i=0; i<size; i++)
+		p[i] = (char)( (v >> (8*i)) & 0xff );
+	return p + size;
+}
+
+/**
+ *	\brief Writes values of IFD entry.
+ *	\return Pointer after written values.
+ */
+static char* putValues(char* p, const TIFFEntry& entry)
+{
+	size_t size = (entry.type == TIFF_TYPE_RATIONAL) ? 4 : typeSize(entry.type);
+	for(uint64_t v : entry.values)
+		p = putLE(p, v, size);
+	return p;
+}
+
+/**
+ *	\brief Creates IFD entry.
+ */
+static TIFFEntry makeEntry(uint16_t tag, uint16_t type, std::vector<uint64_t> values)
+{
+	TIFFEntry entry;
+	entry.tag = tag;
+	entry.type = type;
+	entry.values = std::move(values);
+	return entry;
+}
+
+/**
+ *	\brief Checks whether the TIFF can be written by the native encoder.
+ *	\param [in] photometric : photometric according to TIFF 6.0 specification.
+ *	\return True if TIFFProvider::EncodeTIFF doesn't need libtiff to write whole file.
+ *
+ *	Palette images carry a color map, they are left to libtiff.
+ */
+bool TIFFProvider::isNativeLayout(char photometric)
+{
+	return photometric != PHOTOMETRIC_PALETTE;
+}
+
+/**
+ *	\brief Checks whether strips can be compressed with \a compression.
+ *	\param [in] compression : TIFF compression scheme.
+ *	\return True if there is no compression or libtiff was built with such codec.
+ */
+bool TIFFProvider::isCompressionSupported(uint16_t compression)
+{
+	return compression == COMPRESSION_NONE || TIFFIsCODECConfigured(compression);
+}
+
+/**
+ *	\brief Computes the layout of TIFF.
+ *
+ *	\param [in] p_width : width of image.
+ *	\param [in] p_height : height of image.
+ *	\param [in] bit : number of bits per sample. Should be multiple of 8.
+ *	\param [in] photometric : photometric according to TIFF 6.0 specification.
+ *	\param [in] sampleformat : how samples are interpreted: unsigned, signed integer or IEEE floating point.
+ *	\param [in] compression : TIFF compression scheme of strips.
+ *	\param [in] rows_per_strip : number of rows in strip, 0 for strips of about 64 KB.
+ *	\return Layout of TIFF written by TIFFProvider::EncodeTIFF. TIFFLayout#data_size is the uncompressed size.
+ */
+TIFFLayout TIFFProvider::Layout(int p_width, int p_height, uint bit, char photometric,
+		uint16_t sampleformat, uint16_t compression, uint32_t rows_per_strip)
+{
+	TIFFLayout layout;
+	layout.width = p_width;
+	layout.height = p_height;
+	layout.bit = bit;
+	layout.samples = 1;
+	layout.photometric = photometric;
+	layout.sampleformat = sampleformat;
+	if(photometric == PHOTOMETRIC_RGB)
+	{
+		layout.bit = 8;
+		layout.samples = 3;
+		layout.sampleformat = SAMPLEFORMAT_UINT;
+	}
+
+	layout.compression = compression;
+	layout.predictor = PREDICTOR_NONE;
+	// horizontal differencing makes integer images compress much better
+	if(compression != COMPRESSION_NONE && layout.sampleformat != SAMPLEFORMAT_IEEEFP)
+		layout.predictor = PREDICTOR_HORIZONTAL;
+
+	if(rows_per_strip == 0 && layout.rowBytes() > 0)
+		rows_per_strip = STRIP_BYTES / layout.rowBytes();
+	if(rows_per_strip == 0)
+		rows_per_strip = 1;
+	if(rows_per_strip > layout.height && layout.height > 0)
+		rows_per_strip = layout.height;
+	layout.rows_per_strip = rows_per_strip;
+	layout.strip_count = (layout.height + rows_per_strip - 1) / rows_per_strip;
+	if(layout.strip_count == 0)
+		layout.strip_count = 1;
+
+	layout.header_size = 8 + IFDSize( Entries(layout, false), false );
+	layout.data_size = (size_t)layout.height * layout.rowBytes();
+
+	return layout;
+}
+
+/**
+ *	\brief Creates IFD entries describing the image.
+ *
+ *	\param [in] layout : layout of TIFF.
+ *	\param [in] bigtiff : true for BigTIFF, strip offsets and sizes are 64 bit then.
+ *	\return Entries sorted by tag. Strip offsets and sizes are zero, they are filled by the writer.
+ *
+ *	The same tags are written as by TIFFProvider::WriteTIFF, so the result is equivalent to the libtiff output.
+ */
+std::vector<TIFFEntry> TIFFProvider::Entries(const TIFFLayout& layout, bool bigtiff)
+{
+	uint16_t offset_type = bigtiff ? TIFF_TYPE_LONG8 : TIFF_TYPE_LONG;
+	std::vector<uint64_t> strips(layout.strip_count, 0);
+
+	std::vector<TIFFEntry> entries;
+	entries.push_back( makeEntry(TIFFTAG_IMAGEWIDTH, TIFF_TYPE_LONG, {layout.width}) );
+	entries.push_back( makeEntry(TIFFTAG_IMAGELENGTH, TIFF_TYPE_LONG, {layout.height}) );
+	entries.push_back( makeEntry(TIFFTAG_BITSPERSAMPLE, TIFF_TYPE_SHORT, std::vector<uint64_t>(layout.samples, layout.bit)) );
+	entries.push_back( makeEntry(TIFFTAG_COMPRESSION, TIFF_TYPE_SHORT, {layout.compression}) );
+	entries.push_back( makeEntry(TIFFTAG_PHOTOMETRIC, TIFF_TYPE_SHORT, {layout.photometric}) );
+	entries.push_back( makeEntry(TIFFTAG_STRIPOFFSETS, offset_type, strips) );
+	entries.push_back( makeEntry(TIFFTAG_ORIENTATION, TIFF_TYPE_SHORT, {ORIENTATION_TOPLEFT}) );
+	entries.push_back( makeEntry(TIFFTAG_SAMPLESPERPIXEL, TIFF_TYPE_SHORT, {layout.samples}) );
+	entries.push_back( makeEntry(TIFFTAG_ROWSPERSTRIP, TIFF_TYPE_LONG, {layout.rows_per_strip}) );
+	entries.push_back( makeEntry(TIFFTAG_STRIPBYTECOUNTS, offset_type, strips) );
+	entries.push_back( makeEntry(TIFFTAG_XRESOLUTION, TIFF_TYPE_RATIONAL, {150, 1}) ); // 150 dpi
+	entries.push_back( makeEntry(TIFFTAG_YRESOLUTION, TIFF_TYPE_RATIONAL, {150, 1}) );
+	entries.push_back( makeEntry(TIFFTAG_PLANARCONFIG, TIFF_TYPE_SHORT, {PLANARCONFIG_CONTIG}) );
+	entries.push_back( makeEntry(TIFFTAG_RESOLUTIONUNIT, TIFF_TYPE_SHORT, {RESUNIT_INCH}) );
+	if(layout.predictor != PREDICTOR_NONE)
+		entries.push_back( makeEntry(TIFFTAG_PREDICTOR, TIFF_TYPE_SHORT, {layout.predictor}) );
+	entries.push_back( makeEntry(TIFFTAG_SAMPLEFORMAT, TIFF_TYPE_SHORT, std::vector<uint64_t>(layout.samples, layout.sampleformat)) );
+
+	return entries;
+}
+
+/**
+ *	\brief Gets the size of IFD including the values that don't fit into entries.
+ *	\param [in] entries : IFD entries.
+ *	\param [in] bigtiff : true for BigTIFF.
+ */
+size_t TIFFProvider::IFDSize(const std::vector<TIFFEntry>& entries, bool bigtiff)
+{
+	size_t inline_size = bigtiff ? 8 : 4;
+	size_t size = bigtiff ? (8 + entries.size()*20 + 8) : (2 + entries.size()*12 + 4);
+	for(const TIFFEntry& entry : entries)
+	{
+		size_t values_size = entryCount(entry) * typeSize(entry.type);
+		if(values_size > inline_size)
+			size += (values_size + 1) & ~(size_t)1; // values start on word boundary
+	}
+	return size;
+}
+
+/**
+ *	\brief Writes IFD followed by the values that don't fit into entries.
+ *
+ *	\param [in] entries : IFD entries sorted by tag.
+ *	\param [in] bigtiff : true for BigTIFF.
+ *	\param [in] ifd_offset : offset of IFD from the file begin, needed to point to out of line values.
+ *	\param [in] next_ifd : offset of next IFD, 0 if it is the last one.
+ *	\param [out] into : buffer of at least TIFFProvider::IFDSize bytes.
+ */
+void TIFFProvider::WriteIFD(const std::vector<TIFFEntry>& entries, bool bigtiff, uint64_t ifd_offset, uint64_t next_ifd, char* into)
+{
+	size_t inline_size = bigtiff ? 8 : 4;
+	size_t offset_size = bigtiff ? 8 : 4;
+	size_t table_size = bigtiff ? (8 + entries.size()*20 + 8) : (2 + entries.size()*12 + 4);
+
+	char* p = into;
+	char* extra = into + table_size;
+
+	p = putLE(p, entries.size(), bigtiff ? 8 : 2);
+	for(const TIFFEntry& entry : entries)
+	{
+		uint64_t count = entryCount(entry);
+		size_t values_size = count * typeSize(entry.type);
+
+		p = putLE(p, entry.tag, 2);
+		p = putLE(p, entry.type, 2);
+		p = putLE(p, count, offset_size);
+		if(values_size <= inline_size)
+		{
+			// values are left justified in the value field
+			memset(p, 0, inline_size);
+			putValues(p, entry);
+		}
+		else
+		{
+			putLE(p, ifd_offset + (extra - into), offset_size);
+			putValues(extra, entry);
+			if(values_size & 1)
+				extra[values_size] = 0;
+			extra += (values_size + 1) & ~(size_t)1;
+		}
+		p += inline_size;
+	}
+	putLE(p, next_ifd, offset_size);
+}
+
+/**
+ *	\brief Sets strip offsets and sizes in IFD entries.
+ *	\param [in,out] entries : entries created by TIFFProvider::Entries.
+ *	\param [in] layout : layout of TIFF.
+ *	\param [in] data_offset : offset of the first strip from the file begin, the others follow it.
+ *	\param [in] strip_sizes : sizes of compressed strips, NULL if strips are not compressed.
+ */
+static void fillStrips(std::vector<TIFFEntry>& entries, const TIFFLayout& layout, uint64_t data_offset,
+		const std::vector<uint64_t>* strip_sizes)
+{
+	for(TIFFEntry& entry : entries)
+	{
+		if(entry.tag != TIFFTAG_STRIPOFFSETS && entry.tag != TIFFTAG_STRIPBYTECOUNTS)
+			continue;
+		uint64_t offset = data_offset;
+		for(uint32_t i=0; i<layout.strip_count; i++)
+		{
+			uint64_t size = strip_sizes ? (*strip_sizes)[i] : (uint64_t)layout.stripRows(i) * layout.rowBytes();
+			entry.values[i] = (entry.tag == TIFFTAG_STRIPOFFSETS) ? offset : size;
+			offset += size;
+		}
+	}
+}
+
+/**
+ *	\brief Writes TIFF header, IFD and out of line tag values.
+ *
+ *	\param [in] layout : layout of TIFF to be written.
+ *	\param [out] into : buffer of at least TIFFLayout#header_size bytes.
+ *	\param [in] strip_sizes : sizes of compressed strips, NULL if strips are not compressed.
+ *
+ *	Strips are expected to follow the header one after another, so uncompressed strip \a i begins at
+ *	TIFFLayout#header_size + \a i * TIFFLayout#rows_per_strip * TIFFLayout::rowBytes().
+ */
+void TIFFProvider::WriteTIFFHeader(const TIFFLayout& layout, char* into, const std::vector<uint64_t>* strip_sizes)
+{
+	std::vector<TIFFEntry> entries = Entries(layout, false);
+	fillStrips(entries, layout, layout.header_size, strip_sizes);
+
+	into[0] = 'I';
+	into[1] = 'I';
+	putLE(into + 2, 42, 2);
+	putLE(into + 4, 8, 4);
+	WriteIFD(entries, false, 8, 0, into + 8);
+}
+
+/**
+ *	\brief Computes the layout of multi-page TIFF.
+ *
+ *	\param [in] page : layout of each page, it must be uncompressed.
+ *	\param [in] pages : number of pages.
+ *	\return Layout of TIFF, BigTIFF if offsets don't fit in 32 bits.
+ */
+TIFFStackLayout TIFFProvider::StackLayout(const TIFFLayout& page, size_t pages)
+{
+	TIFFStackLayout stack;
+	stack.page = page;
+	stack.pages = pages;
+
+	for(int big = 0; big < 2; big++)
+	{
+		stack.bigtiff = (big == 1);
+		stack.header_size = stack.bigtiff ? 16 : 8;
+		stack.ifd_size = IFDSize( Entries(page, stack.bigtiff), stack.bigtiff );
+		stack.page_size = stack.ifd_size + page.data_size + (page.data_size & 1);
+		if( stack.bigtiff || (uint64_t)stack.size() <= 0xffffffffULL )
+			break;
+	}
+	return stack;
+}
+
+/**
+ *	\brief Writes the file header of multi-page TIFF.
+ *	\param [in] stack : layout of TIFF.
+ *	\param [out] into : buffer of at least TIFFStackLayout#header_size bytes.
+ */
+void TIFFProvider::WriteStackHeader(const TIFFStackLayout& stack, char* into)
+{
+	into[0] = 'I';
+	into[1] = 'I';
+	if(stack.bigtiff)
+	{
+		putLE(into + 2, 43, 2);
+		putLE(into + 4, 8, 2); // size of offsets
+		putLE(into + 6, 0, 2);
+		putLE(into + 8, stack.ifdOffset(0), 8);
+	}
+	else
+	{
+		putLE(into + 2, 42, 2);
+		putLE(into + 4, stack.ifdOffset(0), 4);
+	}
+}
+
+/**
+ *	\brief Writes IFD of one page of multi-page TIFF.
+ *	\param [in] stack : layout of TIFF.
+ *	\param [in] page : number of page.
+ *	\param [out] into : buffer of at least TIFFStackLayout#ifd_size bytes.
+ *
+ *	IFDs differ only in strip offsets and in the offset of next IFD, so any of them is written without the others.
+ */
+void TIFFProvider::WriteStackIFD(const TIFFStackLayout& stack, size_t page, char* into)
+{
+	std::vector<TIFFEntry> entries = Entries(stack.page, stack.bigtiff);
+	fillStrips(entries, stack.page, stack.dataOffset(page), NULL);
+	uint64_t next_ifd = (page + 1 < stack.pages) ? stack.ifdOffset(page + 1) : 0;
+	WriteIFD(entries, stack.bigtiff, stack.ifdOffset(page), next_ifd, into);
+}
+
+/**
+ *	\brief Gets the header of natively written uncompressed TIFF.
+ *
+ *	\param [in] layout : layout of TIFF, see TIFFProvider::Layout.
+ *	\return TIFFLayout#header_size bytes that precede the pixel data.
+ *
+ *	Headers depend on image parameters only, so they are written once and shared by all images of the same kind.
+ */
+std::shared_ptr<const std::string> TIFFProvider::HeaderTemplate(const TIFFLayout& layout)
+{
+	header_key_t key(layout.width, layout.height, layout.bit, layout.photometric, layout.sampleformat, layout.rows_per_strip);
+
+	std::lock_guard<std::mutex> lock(_headers_mutex);
+	auto it = _headers.find(key);
+	if( it != _headers.end() )
+		return it->second;
+
+	std::string* header = new std::string(layout.header_size, '\0');
+	WriteTIFFHeader(layout, &(*header)[0]);
+	std::shared_ptr<const std::string> output(header);
+	_headers.insert( std::make_pair(key, output) );
+	return output;
+}
+
+/**
+ *	\brief Compresses rows as one TIFF strip.
+ *
+ *	\param [in] layout : layout of TIFF, defines the compression.
+ *	\param [in] rows : uncompressed rows.
+ *	\param [in] row_count : number of rows.
+ *	\return Compressed strip, empty if libtiff failed.
+ *
+ *	libtiff compresses the strip into a temporary TIFF in memory, the strip is cut out of it.
+ *	Each call uses own TIFF, so strips can be compressed concurrently.
+ */
+std::string TIFFProvider::CompressStrip(const TIFFLayout& layout, const char* rows, uint32_t row_count)
+{
+	// libtiff may apply the predictor in place, the rows may be shared with cache
+	std::string strip_data(rows, row_count * layout.rowBytes());
+	std::string buffer;
+	std::string output;
+
+	TIFF* tiff = MemOpen("mem_strip", &buffer);
+	if(tiff == NULL)
+		return output;
+
+	TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, layout.width);
+	TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, row_count);
+	TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, layout.bit);
+	TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, layout.samples);
+	TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, layout.sampleformat);
+	TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, row_count);
+	TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, layout.photometric);
+	TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+	TIFFSetField(tiff, TIFFTAG_COMPRESSION, layout.compression);
+	if(layout.predictor != PREDICTOR_NONE)
+		TIFFSetField(tiff, TIFFTAG_PREDICTOR, layout.predictor);
+
+	toff_t* offsets = NULL;
+	toff_t* sizes = NULL;
+	if( TIFFWriteEncodedStrip(tiff, 0, &strip_data[0], strip_data.length()) >= 0
+			&& TIFFGetField(tiff, TIFFTAG_STRIPOFFSETS, &offsets)
+			&& TIFFGetField(tiff, TIFFTAG_STRIPBYTECOUNTS, &sizes)
+			&& offsets[0] + sizes[0] <= buffer.length() )
+	{
+		output = buffer.substr(offsets[0], sizes[0]);
+	}
+	TIFFClose(tiff);
+
+	return output;
+}
+
+/**
+ *	\brief Writes compressed TIFF, strips are compressed concurrently.
+ *
+ *	\param [in] pixels : uncompressed pixels of whole image.
+ *	\param [in] layout : layout of TIFF with compression.
+ *	\return The content of TIFF file. If any strip can't be compressed the TIFF is written uncompressed.
+ */
+std::string TIFFProvider::EncodeCompressedTIFF(const char* pixels, TIFFLayout layout)
+{
+	std::vector<std::string> strips(layout.strip_count);
+	ThreadPool::shared().parallelFor(layout.strip_count, [&](size_t i)
+	{
+		const char* rows = pixels + (size_t)i * layout.rows_per_strip * layout.rowBytes();
+		strips[i] = CompressStrip(layout, rows, layout.stripRows(i));
+	});
+
+	std::vector<uint64_t> strip_sizes;
+	layout.data_size = 0;
+	for(const std::string& strip : strips)
+	{
+		if(strip.empty())
+		{
+			TIFFLayout plain = Layout(layout.width, layout.height, layout.bit, layout.photometric, layout.sampleformat);
+			return EncodeTIFF(pixels, plain.data_size, plain);
+		}
+		strip_sizes.push_back(strip.length());
+		layout.data_size += strip.length();
+	}
+
+	std::string output(layout.size(), '\0');
+	WriteTIFFHeader(layout, &output[0], &strip_sizes);
+	char* p = &output[layout.header_size];
+	for(const std::string& strip : strips)
+	{
+		memcpy(p, strip.data(), strip.length());
+		p += strip.length();
+	}
+	return output;
+}
+
+/**
+ *	\brief Creates TIFF image in memory.
+ *
+ *	\param [in] data : 2D array of values.
+ *	\param [in] data_len : size of \a data in bytes.
+ *	\param [in] p_width : width of image.
+ *	\param [in] p_height : height of image.
+ *	\param [in] bit : number of bits per sample. Should be multiple of 8.
+ *	\param [in] photometric : photometric according to TIFF 6.0 specification.
+ *	\param [in] sampleformat : how samples are interpreted: unsigned, signed integer or IEEE floating point.
+ *	\return The content of TIFF file.
+ */
+std::string TIFFProvider::EncodeTIFF(const void *data, size_t data_len, int p_width, int p_height, uint bit, char photometric,
+		uint16_t sampleformat)
+{
+	return EncodeTIFF(data, data_len, Layout(p_width, p_height, bit, photometric, sampleformat));
+}
+
+/**
+ *	\brief Creates TIFF image in memory.
+ *
+ *	\param [in] data : 2D array of values.
+ *	\param [in] data_len : size of \a data in bytes.
+ *	\param [in] layout : layout of TIFF, see TIFFProvider::Layout.
+ *	\return The content of TIFF file.
+ *
+ *	Uncompressed images are written natively: header and pixels are copied into a buffer of exact size.\n
+ *	Compressed images get their strips compressed by libtiff concurrently, palette images are written by libtiff.\n
+ *	If \a data is shorter than the image the rest is filled with zeros.
+ */
+std::string TIFFProvider::EncodeTIFF(const void *data, size_t data_len, const TIFFLayout& layout)
+{
+	size_t copy_len = (data_len < layout.data_size) ? data_len : layout.data_size;
+
+	if( isNativeLayout(layout.photometric) && layout.compression == COMPRESSION_NONE )
+	{
+		std::string output(layout.size(), '\0');
+		WriteTIFFHeader(layout, &output[0]);
+		memcpy(&output[layout.header_size], data, copy_len);
+		return output;
+	}
+
+	std::string pixels;
+	const char* full = (const char*)data;
+	if(copy_len < layout.data_size)
+	{
+		pixels.assign(layout.data_size, '\0');
+		memcpy(&pixels[0], data, copy_len);
+		full = pixels.data();
+	}
+
+	if( isNativeLayout(layout.photometric) )
+		return EncodeCompressedTIFF(full, layout);
+
+	if(pixels.empty())
+		pixels.assign(full, layout.data_size);
+	std::string output;
+	output.reserve(layout.size());
+	TIFF *tiff = MemOpen("mem_TIFF", &output);
+	WriteTIFF(tiff, &pixels[0], layout.width, layout.height, layout.bit, layout.photometric, layout.sampleformat);
+	return output;
+}
@@ -23,39 +23,161 @@
 #ifndef TIFFPROVIDER_H_
 #define TIFFPROVIDER_H_
 
-#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <stdint.h>
 #include <tiffio.h>
 #include <stdio.h>
 
 /**
- *	Class used for store some required information while writing TIFF in stream.
+ *	Class used for store some required information while libtiff writes TIFF into memory.
  */
-class tiffos_data
+class tiffmem_data
 {
   public:
-	std::ostream *myOS; /*!< The stream used to write TIFF into */
-	long    myStreamStartPos;
+	std::string *myBuffer; /*!< The buffer used to write TIFF into */
+	toff_t myPos; /*!< Current write position within the buffer */
+};
+
+/**
+ *	Describes a TIFF image written by TIFFProvider without libtiff.\n
+ *	The layout of uncompressed TIFF is fully determined by the image parameters,
+ *	compressed TIFF knows its TIFFLayout#data_size after strips are compressed.
+ */
+struct TIFFLayout
+{
+	uint32_t width; /*!< Image width in pixels. */
+	uint32_t height; /*!< Image height in pixels, i.e. number of rows. */
+	uint16_t bit; /*!< Bits per sample. */
+	uint16_t samples; /*!< Samples per pixel. */
+	uint16_t photometric; /*!< TIFF photometric interpretation. */
+	uint16_t sampleformat; /*!< TIFF sample format: unsigned, signed integer or IEEE floating point. */
+	uint16_t compression; /*!< TIFF compression scheme of strips. */
+	uint16_t predictor; /*!< TIFF predictor applied before compression. */
+	uint32_t rows_per_strip; /*!< Number of rows in each strip, the last one may be shorter. */
+	uint32_t strip_count; /*!< Number of strips. */
+	size_t header_size; /*!< Bytes before the pixel data: file header, IFD and out of line tag values. */
+	size_t data_size; /*!< Bytes of pixel data, i.e. of all strips. */
+
+	/**
+	 *	\brief Gets the size of whole TIFF file.
+	 */
+	size_t size() const { return header_size + data_size; }
+	/**
+	 *	\brief Gets the largest size of pixel data when strips are compressed, incompressible data grows.
+	 *
+	 *	LZW writes codes of up to 12 bits for single bytes, deflate and zstd add a few bytes per block and strip.
+	 */
+	size_t maxDataSize() const
+	{
+		if(compression == COMPRESSION_NONE)
+			return data_size;
+		if(compression == COMPRESSION_LZW)
+			return data_size + data_size/2 + data_size/256 + 16*(size_t)strip_count;
+		return data_size + data_size/256 + 128*(size_t)strip_count;
+	}
+	/**
+	 *	\brief Gets the size of one uncompressed row in bytes.
+	 */
+	size_t rowBytes() const { return (size_t)width * samples * (bit/8); }
+	/**
+	 *	\brief Gets the number of rows in strip.
+	 */
+	uint32_t stripRows(uint32_t strip) const
+	{
+		uint32_t first = strip * rows_per_strip;
+		return (height - first < rows_per_strip) ? height - first : rows_per_strip;
+	}
+};
+
+/**
+ *	Describes a multi-page TIFF of equal uncompressed pages written by TIFFProvider.\n
+ *	Each page is its IFD followed by its strips, so the offset of every byte is computed from the page number.
+ */
+struct TIFFStackLayout
+{
+	TIFFLayout page; /*!< Layout of each page, TIFFLayout#header_size is not used. */
+	size_t pages; /*!< Number of pages. */
+	bool bigtiff; /*!< True if the file is written as BigTIFF, i.e. it doesn't fit in 4 GB. */
+	size_t header_size; /*!< Size of file header before the first IFD. */
+	size_t ifd_size; /*!< Size of each IFD including out of line tag values. */
+	size_t page_size; /*!< Distance between IFDs: IFD, pixel data and a pad byte to keep IFDs on word boundary. */
+
+	/**
+	 *	\brief Gets the size of whole TIFF file.
+	 */
+	size_t size() const { return header_size + pages*page_size; }
+	/**
+	 *	\brief Gets the offset of IFD of \a page from the file begin.
+	 */
+	size_t ifdOffset(size_t page) const { return header_size + page*page_size; }
+	/**
+	 *	\brief Gets the offset of pixel data of \a page from the file begin.
+	 */
+	size_t dataOffset(size_t page) const { return ifdOffset(page) + ifd_size; }
+};
+
+/**
+ *	One entry of TIFF image file directory.
+ */
+struct TIFFEntry
+{
+	uint16_t tag; /*!< TIFF tag. */
+	uint16_t type; /*!< TIFF field type: SHORT, LONG, RATIONAL or LONG8. */
+	std::vector<uint64_t> values; /*!< Values, RATIONAL is stored as numerator and denominator pair. */
 };
 
 class TIFFProvider {
 private:
 	static TIFF*
-	_tiffStreamOpen(const char* name, const char* mode, void *fd);
+	_tiffMemOpen(const char* name, const char* mode, std::string* buffer);
 	static void	_DummyUnmapProc(thandle_t , tdata_t , toff_t );
 	static int	_DummyMapProc(thandle_t , tdata_t* , toff_t* );
-	static int	_osCloseProc(thandle_t fd);
-	static toff_t _osSizeProc(thandle_t fd);
-	static toff_t _osSeekProc(thandle_t fd, toff_t off, int whence);
-	static tsize_t	_osWriteProc(thandle_t fd, tdata_t buf, tsize_t size);
-	static tsize_t	_osReadProc(thandle_t, tdata_t, tsize_t);
-	//tiffos_data *private_data;
+	static int	_memCloseProc(thandle_t fd);
+	static toff_t _memSizeProc(thandle_t fd);
+	static toff_t _memSeekProc(thandle_t fd, toff_t off, int whence);
+	static tsize_t	_memWriteProc(thandle_t fd, tdata_t buf, tsize_t size);
+	static tsize_t	_memReadProc(thandle_t, tdata_t, tsize_t);
+
+	static std::string CompressStrip(const TIFFLayout& layout, const char* rows, uint32_t row_count);
+	static std::string EncodeCompressedTIFF(const char* pixels, TIFFLayout layout);
+
+	/**
+	 *	Key of header template: width, height, bits per sample, photometric, sample format, rows per strip.
+	 */
+	typedef std::tuple<uint32_t, uint32_t, uint16_t, uint16_t, uint16_t, uint32_t> header_key_t;
+	static std::map<header_key_t, std::shared_ptr<const std::string>> _headers; /*!< Header templates written so far. */
+	static std::mutex _headers_mutex; /*!< Guards TIFFProvider#_headers. */
 
 public:
 	TIFFProvider();
 	virtual ~TIFFProvider();
-	static TIFF* StreamOpen(const char* name, void*);
-	static void WriteTIFF(TIFF* into, void *data, int p_width, int p_height, uint bit, char photometric);
+	static TIFF* MemOpen(const char* name, std::string* buffer);
+	static void WriteTIFF(TIFF* into, void *data, int p_width, int p_height, uint bit, char photometric,
+			uint16_t sampleformat = SAMPLEFORMAT_UINT);
+
+	static bool isNativeLayout(char photometric);
+	static bool isCompressionSupported(uint16_t compression);
+	static TIFFLayout Layout(int p_width, int p_height, uint bit, char photometric,
+			uint16_t sampleformat = SAMPLEFORMAT_UINT, uint16_t compression = COMPRESSION_NONE, uint32_t rows_per_strip = 0);
+
+	static std::vector<TIFFEntry> Entries(const TIFFLayout& layout, bool bigtiff);
+	static size_t IFDSize(const std::vector<TIFFEntry>& entries, bool bigtiff);
+	static void WriteIFD(const std::vector<TIFFEntry>& entries, bool bigtiff, uint64_t ifd_offset, uint64_t next_ifd, char* into);
+	static void WriteTIFFHeader(const TIFFLayout& layout, char* into, const std::vector<uint64_t>* strip_sizes = NULL);
+
+	static TIFFStackLayout StackLayout(const TIFFLayout& page, size_t pages);
+	static void WriteStackHeader(const TIFFStackLayout& stack, char* into);
+	static void WriteStackIFD(const TIFFStackLayout& stack, size_t page, char* into);
 
+	static std::shared_ptr<const std::string> HeaderTemplate(const TIFFLayout& layout);
+	static std::string EncodeTIFF(const void *data, size_t data_len, int p_width, int p_height, uint bit, char photometric,
+			uint16_t sampleformat = SAMPLEFORMAT_UINT);
+	static std::string EncodeTIFF(const void *data, size_t data_len, const TIFFLayout& layout);
 };
 
 #endif /* TIFFPROVIDER_H_ */
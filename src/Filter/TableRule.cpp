@@ -130,7 +130,7 @@ std::vector<std::string> TableRule::readNXFieldBoolean (pninx::NXField& nxfield,
 }
 ///@}
 
-FSType TableRule::getattr(pninx::NXObject &nxobject)
+FSType TableRule::getattr(const NXMetadata& metadata)
 {
 	return FSType::FILE;
 }
@@ -304,6 +304,19 @@ size_t TableRule::size(pninx::NXObject &nxobject)
 	return output;
 }
 
+/**
+ *	\brief Gets the size of file without opening NeXus object, see Rule::sizeFromMetadata.
+ *	\return False for groups, the columns have to be opened to know the size of table.
+ */
+bool TableRule::sizeFromMetadata(const NXMetadata& metadata, const SliceRef& slice, size_t& size)
+{
+	if(metadata.object_type != pni::nx::NXObjectType::NXFIELD)
+		return false;
+	//todo think how many characters there will be
+	size = metadata.size * 2;
+	return true;
+}
+
 /**
  *	\brief Gets size of file if NeXus object is a NXGROUP.
  *	\param [in] nxgroup : NeXus group that has to be represented.
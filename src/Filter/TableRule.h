@@ -124,10 +124,11 @@ public:
 	virtual ~TableRule();
 
 	//fuse methods
-	virtual FSType getattr(pninx::NXObject &nxobject);
+	virtual FSType getattr(const NXMetadata& metadata);
 	//virtual std::vector<std::string> readdir(pninx::NXObject &nxobject);
 	virtual std::string read(pninx::NXObject &nxobject);
 	virtual size_t size(pninx::NXObject &nxobject);
+	virtual bool sizeFromMetadata(const NXMetadata& metadata, const SliceRef& slice, size_t& size);
 };
 
 #endif /* TABLERULE_H_ */
@@ -0,0 +1,148 @@
+/*
+ * ThreadPool.cpp
+ *
+ *  Created on: Jul 22, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#include "ThreadPool.h"
+#include <memory>
+#include <atomic>
+
+/**
+ *	\brief Constructor of ThreadPool.
+ *	\param [in] threads : number of workers, at least one is started.
+ */
+ThreadPool::ThreadPool(size_t threads) : _stop(false)
+{
+	if(threads == 0)
+		threads = 1;
+	for(size_t i=0; i<threads; i++)
+		_workers.push_back( std::thread( &ThreadPool::work, this ) );
+}
+
+/**
+ *	Destructor of ThreadPool. Finishes queued tasks and joins workers.
+ */
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_wakeup.notify_all();
+	for(std::thread& worker : _workers)
+		worker.join();
+}
+
+/**
+ *	\brief Loop of worker thread: takes tasks from queue while pool is alive.
+ */
+void ThreadPool::work()
+{
+	for(;;)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			while( !_stop && _tasks.empty() )
+				_wakeup.wait(lock);
+			if( _tasks.empty() )
+				return;
+			task = std::move( _tasks.front() );
+			_tasks.pop_front();
+		}
+		task();
+	}
+}
+
+/**
+ *	\brief Queues the task to be executed by one of workers.
+ *	\param [in] task : function to be called. It shouldn't throw.
+ */
+void ThreadPool::run(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_tasks.push_back( std::move(task) );
+	}
+	_wakeup.notify_one();
+}
+
+/**
+ *	\brief Calls \a body for each index in [0, n) concurrently and waits until all calls are done.
+ *	\param [in] n : number of indexes.
+ *	\param [in] body : function called once for each index. It shouldn't throw.
+ *
+ *	The calling thread takes part in work, so it is safe to call it from a task executed by the pool.
+ */
+void ThreadPool::parallelFor(size_t n, std::function<void(size_t)> body)
+{
+	if(n == 0)
+		return;
+
+	struct State
+	{
+		std::atomic<size_t> next;
+		size_t done;
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+	auto state = std::make_shared<State>();
+	state->next = 0;
+	state->done = 0;
+
+	auto loop = [state, n, body]()
+	{
+		size_t i;
+		while( (i = state->next++) < n )
+		{
+			body(i);
+			std::lock_guard<std::mutex> lock(state->mutex);
+			if( ++state->done == n )
+				state->finished.notify_all();
+		}
+	};
+
+	size_t helpers = (n - 1 < _workers.size()) ? n - 1 : _workers.size();
+	for(size_t i=0; i<helpers; i++)
+		run(loop);
+	loop();
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	while( state->done < n )
+		state->finished.wait(lock);
+}
+
+/**
+ *	\brief Gets the number of workers.
+ */
+size_t ThreadPool::size() const
+{
+	return _workers.size();
+}
+
+/**
+ *	\brief Gets the pool shared by whole application.
+ *	\return Pool with one worker per hardware thread.
+ */
+ThreadPool& ThreadPool::shared()
+{
+	static ThreadPool pool( std::thread::hardware_concurrency() );
+	return pool;
+}
@@ -0,0 +1,59 @@
+/*
+ * ThreadPool.h
+ *
+ *  Created on: Jul 22, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <stdio.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/**
+ *	Fixed set of worker threads executing queued tasks.\n
+ *	Used for work that can be split, e.g. compressing TIFF strips concurrently.
+ */
+class ThreadPool {
+private:
+	std::vector<std::thread> _workers; /*!< Threads executing tasks. */
+	std::deque<std::function<void()>> _tasks; /*!< Tasks waiting for a free worker. */
+	std::mutex _mutex; /*!< Guards ThreadPool#_tasks and ThreadPool#_stop. */
+	std::condition_variable _wakeup; /*!< Signals new task or stop to workers. */
+	bool _stop; /*!< True when pool is being destroyed. */
+
+	void work();
+
+public:
+	ThreadPool(size_t threads);
+	virtual ~ThreadPool();
+
+	void run(std::function<void()> task);
+	void parallelFor(size_t n, std::function<void(size_t)> body);
+	size_t size() const;
+
+	static ThreadPool& shared();
+};
+
+#endif /* THREADPOOL_H_ */
@@ -214,7 +214,8 @@ std::string XMLFile::findSpecificRule( std::string nxobject_path )
 	for(match = this->_doc.first_child().child("specific_rules").first_child() ; match ; match = match.next_sibling() )
 	{
 		std::string str = match.child( "path" ).child_value();
-		if( strcmp( str.c_str(), nxobject_path.c_str() ) == 0 )
+		// concatenations span files, they are not rules of the objects within one file (see XMLFile::fetchConcatRules)
+		if( strcmp( str.c_str(), nxobject_path.c_str() ) == 0 && strcmp( match.child("mode").child_value(), "concat" ) != 0 )
 			break;
 	}
 	std::string output;
@@ -292,7 +293,8 @@ std::map<std::string, std::string> XMLFile::fetchSpecificRule( std::string nxobj
 	// looking for certain xml_node for nxobject
 	for ( pugi::xml_node object = first_nxrule.first_child(); object; object= object.next_sibling() )
 	{
-		if ( strcmp( object.child("path").child_value(), nxobject_path.c_str() ) == 0 )
+		if ( strcmp( object.child("path").child_value(), nxobject_path.c_str() ) == 0
+				&& strcmp( object.child("mode").child_value(), "concat" ) != 0 )
 		{
 			mode = object.child("mode").child_value();
 			match = object;
@@ -320,9 +322,42 @@ std::map<std::string, std::string> XMLFile::fetchSpecificRule( std::string nxobj
 	return output;
 }
 
+/**
+ *	\brief Fetches the rules of concatenated fields of several NeXus files, i.e. specific rules with mode \c concat.
+ *	\return Options of each rule, as fetchSpecificRule returns them, and the path of field within each file as \c path option.
+ *
+ *	For example:
+ *	\code
+ *	<object>
+ *		<path>/entry/data/data</path>
+ *		<mode>concat</mode>
+ *		<concat>
+ *			<name>scan_stack</name>
+ *			<files>scan_*.nx</files>
+ *		</concat>
+ *	</object>
+ *	\endcode
+ */
+std::vector<std::map<std::string, std::string>> XMLFile::fetchConcatRules()
+{
+	std::vector<std::map<std::string, std::string>> output;
 
+	auto first_nxrule = _doc.first_element_by_path( ".filters.specific_rules", '.' );
+	for ( pugi::xml_node object = first_nxrule.first_child(); object; object= object.next_sibling() )
+	{
+		if ( strcmp( object.child("mode").child_value(), "concat" ) != 0 )
+			continue;
 
+		std::map<std::string, std::string> options;
+		recursiveFetchParameter(object.child( "concat" ).first_child(), options, "");
+		if( findDefaultRule("concat") )
+		{
+			auto def_rule_options = fetchDefaultRule("concat");
+			options.insert( def_rule_options.begin(), def_rule_options.end() );
+		}
+		options["path"] = object.child("path").child_value();
+		output.push_back(options);
+	}
 
-
-
-
+	return output;
+}
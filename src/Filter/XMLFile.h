@@ -69,6 +69,7 @@ public:
 	pugi::xml_node& operator[]( const char* path );
 	std::map<std::string, std::string> fetchDefaultRule( std::string rule_name );
 	std::map<std::string, std::string> fetchSpecificRule( std::string nxobject_path );
+	std::vector<std::map<std::string, std::string>> fetchConcatRules();
 
 	bool findDefaultRule( std::string rule_name );
 	std::string findSpecificRule( std::string rule_name );
@@ -0,0 +1,463 @@
+/*
+ * ZarrRule.cpp
+ *
+ *  Created on: Sep 23, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#include "ZarrRule.h"
+#include <cmath>
+#include <sstream>
+#include <iomanip>
+
+/**
+ *	\brief Constructor of ZarrRule.
+ *	\param [in] part : file of Zarr array represented.
+ *	\param [in] storage : how the field is stored, see NXGateway::chunkStorage.
+ *
+ *	The chunks are passed through if the filters are shuffle followed by deflate, each of them optional.
+ */
+ZarrRule::ZarrRule(Part part, const ChunkStorage& storage) : _part(part), _storage(storage), _pass_through(true), _shuffle(0), _level(-1)
+{
+	addOption("fsobject_type", "FILE");
+
+	for(const ChunkFilter& filter : storage.filters)
+	{
+		if(filter.id == H5Z_FILTER_SHUFFLE && _shuffle == 0 && _level < 0)
+			_shuffle = storage.value_bytes;
+		else if(filter.id == H5Z_FILTER_DEFLATE && _level < 0)
+			_level = filter.values.empty() ? 6 : filter.values[0];
+		else
+			_pass_through = false;
+	}
+	if( !_pass_through )
+	{
+		_shuffle = 0;
+		_level = -1;
+	}
+}
+
+/**
+ *	 Destructor of ZarrRule
+ */
+ZarrRule::~ZarrRule() {
+
+}
+
+/**
+ *	\brief Gets the Zarr data type of field.
+ *	\param [in] storage : how the field is stored.
+ *	\return Data type such as "<u2", empty if the values are not integers or floats.
+ */
+std::string ZarrRule::dtype(const ChunkStorage& storage)
+{
+	char kind;
+	if(storage.type_class == H5T_INTEGER)
+		kind = storage.is_signed ? 'i' : 'u';
+	else if(storage.type_class == H5T_FLOAT && (storage.value_bytes == 2 || storage.value_bytes == 4 || storage.value_bytes == 8))
+		kind = 'f';
+	else
+		return std::string();
+
+	char order = (storage.value_bytes == 1) ? '|' : (storage.little_endian ? '<' : '>');
+	return std::string(1, order) + kind + std::to_string(storage.value_bytes);
+}
+
+/**
+ *	\brief Gets the number of chunks along each dimension.
+ *	\param [in] storage : how the field is stored.
+ */
+std::vector<size_t> ZarrRule::chunkGrid(const ChunkStorage& storage)
+{
+	std::vector<size_t> output;
+	for(size_t d=0; d<storage.dims.size(); d++)
+		output.push_back( (storage.dims[d] + storage.chunk[d] - 1) / storage.chunk[d] );
+	return output;
+}
+
+/**
+ *	\brief Gets the position of the first value of chunk.
+ *	\param [in] index : number of chunk in C order.
+ */
+std::vector<size_t> ZarrRule::chunkOffset(size_t index) const
+{
+	std::vector<size_t> grid = chunkGrid(_storage);
+	std::vector<size_t> output(grid.size(), 0);
+	for(size_t d=grid.size(); d-- > 0; )
+	{
+		output[d] = (index % grid[d]) * _storage.chunk[d];
+		index /= grid[d];
+	}
+	return output;
+}
+
+/**
+ *	\brief Gets the size of decoded chunk in bytes, edge chunks are as large as the others.
+ */
+size_t ZarrRule::chunkBytes() const
+{
+	size_t output = _storage.value_bytes;
+	for(size_t n : _storage.chunk)
+		output *= n;
+	return output;
+}
+
+/**
+ *	\brief Escapes string as JSON wants it.
+ *	\param [in] value : string to be escaped.
+ *	\return JSON string, with the quotes.
+ */
+std::string ZarrRule::jsonString(const std::string& value)
+{
+	std::ostringstream stream;
+	stream << '"';
+	for(unsigned char c : value)
+	{
+		if(c == '"' || c == '\\')
+			stream << '\\' << c;
+		else if(c < 0x20)
+			stream << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec;
+		else
+			stream << c;
+	}
+	stream << '"';
+	return stream.str();
+}
+
+/**
+ *	\brief Writes the metadata of Zarr array.
+ *	\return Content of .zarray.
+ */
+std::string ZarrRule::zarray() const
+{
+	std::ostringstream stream;
+	stream << "{\n    \"chunks\": [";
+	for(size_t d=0; d<_storage.chunk.size(); d++)
+		stream << (d ? ", " : "") << _storage.chunk[d];
+	stream << "],\n    \"compressor\": ";
+	if(_level >= 0)
+		stream << "{\"id\": \"zlib\", \"level\": " << _level << "}";
+	else
+		stream << "null";
+	stream << ",\n    \"dtype\": " << jsonString( dtype(_storage) ) << ",\n    \"fill_value\": ";
+	if( std::isnan(_storage.fill_value) )
+		stream << "\"NaN\"";
+	else if( std::isinf(_storage.fill_value) )
+		stream << (_storage.fill_value > 0 ? "\"Infinity\"" : "\"-Infinity\"");
+	else if(_storage.type_class == H5T_INTEGER)
+		stream << (long long)_storage.fill_value;
+	else
+		stream << std::setprecision(17) << _storage.fill_value;
+	stream << ",\n    \"filters\": ";
+	if(_shuffle > 0)
+		stream << "[{\"elementsize\": " << _shuffle << ", \"id\": \"shuffle\"}]";
+	else
+		stream << "null";
+	stream << ",\n    \"order\": \"C\",\n    \"shape\": [";
+	for(size_t d=0; d<_storage.dims.size(); d++)
+		stream << (d ? ", " : "") << _storage.dims[d];
+	stream << "],\n    \"zarr_format\": 2\n}\n";
+	return stream.str();
+}
+
+/**
+ *	\brief Writes the attributes of Zarr array.
+ *	\param [in] nxpath : full path of field.
+ *	\return Content of .zattrs, the string attributes of field.
+ */
+std::string ZarrRule::zattrs(const std::string& nxpath) const
+{
+	std::ostringstream stream;
+	stream << "{";
+	bool first = true;
+	for(auto& attribute : NXGateway::stringAttributes(nxpath))
+	{
+		stream << (first ? "\n    " : ",\n    ") << jsonString(attribute.first) << ": " << jsonString(attribute.second);
+		first = false;
+	}
+	stream << (first ? "}\n" : "\n}\n");
+	return stream.str();
+}
+
+/**
+ *	\brief Shuffles bytes as the shuffle filter of HDF5 does: the first bytes of all values, then the second bytes, and so on.
+ *	\param [in] data : values.
+ *	\param [in] element_size : size of one value.
+ */
+std::string ZarrRule::shuffle(const std::string& data, size_t element_size)
+{
+	std::string output(data.size(), '\0');
+	size_t count = data.size() / element_size;
+	for(size_t i=0; i<count; i++)
+		for(size_t b=0; b<element_size; b++)
+			output[b*count + i] = data[i*element_size + b];
+	// bytes of incomplete value stay at the end
+	for(size_t i=count*element_size; i<data.size(); i++)
+		output[i] = data[i];
+	return output;
+}
+
+/**
+ *	\brief Gets the size of zlib stream of stored blocks, see ZarrRule::storedZlib.
+ *	\param [in] size : size of data.
+ */
+size_t ZarrRule::storedZlibSize(size_t size)
+{
+	size_t blocks = (size == 0) ? 1 : (size + 65534) / 65535;
+	return 2 + blocks*5 + size + 4;
+}
+
+/**
+ *	\brief Wraps data in a zlib stream of stored (not compressed) deflate blocks, zlib decompresses it as any other.
+ *	\param [in] data : data to be wrapped.
+ *
+ *	It is written for chunks HDF5 stored without deflate, though the field is deflated: Zarr expects each chunk compressed.
+ */
+std::string ZarrRule::storedZlib(const std::string& data)
+{
+	std::string output;
+	output.reserve( storedZlibSize(data.size()) );
+	output += '\x78';
+	output += '\x01';
+
+	size_t pos = 0;
+	do
+	{
+		size_t length = std::min<size_t>(data.size() - pos, 65535);
+		bool last = (pos + length == data.size());
+		output += (char)(last ? 1 : 0);
+		output += (char)(length & 0xff);
+		output += (char)(length >> 8);
+		output += (char)(~length & 0xff);
+		output += (char)((~length >> 8) & 0xff);
+		output.append(data, pos, length);
+		pos += length;
+	} while(pos < data.size());
+
+	uint32_t a = 1, b = 0;
+	for(unsigned char c : data)
+	{
+		a = (a + c) % 65521;
+		b = (b + a) % 65521;
+	}
+	uint32_t adler = (b << 16) | a;
+	for(int shift = 24; shift >= 0; shift -= 8)
+		output += (char)((adler >> shift) & 0xff);
+	return output;
+}
+
+/**
+ *	\brief Reads a chunk as Zarr expects it.
+ *	\param [in] nxpath : full path of field.
+ *	\param [in] index : number of chunk in C order.
+ *	\return Bytes of chunk file.
+ *	\throw NXFSException if the chunk was never written, Zarr takes the fill value then.
+ *
+ *	Chunks are passed through as HDF5 stores them. A chunk HDF5 skipped some filter for, or a chunk of field whose filters
+ *	Zarr doesn't know, is read through the filters, and encoded again by shuffle and stored zlib blocks if the array has them.
+ */
+std::string ZarrRule::readChunk(const std::string& nxpath, size_t index) const
+{
+	std::vector<size_t> offset = chunkOffset(index);
+	unsigned filter_mask = 0;
+	size_t nbytes;
+	if( !NXGateway::chunkInfo(nxpath, offset, filter_mask, nbytes) )
+		throw NXFSException("ZarrRule: chunk was not written: " + nxpath);
+
+	std::string output;
+	if( _pass_through && filter_mask == 0 && NXGateway::readChunk(nxpath, offset, output, filter_mask) && filter_mask == 0 )
+		return output;
+	return encodeChunk(nxpath, offset);
+}
+
+/**
+ *	\brief Reads a chunk through the filters, and encodes it again by the codecs of array.
+ *	\param [in] nxpath : full path of field.
+ *	\param [in] offset : position of the first value of chunk.
+ *	\return Chunk as Zarr decodes it, deflate is replaced by stored zlib blocks.
+ */
+std::string ZarrRule::encodeChunk(const std::string& nxpath, const std::vector<size_t>& offset) const
+{
+	std::string output;
+	if( !NXGateway::readChunkValues(nxpath, offset, output) )
+		throw NXFSException("ZarrRule: cannot read chunk of " + nxpath);
+	if(_shuffle > 0)
+		output = shuffle(output, _shuffle);
+	if(_level >= 0)
+		output = storedZlib(output);
+	return output;
+}
+
+/**
+ *	\brief Encodes data in base64.
+ */
+std::string ZarrRule::base64(const std::string& data)
+{
+	static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string output;
+	output.reserve( (data.size() + 2) / 3 * 4 );
+	for(size_t i=0; i<data.size(); i+=3)
+	{
+		uint32_t group = (uint32_t)(unsigned char)data[i] << 16;
+		if(i + 1 < data.size())
+			group |= (uint32_t)(unsigned char)data[i + 1] << 8;
+		if(i + 2 < data.size())
+			group |= (unsigned char)data[i + 2];
+		output += digits[(group >> 18) & 63];
+		output += digits[(group >> 12) & 63];
+		output += (i + 1 < data.size()) ? digits[(group >> 6) & 63] : '=';
+		output += (i + 2 < data.size()) ? digits[group & 63] : '=';
+	}
+	return output;
+}
+
+/**
+ *	\brief Tells whether chunks stored by HDF5 are Zarr chunks as they are, only such arrays can be described by references.
+ */
+bool ZarrRule::passThrough() const
+{
+	return _pass_through;
+}
+
+/**
+ *	\brief Writes the references to chunks of field in NeXus file, in kerchunk format (version 1).
+ *	\param [in] nxpath : full path of field.
+ *	\return JSON of a Zarr group with one array named as the field. Its chunks are given as [file, offset, length],
+ *	chunks HDF5 skipped some filter for are given inline ("base64:...") as ZarrRule::readChunk gives them.
+ *	\throw NXFSException if the chunks can't be listed.
+ *
+ *	The list is made when the file is read, chunks written later to a file being written are not in it.
+ */
+std::string ZarrRule::references(const std::string& nxpath) const
+{
+	std::string file_path;
+	std::vector<ChunkLocation> chunks;
+	if( !NXGateway::chunkLocations(nxpath, file_path, chunks) )
+		throw NXFSException("ZarrRule: cannot list chunks of " + nxpath);
+
+	std::string name = nxpath.substr( nxpath.find_last_of('/') + 1 );
+	std::string file = jsonString(file_path);
+	std::ostringstream stream;
+	stream << "{\n  \"version\": 1,\n  \"refs\": {\n";
+	stream << "    \".zgroup\": " << jsonString("{\"zarr_format\": 2}") << ",\n";
+	stream << "    " << jsonString(name + "/.zarray") << ": " << jsonString( zarray() ) << ",\n";
+	stream << "    " << jsonString(name + "/.zattrs") << ": " << jsonString( zattrs(nxpath) );
+	for(const ChunkLocation& chunk : chunks)
+	{
+		std::string key = name + "/";
+		for(size_t d=0; d<chunk.offset.size(); d++)
+			key += (d ? "." : "") + std::to_string( chunk.offset[d] / _storage.chunk[d] );
+		stream << ",\n    " << jsonString(key) << ": ";
+		if(chunk.filter_mask == 0)
+			stream << "[" << file << ", " << chunk.address << ", " << chunk.nbytes << "]";
+		else
+			stream << jsonString( "base64:" + base64( encodeChunk(nxpath, chunk.offset) ) );
+	}
+	stream << "\n  }\n}\n";
+	return stream.str();
+}
+
+/**
+ *	\brief Gets filesystem type of representation, all parts of Zarr array are files.
+ */
+FSType ZarrRule::getattr(const NXMetadata& metadata)
+{
+	return FSType::FILE;
+}
+
+/**
+ *	\brief Reads .zarray, .zattrs or the references.
+ *	\param [in] nxobject : chunked NeXus field.
+ */
+std::string ZarrRule::read(pninx::NXObject &nxobject)
+{
+	// the path within the file is the full path of object of single NeXus file
+	return readContent(nxobject, SliceRef(nxobject.path())).str();
+}
+
+/**
+ *	\brief Reads a file of Zarr array.
+ *	\param [in] nxobject : chunked NeXus field.
+ *	\param [in] slice : full path of field, and number of chunk for chunk files.
+ *	\return Content of file.
+ */
+FileContent ZarrRule::readContent(pninx::NXObject &nxobject, const SliceRef& slice)
+{
+	const std::string& nxpath = slice.nxpath;
+	switch(_part)
+	{
+		case Part::ARRAY:
+			return FileContent( zarray() );
+		case Part::ATTRIBUTES:
+			return FileContent( zattrs(nxpath) );
+		case Part::REFERENCES:
+			return FileContent( references(nxpath) );
+		default:
+			return FileContent( readChunk(nxpath, slice.index) );
+	}
+}
+
+/**
+ *	\brief Gets size of .zarray, .zattrs or the references.
+ *	\param [in] nxobject : chunked NeXus field.
+ */
+size_t ZarrRule::size(pninx::NXObject &nxobject)
+{
+	// the path within the file is the full path of object of single NeXus file
+	return size(nxobject, SliceRef(nxobject.path()));
+}
+
+/**
+ *	\brief Gets size of a file of Zarr array.
+ *	\param [in] nxobject : chunked NeXus field.
+ *	\param [in] slice : full path of field, and number of chunk for chunk files.
+ *	\return Exact size of file.
+ *	\throw NXFSException if the chunk was never written, so that there is no such file.
+ */
+size_t ZarrRule::size(pninx::NXObject &nxobject, const SliceRef& slice)
+{
+	const std::string& nxpath = slice.nxpath;
+	switch(_part)
+	{
+		case Part::ARRAY:
+			return zarray().size();
+		case Part::ATTRIBUTES:
+			return zattrs(nxpath).size();
+		case Part::REFERENCES:
+			return references(nxpath).size();
+		default:
+			break;
+	}
+
+	unsigned filter_mask = 0;
+	size_t nbytes;
+	if( !NXGateway::chunkInfo(nxpath, chunkOffset(slice.index), filter_mask, nbytes) )
+		throw NXFSException("ZarrRule: chunk was not written: " + nxpath);
+	if(_pass_through && filter_mask == 0)
+		return nbytes;
+	return (_level >= 0) ? storedZlibSize( chunkBytes() ) : chunkBytes();
+}
+
+/**
+ *	\brief Sizes of chunks are known to HDF5 only, see Rule::sizeFromMetadata.
+ *	\return Always false.
+ */
+bool ZarrRule::sizeFromMetadata(const NXMetadata& metadata, const SliceRef& slice, size_t& size)
+{
+	return false;
+}
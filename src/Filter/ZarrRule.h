@@ -0,0 +1,90 @@
+/*
+ * ZarrRule.h
+ *
+ *  Created on: Sep 23, 2013
+ *  Author: Egor Iurchenko <egor.iurchenko@kit.edu> (Karlsruher Institut für Technologie)
+ *  NXFS. FUSE for NeXus files with NeXus data filtering based on rules stored in xml file.
+ *  Copyright (C) 2013 Karlsruher Institut für Technologie (KIT)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#ifndef ZARRRULE_H_
+#define ZARRRULE_H_
+
+#include <string>
+#include <vector>
+
+#include "Rule.h"
+#include "NXGateway.h"
+
+/**
+ *	Class represents chunked NeXus field as Zarr v2 array: a folder of .zarray, .zattrs and one file for each chunk,
+ *	named by its chunk key (see FSObject::setChunkKeys).\n
+ *	Chunks are read as HDF5 stores them and passed through if Zarr can decode them, i.e. the filters are shuffle and deflate
+ *	(zlib in Zarr). Otherwise the chunks are given decoded and the array has no compressor.\n
+ *	The same array can be described by references to the chunks in NeXus file (ZarrRule::Part::REFERENCES), so that readers
+ *	on the same machine read them from the file directly.
+ */
+class ZarrRule: public Rule {
+public:
+	/**
+	 *	File of Zarr array represented by the rule.
+	 */
+	enum class Part {
+		ARRAY, /*!< .zarray, the shape, chunks, value type and codecs. */
+		ATTRIBUTES, /*!< .zattrs, the string attributes of field. */
+		CHUNK, /*!< One chunk, the slice of file is the number of chunk in C order. */
+		REFERENCES /*!< Offsets and lengths of all chunks in NeXus file, in kerchunk format. */
+	};
+
+private:
+	Part _part; /*!< File represented. */
+	ChunkStorage _storage; /*!< How the field is stored, taken when the tree was built. */
+	bool _pass_through; /*!< True if chunks stored by HDF5 are Zarr chunks as they are. */
+	size_t _shuffle; /*!< Element size of shuffle filter, 0 if there is none. */
+	int _level; /*!< Level of zlib compressor, -1 if there is none. */
+
+	std::vector<size_t> chunkOffset(size_t index) const;
+	size_t chunkBytes() const;
+	std::string zarray() const;
+	std::string zattrs(const std::string& nxpath) const;
+	std::string readChunk(const std::string& nxpath, size_t index) const;
+	std::string encodeChunk(const std::string& nxpath, const std::vector<size_t>& offset) const;
+	std::string references(const std::string& nxpath) const;
+
+	static std::string shuffle(const std::string& data, size_t element_size);
+	static std::string storedZlib(const std::string& data);
+	static size_t storedZlibSize(size_t size);
+	static std::string jsonString(const std::string& value);
+	static std::string base64(const std::string& data);
+
+public:
+	ZarrRule(Part part, const ChunkStorage& storage);
+	virtual ~ZarrRule();
+
+	static std::string dtype(const ChunkStorage& storage);
+	static std::vector<size_t> chunkGrid(const ChunkStorage& storage);
+	bool passThrough() const;
+
+	//fuse methods
+	virtual FSType getattr(const NXMetadata& metadata);
+	virtual std::string read(pninx::NXObject &nxobject);
+	virtual FileContent readContent(pninx::NXObject &nxobject, const SliceRef& slice);
+	virtual size_t size(pninx::NXObject &nxobject);
+	virtual size_t size(pninx::NXObject &nxobject, const SliceRef& slice);
+	virtual bool sizeFromMetadata(const NXMetadata& metadata, const SliceRef& slice, size_t& size);
+};
+
+#endif /* ZARRRULE_H_ */
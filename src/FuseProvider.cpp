@@ -22,6 +22,9 @@
 
 #include "FuseProvider.h"
 
+std::set<FuseProvider::OpenFile*> FuseProvider::_pollers;
+std::mutex FuseProvider::_pollers_mutex;
+
 // ./progName [FUSE options] dummy.h5 xml_file mountdir
 //argv[argc-1] = mountdir = argv[3]
 //argv[argc-2] = nxfile  = argv[2]
@@ -37,12 +40,14 @@
  *	Arguments should be the following:\n
  *	1) &lt;programName&gt; -h : prints the help about mount options and FUSE options.\n
  *	2) &lt;programName&gt; [FUSE and mount options] [XML file path] &lt;NeXus file path&gt; &lt;mount directory&gt;.\n
- *	The order of arguments makes sense, do not change it.
+ *	The order of arguments makes sense, do not change it. The option --follow[=&lt;ms&gt;] may be given among FUSE options.
  */
 FuseProvider::FuseProvider(int argc, char** argv) {
 	std::string _xmlfile_path = "";
 	std::string _nxfile_path;
 
+	Filter::setFollow( followOption(argc, argv) );
+
 	if(argc == 2 && argv[argc-1][0] == '-' && argv[argc-1][1] == 'h' )
 	{
 		fuse_main( argc, argv, &fs_operations, NULL );
@@ -97,6 +102,8 @@ FuseProvider::FuseProvider(int argc, char** argv) {
 
 	//private data initialization
 	_fs_data.logFile = ErrorLog::log_fuse_open();//FuseProvider::log.log_fuse_open();
+	// before NeXus file is opened and threads are started
+	ReadWorkers::start( ReadWorkers::countFromEnvironment(), _nxfile_path, Filter::following() );
 	_fs_data.myFilter = new Filter(_nxfile_path.c_str(), _xmlfile_path.c_str());
 	_fs_data.myFilter->createTree();
 
@@ -107,18 +114,45 @@ FuseProvider::FuseProvider(int argc, char** argv) {
 	fs_operations.open = fs_open;
 	fs_operations.getattr = fs_getattr;
 	fs_operations.read = fs_read;
+	fs_operations.read_buf = fs_read_buf;
 	fs_operations.readdir = fs_readdir;
 	fs_operations.init = fs_init;
 	fs_operations.opendir = fs_opendir;
 	fs_operations.releasedir = fs_releasedir;
 	fs_operations.access = fs_access;
 	fs_operations.fgetattr = fs_fgetattr;
+	if( Filter::following() )
+	{
+		fs_operations.release = fs_release;
+		fs_operations.poll = fs_poll;
+		Filter::setChangeListener(notifyPollers);
+	}
 
 	fprintf( stderr, "\nFUSE starting. Mounting in %s \n", argv[argc-1] );
 	int fuse_stat;
 
+	// kernel remembers missing paths too; options given by user come later and win
+	char negative_timeout[64];
+	snprintf(negative_timeout, sizeof(negative_timeout), "negative_timeout=%d", Filter::NEGATIVE_TIMEOUT);
+	std::vector<char*> fuse_argv;
+	fuse_argv.push_back(argv[0]);
+	// inode numbers are given by FSTree (FSObject::stat), FUSE puts its own node ids into st_ino otherwise
+	fuse_argv.push_back(const_cast<char*>("-o"));
+	fuse_argv.push_back(const_cast<char*>("use_ino"));
+	fuse_argv.push_back(const_cast<char*>("-o"));
+	if( !Filter::following() )
+		fuse_argv.push_back(negative_timeout);
+	else
+	{
+		// slice files appear while the file is written; the kernel drops cached contents of files whose time or size changed
+		fuse_argv.push_back(const_cast<char*>("auto_cache"));
+	}
+	for(int i=1; i<argc; i++)
+		fuse_argv.push_back(argv[i]);
+	fuse_argv.push_back(NULL);
+
 	ErrorLog::changeStateToFUSEmode();
-	fuse_stat = fuse_main( argc, argv, &fs_operations, reinterpret_cast<void*>( &_fs_data ) );
+	fuse_stat = fuse_main( fuse_argv.size() - 1, fuse_argv.data(), &fs_operations, reinterpret_cast<void*>( &_fs_data ) );
 
 	fprintf( stderr, "fuse returned %d \n", fuse_stat );
 	fprintf( stderr, "%s \n", strerror( fuse_stat ) );
@@ -148,6 +182,117 @@ int FuseProvider::fs_access (const char *path, int mask)
 }
 
 
+/**\brief Finds and removes the option --follow[=&lt;ms&gt;] from passed arguments.
+ *
+ *	\param [in,out] argc : number of passed arguments.
+ *	\param [in,out] argv : arguments, the option is removed so that FUSE doesn't see it.
+ *	\return Milliseconds between refreshes of NeXus file, 0 if the option is not given.
+ */
+int FuseProvider::followOption(int& argc, char** argv)
+{
+	int interval = 0;
+	for(int i=1; i<argc; )
+	{
+		if( strcmp(argv[i], "--follow") == 0 )
+			interval = Filter::DEFAULT_FOLLOW_INTERVAL;
+		else if( strncmp(argv[i], "--follow=", 9) == 0 )
+		{
+			interval = atoi(argv[i] + 9);
+			if(interval <= 0)
+				Filter::usage();
+		}
+		else
+		{
+			i++;
+			continue;
+		}
+		for(int j=i; j<argc; j++)
+			argv[j] = argv[j+1];
+		argc--;
+	}
+	return interval;
+}
+
+/**\brief Releases the version and the poll kept for opened file, see FuseProvider::fs_open.
+ *
+ */
+int FuseProvider::fs_release(const char* path, struct fuse_file_info* fi)
+{
+	OpenFile* file = reinterpret_cast<OpenFile*>(fi->fh);
+	if(file == NULL)
+		return 0;
+	{
+		std::lock_guard<std::mutex> lock(_pollers_mutex);
+		_pollers.erase(file);
+		if(file->poller != NULL)
+			fuse_pollhandle_destroy(file->poller);
+	}
+	delete file;
+	fi->fh = 0;
+	return 0;
+}
+
+/**\brief Polls file of NeXus file being written.
+ *
+ *	\param [in] path : path of file opened by user.
+ *	\param [in] fi : file info about opened file, it keeps the version of file reported last and the poll waiting.
+ *	\param [in] ph : poll handle, it is notified when NeXus objects grow (FuseProvider::notifyPollers).
+ *	It replaces the one of the previous poll of file, which is destroyed.
+ *	\param [out] reventsp : POLLIN if the NeXus object of file grew since the file was opened or polled ready last.
+ *	\return 0 if success.
+ *
+ *	A consumer polls a slice file of image folder or a table file to wake up when new frames or rows land.
+ */
+int FuseProvider::fs_poll(const char* path, struct fuse_file_info* fi, struct fuse_pollhandle* ph, unsigned* reventsp)
+{
+	// versions are published before the pollers are notified, so a change is either seen here or notified
+	std::lock_guard<std::mutex> lock(_pollers_mutex);
+	OpenFile* file = reinterpret_cast<OpenFile*>(fi->fh);
+	unsigned long version = NXFS_DATA->myFilter->version(path);
+	*reventsp = 0;
+	if(file != NULL && file->version != version)
+	{
+		file->version = version;
+		*reventsp = POLLIN | POLLRDNORM;
+	}
+
+	if(ph == NULL)
+		return 0;
+	if(*reventsp != 0 || file == NULL)
+	{
+		fuse_pollhandle_destroy(ph);
+		return 0;
+	}
+	// the kernel polls again with a new handle, only the last one is notified
+	if(file->poller != NULL)
+		fuse_pollhandle_destroy(file->poller);
+	file->poller = ph;
+	_pollers.insert(file);
+	return 0;
+}
+
+/**\brief Wakes all polls waiting, the kernel polls their files again and those that grew become ready.
+ *
+ */
+void FuseProvider::notifyPollers()
+{
+	std::vector<struct fuse_pollhandle*> pollers;
+	{
+		std::lock_guard<std::mutex> lock(_pollers_mutex);
+		for(OpenFile* file : _pollers)
+		{
+			pollers.push_back(file->poller);
+			file->poller = NULL;
+		}
+		_pollers.clear();
+	}
+	for(struct fuse_pollhandle* ph : pollers)
+	{
+		fuse_notify_poll(ph);
+		fuse_pollhandle_destroy(ph);
+	}
+}
+
 /**\brief Releases memory after directory open
  *
  */
@@ -160,10 +305,11 @@ int FuseProvider::fs_releasedir(const char* path, struct fuse_file_info* fi)
  *	\param [in] conn : struct fuse_conn_info contains FUSE settings.
  *	\return NXFS_DATA : private data structure, contains pointer to Filter, and pointer to FILE for logging.
  *
- *  Passing filter as a private data to FUSE.
+ *  Passing filter as a private data to FUSE. Starts the reloading thread, FUSE has daemonized now.
  */
 void* FuseProvider::fs_init(struct fuse_conn_info *conn)
 {
+	NXFS_DATA->myFilter->startReloader();
     return NXFS_DATA;
 }
 
@@ -209,6 +355,14 @@ int FuseProvider::fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler
  */
 int FuseProvider::fs_open(const char *path, struct fuse_file_info *fi)
 {
+	// the version is compared by FuseProvider::fs_poll
+	if( Filter::following() )
+	{
+		OpenFile* file = new OpenFile();
+		file->version = NXFS_DATA->myFilter->version(path);
+		file->poller = NULL;
+		fi->fh = reinterpret_cast<uint64_t>(file);
+	}
 	return 0;
 }
 
@@ -243,28 +397,21 @@ int FuseProvider::fs_read(const char *path, char *buf, size_t size,
 	try{
 		type = NXFS_DATA->myFilter->getattr(path);
 	}catch (NXFSException&) {
+		ENDNACCESS;
 		return 0;
 	}
 
 	if(type == FSType::FILE)
 	{
-		std::string outputdata;
+		FileContent outputdata;
 		try{
-			outputdata = NXFS_DATA->myFilter->read(path);
+			outputdata = NXFS_DATA->myFilter->read(path, size, offset);
 		}catch (...) {
+			ENDNACCESS;
 			return 0;
 		}
 
-		size_t len = outputdata.length();
-
-		if(offset < len)
-		{
-			if(offset + size > len)
-				size = len - offset;
-			std::copy( ( outputdata.data() + offset ), ( outputdata.data() + offset ) + size, buf );
-		}
-
-		retFileSize = size;
+		retFileSize = outputdata.copy(buf, size, 0);
 	}
 	else
 		retFileSize = -ENOENT;
@@ -273,65 +420,100 @@ int FuseProvider::fs_read(const char *path, char *buf, size_t size,
 	return retFileSize;
 }
 
-
-/**\brief Get attributes of each file/folder.
+/**\brief Gets the file content without copying it.
  *
- *	Writing metadata for file system objects.
- *	\param [in] path : path of file/folder accessed by user.
- *	\param [out] statbuf : buffer that contains metadata of file/folder accessed by user.
+ * 	Like fs_read, but returns the segments of file content (e.g. TIFF header and pixel data) as a buffer vector,
+ * 	so that pixels lying in NeXus file are spliced from the file by FUSE instead of being read here.
+ *	\param [in] path : path of file opened by user.
+ *	\param [out] bufp : buffer vector with the file content, pieces of NeXus file are given by their file descriptor. Allocated here, freed by FUSE.
+ *	\param [in] size : size of maximum block to read.
+ *	\param [in] offset : offset from the file begin. Due to file is read by blocks.
+ *	\param [in] fi : file info about opened filesystem object.
  *	\return 0 if success, -ERRNO if fail.
  */
-int FuseProvider::fs_getattr(const char *path, struct stat *statbuf)
+int FuseProvider::fs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size,
+			off_t offset, struct fuse_file_info *fi)
 {
-	//cache results
-	//statbuf->keep_caching or something like that
-	int retStat = 0;
-	memset(statbuf, 0, sizeof(struct stat)); //cleaning memory
+	// FUSE reads the pieces stored in files after this function returns, so the content of the last
+	// request (and with it the files) is kept alive until the same worker thread handles the next one.
+	static thread_local FileContent served;
 
-	if( strcmp(path, "/") == 0 )
-	{
-		statbuf->st_mode = S_IFDIR | 0444;
-		statbuf->st_nlink = 3;
-		//statbuf->st_atim;//last access
-	}else
+	STARTNACCESS;
+	FSType type;
+	try{
+		type = NXFS_DATA->myFilter->getattr(path);
+		if(type == FSType::FILE)
+			served = NXFS_DATA->myFilter->read(path, size, offset);
+	}catch (...) {
+		type = FSType::NONE;
+	}
+	ENDNACCESS;
+
+	if(type != FSType::FILE)
+		return -ENOENT;
+
+	std::vector<ContentSegment> pieces;
+	served.slice(size, 0, pieces);
+
+	size_t count = pieces.empty() ? 1 : pieces.size();
+	struct fuse_bufvec* bufv = (struct fuse_bufvec*)malloc( sizeof(struct fuse_bufvec) + (count-1)*sizeof(struct fuse_buf) );
+	if(bufv == NULL)
+		return -ENOMEM;
+
+	memset(bufv, 0, sizeof(struct fuse_bufvec) + (count-1)*sizeof(struct fuse_buf));
+	bufv->count = count;
+	for(size_t i=0; i<pieces.size(); i++)
 	{
-		FSType fstype = FSType::NONE;
-		try{
-			fstype = NXFS_DATA->myFilter->getattr(path);
-		}
-		catch (NXFSException&) {
-			std::string path_str = path;
-			size_t pos = path_str.find_last_of("/");
-			if(pos != std::string::npos)
+		bufv->buf[i].size = pieces[i].length;
+		if(pieces[i].data != NULL)
+		{
+			// FUSE frees the memory of each buffer, the pieces are shared by other reads
+			bufv->buf[i].mem = malloc( pieces[i].length );
+			if(bufv->buf[i].mem == NULL)
 			{
-				pos++;
-				int len = path_str.length();
-				std::string command = path_str.substr(pos, (len-pos));
-				if( command == "fuse_reload")
-					NXFS_DATA->myFilter->reopenNXFile();
+				for(size_t j=0; j<i; j++)
+					free( bufv->buf[j].mem );
+				free(bufv);
+				return -ENOMEM;
 			}
-
-			return -ENOENT;
+			memcpy( bufv->buf[i].mem, pieces[i].data, pieces[i].length );
+			bufv->buf[i].fd = -1;
 		}
-
-		switch(fstype)
+		else
 		{
-			case FSType::FILE:
-				statbuf->st_mode = S_IFREG | 0444;
-				statbuf->st_nlink = 1;
-				statbuf->st_size = NXFS_DATA->myFilter->size(path);
-				break;
-			case FSType::FOLDER:
-				statbuf->st_mode = S_IFDIR | 0444;
-				statbuf->st_nlink = 2;
-				break;
-			default:
-				retStat = -ENOENT;
-				break;
-		};
+			// FUSE reads the piece from file itself, e.g. values of contiguous dataset from NeXus file
+			bufv->buf[i].flags = (enum fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+			bufv->buf[i].fd = pieces[i].fd;
+			bufv->buf[i].pos = pieces[i].position;
+		}
+	}
+	if(pieces.empty())
+		bufv->buf[0].fd = -1;
+
+	*bufp = bufv;
+	return 0;
+}
 
+
+/**\brief Get attributes of each file/folder.
+ *
+ *	Writing metadata for file system objects.
+ *	\param [in] path : path of file/folder accessed by user.
+ *	\param [out] statbuf : buffer that contains metadata of file/folder accessed by user.
+ *	\return 0 if success, -ERRNO if fail.
+ */
+int FuseProvider::fs_getattr(const char *path, struct stat *statbuf)
+{
+	// looking up "fuse_reload" in any folder requests a reload, like SIGUSR1 does. The miss is cached by the kernel
+	// for negative_timeout (Filter::NEGATIVE_TIMEOUT), a repeated lookup of the same path within it doesn't get here
+	const char* name = strrchr(path, '/');
+	if( name != NULL && strcmp(name + 1, "fuse_reload") == 0 )
+	{
+		Filter::requestReload();
+		return -ENOENT;
 	}
-	return retStat;
+
+	return NXFS_DATA->myFilter->stat(path, *statbuf);
 }
 
 /**\brief Get attributes of each file/folder when file is opened.
@@ -22,7 +22,7 @@
 
 #ifndef FUSEPROVIDER_H_
 #define FUSEPROVIDER_H_
-#define FUSE_USE_VERSION 26
+#define FUSE_USE_VERSION 29
 
 #include <fcntl.h>
 #include <fuse.h>
@@ -32,21 +32,26 @@
 #include <string.h>
 #include <iostream>
 #include <pthread.h>
+#include <poll.h>
+#include <mutex>
+#include <vector>
+#include <set>
 #include <pni/nx/NX.hpp>
 #include <pni/utils/Types.hpp>
 #include "limits.h"
 
 #include "Filter/Filter.h"
+#include "Filter/ReadWorkers.h"
+#include "Filter/NXGateway.h"
 #include "ErrorLog.h"
 
-static pthread_mutex_t access_nexus = PTHREAD_MUTEX_INITIALIZER;
-
+// the same access is taken by read-ahead tasks, see NXGateway::lockAccess
 static void start_naccess() {
-	pthread_mutex_lock(&access_nexus);
+	NXGateway::lockAccess();
 }
 
 static void end_naccess() {
-	pthread_mutex_unlock(&access_nexus);
+	NXGateway::unlockAccess();
 }
 
 #define STARTNACCESS    start_naccess()
@@ -69,10 +74,27 @@ private:
 	static int fs_opendir(const char* path, struct fuse_file_info *fi);
 	static int fs_read(const char *path, char *buf, size_t size,
 			off_t offset, struct fuse_file_info *fi);
+	static int fs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size,
+			off_t offset, struct fuse_file_info *fi);
 	static int fs_getattr(const char *path, struct stat *statbuf);
 	static int fs_fgetattr (const char *path, struct stat *statbuf, struct fuse_file_info *fi);
 	static int fs_releasedir(const char* path, struct fuse_file_info* fi);
 	static int fs_access (const char *path, int mask);
+	static int fs_release(const char* path, struct fuse_file_info* fi);
+	static int fs_poll(const char* path, struct fuse_file_info* fi, struct fuse_pollhandle* ph, unsigned* reventsp);
+
+	/**
+	 *	File opened by user while NeXus file is followed, kept in fuse_file_info::fh.
+	 */
+	struct OpenFile {
+		unsigned long version; /*!< Version of file reported last, see Filter::version. */
+		struct fuse_pollhandle* poller; /*!< The last poll waiting for the file to grow, NULL if there is none. */
+	};
+
+	static std::set<OpenFile*> _pollers; /*!< Open files with a poll waiting for NeXus objects to grow. */
+	static std::mutex _pollers_mutex; /*!< Guards FuseProvider#_pollers and OpenFile#poller. */
+	static void notifyPollers();
+	static int followOption(int& argc, char** argv);
 
 public:
 